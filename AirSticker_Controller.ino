@@ -2,51 +2,73 @@
 #include "app_config.h"
 #include "esp_bsp.h"
 #include "display.h"
+#include "menu.h"
 #include "bluetooth.h"
+#include "trace.h"
+#include "profiler.h"
+#include "events.h"
 
 typedef void (*button_handler_t)(void);
 
 static const char *screen_names[] = SCREEN_NAMES;
-static tag_scan_t *tags;
 
 system_status_t system_status;
 
 /******************************************************************************/
 
-static void fill_devices_name(void) {
-    uint8_t start = 0;
-    uint8_t line = 0;
+/* Scroll the device window just enough to keep the cursor visible */
+static void update_device_window(void) {
+    uint16_t count = system_status.device_count;
+    uint8_t rows = (count + 1 <= MAX_LINES) ? count : MAX_LINES - 1;
+    uint16_t selected = system_status.selected_device;
+    uint16_t start = system_status.list_start;
 
-    bool list_short = (system_status.device_count + 1 <= MAX_LINES);
-    uint8_t max_devices_to_show = list_short ? system_status.device_count : MAX_LINES - 1;
-
-    if (!list_short) {
-        if (system_status.selected_device >= max_devices_to_show) {
-            start = system_status.selected_device - (max_devices_to_show - 1);
-            if (start > system_status.device_count - max_devices_to_show) {
-                start = system_status.device_count - max_devices_to_show;
-            }
+    if (selected < count) {
+        if (selected < start) {
+            start = selected;
+        }
+        else if (selected >= start + rows) {
+            start = selected - rows + 1;
         }
     }
-
-    for (uint8_t line = 0; line < MAX_LINES; line++) {
-        snprintf(system_status.names[line], sizeof(system_status.names[line]), " ");
+    if (start + rows > count) {
+        start = count - rows;
     }
 
-    for (uint8_t i = start; i < system_status.device_count && line < max_devices_to_show; i++) {
-        if (i == system_status.selected_device)
-            system_status.selected_index = line;
+    system_status.list_start = start;
+    system_status.list_rows = rows;
+    system_status.selected_index = (selected < count) ? selected - start : rows;
+}
 
-        snprintf(system_status.names[line], sizeof(system_status.names[line]),
-                (i + 1 > 9) ? "  %d. %s" : "  %d. %s",
-                i + 1, tags->tags[i].name);
-        line++;
+/* Remember the tag under the cursor so reordering does not move the
+ * selection to another tag */
+static void remember_cursor(void) {
+    tag_view_t view;
+
+    system_status.cursor_on_tag = false;
+    if (system_status.selected_device < system_status.device_count) {
+        bluetooth_read_tags(system_status.selected_device, 1, &view);
+        if (view.rows > 0) {
+            memcpy(system_status.cursor_bda, view.tags[0].bda, sizeof(esp_bd_addr_t));
+            system_status.cursor_on_tag = true;
+        }
     }
+}
 
-    snprintf(system_status.names[line], sizeof(system_status.names[line]), "  [ Back ]");
-    if (system_status.selected_device == system_status.device_count) {
-        system_status.selected_index = line;
-    }
+static void select_device(uint16_t device) {
+    system_status.selected_device = device;
+    remember_cursor();
+    update_device_window();
+}
+
+static void enter_device_list(uint16_t version) {
+    system_status.screen_id = SCREEN_DEVICE_LIST;
+    system_status.selected_device = 0;
+    system_status.list_start = 0;
+    system_status.list_version = version;
+    system_status.last_device_count = system_status.device_count;
+    remember_cursor();
+    update_device_window();
 }
 
 int mod_wrap(int value, int delta, int mod) {
@@ -100,12 +122,22 @@ static void adjust_delay_time(int delta) {
 
 /******************************************************************************/
 
+static void enter_screen(uint8_t screen_id) {
+    system_status.screen_id = screen_id;
+    system_status.max_index = menu_index_count(screen_id);
+    if (screen_id == SCREEN_DEVICE_LIST) {
+        /* Back on the list, the cursor stays on its tag */
+        update_device_window();
+    }
+    else {
+        system_status.selected_index = 0;
+    }
+}
+
 static void enter_error_screen(uint8_t error) {
     LOG_PRINTF("!!! ERROR %d !!!\n", error);
     system_status.error = error;
-    system_status.selected_index = 0;
-    system_status.max_index = 1;  /* Only Back option */
-    system_status.screen_id = SCREEN_BLE_ERROR;
+    enter_screen(SCREEN_BLE_ERROR);
 }
 
 static bool main_send_command(const char *cmd) {
@@ -119,8 +151,7 @@ static bool main_send_command(const char *cmd) {
 static void increase_selection(void) {
     if (system_status.screen_id == SCREEN_DEVICE_LIST) {
         if (system_status.selected_device < system_status.device_count) {
-            system_status.selected_device++;
-            fill_devices_name();
+            select_device(system_status.selected_device + 1);
         }
     }
     else {
@@ -136,8 +167,7 @@ static void increase_selection(void) {
 static void decrease_selection(void) {
     if (system_status.screen_id == SCREEN_DEVICE_LIST) {
         if (system_status.selected_device > 0) {
-            system_status.selected_device--;
-            fill_devices_name();
+            select_device(system_status.selected_device - 1);
         }
     }
     else {
@@ -152,127 +182,109 @@ static void decrease_selection(void) {
     }
 }
 
-static void handle_select(void) {
-    switch (system_status.screen_id) {
-        case SCREEN_PING:
-            system_status.screen_id = SCREEN_SCANNING;
-            system_status.last_ping_ms = CURRENT_TIME_MS();
-            bluetooth_start_scanning();
+static void menu_set_field(uint8_t field, int value) {
+    switch (field) {
+        case MENU_FIELD_GPIO_STATE:
+            system_status.gpio_state = value;
             break;
+        case MENU_FIELD_BLE_DELAY:
+            system_status.ble_delay = value;
+            break;
+        default:
+            break;
+    }
+}
 
-        case SCREEN_DEVICE_LIST:
-            if (system_status.device_count > 0) {
-                if (system_status.selected_device >= system_status.device_count) {
-                    /* Back to ping */
-                    system_status.screen_id = SCREEN_PING;
-                }
-                else {
-                    LOG_PRINTLN(system_status.names[system_status.selected_index]);
-                    tags = bluetooth_get_tag_list();
-                    memcpy(&system_status.selected_tag, &tags->tags[system_status.selected_device], sizeof(tag_t));
-                    bluetooth_airtag_connect(system_status.selected_tag.bda, system_status.selected_tag.addr_type);
-                    bluetooth_release_tag_list();
-                    system_status.max_index = ACTION_MENU_COUNT;
-                    system_status.screen_id = SCREEN_ACTIONS;
-                }
-            }
+/* Select on a screen described by the menu table */
+static void menu_select(void) {
+    const menu_screen_t *screen = &menu_screens[system_status.screen_id];
+    uint8_t option = system_status.selected_index - screen->option_first;
+
+    if ((system_status.selected_index < screen->option_first) || (option >= screen->option_count)) {
+        return;
+    }
+    if ((screen->flags & MENU_NEEDS_LINK) && !bluetooth_is_connected()) {
+        enter_error_screen(ERROR_BLE_CONNECT);
+        return;
+    }
+
+    const menu_option_t *selected = &screen->options[option];
+    switch (selected->action) {
+        case MENU_ACT_GOTO:
+            enter_screen(selected->target);
             break;
 
-        case SCREEN_ACTIONS:
-            if (bluetooth_is_connected()) {
-                if (system_status.selected_index == ACTION_CONTROL_GPIO) {
-                    system_status.max_index = GPIO_MENU_COUNT;
-                    system_status.screen_id = SCREEN_CONTROL_GPIO;
-                }
-                else if (system_status.selected_index == ACTION_CONTROL_BLE) {
-                    system_status.max_index = BLE_MENU_COUNT;
-                    system_status.screen_id = SCREEN_CONTROL_BLE;
-                }
-                else {
-                    /* Back to device list screen */
-                    system_status.screen_id = SCREEN_DEVICE_LIST;
-                    fill_devices_name();
-                }
-            }
-            else {
-                enter_error_screen(ERROR_BLE_CONNECT);
+        case MENU_ACT_SEND:
+            if (main_send_command(selected->command)) {
+                menu_set_field(selected->field, selected->value);
             }
             break;
 
-        case SCREEN_CONTROL_GPIO:
-            if (system_status.selected_index == GPIO_CONTROL_OFF) {
-                if (main_send_command("OUTPUTS:0")) {
-                    system_status.gpio_state = 0;
-                }
-                return;
-            }
-            else if (system_status.selected_index == GPIO_CONTROL_ON) {
-                if (main_send_command("OUTPUTS:1")) {
-                    system_status.gpio_state = 1;
-                }
-                return;
-            }
-            else {
-                /* Back to actions screen */
-                system_status.max_index = ACTION_MENU_COUNT;
-                system_status.screen_id = SCREEN_ACTIONS;
+        case MENU_ACT_SEND_DELAY: {
+            char cmd[16];
+            LOG_PRINTF("Set BLE delay %d minutes\n", system_status.set_ble_delay);
+            snprintf(cmd, sizeof(cmd), "BLE_DELAY:%d", system_status.set_ble_delay);
+            if (main_send_command(cmd)) {
+                system_status.ble_delay = system_status.set_ble_delay;
+                enter_screen(selected->target);
             }
             break;
+        }
 
-        case SCREEN_CONTROL_BLE:
-            if (system_status.selected_index == BLE_CONTROL_OFF) {
-                if (main_send_command("BLE_DELAY:-1")) {
-                    system_status.ble_delay = -1;
-                }
-                return;
-            }
-            else if (system_status.selected_index == BLE_CONTROL_ON) {
-                if (main_send_command("BLE_DELAY:0")) {
-                    system_status.ble_delay = 0;
+        default:
+            break;
+    }
+}
+
+static void handle_select(void) {
+    switch (system_status.screen_id) {
+        case SCREEN_PING:
+            system_status.last_ping_ms = CURRENT_TIME_MS();
+            /* Set before the request so the scan report is never older */
+            system_status.start_scanning_ms = system_status.last_ping_ms;
+            bluetooth_start_scanning();
+#if SCAN_CONTINUOUS
+            /* Background scanning already has a list, show it right away */
+            {
+                tag_view_t view;
+                bluetooth_read_tags(0, 0, &view);
+                system_status.device_count = view.count;
+                if (system_status.device_count > 0) {
+                    enter_device_list(view.version);
+                    break;
                 }
-                return;
-            }
-            else if (system_status.selected_index == BLE_CONTROL_DELAY) {
-                system_status.max_index = DELAY_MENU_COUNT;
-                system_status.screen_id = SCREEN_SET_DELAY;
-            }
-            else {
-                /* Back to actions screen */
-                system_status.max_index = ACTION_MENU_COUNT;
-                system_status.screen_id = SCREEN_ACTIONS;
             }
+#endif
+            enter_screen(SCREEN_SCANNING);
             break;
 
-        case SCREEN_SET_DELAY:
-            if (system_status.selected_index < DELAY_CONTROL_OK) {
-                return;  /* Do nothing */
+        case SCREEN_DEVICE_LIST:
+            /* Back stays selectable when every tag expired while the list was open */
+            if (system_status.selected_device >= system_status.device_count) {
+                /* Back to ping */
+                enter_screen(SCREEN_PING);
             }
             else {
-                if (system_status.selected_index == DELAY_CONTROL_OK) {
-                    LOG_PRINTF("Set BLE delay %d minutes\n", system_status.set_ble_delay);
-                    char cmd[16];
-                    sprintf(cmd, "BLE_DELAY:%d", system_status.set_ble_delay);
-                    if (main_send_command(cmd)) {
-                        system_status.ble_delay = system_status.set_ble_delay;
-                    }
+                tag_view_t view;
+                bluetooth_read_tags(system_status.selected_device, 1, &view);
+                if (view.rows == 0) {
+                    break;  /* Expired meanwhile, the list catches up */
                 }
-
-                /* Back to BLE screen */
-                system_status.max_index = BLE_MENU_COUNT;
-                system_status.screen_id = SCREEN_CONTROL_BLE;
+                memcpy(&system_status.selected_tag, &view.tags[0], sizeof(tag_t));
+                LOG_PRINTLN(system_status.selected_tag.name);
+                trace_event(TRACE_UI_SELECT, system_status.selected_device);
+                bluetooth_airtag_connect(system_status.selected_tag.bda, system_status.selected_tag.addr_type);
+                enter_screen(SCREEN_ACTIONS);
             }
             break;
 
-        case SCREEN_BLE_ERROR:
-            /* Back to ping screen */
-            system_status.screen_id = SCREEN_PING;
+        case SCREEN_SCANNING:
             break;
 
         default:
-            return;
+            menu_select();
+            break;
     }
-
-    system_status.selected_index = 0;
 }
 
 static void handle_up(void) {
@@ -297,32 +309,39 @@ static void handle_down(void) {
     }
 }
 
-static void handle_left(void) {
-    decrease_selection();
-}
+/* Left and Right page through long device lists, one screen of rows at a time */
+static void page_devices(int pages) {
+    int device = system_status.selected_device + pages * (MAX_LINES - 1);
 
-static void handle_right(void) {
-    increase_selection();
+    if (device < 0) {
+        device = 0;
+    }
+    if (device > system_status.device_count) {
+        device = system_status.device_count;
+    }
+    select_device(device);
 }
 
-static void handle_select_holding(void) {
-    if (system_status.screen_id == SCREEN_SET_DELAY) {
-        system_status.max_index = BLE_MENU_COUNT;
-        system_status.screen_id = SCREEN_CONTROL_BLE;
+static void handle_left(void) {
+    if (system_status.screen_id == SCREEN_DEVICE_LIST) {
+        page_devices(-1);
     }
-    else if ((system_status.screen_id == SCREEN_CONTROL_GPIO) || (system_status.screen_id == SCREEN_CONTROL_BLE)) {
-        system_status.max_index = ACTION_MENU_COUNT;
-        system_status.screen_id = SCREEN_ACTIONS;
+    else {
+        decrease_selection();
     }
-    else if (system_status.screen_id == SCREEN_ACTIONS) {
-        system_status.screen_id = SCREEN_DEVICE_LIST;
-        fill_devices_name();
-        return;
+}
+
+static void handle_right(void) {
+    if (system_status.screen_id == SCREEN_DEVICE_LIST) {
+        page_devices(1);
     }
     else {
-        system_status.screen_id = SCREEN_PING;
+        increase_selection();
     }
-    system_status.selected_index = 0;
+}
+
+static void handle_select_holding(void) {
+    enter_screen(menu_screens[system_status.screen_id].back);
 }
 
 static const button_handler_t button_handlers[BUTTON_COUNT] = {
@@ -338,12 +357,14 @@ static void user_inft_loop(void) {
         if (button_is_pressed(id)) {
             button_handlers[id]();
             system_status.force_update = true;
+            events_input_handled(button_take_input_us());
         }
     }
 
     if (button_is_holding(SELECT_BUTTON_ID)) {
         handle_select_holding();
         system_status.force_update = true;
+        events_input_handled(button_take_input_us());
     }
 }
 
@@ -353,51 +374,136 @@ static void machine_state(void) {
         if ((last_screen_id < SCREEN_COUNT) && (system_status.screen_id < SCREEN_COUNT)) {
             LOG_PRINTF("Change screen from %s to %s\n", screen_names[last_screen_id], screen_names[system_status.screen_id]);
         }
+        trace_event(TRACE_UI_SCREEN, system_status.screen_id);
         last_screen_id = system_status.screen_id;
     }
 
-    switch (system_status.screen_id) {
-        case SCREEN_PING:
-            system_status.start_scanning_ms = CURRENT_TIME_MS();
-            break;
+    /* Commands complete asynchronously, report late failures */
+    if (bluetooth_take_command_error()) {
+        enter_error_screen(ERROR_BLE_SEND);
+    }
 
+    switch (system_status.screen_id) {
         case SCREEN_SCANNING: {
-            tags = bluetooth_get_tag_list();
-            system_status.device_count = tags->count;
-
-            if (ELAPSED_TIME_MS(system_status.start_scanning_ms) > GAP_SCAN_DURATION * 1000) {
-                if (system_status.device_count > 0) { 
-                    system_status.screen_id = SCREEN_DEVICE_LIST;
-
-                    system_status.selected_device = 0;
-                    system_status.last_device_count = system_status.device_count;
-                    fill_devices_name();
+            /* The scheduler ends the scan once the list stops growing, the
+             * full duration is only a fallback */
+            scan_sched_t scan;
+            bluetooth_get_scan_report(&scan);
+            bool complete = (scan.state > SCAN_SCHED_RUNNING) &&
+                            ((int32_t)(scan.start_ms - system_status.start_scanning_ms) >= 0);
+            system_status.scan_duty = scan_sched_duty_percent(&scan);
+
+            tag_view_t view;
+            bluetooth_read_tags(0, 0, &view);
+            system_status.device_count = view.count;
+
+            if (complete || (ELAPSED_TIME_MS(system_status.start_scanning_ms) > GAP_SCAN_DURATION * 1000)) {
+                if (system_status.device_count > 0) {
+                    enter_device_list(view.version);
                 }
                 else {
                     LOG_PRINTLN("No device found");
                     system_status.screen_id = SCREEN_PING;
                 }
             }
-
-            bluetooth_release_tag_list();
             break;
         }
 
-        case SCREEN_DEVICE_LIST:
+        case SCREEN_DEVICE_LIST: {
+            /* Follow tags appearing, expiring and reordering in the background */
+            tag_view_t view;
+            bluetooth_read_tags(0, 0, &view);
+            if ((view.version != system_status.list_version) || (view.count != system_status.device_count)) {
+                system_status.list_version = view.version;
+                system_status.device_count = view.count;
+
+                if (system_status.cursor_on_tag) {
+                    int rank = bluetooth_find_tag(system_status.cursor_bda);
+                    if (rank >= 0) {
+                        system_status.selected_device = rank;
+                    }
+                }
+                else {
+                    system_status.selected_device = system_status.device_count;  /* Stay on Back */
+                }
+                if (system_status.selected_device > system_status.device_count) {
+                    system_status.selected_device = system_status.device_count;
+                }
+
+                remember_cursor();
+                update_device_window();
+            }
             system_status.last_device_count = system_status.device_count;
             break;
+        }
 
         default:
             break;
     }
 }
 
+/* Time until machine_state has something to do on its own */
+static uint32_t machine_next_deadline_ms(void) {
+    if (system_status.screen_id == SCREEN_SCANNING) {
+        uint32_t elapsed = ELAPSED_TIME_MS(system_status.start_scanning_ms);
+        return (elapsed <= GAP_SCAN_DURATION * 1000) ? GAP_SCAN_DURATION * 1000 + 1 - elapsed : 0;
+    }
+    return EVENT_WAIT_FOREVER;
+}
+
+static uint32_t next_deadline_ms(void) {
+    uint32_t timeout = esp_bsp_next_deadline_ms();
+    uint32_t deadline;
+
+    deadline = machine_next_deadline_ms();
+    if (deadline < timeout) timeout = deadline;
+    deadline = display_next_deadline_ms(&system_status);
+    if (deadline < timeout) timeout = deadline;
+    return timeout;
+}
+
+#if DEBUG_ENABLED
+static void serial_received(void) {
+    events_post(EVENT_SERIAL);
+}
+#endif
+
+static void serial_console_loop(void) {
+#if DEBUG_ENABLED
+    while (Serial.available() > 0) {
+        switch (Serial.read()) {
+            case 't':
+                trace_dump();
+                break;
+            case 'p':
+                profile_dump();
+                break;
+            case 'e':
+                events_dump();
+                break;
+            case 'd':
+                display_dump();
+                break;
+            case 'b':
+                bluetooth_dump();
+                break;
+            default:
+                break;
+        }
+    }
+#endif
+}
+
 /******************************************************************************/
 
 void setup() {
     LOG_BEGIN(115200);
     memset(&system_status, 0, sizeof(system_status));
 
+    events_init();
+#if DEBUG_ENABLED
+    Serial.onReceive(serial_received);
+#endif
     esp_bsp_init();
     display_init();
     bluetooth_init();
@@ -406,8 +512,18 @@ void setup() {
 }
 
 void loop() {
+    /* Sleep until a callback, an ISR or the nearest deadline needs us */
+    profile_loop_end();
+    events_wait(next_deadline_ms());
+
+    profile_loop_begin();
     esp_bsp_loop();
+    profile_stage(PROFILE_STAGE_BSP);
     user_inft_loop();
-    display_loop(&system_status);
+    profile_stage(PROFILE_STAGE_UI);
     machine_state();
+    profile_stage(PROFILE_STAGE_STATE);
+    display_loop(&system_status);
+    profile_stage(PROFILE_STAGE_DISPLAY);
+    serial_console_loop();
 }
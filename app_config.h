@@ -5,12 +5,75 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define MAX_AIRTAG_COUNT          64
+#define MAX_AIRTAG_COUNT          1024    /* Tag store capacity, at most half of the tag hash table */
 #define GAP_SCAN_DURATION         5
 
-/* Utils */
+/* Scanning */
+#define SCAN_CONTINUOUS           1       /* Keep scanning in the background instead of one-shot pings */
+#define SCAN_INTERVAL             0x50    /* In 0.625 ms units */
+#define SCAN_WINDOW               0x30    /* Radio duty cycle is SCAN_WINDOW / SCAN_INTERVAL */
+#define TAG_EXPIRE_MS             30000   /* Tags not heard for this long are dropped */
+#define TAG_RSSI_WEIGHT           4       /* New RSSI samples count 1/TAG_RSSI_WEIGHT */
+#define TAG_SORT_BY_NAME          0       /* Device list order: 0 = strongest signal first, 1 = by name */
+#define TAG_NAMES_IN_PSRAM        1       /* Keep tag names in PSRAM when present, hot fields stay internal */
+#define SCAN_WHITELIST            1       /* Alternate open discovery with scans the controller filters to known tags */
+#define SCAN_WHITELIST_MAX        12      /* Tags loaded into the controller, also capped by its whitelist size */
+#define SCAN_DISCOVERY_MS         5000    /* Open discovery before switching to the whitelist */
+#define SCAN_TARGETED_MS          20000   /* Whitelist scanning before falling back to open discovery */
+#define ADV_REJECT_EXPIRE_MS      10000   /* Adverts from non-tags are dropped unparsed for this long */
+
+/* Scan scheduler: a scan asked for from the UI ends once the list stops
+ * growing, GAP_SCAN_DURATION is only the upper bound */
+#define SCAN_QUIET_MS             2000    /* Complete after this long without a new tag */
+#define SCAN_TARGET_COUNT         0       /* Complete once this many tags are known, 0 = no target */
+#define SCAN_WINDOW_MIN           0x10    /* Window floor while nothing new shows up */
+#define SCAN_IDLE_WINDOW_MIN      0x20    /* Floor between UI scans, known tags must still be heard before TAG_EXPIRE_MS */
+#define SCAN_DUTY_STEP_MS         2000    /* Window shrinks by a quarter this often without a new tag, each change restarts the scan */
+
+/* Connections */
+#define BLE_MAX_LINKS             3       /* Concurrent tag connections, within CONFIG_BT_ACL_CONNECTIONS */
+#define BLE_LOCAL_MTU             185     /* Requested on every connection */
+#define BLE_CMD_MAX_LEN           32
+#define BLE_CMD_QUEUE_SIZE        4       /* Per link, power of two */
+#define BLE_CMD_WRITE_NO_RSP      1       /* Use write without response when the RX characteristic allows it */
+#define GATT_CACHE_SLOTS          32      /* Tags whose handles are kept in NVS, least recently used go first */
+
+/* Tasks: BLE work runs next to the Bluedroid stack, the Arduino loop (UI and
+ * display) keeps CONFIG_ARDUINO_RUNNING_CORE */
+#define BLE_TASK_CORE             0
+#define BLE_TASK_PRIORITY         5       /* Above the loop task, below Bluedroid */
+#define BLE_TASK_STACK            4096
+#define BLE_TASK_QUEUE_SIZE       16      /* UI requests and wake-ups waiting for the BLE task */
+#define BLE_GATTC_QUEUE_SIZE      (8 * BLE_MAX_LINKS)  /* GATTC events, about what each link can have outstanding */
+#define BLE_GATTC_RESERVED        (4 * BLE_MAX_LINKS)  /* Of which only events a link waits on may take */
+#define BLE_GATTC_WAIT_MS         20      /* Bluedroid waits this long for room for such an event */
+
+/* Power: the loop blocks in events_wait() between events and deadlines. That
+ * saves power only through the idle task halting the CPU, unless the core
+ * is built with CONFIG_PM_ENABLE and CONFIG_FREERTOS_USE_TICKLESS_IDLE:
+ * then events_init() lets the chip light sleep while blocked. The stock
+ * Arduino-ESP32 libraries are built without PM, so light sleep needs a
+ * custom build of the core (or ESP-IDF with Arduino as a component). */
+#define EVENT_PM_POLL_MS          100     /* Longest wait with PM, button edges are not latched across light sleep */
+
+/* Display: frames are pushed to the panel by a task while the loop goes on */
+#define DISPLAY_I2C_CLOCK_HZ      400000  /* SSD1306 is specified up to 400 kHz, many panels take more */
+#define DISPLAY_TASK_CORE         1
+#define DISPLAY_TASK_PRIORITY     2       /* Above the loop task, blocked on I2C most of the time */
+#define DISPLAY_TASK_STACK        2048
+
+/* Platform: every time, delay and GPIO access goes through these */
 #define CURRENT_TIME_MS()         millis()
-#define ELAPSED_TIME_MS(a)        ((millis() - (a)) & 0xFFFFFFFF)
+#define CURRENT_TIME_US()         micros()
+#define CURRENT_CYCLES()          ESP.getCycleCount()
+#define DELAY_MS(a)               delay(a)
+#define GPIO_MODE(pin, mode)      pinMode(pin, mode)
+#define GPIO_READ(pin)            digitalRead(pin)
+#define GPIO_READ_PORT()          REG_READ(GPIO_IN_REG)   /* Levels of GPIO 0-31 */
+#define GPIO_WRITE(pin, level)    digitalWrite(pin, level)
+
+/* Utils */
+#define ELAPSED_TIME_MS(a)        ((CURRENT_TIME_MS() - (a)) & 0xFFFFFFFF)
 
 /* GPIO */
 #define SCREEN_WIDTH 128
@@ -27,6 +90,9 @@
 
 /* Debug */
 #define DEBUG_ENABLED 1
+#define TRACE_ENABLED 1           /* Connection lifecycle trace, dumped with 't' on Serial */
+#define PROFILE_ENABLED 1         /* Main loop profiler, dumped with 'p' on Serial */
+#define PROFILE_STALL_US 20000    /* Loop periods above this count as stalls */
 #if DEBUG_ENABLED
 #define LOG_BEGIN(a)              Serial.begin(a)
 #define LOG_PRINT(a)              Serial.print(a)
@@ -36,5 +102,5 @@
 #define LOG_BEGIN(a)
 #define LOG_PRINT(a)
 #define LOG_PRINTLN(a)
-#define LOG_PRINTF(a)
+#define LOG_PRINTF(...)
 #endif
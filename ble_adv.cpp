@@ -0,0 +1,106 @@
+#include <string.h>
+#include "ble_adv.h"
+
+void ble_ad_iter_init(ble_ad_iter_t *it, const uint8_t *data, uint8_t adv_len, uint8_t rsp_len, uint16_t buf_len) {
+    uint16_t total = adv_len + rsp_len;
+
+    /* Never trust the lengths reported with the buffer */
+    if (adv_len > buf_len) {
+        adv_len = buf_len;
+    }
+    if (total > buf_len) {
+        total = buf_len;
+    }
+
+    it->data = data;
+    it->pos = 0;
+    it->end = adv_len;
+    it->next_end = total;
+}
+
+bool ble_ad_next(ble_ad_iter_t *it, ble_ad_field_t *field) {
+    while (true) {
+        if (it->pos >= it->end) {
+            /* Advertising data done, continue with the scan response */
+            if (it->end == it->next_end) {
+                return false;
+            }
+            it->pos = it->end;
+            it->end = it->next_end;
+            continue;
+        }
+
+        uint8_t field_len = it->data[it->pos];
+
+        /* A zero length or a field running past the segment ends the segment */
+        if ((field_len == 0) || (field_len > it->end - it->pos - 1)) {
+            it->pos = it->end;
+            continue;
+        }
+
+        field->type = it->data[it->pos + 1];
+        field->len = field_len - 1;
+        field->data = &it->data[it->pos + 2];
+        it->pos += field_len + 1;
+        return true;
+    }
+}
+
+void ble_adv_parse(const uint8_t *data, uint8_t adv_len, uint8_t rsp_len, uint16_t buf_len, ble_adv_info_t *info) {
+    ble_ad_iter_t it;
+    ble_ad_field_t field;
+
+    memset(info, 0, sizeof(*info));
+    ble_ad_iter_init(&it, data, adv_len, rsp_len, buf_len);
+
+    while (ble_ad_next(&it, &field)) {
+        switch (field.type) {
+            case BLE_AD_TYPE_FLAGS:
+                if (field.len >= 1) {
+                    info->flags = field.data[0];
+                    info->has_flags = true;
+                }
+                break;
+
+            case BLE_AD_TYPE_TX_POWER:
+                if (field.len >= 1) {
+                    info->tx_power = (int8_t) field.data[0];
+                    info->has_tx_power = true;
+                }
+                break;
+
+            case BLE_AD_TYPE_NAME_CMPL:
+                info->name = field;
+                break;
+
+            case BLE_AD_TYPE_NAME_SHORT:
+                /* Complete name wins over shortened one */
+                if (info->name.type != BLE_AD_TYPE_NAME_CMPL) {
+                    info->name = field;
+                }
+                break;
+
+            case BLE_AD_TYPE_UUID16_INCMPL:
+            case BLE_AD_TYPE_UUID16_CMPL:
+                info->uuid16 = field;
+                break;
+
+            case BLE_AD_TYPE_UUID128_INCMPL:
+            case BLE_AD_TYPE_UUID128_CMPL:
+                info->uuid128 = field;
+                break;
+
+            case BLE_AD_TYPE_MANUFACTURER:
+                info->manufacturer = field;
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+bool ble_ad_field_has_prefix(const ble_ad_field_t *field, const char *prefix) {
+    size_t len = strlen(prefix);
+    return (field->data != NULL) && (field->len >= len) && (memcmp(field->data, prefix, len) == 0);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* AD structure types (Bluetooth Core Supplement, Part A) */
+#define BLE_AD_TYPE_FLAGS           0x01
+#define BLE_AD_TYPE_UUID16_INCMPL   0x02
+#define BLE_AD_TYPE_UUID16_CMPL     0x03
+#define BLE_AD_TYPE_UUID128_INCMPL  0x06
+#define BLE_AD_TYPE_UUID128_CMPL    0x07
+#define BLE_AD_TYPE_NAME_SHORT      0x08
+#define BLE_AD_TYPE_NAME_CMPL       0x09
+#define BLE_AD_TYPE_TX_POWER        0x0A
+#define BLE_AD_TYPE_MANUFACTURER    0xFF
+
+/* View of one AD structure, pointing into the caller's buffer */
+typedef struct {
+    uint8_t type;
+    uint8_t len;
+    const uint8_t *data;
+} ble_ad_field_t;
+
+/* Walks the advertising data followed by the scan response data */
+typedef struct {
+    const uint8_t *data;
+    uint16_t pos;
+    uint16_t end;
+    uint16_t next_end;
+} ble_ad_iter_t;
+
+/* Selected fields of one advert, all views into the scan result buffer */
+typedef struct {
+    ble_ad_field_t name;
+    ble_ad_field_t manufacturer;
+    ble_ad_field_t uuid16;
+    ble_ad_field_t uuid128;
+    uint8_t flags;
+    int8_t tx_power;
+    bool has_flags;
+    bool has_tx_power;
+} ble_adv_info_t;
+
+void ble_ad_iter_init(ble_ad_iter_t *it, const uint8_t *data, uint8_t adv_len, uint8_t rsp_len, uint16_t buf_len);
+bool ble_ad_next(ble_ad_iter_t *it, ble_ad_field_t *field);
+void ble_adv_parse(const uint8_t *data, uint8_t adv_len, uint8_t rsp_len, uint16_t buf_len, ble_adv_info_t *info);
+bool ble_ad_field_has_prefix(const ble_ad_field_t *field, const char *prefix);
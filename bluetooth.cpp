@@ -1,11 +1,27 @@
 #include <Arduino.h>
 #include <esp_err.h>
+#include <esp_bt.h>
+#include <esp_bt_main.h>
 #include <esp_gap_ble_api.h>
 #include <esp_gattc_api.h>
 #include <esp_gatt_defs.h>
 #include <esp_gatt_common_api.h>
+#include <esp_heap_caps.h>
 #include "app_config.h"
 #include "bluetooth.h"
+#include "ble_adv.h"
+#include "gatt_cache.h"
+#include "trace.h"
+#include "events.h"
+
+#if SCAN_CONTINUOUS
+#define BLUETOOTH_SCAN_DURATION  0   /* Scan until stopped */
+#else
+#define BLUETOOTH_SCAN_DURATION  GAP_SCAN_DURATION
+#endif
+
+/* Whitelist scanning needs a scan that keeps running to switch modes on */
+#define BLUETOOTH_SCAN_TARGETED  (SCAN_CONTINUOUS && SCAN_WHITELIST)
 
 #define PROFILE_NUM       1
 #define PROFILE_A_APP_ID  0
@@ -14,29 +30,234 @@ struct gattc_profile_inst {
     esp_gattc_cb_t gattc_cb;
     uint16_t gattc_if;
     uint16_t app_id;
+};
+
+enum {
+    LINK_IDLE = 0,
+    LINK_CLAIMED,       /* Taken by the UI, set up by the BLE task on the OPEN request */
+    LINK_PENDING,       /* Waiting for the controller to be free to connect */
+    LINK_OPENING,       /* esp_ble_gattc_open() issued */
+    LINK_CLOSING,       /* Closed while opening, dropped as soon as it connects */
+    LINK_DISCOVERING,   /* Connected, looking for the NUS RX characteristic */
+    LINK_READY,
+};
+
+#define BLE_ATT_HEADER_LEN  3
+#define BLE_DEFAULT_MTU     23
+
+typedef struct {
+    uint8_t len;
+    uint8_t data[BLE_CMD_MAX_LEN];
+} ble_command_t;
+
+/* Per-connection state, all links share the one GATTC application */
+typedef struct {
+    uint8_t state;          /* Through link_state() and link_set_state(), the UI reads it */
+    uint8_t gen;            /* Bumped each time the slot is taken, requests carry it */
+    esp_ble_addr_type_t addr_type;
+    esp_bd_addr_t bda;
     uint16_t conn_id;
+    uint16_t mtu;
     uint16_t service_start_handle;
     uint16_t service_end_handle;
-    uint16_t char_handle;
-    esp_bd_addr_t remote_bda;
-};
+    uint16_t nus_handler;
+    bool has_service;
+    bool write_no_rsp;
+    bool from_cache;        /* Handles came from a cache, not yet proven by a write */
+    bool cache_assoc;       /* Stack told to reuse the template tag's attribute table */
+    bool close_pending;     /* Closed while opening, nobody wants the connection */
+
+    /* Commands wait here until the previous write completes, the slot
+     * buffer stays valid while the stack transmits it */
+    ble_command_t cmds[BLE_CMD_QUEUE_SIZE];
+    uint8_t cmd_head;
+    uint8_t cmd_tail;
+    bool cmd_in_flight;
+    bool cmd_failed;
+    uint32_t cmd_sent_ms;
+    uint32_t cmd_latency_ms;
+    uint32_t cmd_max_latency_ms;
+} ble_link_t;
+
+/* The tag store is split by access pattern: every advert touches the hot
+ * record (lookup, RSSI, expiry), names are only read to draw a row. */
+typedef uint16_t tag_index_t;
+
+typedef struct {
+    esp_bd_addr_t bda;
+    int16_t rssi;               /* Smoothed, TAG_RSSI_FRAC_BITS below the dB */
+    uint8_t addr_type;
+    uint32_t last_seen;
+} tag_hot_t;
 
-static SemaphoreHandle_t ble_semaphore;
+typedef char tag_name_t[BLE_NAME_MAX_LEN];
+
+typedef struct {
+    tag_name_t *names;     /* Same index as tag_hot[], may live in PSRAM */
+    uint16_t count;
+    uint16_t version;      /* Bumped whenever tags are added, removed or reordered */
+} tag_scan_t;
+
+/* The BLE task is the only writer of the tag store and scan_report. Readers
+ * copy what they need and retry when tag_seq moved meanwhile; it is odd
+ * while a write is in progress. Readers may copy while the BLE task writes,
+ * so the shared fields go through TAG_LOAD() and TAG_STORE(): a release
+ * store read by an acquire load makes the odd tag_seq visible to the retry
+ * check, without fences. The BLE task reads its own writes plainly. */
+#define TAG_LOAD(field)           __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define TAG_STORE(field, value)   __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+#define TAG_READ_SPINS            1000    /* Reader spins on a write before it sleeps a tick */
+static uint32_t tag_seq = 0;
 static tag_scan_t tag_list;
-static bool is_scanning = false;
-static bool get_server = false;
-static bool is_connected = false;
-static esp_bd_addr_t last_tag_addr = {0};
+static bool is_scanning = false;      /* Set by GAP events, read and cleared by the BLE task */
+
+/* Open discovery hears every advertiser around; targeted scans let the
+ * controller drop everything but known tags before the host wakes up */
+enum {
+    SCAN_MODE_OPEN = 0,
+    SCAN_MODE_TARGETED,
+    SCAN_MODE_COUNT,
+};
+
+static uint8_t scan_mode = SCAN_MODE_OPEN;        /* Written by the BLE task only */
+static uint32_t scan_mode_since_ms = 0;            /* Stored atomically, read by bluetooth_dump() */
+static uint32_t scan_mode_ms[SCAN_MODE_COUNT];     /* Time spent in each mode, current one excluded, same */
+static uint32_t scan_callbacks[SCAN_MODE_COUNT];   /* Scan results delivered to the host */
+static uint32_t scan_accepted[SCAN_MODE_COUNT];    /* Of which from tags */
+#if SCAN_CONTINUOUS
+static bool scan_switching = false;                /* Scan stopped to change parameters */
+static bool scan_params_pending = false;           /* Stopped, set by the GAP event, taken by the BLE task */
+#endif
+#if BLUETOOTH_SCAN_TARGETED
+static uint16_t scan_whitelist_size = SCAN_WHITELIST_MAX;
+#endif
+static scan_sched_t scan_sched;                    /* BLE task only */
+static scan_sched_t scan_report;                   /* Copy of scan_sched for readers, under tag_seq */
+#if SCAN_CONTINUOUS
+static scan_duty_t scan_idle_duty;                 /* Window between UI scans, BLE task only */
+#endif
+
+/* Owned by the BLE task, which sets a slot up from the OPEN request. The UI
+ * only claims an idle slot, compare-and-swap on state, and reads state,
+ * cmd_failed and the latencies; those go through atomics on both sides. */
+static ble_link_t links[BLE_MAX_LINKS];
+static int current_link = BLUETOOTH_LINK_NONE;  /* Link behind the single-device API, UI only */
+static uint8_t link_gen[BLE_MAX_LINKS];         /* Generation each slot was last taken with, UI only */
+static esp_bd_addr_t link_bda[BLE_MAX_LINKS];   /* Address each slot was last taken for, UI only */
+
+#if CONFIG_BT_GATTC_CACHE_NVS_FLASH
+/* Last tag a write went through to. Tags share one firmware, so the stack
+ * can take a new tag's attribute table from this one instead of the air. */
+static esp_bd_addr_t gatt_template_bda;
+static bool gatt_template_valid = false;
+#endif
+
+/* Power of two, at least twice MAX_AIRTAG_COUNT to keep probe chains short */
+#define TAG_HASH_BITS     11
+#define TAG_HASH_SIZE     (1 << TAG_HASH_BITS)
+#define TAG_INDEX_NONE    0xFFFF
+#define TAG_RSSI_FRAC_BITS  4
+
+static_assert(TAG_HASH_SIZE >= 2 * MAX_AIRTAG_COUNT, "Tag hash table too small");
+static_assert(MAX_AIRTAG_COUNT < TAG_INDEX_NONE, "Tag indices are 16 bits");
+
+/* Everything touched per advert stays in internal RAM; only the names,
+ * read when a row is drawn, may go to PSRAM */
+static tag_hot_t tag_hot[MAX_AIRTAG_COUNT];
+static tag_index_t tag_order[MAX_AIRTAG_COUNT];    /* Indices into tag_hot, in display order */
+static tag_index_t tag_hash[TAG_HASH_SIZE];
+static tag_index_t tag_lru_prev[MAX_AIRTAG_COUNT];
+static tag_index_t tag_lru_next[MAX_AIRTAG_COUNT];
+static tag_index_t tag_lru_head = TAG_INDEX_NONE;  /* Most recently seen */
+static tag_index_t tag_lru_tail = TAG_INDEX_NONE;  /* Least recently seen */
+static tag_index_t tag_rank[MAX_AIRTAG_COUNT];     /* Position of each tag in tag_order */
+static bool tag_names_in_psram = false;
+
+/* Lookup cost, BLE task only */
+static uint32_t tag_lookups = 0;
+static uint32_t tag_probes = 0;
+static uint64_t tag_lookup_cycles = 0;
+
+/* Single-producer (GAP callback) / single-consumer (bluetooth_loop) advert ring */
+#define ADV_QUEUE_SIZE    32  /* Power of two */
+#define ADV_DRAIN_BATCH   ADV_QUEUE_SIZE
+#define TAG_EXPIRE_BATCH  4   /* Expired tags removed per bluetooth_loop() call */
+
+typedef struct {
+    esp_bd_addr_t bda;
+    esp_ble_addr_type_t addr_type;
+    int8_t rssi;
+    char name[BLE_NAME_MAX_LEN];
+} adv_record_t;
+
+static adv_record_t adv_queue[ADV_QUEUE_SIZE];
+static uint32_t adv_queue_head = 0;      /* Only written by the producer */
+static uint32_t adv_queue_tail = 0;      /* Only written by the consumer */
+static uint32_t adv_queue_received = 0;  /* Only written by the producer */
+static uint32_t adv_queue_dropped = 0;   /* Only written by the producer */
+
+/* Advertisers rejected by name, see adv_reject_cache_hit() */
+#define ADV_REJECT_CACHE_BITS  6
+#define ADV_REJECT_CACHE_SIZE  (1 << ADV_REJECT_CACHE_BITS)
+
+typedef struct {
+    esp_bd_addr_t bda;
+    bool used;
+    uint32_t seen_ms;
+} adv_reject_entry_t;
+
+/* Only written by the Bluedroid callback task, each counter atomically so
+ * the loop task never reads half of a 64-bit one */
+typedef struct {
+    uint32_t hits;
+    uint32_t rejects;        /* Adverts parsed and rejected */
+    uint32_t inserts;
+    uint32_t evictions;      /* Live entries replaced by a colliding advertiser */
+    uint64_t hit_cycles;
+    uint64_t reject_cycles;
+} adv_reject_stats_t;
+
+static adv_reject_entry_t adv_reject_cache[ADV_REJECT_CACHE_SIZE];
+static adv_reject_stats_t adv_reject_stats;
+
+/* UI requests arrive through one queue, GATTC events through another so
+ * requests can never crowd out the events links wait on */
+enum {
+    BLE_MSG_WAKE = 0,   /* Adverts or GATTC events queued */
+    BLE_MSG_SCAN,
+    BLE_MSG_OPEN,
+    BLE_MSG_CLOSE,
+    BLE_MSG_SEND,
+};
+
+typedef struct {
+    uint8_t type;
+    int8_t link;
+    uint8_t gen;        /* Of the link addressed, a request for an earlier user is stale */
+    uint8_t addr_type;  /* BLE_MSG_OPEN */
+    esp_bd_addr_t bda;  /* BLE_MSG_OPEN */
+    ble_command_t cmd;  /* BLE_MSG_SEND */
+} ble_msg_t;
+
+typedef struct {
+    esp_gattc_cb_event_t event;
+    esp_gatt_if_t gattc_if;
+    esp_ble_gattc_cb_param_t param;
+} ble_gattc_msg_t;
+
+static QueueHandle_t ble_queue;
+static QueueHandle_t gattc_queue;
+static TaskHandle_t ble_task_handle;
+static uint32_t gattc_dropped = 0;      /* Advisory GATTC events that found no room */
+static uint32_t gattc_lost = 0;         /* GATTC events a link waited on that found no room */
 
-static uint16_t nus_handler = 0;
-static uint8_t ble_tx_buf[32];
 
 static esp_ble_scan_params_t ble_scan_params = {
     .scan_type          = BLE_SCAN_TYPE_ACTIVE,
     .own_addr_type      = BLE_ADDR_TYPE_PUBLIC,
     .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
-    .scan_interval      = 0x50,
-    .scan_window        = 0x30,
+    .scan_interval      = SCAN_INTERVAL,
+    .scan_window        = SCAN_WINDOW,
     .scan_duplicate     = BLE_SCAN_DUPLICATE_DISABLE
 };
 
@@ -60,29 +281,333 @@ static struct gattc_profile_inst gl_profile_tab[PROFILE_NUM] = {
     },
 };
 
-static esp_gattc_char_elem_t *char_elem_result = NULL;
+static uint8_t link_state(const ble_link_t *link) {
+    return __atomic_load_n(&link->state, __ATOMIC_ACQUIRE);
+}
+
+static void link_set_state(ble_link_t *link, uint8_t state) {
+    __atomic_store_n(&link->state, state, __ATOMIC_RELEASE);
+}
+
+/* Any active link when state is LINK_IDLE. Claimed slots are not set up
+ * yet, their address is stale. */
+static ble_link_t *link_find_by_bda(const uint8_t *bda, uint8_t state) {
+    for (int i = 0; i < BLE_MAX_LINKS; i++) {
+        uint8_t current = link_state(&links[i]);
+        if ((current > LINK_CLAIMED) && ((state == LINK_IDLE) || (current == state)) &&
+            (memcmp(links[i].bda, bda, sizeof(esp_bd_addr_t)) == 0)) {
+            return &links[i];
+        }
+    }
+    return NULL;
+}
+
+static ble_link_t *link_find_by_conn(uint16_t conn_id) {
+    for (int i = 0; i < BLE_MAX_LINKS; i++) {
+        if ((link_state(&links[i]) >= LINK_DISCOVERING) && (links[i].conn_id == conn_id)) {
+            return &links[i];
+        }
+    }
+    return NULL;
+}
+
+static bool link_any_active(void) {
+    for (int i = 0; i < BLE_MAX_LINKS; i++) {
+        if (link_state(&links[i]) > LINK_CLAIMED) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* The controller creates one connection at a time, so pending links are
+ * opened one after the other; established links run concurrently. */
+static void link_open_next(void) {
+    ble_link_t *next = NULL;
+
+    for (int i = 0; i < BLE_MAX_LINKS; i++) {
+        uint8_t state = link_state(&links[i]);
+        if (state == LINK_OPENING) {
+            return;
+        }
+        if ((next == NULL) && (state == LINK_PENDING)) {
+            next = &links[i];
+        }
+    }
+    if (next == NULL) {
+        return;
+    }
+
+    link_set_state(next, LINK_OPENING);
+    next->cache_assoc = false;
+#if CONFIG_BT_GATTC_CACHE_NVS_FLASH
+    /* Must be in place before the connection, the stack discovers right away */
+    gatt_cache_entry_t cached;
+    if (gatt_template_valid && (memcmp(gatt_template_bda, next->bda, sizeof(esp_bd_addr_t)) != 0) &&
+        !gatt_cache_lookup(next->bda, &cached)) {
+        next->cache_assoc = (esp_ble_gattc_cache_assoc(gl_profile_tab[PROFILE_A_APP_ID].gattc_if,
+                                                       next->bda, gatt_template_bda, true) == ESP_OK);
+    }
+#endif
+    LOG_PRINTLN("Connecting to device");
+    if (esp_ble_gattc_open(gl_profile_tab[PROFILE_A_APP_ID].gattc_if, next->bda, next->addr_type, true) != ESP_OK) {
+        LOG_PRINTLN("esp_ble_gattc_open failed");
+        link_set_state(next, LINK_IDLE);
+    }
+}
+
+static void link_pump_commands(ble_link_t *link);
+static void scan_start(void);
+
+/* OPEN and CONNECT events both report the connection, in either order */
+static void link_connected(ble_link_t *link, uint16_t conn_id) {
+    gatt_cache_entry_t cached;
+
+    link->conn_id = conn_id;
+    if (link_state(link) != LINK_OPENING) {
+        return;
+    }
+    if (link->close_pending) {
+        /* Nobody owns the link anymore, the disconnect frees it */
+        link_set_state(link, LINK_CLOSING);
+        esp_ble_gattc_close(gl_profile_tab[PROFILE_A_APP_ID].gattc_if, conn_id);
+        return;
+    }
+
+    link->has_service = false;
+    link->nus_handler = 0;
+    link->from_cache = link->cache_assoc;
+    link->mtu = BLE_DEFAULT_MTU;
+    link_set_state(link, LINK_DISCOVERING);
+    trace_event(TRACE_LINK_CONNECTED, link - links);
+    esp_ble_gattc_send_mtu_req(gl_profile_tab[PROFILE_A_APP_ID].gattc_if, conn_id);
+
+    /* Known tag: go straight to writing, the first write checks the handles */
+    if (gatt_cache_lookup(link->bda, &cached)) {
+        LOG_PRINTF("GATT cache hit, RX Handler %d\n", cached.nus_handler);
+        link->service_start_handle = cached.service_start_handle;
+        link->service_end_handle = cached.service_end_handle;
+        link->nus_handler = cached.nus_handler;
+        link->write_no_rsp = cached.write_no_rsp;
+        link->has_service = true;
+        link->from_cache = true;
+        link_set_state(link, LINK_READY);
+        trace_event(TRACE_LINK_READY, link - links);
+        link_pump_commands(link);
+    }
+}
+
+/* Cached handles were wrong: forget them and discover the service again.
+ * The stack cache may be just as stale, so it is dropped too and the stack
+ * rediscovers over the air, reporting back with DIS_SRVC_CMPL. */
+static void link_rediscover(ble_link_t *link) {
+    LOG_PRINTLN("GATT cache stale, rediscovering");
+    gatt_cache_invalidate(link->bda);
+    link->from_cache = false;
+    link->cache_assoc = false;
+    link->has_service = false;
+    link->nus_handler = 0;
+    link_set_state(link, LINK_DISCOVERING);
+#if CONFIG_BT_GATTC_CACHE_NVS_FLASH
+    if (esp_ble_gattc_cache_refresh(link->bda) == ESP_OK) {
+        return;
+    }
+#endif
+    esp_ble_gattc_search_service(gl_profile_tab[PROFILE_A_APP_ID].gattc_if, link->conn_id, &nus_service_uuid);
+}
+
+static void link_reset_commands(ble_link_t *link) {
+    link->cmd_head = 0;
+    link->cmd_tail = 0;
+    link->cmd_in_flight = false;
+}
+
+static void link_set_failed(ble_link_t *link) {
+    __atomic_store_n(&link->cmd_failed, true, __ATOMIC_RELAXED);
+}
+
+/* Start the next queued write if none is in flight. A write the stack
+ * refuses is dropped and reported, the ones behind it still go out. */
+static void link_pump_commands(ble_link_t *link) {
+    while ((link_state(link) == LINK_READY) && !link->cmd_in_flight && (link->cmd_head != link->cmd_tail)) {
+        ble_command_t *cmd = &link->cmds[link->cmd_tail % BLE_CMD_QUEUE_SIZE];
+        link->cmd_in_flight = true;
+        link->cmd_sent_ms = CURRENT_TIME_MS();
+
+        /* A write without response to a stale handle is dropped silently by
+         * the tag, so cached handles are proven with a response first */
+        bool no_rsp = link->write_no_rsp && !link->from_cache;
+        if (esp_ble_gattc_write_char(gl_profile_tab[PROFILE_A_APP_ID].gattc_if,
+                                link->conn_id,
+                                link->nus_handler, cmd->len, cmd->data,
+                                no_rsp ? ESP_GATT_WRITE_TYPE_NO_RSP : ESP_GATT_WRITE_TYPE_RSP,
+                                ESP_GATT_AUTH_REQ_NONE) != ESP_OK) {
+            LOG_PRINTF("Failed to write char handler %d\n", link->nus_handler);
+            link->cmd_tail++;
+            link->cmd_in_flight = false;
+            link_set_failed(link);
+        }
+    }
+}
+
+static void link_command_done(ble_link_t *link, esp_gatt_status_t status) {
+    uint32_t latency = ELAPSED_TIME_MS(link->cmd_sent_ms);
+
+    if ((status != ESP_GATT_OK) && link->from_cache) {
+        /* Keep the command queued, it is resent once the RX handle is found again */
+        link->cmd_in_flight = false;
+        link_rediscover(link);
+        return;
+    }
+    link->from_cache = false;
+#if CONFIG_BT_GATTC_CACHE_NVS_FLASH
+    if (status == ESP_GATT_OK) {
+        memcpy(gatt_template_bda, link->bda, sizeof(esp_bd_addr_t));
+        gatt_template_valid = true;
+    }
+#endif
+
+    if (link->cmd_in_flight) {
+        link->cmd_tail++;
+        link->cmd_in_flight = false;
+        __atomic_store_n(&link->cmd_latency_ms, latency, __ATOMIC_RELAXED);
+        if (latency > link->cmd_max_latency_ms) {
+            __atomic_store_n(&link->cmd_max_latency_ms, latency, __ATOMIC_RELAXED);
+        }
+        if (status != ESP_GATT_OK) {
+            link_set_failed(link);
+        }
+    }
+
+    if (status != ESP_GATT_OK) {
+        LOG_PRINTF("Write failed, status %d\n", status);
+    }
+    else {
+        trace_event(TRACE_CMD_DONE, link - links);
+        LOG_PRINTF("BLE command done in %u ms\n", latency);
+    }
+    link_pump_commands(link);
+}
+
+/* Nothing to write to on this connection: report it to whoever queued
+ * commands and drop the connection, the disconnect frees the link */
+static void link_discovery_failed(ble_link_t *link, const char *reason) {
+    LOG_PRINTLN(reason);
+    link_set_failed(link);
+    esp_ble_gattc_close(gl_profile_tab[PROFILE_A_APP_ID].gattc_if, link->conn_id);
+}
+
+static void link_find_nus_rx(ble_link_t *link, esp_gatt_if_t gattc_if) {
+    uint16_t count = 0;
+    esp_ble_gattc_get_attr_count(
+        gattc_if,
+        link->conn_id,
+        ESP_GATT_DB_CHARACTERISTIC,
+        link->service_start_handle,
+        link->service_end_handle,
+        0,
+        &count
+    );
+    if (count == 0) {
+        link_discovery_failed(link, "No characteristics found");
+        return;
+    }
+    LOG_PRINTF("Found %d characteristics\n", count);
+
+    esp_gattc_char_elem_t *char_elem = (esp_gattc_char_elem_t *) malloc(count * sizeof(*char_elem));
+    if (char_elem == NULL) {
+        link_discovery_failed(link, "No memory for characteristics");
+        return;
+    }
+    esp_ble_gattc_get_all_char(
+        gattc_if,
+        link->conn_id,
+        link->service_start_handle,
+        link->service_end_handle,
+        char_elem, &count, 0
+    );
+    for (int i = 0; i < count; i++) {
+        if (memcmp(char_elem[i].uuid.uuid.uuid128, nus_rx_uuid.uuid.uuid128, ESP_UUID_LEN_128) == 0) {
+            link->nus_handler = char_elem[i].char_handle;
+            link->write_no_rsp = BLE_CMD_WRITE_NO_RSP && (char_elem[i].properties & ESP_GATT_CHAR_PROP_BIT_WRITE_NR);
+            link_set_state(link, LINK_READY);
+            trace_event(TRACE_LINK_READY, link - links);
+            LOG_PRINTF("RX Handler %d\n", link->nus_handler);
+
+            gatt_cache_entry_t entry = {};
+            entry.write_no_rsp = link->write_no_rsp;
+            entry.service_start_handle = link->service_start_handle;
+            entry.service_end_handle = link->service_end_handle;
+            entry.nus_handler = link->nus_handler;
+            gatt_cache_store(link->bda, &entry);
+            break;
+        }
+    }
+    free(char_elem);
+
+    if (link_state(link) != LINK_READY) {
+        link_discovery_failed(link, "NUS RX characteristic not found");
+        return;
+    }
+    /* Commands may have been queued while discovering */
+    link_pump_commands(link);
+}
 
 static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param) {
     esp_ble_gattc_cb_param_t *p_data = (esp_ble_gattc_cb_param_t *)param;
+    ble_link_t *link;
 
     switch (event) {
         case ESP_GATTC_OPEN_EVT:
             LOG_PRINTLN("ESP_GATTC_OPEN_EVT");
+            link = link_find_by_bda(p_data->open.remote_bda, LINK_IDLE);
+            if (link != NULL) {
+                if (p_data->open.status != ESP_GATT_OK) {
+                    LOG_PRINTF("Open failed, status %d\n", p_data->open.status);
+                    link_set_state(link, LINK_IDLE);
+                }
+                else {
+                    link_connected(link, p_data->open.conn_id);
+                }
+            }
+            link_open_next();
             break;
         case ESP_GATTC_CONNECT_EVT:{
             LOG_PRINTLN("ESP_GATTC_CONNECT_EVT");
-            gl_profile_tab[PROFILE_A_APP_ID].conn_id = p_data->connect.conn_id;
-            memcpy(gl_profile_tab[PROFILE_A_APP_ID].remote_bda, p_data->connect.remote_bda, sizeof(esp_bd_addr_t));
+            link = link_find_by_bda(p_data->connect.remote_bda, LINK_IDLE);
+            if (link != NULL) {
+                link_connected(link, p_data->connect.conn_id);
+            }
+            link_open_next();
             break;
         }
         case ESP_GATTC_DIS_SRVC_CMPL_EVT:
-            if (param->dis_srvc_cmpl.status == ESP_GATT_OK){
-                LOG_PRINTLN("ESP_GATTC_DIS_SRVC_CMPL_EVT");
-                esp_ble_gattc_search_service(gattc_if, gl_profile_tab[PROFILE_A_APP_ID].conn_id, &nus_service_uuid);
+            link = link_find_by_conn(param->dis_srvc_cmpl.conn_id);
+            if (param->dis_srvc_cmpl.status != ESP_GATT_OK) {
+                if ((link != NULL) && (link_state(link) != LINK_READY)) {
+                    link_discovery_failed(link, "Service discovery failed");
+                }
+                break;
             }
+            LOG_PRINTLN("ESP_GATTC_DIS_SRVC_CMPL_EVT");
+            if ((link != NULL) && (link_state(link) == LINK_READY)) {
+                break;  /* Handles already known */
+            }
+            esp_ble_gattc_search_service(gattc_if, param->dis_srvc_cmpl.conn_id, &nus_service_uuid);
             break;
         case ESP_GATTC_CFG_MTU_EVT:
             LOG_PRINTLN("ESP_GATTC_CFG_MTU_EVT");
+            link = link_find_by_conn(p_data->cfg_mtu.conn_id);
+            if ((link != NULL) && (p_data->cfg_mtu.status == ESP_GATT_OK)) {
+                link->mtu = p_data->cfg_mtu.mtu;
+                LOG_PRINTF("MTU %d\n", link->mtu);
+            }
+            break;
+        case ESP_GATTC_WRITE_CHAR_EVT:
+            link = link_find_by_conn(p_data->write.conn_id);
+            if (link != NULL) {
+                link_command_done(link, p_data->write.status);
+            }
             break;
         case ESP_GATTC_SEARCH_RES_EVT: {
             LOG_PRINT("UUID len "); LOG_PRINT(p_data->search_res.srvc_id.uuid.len); LOG_PRINT(" UUID "); LOG_PRINTLN(p_data->search_res.srvc_id.uuid.uuid.uuid128[0]);
@@ -90,79 +615,63 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
                 (memcmp(p_data->search_res.srvc_id.uuid.uuid.uuid128, nus_service_uuid.uuid.uuid128, ESP_UUID_LEN_128))) {
                     break;
             }
-            
+            link = link_find_by_conn(p_data->search_res.conn_id);
+            if (link == NULL) {
+                break;
+            }
+
             LOG_PRINTLN("ESP_GATTC_SEARCH_RES_EVT");
             LOG_PRINT("Server start handle "); LOG_PRINTLN(p_data->search_res.start_handle);
             LOG_PRINT("Server end handle "); LOG_PRINTLN(p_data->search_res.end_handle);
-            get_server = true;
-            gl_profile_tab[PROFILE_A_APP_ID].service_start_handle = p_data->search_res.start_handle;
-            gl_profile_tab[PROFILE_A_APP_ID].service_end_handle = p_data->search_res.end_handle;
+            link->has_service = true;
+            link->service_start_handle = p_data->search_res.start_handle;
+            link->service_end_handle = p_data->search_res.end_handle;
             break;
         }
         case ESP_GATTC_SEARCH_CMPL_EVT: {
-            if (p_data->search_cmpl.status != ESP_GATT_OK){
-                LOG_PRINTLN("ESP_GATTC_SEARCH_CMPL_EVT failed");
-                esp_ble_gatts_close(gattc_if, gl_profile_tab[PROFILE_A_APP_ID].conn_id);
+            link = link_find_by_conn(p_data->search_cmpl.conn_id);
+            if (link == NULL) {
                 break;
             }
-            
-            LOG_PRINTLN("ESP_GATTC_SEARCH_CMPL_EVT successfully");
-            if (!get_server) {
-                LOG_PRINTLN("Couldn't found service");
+            if (p_data->search_cmpl.status != ESP_GATT_OK){
+                link_discovery_failed(link, "ESP_GATTC_SEARCH_CMPL_EVT failed");
                 break;
             }
-            is_connected = true;
-
-            uint16_t count = 0;
-            esp_ble_gattc_get_attr_count(
-                gl_profile_tab[PROFILE_A_APP_ID].gattc_if,
-                gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                ESP_GATT_DB_CHARACTERISTIC,
-                gl_profile_tab[PROFILE_A_APP_ID].service_start_handle,
-                gl_profile_tab[PROFILE_A_APP_ID].service_end_handle,
-                0,
-                &count
-            );
-            if (count == 0) {
-                LOG_PRINTLN("No characteristics found");
+
+            LOG_PRINTLN("ESP_GATTC_SEARCH_CMPL_EVT successfully");
+            if (!link->has_service) {
+                link_discovery_failed(link, "Couldn't found service");
                 break;
             }
-            LOG_PRINTF("Found %d characteristics\n", count);
-
-            esp_gattc_char_elem_t *char_elem = (esp_gattc_char_elem_t *) malloc(count * sizeof(*char_elem));
-            esp_ble_gattc_get_all_char(
-                gl_profile_tab[PROFILE_A_APP_ID].gattc_if,
-                gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                gl_profile_tab[PROFILE_A_APP_ID].service_start_handle,
-                gl_profile_tab[PROFILE_A_APP_ID].service_end_handle,
-                char_elem, &count, 0
-            );
-            for (int i = 0; i < count; i++) {
-                ESP_LOGI(TAG, "Char %d UUID: %s handle: %u", i,
-                        uuid_to_str(char_elem[i].uuid), char_elem[i].char_handle);
-                
-                if (memcmp(char_elem[i].uuid.uuid.uuid128, nus_rx_uuid.uuid.uuid128, ESP_UUID_LEN_128) == 0) {
-                    nus_handler = char_elem[i].char_handle;
-                    LOG_PRINTF("RX Handler %d\n", nus_handler);
-                    break;
-                }
-            }
-            free(char_elem);
+            link_find_nus_rx(link, gattc_if);
             break;
         }
 
         case ESP_GATTC_DISCONNECT_EVT:
             LOG_PRINTLN("ESP_GATTC_DISCONNECT_EVT");
-            get_server = false;
-            nus_handler = 0;
+            link = link_find_by_bda(p_data->disconnect.remote_bda, LINK_IDLE);
+            if (link != NULL) {
+                link->nus_handler = 0;
+                link_reset_commands(link);
+                link_set_state(link, LINK_IDLE);
+                trace_event(TRACE_LINK_CLOSED, link - links);
+            }
             gl_profile_tab[PROFILE_A_APP_ID].gattc_if = gattc_if;
+            link_open_next();
+#if SCAN_CONTINUOUS
+            if (!link_any_active()) {
+                scan_start();
+            }
+#endif
             break;
         default:
             break;
     }
 }
 
-static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param) {
+static void bluetooth_gattc_handle(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param) {
+    trace_event(TRACE_GATTC_EVT, event);
+
     /* If event is register event, store the gattc_if for each profile */
     if (event == ESP_GATTC_REG_EVT) {
         if (param->reg.status == ESP_GATT_OK) {
@@ -187,234 +696,1335 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp
     } while (0);
 }
 
-static char* ble_get_name(uint8_t *data, uint8_t len, char *out, size_t out_len) {
-    uint8_t pos = 0;
+/* Writer side, BLE task only. Keep sections short, readers spin on them.
+ * The stores in the section are release stores, they cannot be seen
+ * before the odd sequence. */
+static void tag_write_begin(void) {
+    __atomic_store_n(&tag_seq, tag_seq + 1, __ATOMIC_RELAXED);
+}
 
-    while (pos < len) {
-        uint8_t field_len = data[pos];
-        if (field_len == 0) break;
+static void tag_write_end(void) {
+    __atomic_store_n(&tag_seq, tag_seq + 1, __ATOMIC_RELEASE);
+}
 
-        uint8_t type = data[pos + 1];
+/* Readers run below the BLE task priority, so the writer preempts them or
+ * runs on the other core and a section ends within microseconds. Should it
+ * not, the reader sleeps a tick per TAG_READ_SPINS checks rather than
+ * starve the writer. */
+static uint32_t tag_read_begin(void) {
+    uint32_t spins = 0;
+    uint32_t seq;
 
-        if (type == 0x09 || type == 0x08) {
-            uint8_t name_len = field_len - 1;
-            if (name_len >= out_len) name_len = out_len - 1;
-            memcpy(out, &data[pos + 2], name_len);
-            out[name_len] = '\0';
-            return out;
+    while ((seq = __atomic_load_n(&tag_seq, __ATOMIC_ACQUIRE)) & 1) {
+        if (++spins >= TAG_READ_SPINS) {
+            vTaskDelay(1);
+            spins = 0;
         }
-        pos += field_len + 1;
     }
-    return NULL;
+    return seq;
 }
 
-void bluetooth_add_device(char *name, uint8_t *address, int8_t rssi, esp_ble_addr_type_t addr_type) {
-    int timeout = 0;
-    xSemaphoreTake(ble_semaphore, portMAX_DELAY);
-
-    int8_t index = -1;
-    int8_t oldest_index = -1;
-    uint32_t elapsed_ms;
-    uint8_t max_count;
-    uint32_t oldest_time = 0;
-
-    if (tag_list.count > 0) {
-        max_count = ((tag_list.count < MAX_AIRTAG_COUNT) ? tag_list.count : MAX_AIRTAG_COUNT);
-        for (int i = 0; i < max_count; i++) {
-            if (
-                (tag_list.tags[i].bda[0] == address[0]) &&
-                (tag_list.tags[i].bda[1] == address[1]) &&
-                (tag_list.tags[i].bda[2] == address[2]) &&
-                (tag_list.tags[i].bda[3] == address[3]) &&
-                (tag_list.tags[i].bda[4] == address[4]) &&
-                (tag_list.tags[i].bda[5] == address[5])
-            ) {
-                index = i;
-                break;
-            }
-            /* Remove oldest tags */
-            else {
-                elapsed_ms = (millis() - tag_list.tags[i].last_seen) & 0xFFFFFFFF;
-                if (elapsed_ms > oldest_time) {
-                    oldest_index = i;
-                    oldest_time = elapsed_ms;
-                }
-            }
-        }
-    }
-    if (index == -1) {
-        /* If buff is full or not in scanning, ignore new tag */
-        if (tag_list.count < MAX_AIRTAG_COUNT) {
-            index = tag_list.count;
-            tag_list.count++;
-            LOG_PRINT("Add a new device ");
-            LOG_PRINTLN(name);
-        }
-        else if (oldest_index != -1) {
-            index = oldest_index;
-        }
+/* True when the data read since tag_read_begin() may be torn. Every load
+ * in between was an acquire, so a store from a later section implies the
+ * odd sequence is visible here. */
+static bool tag_read_retry(uint32_t seq) {
+    return __atomic_load_n(&tag_seq, __ATOMIC_RELAXED) != seq;
+}
+
+/* Section copies, a byte at a time to stay atomic at any alignment */
+static void tag_copy_in(void *dst, const void *src, size_t len) {
+    uint8_t *d = (uint8_t *) dst;
+    const uint8_t *s = (const uint8_t *) src;
+
+    for (size_t i = 0; i < len; i++) {
+        TAG_STORE(d[i], s[i]);
     }
+}
 
-    xthal_memcpy(tag_list.tags[index].bda, address, 6);
-    snprintf(tag_list.tags[index].name, BLE_NAME_MAX_LEN, "%s", name);
-    tag_list.tags[index].rssi = rssi;
-    tag_list.tags[index].addr_type = addr_type;
-    tag_list.tags[index].last_seen = CURRENT_TIME_MS();
-    xSemaphoreGive(ble_semaphore);
+static void tag_copy_out(void *dst, const void *src, size_t len) {
+    uint8_t *d = (uint8_t *) dst;
+    const uint8_t *s = (const uint8_t *) src;
+
+    for (size_t i = 0; i < len; i++) {
+        d[i] = TAG_LOAD(s[i]);
+    }
 }
 
-static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
-    static int try_start = 0;
+/* Tag index: open-addressed hash (linear probing) from BDA to slot in tag_hot,
+ * plus a doubly linked LRU list so the oldest tag is always at the tail. */
+static uint32_t bda_hash(const uint8_t *bda, uint8_t bits) {
+    uint32_t h = (((uint32_t)bda[0] << 8) | bda[1]) ^
+                 (((uint32_t)bda[2] << 24) | ((uint32_t)bda[3] << 16) | ((uint32_t)bda[4] << 8) | bda[5]);
+    return (h * 0x9E3779B1u) >> (32 - bits);
+}
 
-    switch (event) {
-        case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT: {
-            break;
-        }
+static uint32_t tag_hash_bda(const uint8_t *bda) {
+    return bda_hash(bda, TAG_HASH_BITS);
+}
 
-        case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
-            if (param->scan_start_cmpl.status != ESP_BT_STATUS_SUCCESS) {
-                LOG_PRINTLN("ESP_GAP_BLE_SCAN_START_COMPLETE_EVT failed");
-                esp_ble_gattc_close(gl_profile_tab[PROFILE_A_APP_ID].gattc_if, gl_profile_tab[PROFILE_A_APP_ID].conn_id);
-                esp_ble_gap_start_scanning(GAP_SCAN_DURATION);
-                break;
-            }
-            LOG_PRINTLN("ESP_GAP_BLE_SCAN_START_COMPLETE_EVT successfully");
-            is_scanning = true;
-            break;
+/* Reject cache: direct-mapped table of advertisers known not to be tags,
+ * so their adverts are dropped before parsing. A colliding advertiser just
+ * takes the slot over. Only used from the Bluedroid callback task. */
+static bool adv_reject_cache_hit(const uint8_t *bda) {
+    adv_reject_entry_t *entry = &adv_reject_cache[bda_hash(bda, ADV_REJECT_CACHE_BITS)];
 
-        /* The scan has aquired results */
-        case ESP_GAP_BLE_SCAN_RESULT_EVT: {
-            esp_ble_gap_cb_param_t *scan_result = (esp_ble_gap_cb_param_t *) param;
-            switch (scan_result->scan_rst.search_evt) {
-                /* Compare the current packet to what we expect to get */
-                case ESP_GAP_SEARCH_INQ_RES_EVT:
-                {
-                    char dev_name[32];
-                    char *name = ble_get_name(scan_result->scan_rst.ble_adv,
-                                            scan_result->scan_rst.adv_data_len,
-                                            dev_name,
-                                            sizeof(dev_name));
-
-                    if ((!name) || (strncmp(name, "ATS", 3) != 0)) {
-                        LOG_PRINTLN("Not supported name");
-                        return;
-                    }
+    return entry->used && (memcmp(entry->bda, bda, sizeof(esp_bd_addr_t)) == 0) &&
+           (ELAPSED_TIME_MS(entry->seen_ms) < ADV_REJECT_EXPIRE_MS);
+}
 
-                    bluetooth_add_device(name, scan_result->scan_rst.bda, scan_result->scan_rst.rssi, scan_result->scan_rst.ble_addr_type);
-                    break;
-                }
+static void adv_reject_cache_add(const uint8_t *bda) {
+    adv_reject_entry_t *entry = &adv_reject_cache[bda_hash(bda, ADV_REJECT_CACHE_BITS)];
 
-                case ESP_GAP_SEARCH_INQ_CMPL_EVT:
-                    break;
-                default:
-                    break;
-            }
-        } break;
+    if (entry->used && (ELAPSED_TIME_MS(entry->seen_ms) < ADV_REJECT_EXPIRE_MS)) {
+        __atomic_fetch_add(&adv_reject_stats.evictions, 1, __ATOMIC_RELAXED);
+    }
+    memcpy(entry->bda, bda, sizeof(esp_bd_addr_t));
+    entry->seen_ms = CURRENT_TIME_MS();
+    entry->used = true;
+    __atomic_fetch_add(&adv_reject_stats.inserts, 1, __ATOMIC_RELAXED);
+}
 
-        /* The scan has either stopped successfully or failed */
-        case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
-            if (param->scan_stop_cmpl.status != ESP_BT_STATUS_SUCCESS) {
-                LOG_PRINTLN("ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT failed");
-                break;
-            }
-            LOG_PRINTLN("ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT successfully");
-            break;
+static void adv_reject_stats_read(adv_reject_stats_t *stats) {
+    stats->hits = __atomic_load_n(&adv_reject_stats.hits, __ATOMIC_RELAXED);
+    stats->rejects = __atomic_load_n(&adv_reject_stats.rejects, __ATOMIC_RELAXED);
+    stats->inserts = __atomic_load_n(&adv_reject_stats.inserts, __ATOMIC_RELAXED);
+    stats->evictions = __atomic_load_n(&adv_reject_stats.evictions, __ATOMIC_RELAXED);
+    stats->hit_cycles = __atomic_load_n(&adv_reject_stats.hit_cycles, __ATOMIC_RELAXED);
+    stats->reject_cycles = __atomic_load_n(&adv_reject_stats.reject_cycles, __ATOMIC_RELAXED);
+}
 
-        case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
-            break;
+/* Hash slot holding bda, or -1. probes, when not NULL, gets the number of
+ * slots looked at, for the lookup statistics */
+static int tag_index_find_slot(const uint8_t *bda, uint32_t *probes) {
+    uint32_t slot = tag_hash_bda(bda);
+    uint32_t count = 0;
+    int found = -1;
 
-        default:
+    while (tag_hash[slot] != TAG_INDEX_NONE) {
+        count++;
+        if (memcmp(tag_hot[tag_hash[slot]].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            found = slot;
             break;
+        }
+        slot = (slot + 1) & (TAG_HASH_SIZE - 1);
     }
+    if (probes != NULL) {
+        *probes = count;
+    }
+    return found;
 }
 
-tag_scan_t *bluetooth_get_tag_list(void) {
-    xSemaphoreTake(ble_semaphore, portMAX_DELAY);
-    return &tag_list;
+static void tag_index_insert(tag_index_t index) {
+    uint32_t slot = tag_hash_bda(tag_hot[index].bda);
+
+    while (tag_hash[slot] != TAG_INDEX_NONE) {
+        slot = (slot + 1) & (TAG_HASH_SIZE - 1);
+    }
+    TAG_STORE(tag_hash[slot], index);
 }
 
-void bluetooth_release_tag_list(void) {
-    xSemaphoreGive(ble_semaphore);
+static void tag_index_remove(const uint8_t *bda) {
+    int found = tag_index_find_slot(bda, NULL);
+    if (found < 0) {
+        return;
+    }
+
+    /* Backward shift deletion keeps probe sequences intact without tombstones */
+    uint32_t hole = found;
+    uint32_t next = hole;
+    while (true) {
+        next = (next + 1) & (TAG_HASH_SIZE - 1);
+        if (tag_hash[next] == TAG_INDEX_NONE) {
+            break;
+        }
+
+        uint32_t home = tag_hash_bda(tag_hot[tag_hash[next]].bda);
+        bool movable = (hole <= next) ? ((home <= hole) || (home > next))
+                                      : ((home <= hole) && (home > next));
+        if (movable) {
+            TAG_STORE(tag_hash[hole], tag_hash[next]);
+            hole = next;
+        }
+    }
+    TAG_STORE(tag_hash[hole], TAG_INDEX_NONE);
 }
 
-void bluetooth_clear_device_list(void) {
-    xSemaphoreTake(ble_semaphore, portMAX_DELAY);
-    memset(&tag_list, 0, sizeof(tag_list));
-    xSemaphoreGive(ble_semaphore);
+static void tag_lru_unlink(tag_index_t index) {
+    tag_index_t prev = tag_lru_prev[index];
+    tag_index_t next = tag_lru_next[index];
+
+    if (prev != TAG_INDEX_NONE) tag_lru_next[prev] = next;
+    else tag_lru_head = next;
+
+    if (next != TAG_INDEX_NONE) tag_lru_prev[next] = prev;
+    else tag_lru_tail = prev;
 }
 
-void bluetooth_start_scanning(void) {
-    bluetooth_clear_device_list();
-    esp_ble_gap_start_scanning(GAP_SCAN_DURATION);
+static void tag_lru_push_head(tag_index_t index) {
+    tag_lru_prev[index] = TAG_INDEX_NONE;
+    tag_lru_next[index] = tag_lru_head;
+    if (tag_lru_head != TAG_INDEX_NONE) tag_lru_prev[tag_lru_head] = index;
+    tag_lru_head = index;
+    if (tag_lru_tail == TAG_INDEX_NONE) tag_lru_tail = index;
 }
 
-void bluetooth_airtag_connect(esp_bd_addr_t mac, esp_ble_addr_type_t addr_type) {
-    LOG_PRINTLN("Connecting to device");
-    esp_ble_gap_stop_scanning();
-    is_scanning = false;
-    
-    memcpy(last_tag_addr, mac, sizeof(esp_bd_addr_t));
-    esp_ble_gattc_open(gl_profile_tab[PROFILE_A_APP_ID].gattc_if, mac, (esp_ble_addr_type_t) addr_type, true);
+/* RSSI is averaged in fixed point. Whole dB would truncate every step and
+ * leave the average stuck up to TAG_RSSI_WEIGHT - 1 dB short of a steady
+ * signal, always on the strong side for negative values. */
+static int16_t tag_rssi_smooth(int16_t average, int8_t sample) {
+    int16_t target = sample * (1 << TAG_RSSI_FRAC_BITS);
+
+    return average + (target - average) / TAG_RSSI_WEIGHT;
 }
 
-void bluetooth_disconnect(void) {
-    esp_ble_gatts_close(gl_profile_tab[PROFILE_A_APP_ID].gattc_if, gl_profile_tab[PROFILE_A_APP_ID].conn_id);
-    esp_ble_gattc_close(gl_profile_tab[PROFILE_A_APP_ID].gattc_if, gl_profile_tab[PROFILE_A_APP_ID].conn_id);
-    is_connected = false;
+/* Rounded to the nearest dB */
+static int8_t tag_rssi_dbm(int16_t average) {
+    return (average + (1 << (TAG_RSSI_FRAC_BITS - 1))) >> TAG_RSSI_FRAC_BITS;
 }
 
-bool bluetooth_send_command(const char *cmd) {
-    int length = strlen(cmd);
-    if ((!is_connected) || (nus_handler == 0) || (length > sizeof(ble_tx_buf))) {
-        return false;
-    }
+/* Display order: strongest (smoothed) signal first, or by name */
+static bool tag_order_before(tag_index_t a, tag_index_t b) {
+    const tag_hot_t *ta = &tag_hot[a];
+    const tag_hot_t *tb = &tag_hot[b];
+    int cmp;
 
-    memcpy(ble_tx_buf, cmd, length);
-    if (esp_ble_gattc_write_char(gl_profile_tab[PROFILE_A_APP_ID].gattc_if,
-                            gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                            nus_handler, length, ble_tx_buf,
-                            ESP_GATT_WRITE_TYPE_RSP,
-                            ESP_GATT_AUTH_REQ_NONE) != ESP_OK) {
-        LOG_PRINTF("Failed to write char handler %d\n", nus_handler);
-        return false;
+#if TAG_SORT_BY_NAME
+    cmp = strncmp(tag_list.names[a], tag_list.names[b], BLE_NAME_MAX_LEN);
+#else
+    cmp = tag_rssi_dbm(tb->rssi) - tag_rssi_dbm(ta->rssi);
+#endif
+    if (cmp == 0) {
+        /* Total order so equal keys never swap back and forth */
+        cmp = memcmp(ta->bda, tb->bda, sizeof(esp_bd_addr_t));
     }
-
-    LOG_PRINT("BLE sent "); LOG_PRINTLN(cmd);
-    return true;
+    return cmp < 0;
 }
 
-bool bluetooth_is_connected(void) {
-    return is_connected;
+static void tag_order_set(tag_index_t rank, tag_index_t index) {
+    TAG_STORE(tag_order[rank], index);
+    TAG_STORE(tag_rank[index], rank);
 }
 
-void bluetooth_init(void) {
-    esp_err_t ret;
-    esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_DEFAULT, ESP_PWR_LVL_P9);
-    BLEDevice::init("");
+/* Move one tag to its place after its key changed. Keys change by small
+ * steps, so this is usually a swap or two. */
+static void tag_order_update(tag_index_t index) {
+    tag_index_t start = tag_rank[index];
+    tag_index_t rank = start;
 
-    /* Register the callback function to the gap module */
-    ret = esp_ble_gap_register_callback(esp_gap_cb);
-    if (ret) {
-        LOG_PRINTLN("esp_ble_gap_register_callback failed");
+    while ((rank > 0) && tag_order_before(index, tag_order[rank - 1])) {
+        tag_order_set(rank, tag_order[rank - 1]);
+        rank--;
     }
-
-    ret = esp_ble_gattc_register_callback(esp_gattc_cb);
-    if(ret){
-        LOG_PRINTLN("esp_ble_gattc_register_callback failed");
-        return;
+    while ((rank + 1 < tag_list.count) && tag_order_before(tag_order[rank + 1], index)) {
+        tag_order_set(rank, tag_order[rank + 1]);
+        rank++;
     }
+    tag_order_set(rank, index);
 
-    ret = esp_ble_gattc_app_register(PROFILE_A_APP_ID);
-    if (ret){
-        LOG_PRINTLN("esp_ble_gattc_app_register failed");
+    if (rank != start) {
+        TAG_STORE(tag_list.version, tag_list.version + 1);
     }
+}
 
-    /* Set scanning params */
-    ret = esp_ble_gap_set_scan_params(&ble_scan_params);
-    if (ret) {
-        LOG_PRINTLN("esp_ble_gap_set_scan_params failed");
+static void tag_order_remove(tag_index_t index) {
+    for (tag_index_t rank = tag_rank[index]; rank + 1 < tag_list.count; rank++) {
+        tag_order_set(rank, tag_order[rank + 1]);
     }
+}
+
+/* Swap-remove a tag, the last entry moves into its slot */
+static void tag_list_remove(tag_index_t index) {
+    tag_index_t last = tag_list.count - 1;
+
+    tag_lru_unlink(index);
+    tag_index_remove(tag_hot[index].bda);
+    tag_order_remove(index);
 
-    /* Create bluetooth task */
-    ble_semaphore = xSemaphoreCreateMutex();
+    if (index != last) {
+        tag_copy_in(&tag_hot[index], &tag_hot[last], sizeof(tag_hot_t));
+        tag_copy_in(tag_list.names[index], tag_list.names[last], BLE_NAME_MAX_LEN);
+        TAG_STORE(tag_hash[tag_index_find_slot(tag_hot[index].bda, NULL)], index);
+        tag_order_set(tag_rank[last], index);
+
+        tag_lru_prev[index] = tag_lru_prev[last];
+        tag_lru_next[index] = tag_lru_next[last];
+        if (tag_lru_prev[index] != TAG_INDEX_NONE) tag_lru_next[tag_lru_prev[index]] = index;
+        else tag_lru_head = index;
+        if (tag_lru_next[index] != TAG_INDEX_NONE) tag_lru_prev[tag_lru_next[index]] = index;
+        else tag_lru_tail = index;
+    }
+
+    static const tag_hot_t empty = {};
+    tag_copy_in(&tag_hot[last], &empty, sizeof(tag_hot_t));
+    TAG_STORE(tag_list.count, tag_list.count - 1);
+    TAG_STORE(tag_list.version, tag_list.version + 1);
+}
+
+/* Must be called inside a tag write. The LRU tail is the oldest tag,
+ * so expiry only ever looks at the tail. */
+static int tag_list_expire(uint32_t now) {
+    int removed;
+
+    for (removed = 0; removed < TAG_EXPIRE_BATCH; removed++) {
+        if (tag_lru_tail == TAG_INDEX_NONE) {
+            break;
+        }
+        if (((now - tag_hot[tag_lru_tail].last_seen) & 0xFFFFFFFF) < TAG_EXPIRE_MS) {
+            break;
+        }
+        tag_list_remove(tag_lru_tail);
+    }
+    return removed;
+}
+
+static void tag_index_reset(void) {
+    for (uint32_t slot = 0; slot < TAG_HASH_SIZE; slot++) {
+        TAG_STORE(tag_hash[slot], TAG_INDEX_NONE);
+    }
+    tag_lru_head = TAG_INDEX_NONE;
+    tag_lru_tail = TAG_INDEX_NONE;
+}
+
+/* Must be called inside a tag write */
+static void bluetooth_add_device(const adv_record_t *adv) {
+    tag_index_t index;
+    uint32_t start = CURRENT_CYCLES();
+    uint32_t probes;
+    int slot = tag_index_find_slot(adv->bda, &probes);
+    bool is_new = false;
+
+    TAG_STORE(tag_lookups, tag_lookups + 1);
+    TAG_STORE(tag_probes, tag_probes + probes);
+    TAG_STORE(tag_lookup_cycles, tag_lookup_cycles + (CURRENT_CYCLES() - start));
+
+    if (slot >= 0) {
+        index = tag_hash[slot];
+        tag_lru_unlink(index);
+        TAG_STORE(tag_hot[index].rssi, tag_rssi_smooth(tag_hot[index].rssi, adv->rssi));
+    }
+    else {
+        if (tag_list.count < MAX_AIRTAG_COUNT) {
+            index = tag_list.count;
+            TAG_STORE(tag_list.count, tag_list.count + 1);
+            is_new = true;
+            LOG_PRINT("Add a new device ");
+            LOG_PRINTLN(adv->name);
+        }
+        else {
+            /* Buffer is full, reuse the least recently seen tag */
+            index = tag_lru_tail;
+            tag_lru_unlink(index);
+            tag_index_remove(tag_hot[index].bda);
+        }
+
+        tag_copy_in(tag_hot[index].bda, adv->bda, sizeof(esp_bd_addr_t));
+        tag_index_insert(index);
+        TAG_STORE(tag_hot[index].rssi, (int16_t)(adv->rssi * (1 << TAG_RSSI_FRAC_BITS)));
+        TAG_STORE(tag_list.version, tag_list.version + 1);
+    }
+    tag_lru_push_head(index);
+
+    /* Names rarely change, keep PSRAM writes off the common path */
+    if (is_new || (strncmp(tag_list.names[index], adv->name, BLE_NAME_MAX_LEN) != 0)) {
+        tag_copy_in(tag_list.names[index], adv->name, BLE_NAME_MAX_LEN);
+    }
+    TAG_STORE(tag_hot[index].addr_type, (uint8_t) adv->addr_type);
+    TAG_STORE(tag_hot[index].last_seen, (uint32_t) CURRENT_TIME_MS());
+
+    if (is_new) {
+        tag_order_set(tag_list.count - 1, index);
+    }
+    tag_order_update(index);
+}
+
+/* Producer side, called from the Bluedroid callback task. Never blocks. */
+static bool adv_queue_push(const ble_ad_field_t *name, const uint8_t *address, int8_t rssi, esp_ble_addr_type_t addr_type) {
+    uint32_t head = __atomic_load_n(&adv_queue_head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&adv_queue_tail, __ATOMIC_ACQUIRE);
+
+    __atomic_fetch_add(&adv_queue_received, 1, __ATOMIC_RELAXED);
+    if ((head - tail) >= ADV_QUEUE_SIZE) {
+        __atomic_fetch_add(&adv_queue_dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    adv_record_t *adv = &adv_queue[head & (ADV_QUEUE_SIZE - 1)];
+    memcpy(adv->bda, address, sizeof(esp_bd_addr_t));
+    adv->addr_type = addr_type;
+    adv->rssi = rssi;
+    uint8_t name_len = (name->len < BLE_NAME_MAX_LEN) ? name->len : BLE_NAME_MAX_LEN - 1;
+    memcpy(adv->name, name->data, name_len);
+    adv->name[name_len] = '\0';
+
+    /* Publish the record only after it is completely written */
+    __atomic_store_n(&adv_queue_head, head + 1, __ATOMIC_RELEASE);
+
+    /* The BLE task drains everything it finds, wake it for the first record only */
+    if (head == tail) {
+        ble_msg_t msg = {};
+        msg.type = BLE_MSG_WAKE;
+        xQueueSend(ble_queue, &msg, 0);
+    }
+    return true;
+}
+
+/* Consumer side, BLE task only. Records from adv_queue_tail up to the
+ * returned head stay valid until adv_queue_release(). */
+static uint32_t adv_queue_peek(uint32_t max) {
+    uint32_t tail = adv_queue_tail;
+    uint32_t head = __atomic_load_n(&adv_queue_head, __ATOMIC_ACQUIRE);
+
+    return ((head - tail) > max) ? tail + max : head;
+}
+
+static const adv_record_t *adv_queue_at(uint32_t position) {
+    return &adv_queue[position & (ADV_QUEUE_SIZE - 1)];
+}
+
+/* Hand the slots up to tail back to the producer */
+static void adv_queue_release(uint32_t tail) {
+    __atomic_store_n(&adv_queue_tail, tail, __ATOMIC_RELEASE);
+}
+
+static void bluetooth_gap_handle(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+    /* Scan results are far too frequent for the trace ring */
+    if (event != ESP_GAP_BLE_SCAN_RESULT_EVT) {
+        trace_event(TRACE_GAP_EVT, event);
+    }
+
+    switch (event) {
+        case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT: {
+#if SCAN_CONTINUOUS
+            /* A connection may have taken the radio since the parameters
+             * went out, its disconnect restarts the scan. A switch asked
+             * for meanwhile applies its own parameters first. */
+            if (!link_any_active() && !__atomic_load_n(&scan_switching, __ATOMIC_ACQUIRE)) {
+                esp_ble_gap_start_scanning(BLUETOOTH_SCAN_DURATION);
+            }
+#endif
+            break;
+        }
+
+        case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
+            if (param->scan_start_cmpl.status != ESP_BT_STATUS_SUCCESS) {
+                LOG_PRINTLN("ESP_GAP_BLE_SCAN_START_COMPLETE_EVT failed");
+                esp_ble_gap_start_scanning(BLUETOOTH_SCAN_DURATION);
+                break;
+            }
+            LOG_PRINTLN("ESP_GAP_BLE_SCAN_START_COMPLETE_EVT successfully");
+            __atomic_store_n(&is_scanning, true, __ATOMIC_RELEASE);
+#if SCAN_CONTINUOUS
+            /* Tags only age while scanning, the BLE task may be waiting
+             * with no expiry deadline. Adverts would wake it, silent tags
+             * would never go. */
+            {
+                ble_msg_t msg = {};
+                msg.type = BLE_MSG_WAKE;
+                xQueueSend(ble_queue, &msg, 0);
+            }
+#endif
+            break;
+
+        /* The scan has aquired results */
+        case ESP_GAP_BLE_SCAN_RESULT_EVT: {
+            esp_ble_gap_cb_param_t *scan_result = (esp_ble_gap_cb_param_t *) param;
+            switch (scan_result->scan_rst.search_evt) {
+                /* Compare the current packet to what we expect to get */
+                case ESP_GAP_SEARCH_INQ_RES_EVT:
+                {
+                    uint8_t mode = __atomic_load_n(&scan_mode, __ATOMIC_RELAXED);
+                    uint32_t start = CURRENT_CYCLES();
+                    ble_adv_info_t adv;
+
+                    __atomic_fetch_add(&scan_callbacks[mode], 1, __ATOMIC_RELAXED);
+                    if (adv_reject_cache_hit(scan_result->scan_rst.bda)) {
+                        __atomic_fetch_add(&adv_reject_stats.hits, 1, __ATOMIC_RELAXED);
+                        __atomic_fetch_add(&adv_reject_stats.hit_cycles, CURRENT_CYCLES() - start, __ATOMIC_RELAXED);
+                        return;
+                    }
+
+                    ble_adv_parse(scan_result->scan_rst.ble_adv,
+                                scan_result->scan_rst.adv_data_len,
+                                scan_result->scan_rst.scan_rsp_len,
+                                sizeof(scan_result->scan_rst.ble_adv),
+                                &adv);
+
+                    if (!ble_ad_field_has_prefix(&adv.name, "ATS")) {
+                        /* A nameless connectable advert may still get its name
+                         * from a scan response, only cache once it cannot */
+                        if ((adv.name.len > 0) || (scan_result->scan_rst.scan_rsp_len > 0) ||
+                            (scan_result->scan_rst.ble_evt_type == ESP_BLE_EVT_NON_CONN_ADV)) {
+                            adv_reject_cache_add(scan_result->scan_rst.bda);
+                        }
+                        __atomic_fetch_add(&adv_reject_stats.rejects, 1, __ATOMIC_RELAXED);
+                        __atomic_fetch_add(&adv_reject_stats.reject_cycles, CURRENT_CYCLES() - start, __ATOMIC_RELAXED);
+                        return;
+                    }
+
+                    __atomic_fetch_add(&scan_accepted[mode], 1, __ATOMIC_RELAXED);
+                    adv_queue_push(&adv.name, scan_result->scan_rst.bda, scan_result->scan_rst.rssi, scan_result->scan_rst.ble_addr_type);
+                    break;
+                }
+
+                case ESP_GAP_SEARCH_INQ_CMPL_EVT:
+                    __atomic_store_n(&is_scanning, false, __ATOMIC_RELEASE);
+                    break;
+                default:
+                    break;
+            }
+        } break;
+
+        /* The scan has either stopped successfully or failed */
+        case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
+            if (param->scan_stop_cmpl.status != ESP_BT_STATUS_SUCCESS) {
+                LOG_PRINTLN("ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT failed");
+#if SCAN_CONTINUOUS
+                __atomic_store_n(&scan_switching, false, __ATOMIC_RELEASE);
+#endif
+                break;
+            }
+            LOG_PRINTLN("ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT successfully");
+            __atomic_store_n(&is_scanning, false, __ATOMIC_RELEASE);
+#if SCAN_CONTINUOUS
+            /* Scan parameters and the whitelist only change while stopped.
+             * Never blocks: when the wake does not fit the queue, the BLE
+             * task is awake already and finds the flag after its messages. */
+            if (__atomic_exchange_n(&scan_switching, false, __ATOMIC_ACQ_REL)) {
+                ble_msg_t msg = {};
+                msg.type = BLE_MSG_WAKE;
+                __atomic_store_n(&scan_params_pending, true, __ATOMIC_RELEASE);
+                xQueueSend(ble_queue, &msg, 0);
+            }
+#endif
+            break;
+
+        case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* Wake the main loop once the event has been applied. Scan results go to
+ * the BLE task through adv_queue_push instead. */
+void bluetooth_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+    bluetooth_gap_handle(event, param);
+    if (event != ESP_GAP_BLE_SCAN_RESULT_EVT) {
+        events_post(EVENT_BLE);
+    }
+}
+
+/* Events that move a link along or finish a write: losing one leaves the
+ * link stuck. The MTU only ever stays at the default without its event. */
+static bool gattc_event_needed(esp_gattc_cb_event_t event) {
+    switch (event) {
+        case ESP_GATTC_REG_EVT:
+        case ESP_GATTC_OPEN_EVT:
+        case ESP_GATTC_CONNECT_EVT:
+        case ESP_GATTC_DIS_SRVC_CMPL_EVT:
+        case ESP_GATTC_SEARCH_RES_EVT:
+        case ESP_GATTC_SEARCH_CMPL_EVT:
+        case ESP_GATTC_WRITE_CHAR_EVT:
+        case ESP_GATTC_DISCONNECT_EVT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* GATTC events are applied on the BLE task, which owns the links. None of
+ * the events handled carry pointers, so the parameters are copied. A
+ * stalled Bluedroid task stalls the controller, so other events never wait
+ * and leave BLE_GATTC_RESERVED entries free; the events a link needs take
+ * those, and wait BLE_GATTC_WAIT_MS for the BLE task when even they are
+ * gone. Bluedroid is the only producer, the free count cannot shrink
+ * between the check and the send. */
+void bluetooth_gattc_event(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param) {
+    ble_gattc_msg_t msg;
+    msg.event = event;
+    msg.gattc_if = gattc_if;
+    memcpy(&msg.param, param, sizeof(msg.param));
+
+    if (gattc_event_needed(event)) {
+        if (xQueueSend(gattc_queue, &msg, pdMS_TO_TICKS(BLE_GATTC_WAIT_MS)) != pdTRUE) {
+            __atomic_fetch_add(&gattc_lost, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    else if ((uxQueueMessagesWaiting(gattc_queue) >= BLE_GATTC_QUEUE_SIZE - BLE_GATTC_RESERVED) ||
+             (xQueueSend(gattc_queue, &msg, 0) != pdTRUE)) {
+        __atomic_fetch_add(&gattc_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    /* When the wake does not fit, the BLE task has requests to handle and
+     * takes the events after them */
+    ble_msg_t wake = {};
+    wake.type = BLE_MSG_WAKE;
+    xQueueSend(ble_queue, &wake, 0);
+}
+
+void bluetooth_read_tags(uint16_t first, uint8_t rows, tag_view_t *view) {
+    uint32_t seq;
+
+    if (rows > TAG_VIEW_ROWS) {
+        rows = TAG_VIEW_ROWS;
+    }
+
+    do {
+        seq = tag_read_begin();
+        view->count = TAG_LOAD(tag_list.count);
+        view->version = TAG_LOAD(tag_list.version);
+        view->first = first;
+        view->rows = 0;
+
+        for (uint16_t rank = first; (rank < view->count) && (view->rows < rows); rank++) {
+            tag_index_t index = TAG_LOAD(tag_order[rank]);
+            tag_t *tag = &view->tags[view->rows];
+
+            /* Indices can be stale mid-write, the retry catches it */
+            if (index >= MAX_AIRTAG_COUNT) {
+                break;
+            }
+            tag_copy_out(tag->bda, tag_hot[index].bda, sizeof(esp_bd_addr_t));
+            tag->rssi = tag_rssi_dbm(TAG_LOAD(tag_hot[index].rssi));
+            tag->addr_type = (esp_ble_addr_type_t) TAG_LOAD(tag_hot[index].addr_type);
+            tag->last_seen = TAG_LOAD(tag_hot[index].last_seen);
+            tag_copy_out(tag->name, tag_list.names[index], BLE_NAME_MAX_LEN);
+            tag->name[BLE_NAME_MAX_LEN - 1] = '\0';
+            view->rows++;
+        }
+    } while (tag_read_retry(seq));
+}
+
+int bluetooth_find_tag(const uint8_t *bda) {
+    uint32_t seq;
+    int rank;
+
+    do {
+        seq = tag_read_begin();
+        rank = -1;
+
+        /* Same probe as tag_index_find_slot(), bounded since the table may
+         * change under us */
+        uint32_t slot = tag_hash_bda(bda);
+        for (uint32_t probe = 0; probe < TAG_HASH_SIZE; probe++) {
+            tag_index_t index = TAG_LOAD(tag_hash[slot]);
+            esp_bd_addr_t found;
+            if (index >= MAX_AIRTAG_COUNT) {
+                break;
+            }
+            tag_copy_out(found, tag_hot[index].bda, sizeof(esp_bd_addr_t));
+            if (memcmp(found, bda, sizeof(esp_bd_addr_t)) == 0) {
+                rank = TAG_LOAD(tag_rank[index]);
+                break;
+            }
+            slot = (slot + 1) & (TAG_HASH_SIZE - 1);
+        }
+    } while (tag_read_retry(seq));
+
+    return rank;
+}
+
+void bluetooth_dump(void) {
+    uint32_t seq;
+    uint16_t count;
+    uint32_t lookups;
+    uint32_t probes;
+    uint64_t cycles;
+
+    do {
+        seq = tag_read_begin();
+        count = TAG_LOAD(tag_list.count);
+        lookups = TAG_LOAD(tag_lookups);
+        probes = TAG_LOAD(tag_probes);
+        cycles = TAG_LOAD(tag_lookup_cycles);
+    } while (tag_read_retry(seq));
+
+    size_t per_tag = sizeof(tag_hot_t) + sizeof(tag_name_t) +
+                     4 * sizeof(tag_index_t) +                              /* order, rank, LRU links */
+                     (TAG_HASH_SIZE / MAX_AIRTAG_COUNT) * sizeof(tag_index_t);
+
+    LOG_PRINTF("TAGS %u of %u, %u bytes per tag (hot %u, name %u), %u KB total, names in %s\n",
+               count, MAX_AIRTAG_COUNT, (unsigned) per_tag, (unsigned) sizeof(tag_hot_t), (unsigned) sizeof(tag_name_t),
+               (unsigned)(per_tag * MAX_AIRTAG_COUNT) / 1024, tag_names_in_psram ? "PSRAM" : "internal RAM");
+    if (lookups > 0) {
+        LOG_PRINTF("TAGS %u lookups, %u.%02u probes and %u cycles per lookup\n",
+                   lookups, probes / lookups, (probes % lookups) * 100 / lookups,
+                   (uint32_t)(cycles / lookups));
+    }
+
+    static const char *mode_names[SCAN_MODE_COUNT] = { "open", "targeted" };
+    uint8_t mode = __atomic_load_n(&scan_mode, __ATOMIC_RELAXED);
+    for (uint8_t i = 0; i < SCAN_MODE_COUNT; i++) {
+        /* A mode switch in between shifts the current mode's time by one read, no more */
+        uint32_t ms = __atomic_load_n(&scan_mode_ms[i], __ATOMIC_RELAXED) +
+                      ((i == mode) ? ELAPSED_TIME_MS(__atomic_load_n(&scan_mode_since_ms, __ATOMIC_RELAXED)) : 0);
+        uint32_t callbacks = __atomic_load_n(&scan_callbacks[i], __ATOMIC_RELAXED);
+        if (ms == 0) {
+            continue;
+        }
+        LOG_PRINTF("SCAN %-8s %u s, %u callbacks (%u.%u/s), %u from tags%s\n", mode_names[i], ms / 1000,
+                   callbacks, (uint32_t)((uint64_t) callbacks * 1000 / ms), (uint32_t)((uint64_t) callbacks * 10000 / ms % 10),
+                   __atomic_load_n(&scan_accepted[i], __ATOMIC_RELAXED), (i == mode) ? ", current" : "");
+    }
+
+    scan_sched_t scan;
+    bluetooth_get_scan_report(&scan);
+    if (scan.state > SCAN_SCHED_RUNNING) {
+        static const char *results[] = { "", "", "quiet", "target", "timeout" };
+        LOG_PRINTF("SCAN last %u tags complete in %u ms (%s), radio on %u ms\n",
+                   scan.count, scan.complete_ms, results[scan.state], scan_sched_radio_on_ms(&scan));
+    }
+
+    uint32_t dropped = __atomic_load_n(&gattc_dropped, __ATOMIC_RELAXED);
+    uint32_t lost = __atomic_load_n(&gattc_lost, __ATOMIC_RELAXED);
+    if ((dropped > 0) || (lost > 0)) {
+        LOG_PRINTF("QUEUE %u advisory GATTC events dropped, %u link events lost\n", dropped, lost);
+    }
+
+    /* The counters keep moving on the callback task, a count and its cycles
+     * may be one advert apart */
+    adv_reject_stats_t rej;
+    adv_reject_stats_read(&rej);
+    uint32_t filtered = rej.hits + rej.rejects;
+    if (filtered > 0) {
+        uint32_t hit_cycles = rej.hits ? (uint32_t)(rej.hit_cycles / rej.hits) : 0;
+        uint32_t reject_cycles = rej.rejects ? (uint32_t)(rej.reject_cycles / rej.rejects) : 0;
+
+        LOG_PRINTF("REJECT %u of %u foreign adverts from cache (%u%%), %u inserts, %u evictions\n",
+                   rej.hits, filtered, (uint32_t)((uint64_t) rej.hits * 100 / filtered), rej.inserts, rej.evictions);
+        LOG_PRINTF("REJECT %u cycles per hit, %u per parse and reject\n", hit_cycles, reject_cycles);
+        if (reject_cycles > hit_cycles) {
+            LOG_PRINTF("REJECT %u ms of callback time saved\n",
+                       (uint32_t)((uint64_t) rej.hits * (reject_cycles - hit_cycles) / (ESP.getCpuFreqMHz() * 1000)));
+        }
+    }
+}
+
+void bluetooth_get_scan_report(scan_sched_t *report) {
+    uint32_t seq;
+
+    do {
+        seq = tag_read_begin();
+        tag_copy_out(report, &scan_report, sizeof(*report));
+    } while (tag_read_retry(seq));
+}
+
+void bluetooth_get_adv_stats(uint32_t *received, uint32_t *dropped) {
+    *received = __atomic_load_n(&adv_queue_received, __ATOMIC_RELAXED);
+    *dropped = __atomic_load_n(&adv_queue_dropped, __ATOMIC_RELAXED);
+}
+
+#if !SCAN_CONTINUOUS
+static void bluetooth_clear_device_list(void) {
+    tag_write_begin();
+    TAG_STORE(tag_list.count, 0);
+    TAG_STORE(tag_list.version, tag_list.version + 1);
+    tag_index_reset();
+    tag_write_end();
+}
+#endif
+
+static void scan_start(void) {
+#if SCAN_CONTINUOUS
+    /* Tags are kept and aged out, just make sure the radio is scanning */
+    if (__atomic_load_n(&is_scanning, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+#else
+    bluetooth_clear_device_list();
+#endif
+    esp_ble_gap_start_scanning(BLUETOOTH_SCAN_DURATION);
+}
+
+/* A scan asked for by the UI, the scheduler decides when it is complete */
+static void scan_session_start(void) {
+    uint32_t now = CURRENT_TIME_MS();
+
+    scan_start();
+
+    /* With continuous scanning only the window can be changed on the fly */
+    scan_sched_start(&scan_sched, now, tag_list.count, SCAN_CONTINUOUS);
+    tag_write_begin();
+    tag_copy_in(&scan_report, &scan_sched, sizeof(scan_report));
+    tag_write_end();
+}
+
+/* Sampled on every BLE task pass, so a stop and the restart that follows
+ * it are at most one pass off */
+static uint16_t scan_listening_window(void) {
+    return __atomic_load_n(&is_scanning, __ATOMIC_ACQUIRE) ? ble_scan_params.scan_window : 0;
+}
+
+static void scan_sched_tick(void) {
+    uint32_t now = CURRENT_TIME_MS();
+    bool done;
+
+#if SCAN_CONTINUOUS
+    scan_duty_update(&scan_idle_duty, now, tag_list.count);
+#endif
+    if (!scan_sched_is_running(&scan_sched)) {
+        return;
+    }
+
+    scan_sched_update(&scan_sched, now, tag_list.count, scan_listening_window());
+    done = !scan_sched_is_running(&scan_sched);
+    tag_write_begin();
+    tag_copy_in(&scan_report, &scan_sched, sizeof(scan_report));
+    tag_write_end();
+
+    if (done) {
+        LOG_PRINTF("Scan complete, %u tags in %u ms, radio on %u ms\n",
+                   scan_sched.count, scan_sched.complete_ms, scan_sched_radio_on_ms(&scan_sched));
+#if !SCAN_CONTINUOUS
+        /* End a one-shot scan early, the list will not grow anymore */
+        if (__atomic_load_n(&is_scanning, __ATOMIC_ACQUIRE)) {
+            esp_ble_gap_stop_scanning();
+        }
+#endif
+        events_post(EVENT_BLE);
+    }
+}
+
+#if SCAN_CONTINUOUS
+#if BLUETOOTH_SCAN_TARGETED
+/* The controller whitelist takes public and static random addresses only.
+ * Tags seen with a resolvable private address cannot be filtered for. */
+static bool scan_whitelist_type(uint8_t addr_type, esp_ble_wl_addr_type_t *wl_type) {
+    switch (addr_type) {
+        case BLE_ADDR_TYPE_PUBLIC:
+            *wl_type = BLE_WL_ADDR_TYPE_PUBLIC;
+            return true;
+        case BLE_ADDR_TYPE_RANDOM:
+            *wl_type = BLE_WL_ADDR_TYPE_RANDOM;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool scan_whitelist_fits(void) {
+    esp_ble_wl_addr_type_t wl_type;
+
+    if ((tag_list.count == 0) || (tag_list.count > scan_whitelist_size)) {
+        return false;
+    }
+    for (tag_index_t index = tag_lru_head; index != TAG_INDEX_NONE; index = tag_lru_next[index]) {
+        if (!scan_whitelist_type(tag_hot[index].addr_type, &wl_type)) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+/* Targeted scanning only pays off when every known tag fits in the
+ * controller whitelist, anything else is left to open discovery. Scans
+ * asked for by the UI look for new tags, so they stay open. */
+static uint8_t scan_mode_wanted(void) {
+#if BLUETOOTH_SCAN_TARGETED
+    uint32_t elapsed = ELAPSED_TIME_MS(scan_mode_since_ms);
+    bool fits = scan_whitelist_fits();
+
+    if (scan_sched_is_running(&scan_sched)) {
+        return SCAN_MODE_OPEN;
+    }
+    if (scan_mode == SCAN_MODE_OPEN) {
+        return (fits && (elapsed >= SCAN_DISCOVERY_MS)) ? SCAN_MODE_TARGETED : SCAN_MODE_OPEN;
+    }
+    return (fits && (elapsed < SCAN_TARGETED_MS)) ? SCAN_MODE_TARGETED : SCAN_MODE_OPEN;
+#else
+    return SCAN_MODE_OPEN;
+#endif
+}
+
+static uint16_t scan_window_wanted(void) {
+    return scan_sched_is_running(&scan_sched) ? scan_sched.duty.window : scan_idle_duty.window;
+}
+
+#if BLUETOOTH_SCAN_TARGETED
+static uint32_t scan_mode_next_deadline_ms(void) {
+    uint32_t period = (scan_mode == SCAN_MODE_OPEN) ? SCAN_DISCOVERY_MS : SCAN_TARGETED_MS;
+    uint32_t elapsed = ELAPSED_TIME_MS(scan_mode_since_ms);
+
+    if (!__atomic_load_n(&is_scanning, __ATOMIC_ACQUIRE) || __atomic_load_n(&scan_switching, __ATOMIC_ACQUIRE) ||
+        link_any_active()) {
+        return EVENT_WAIT_FOREVER;
+    }
+    if (elapsed < period) {
+        return period - elapsed;
+    }
+    /* Overdue but staying put, a UI scan or the tag count has to change
+     * first and both wake the task anyway. Returning 0 here would spin. */
+    return (scan_mode_wanted() != scan_mode) ? 0 : EVENT_WAIT_FOREVER;
+}
+#endif
+
+/* Stop the scan, new parameters are applied once the controller confirms */
+static void scan_params_update(void) {
+    if (!__atomic_load_n(&is_scanning, __ATOMIC_ACQUIRE) || __atomic_load_n(&scan_switching, __ATOMIC_ACQUIRE) ||
+        link_any_active()) {
+        return;
+    }
+    if ((scan_mode_wanted() != scan_mode) || (scan_window_wanted() != ble_scan_params.scan_window)) {
+        __atomic_store_n(&scan_switching, true, __ATOMIC_RELEASE);
+        esp_ble_gap_stop_scanning();
+    }
+}
+
+static void scan_params_apply(void) {
+    uint8_t mode = scan_mode_wanted();
+
+    /* A connection took the radio meanwhile, try again once it is back */
+    if (link_any_active()) {
+        return;
+    }
+
+#if BLUETOOTH_SCAN_TARGETED
+    if (mode != scan_mode) {
+        if (mode == SCAN_MODE_TARGETED) {
+            uint16_t loaded = 0;
+            esp_ble_wl_addr_type_t wl_type;
+
+            esp_ble_gap_clear_whitelist();
+            for (tag_index_t index = tag_lru_head; (index != TAG_INDEX_NONE) && (loaded < scan_whitelist_size); index = tag_lru_next[index]) {
+                if (scan_whitelist_type(tag_hot[index].addr_type, &wl_type)) {
+                    esp_ble_gap_update_whitelist(true, tag_hot[index].bda, wl_type);
+                    loaded++;
+                }
+            }
+            LOG_PRINTF("Targeted scan, %u tags in whitelist\n", loaded);
+        }
+        else {
+            LOG_PRINTLN("Open discovery scan");
+        }
+
+        __atomic_store_n(&scan_mode_ms[scan_mode], scan_mode_ms[scan_mode] + ELAPSED_TIME_MS(scan_mode_since_ms),
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&scan_mode_since_ms, CURRENT_TIME_MS(), __ATOMIC_RELAXED);
+        __atomic_store_n(&scan_mode, mode, __ATOMIC_RELAXED);
+    }
+#endif
+
+    /* Scanning restarts on ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT */
+    ble_scan_params.scan_filter_policy = (mode == SCAN_MODE_TARGETED) ? BLE_SCAN_FILTER_ALLOW_ONLY_WLST : BLE_SCAN_FILTER_ALLOW_ALL;
+    ble_scan_params.scan_window = scan_window_wanted();
+    esp_ble_gap_set_scan_params(&ble_scan_params);
+}
+#endif
+
+/* Requests are queued, never block the UI on a full queue */
+static bool ble_post(const ble_msg_t *msg) {
+    return xQueueSend(ble_queue, msg, 0) == pdTRUE;
+}
+
+void bluetooth_start_scanning(void) {
+    ble_msg_t msg = {};
+    msg.type = BLE_MSG_SCAN;
+    ble_post(&msg);
+}
+
+int bluetooth_link_open(esp_bd_addr_t mac, esp_ble_addr_type_t addr_type) {
+    int id = BLUETOOTH_LINK_NONE;
+
+    for (int i = 0; i < BLE_MAX_LINKS; i++) {
+        uint8_t state = link_state(&links[i]);
+        if ((state != LINK_IDLE) && (memcmp(link_bda[i], mac, sizeof(esp_bd_addr_t)) == 0)) {
+            /* Already open or on its way */
+            return i;
+        }
+        if ((id == BLUETOOTH_LINK_NONE) && (state == LINK_IDLE)) {
+            id = i;
+        }
+    }
+    if (id == BLUETOOTH_LINK_NONE) {
+        LOG_PRINTLN("No free link");
+        return BLUETOOTH_LINK_NONE;
+    }
+
+    /* Only the UI takes idle slots, so the claim holds. The BLE task
+     * ignores a claimed slot until the request sets it up. */
+    uint8_t expected = LINK_IDLE;
+    __atomic_compare_exchange_n(&links[id].state, &expected, (uint8_t)LINK_CLAIMED, false,
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+
+    ble_msg_t msg = {};
+    msg.type = BLE_MSG_OPEN;
+    msg.link = id;
+    msg.gen = link_gen[id] + 1;
+    msg.addr_type = addr_type;
+    memcpy(msg.bda, mac, sizeof(esp_bd_addr_t));
+    if (!ble_post(&msg)) {
+        LOG_PRINTLN("BLE request queue full");
+        link_set_state(&links[id], LINK_IDLE);
+        return BLUETOOTH_LINK_NONE;
+    }
+    link_gen[id] = msg.gen;
+    memcpy(link_bda[id], mac, sizeof(esp_bd_addr_t));
+    trace_event(TRACE_LINK_REQUEST, id);
+    return id;
+}
+
+void bluetooth_link_close(int link) {
+    if ((link < 0) || (link >= BLE_MAX_LINKS)) {
+        return;
+    }
+
+    /* The slot may be taken again before the BLE task gets to this, the
+     * generation tells the new link from the one being closed */
+    ble_msg_t msg = {};
+    msg.type = BLE_MSG_CLOSE;
+    msg.link = link;
+    msg.gen = link_gen[link];
+    ble_post(&msg);
+}
+
+bool bluetooth_link_is_ready(int link) {
+    return (link >= 0) && (link < BLE_MAX_LINKS) &&
+           (link_state(&links[link]) == LINK_READY);
+}
+
+/* A full command queue or a command above the MTU is reported later
+ * through bluetooth_link_take_error() */
+bool bluetooth_link_send(int link, const char *cmd) {
+    size_t length = strlen(cmd);
+    if ((link < 0) || (link >= BLE_MAX_LINKS) || (length > BLE_CMD_MAX_LEN) ||
+        (link_state(&links[link]) < LINK_DISCOVERING)) {
+        return false;
+    }
+
+    ble_msg_t msg = {};
+    msg.type = BLE_MSG_SEND;
+    msg.link = link;
+    memcpy(msg.cmd.data, cmd, length);
+    msg.cmd.len = length;
+    if (!ble_post(&msg)) {
+        LOG_PRINTLN("BLE request queue full");
+        return false;
+    }
+
+    LOG_PRINT("BLE queued "); LOG_PRINTLN(cmd);
+    return true;
+}
+
+bool bluetooth_link_take_error(int link) {
+    if ((link < 0) || (link >= BLE_MAX_LINKS)) {
+        return false;
+    }
+    return __atomic_exchange_n(&links[link].cmd_failed, false, __ATOMIC_RELAXED);
+}
+
+uint32_t bluetooth_link_get_latency(int link, uint32_t *max_ms) {
+    if ((link < 0) || (link >= BLE_MAX_LINKS)) {
+        return 0;
+    }
+    if (max_ms) {
+        *max_ms = __atomic_load_n(&links[link].cmd_max_latency_ms, __ATOMIC_RELAXED);
+    }
+    return __atomic_load_n(&links[link].cmd_latency_ms, __ATOMIC_RELAXED);
+}
+
+void bluetooth_airtag_connect(esp_bd_addr_t mac, esp_ble_addr_type_t addr_type) {
+    /* The single-device UI talks to one tag at a time */
+    if ((current_link != BLUETOOTH_LINK_NONE) &&
+        (memcmp(link_bda[current_link], mac, sizeof(esp_bd_addr_t)) != 0)) {
+        bluetooth_link_close(current_link);
+    }
+    current_link = bluetooth_link_open(mac, addr_type);
+}
+
+void bluetooth_disconnect(void) {
+    bluetooth_link_close(current_link);
+    current_link = BLUETOOTH_LINK_NONE;
+}
+
+bool bluetooth_send_command(const char *cmd) {
+    return bluetooth_link_send(current_link, cmd);
+}
+
+bool bluetooth_take_command_error(void) {
+    return bluetooth_link_take_error(current_link);
+}
+
+bool bluetooth_is_connected(void) {
+    return bluetooth_link_is_ready(current_link);
+}
+
+/* BLE task side of the requests above */
+static void link_request_open(const ble_msg_t *msg) {
+    ble_link_t *link = &links[msg->link];
+
+    if (link_state(link) != LINK_CLAIMED) {
+        return;
+    }
+
+    /* Field by field, the UI may read cmd_failed and the latencies meanwhile */
+    link->gen = msg->gen;
+    link->addr_type = (esp_ble_addr_type_t)msg->addr_type;
+    memcpy(link->bda, msg->bda, sizeof(esp_bd_addr_t));
+    link->conn_id = 0;
+    link->mtu = BLE_DEFAULT_MTU;
+    link->service_start_handle = 0;
+    link->service_end_handle = 0;
+    link->nus_handler = 0;
+    link->has_service = false;
+    link->write_no_rsp = false;
+    link->from_cache = false;
+    link->cache_assoc = false;
+    link->close_pending = false;
+    link_reset_commands(link);
+    link->cmd_sent_ms = 0;
+    __atomic_store_n(&link->cmd_failed, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&link->cmd_latency_ms, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&link->cmd_max_latency_ms, 0, __ATOMIC_RELAXED);
+    link_set_state(link, LINK_PENDING);
+
+    /* The radio is needed for connecting */
+#if SCAN_CONTINUOUS
+    __atomic_store_n(&scan_switching, false, __ATOMIC_RELEASE);
+#endif
+    esp_ble_gap_stop_scanning();
+    __atomic_store_n(&is_scanning, false, __ATOMIC_RELEASE);
+    link_open_next();
+}
+
+static void link_request_close(ble_link_t *link, uint8_t gen) {
+    if (link->gen != gen) {
+        return;     /* Closed and taken again since */
+    }
+    uint8_t state = link_state(link);
+    if (state >= LINK_DISCOVERING) {
+        esp_ble_gattc_close(gl_profile_tab[PROFILE_A_APP_ID].gattc_if, link->conn_id);
+    }
+    else if (state == LINK_PENDING) {
+        link_set_state(link, LINK_IDLE);
+    }
+    else if (state == LINK_OPENING) {
+        /* Cannot be cancelled, closed by link_connected() when it comes up */
+        link->close_pending = true;
+    }
+}
+
+static void link_request_send(ble_link_t *link, const ble_command_t *cmd) {
+    if ((link_state(link) < LINK_DISCOVERING) || (cmd->len > link->mtu - BLE_ATT_HEADER_LEN)) {
+        LOG_PRINTLN("Command dropped, link down or above MTU");
+        link_set_failed(link);
+        return;
+    }
+    if ((uint8_t)(link->cmd_head - link->cmd_tail) >= BLE_CMD_QUEUE_SIZE) {
+        LOG_PRINTLN("Command queue full");
+        link_set_failed(link);
+        return;
+    }
+
+    memcpy(&link->cmds[link->cmd_head % BLE_CMD_QUEUE_SIZE], cmd, sizeof(*cmd));
+    link->cmd_head++;
+    link_pump_commands(link);
+}
+
+static void ble_handle_msg(const ble_msg_t *msg) {
+    switch (msg->type) {
+        case BLE_MSG_SCAN:
+            scan_session_start();
+            break;
+        case BLE_MSG_OPEN:
+            link_request_open(msg);
+            break;
+        case BLE_MSG_CLOSE:
+            link_request_close(&links[msg->link], msg->gen);
+            break;
+        case BLE_MSG_SEND:
+            link_request_send(&links[msg->link], &msg->cmd);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Applies every GATTC event queued so far, then wakes the UI once */
+static void ble_handle_gattc(void) {
+    ble_gattc_msg_t msg;
+
+    if (uxQueueMessagesWaiting(gattc_queue) == 0) {
+        return;
+    }
+    while (xQueueReceive(gattc_queue, &msg, 0) == pdTRUE) {
+        bluetooth_gattc_handle(msg.event, msg.gattc_if, &msg.param);
+    }
+    events_post(EVENT_BLE);
+}
+
+static uint32_t bluetooth_next_deadline_ms(void) {
+    if ((__atomic_load_n(&adv_queue_head, __ATOMIC_ACQUIRE) != adv_queue_tail) ||
+        (uxQueueMessagesWaiting(gattc_queue) > 0)) {
+        return 0;
+    }
+#if SCAN_CONTINUOUS
+    if (__atomic_load_n(&scan_params_pending, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+#endif
+
+    uint32_t timeout = EVENT_WAIT_FOREVER;
+#if SCAN_CONTINUOUS
+    if (__atomic_load_n(&is_scanning, __ATOMIC_ACQUIRE) && (tag_lru_tail != TAG_INDEX_NONE)) {
+        uint32_t age = ELAPSED_TIME_MS(tag_hot[tag_lru_tail].last_seen);
+        timeout = (age < TAG_EXPIRE_MS) ? TAG_EXPIRE_MS - age : 0;
+    }
+#endif
+    uint32_t deadline = scan_sched_next_deadline_ms(&scan_sched, CURRENT_TIME_MS());
+    if (deadline < timeout) timeout = deadline;
+#if SCAN_CONTINUOUS
+    deadline = scan_duty_next_deadline_ms(&scan_idle_duty, CURRENT_TIME_MS());
+    if (deadline < timeout) timeout = deadline;
+#endif
+#if BLUETOOTH_SCAN_TARGETED
+    deadline = scan_mode_next_deadline_ms();
+    if (deadline < timeout) timeout = deadline;
+#endif
+    return timeout;
+}
+
+static void bluetooth_ingest(void) {
+#if SCAN_CONTINUOUS
+    /* Only age tags while we can actually hear them. This task is the only
+     * writer of tag_list, so it reads it without a write section. */
+    if (__atomic_load_n(&is_scanning, __ATOMIC_ACQUIRE) && (tag_lru_tail != TAG_INDEX_NONE) &&
+        (ELAPSED_TIME_MS(tag_hot[tag_lru_tail].last_seen) >= TAG_EXPIRE_MS)) {
+        tag_write_begin();
+        int removed = tag_list_expire(CURRENT_TIME_MS());
+        tag_write_end();
+        LOG_PRINTF("Removed %d expired devices\n", removed);
+    }
+#endif
+
+    uint32_t tail = adv_queue_tail;
+    uint32_t head = adv_queue_peek(ADV_DRAIN_BATCH);
+    if (head == tail) {
+        return;
+    }
+
+    /* Drain a bounded batch in a single write section */
+    tag_write_begin();
+    while (tail != head) {
+        bluetooth_add_device(adv_queue_at(tail));
+        tail++;
+    }
+    tag_write_end();
+
+    adv_queue_release(tail);
+}
+
+/* Pinned next to Bluedroid, so advert processing never waits for a display
+ * flush on the loop core */
+static void ble_task(void *arg) {
+    uint16_t version = tag_list.version;
+    uint16_t count = tag_list.count;
+    ble_msg_t msg;
+
+    for (;;) {
+        uint32_t timeout = bluetooth_next_deadline_ms();
+        TickType_t ticks = (timeout == EVENT_WAIT_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout);
+
+        if (xQueueReceive(ble_queue, &msg, ticks) == pdTRUE) {
+            ble_handle_msg(&msg);
+        }
+        ble_handle_gattc();
+        bluetooth_ingest();
+        scan_sched_tick();
+#if SCAN_CONTINUOUS
+        if (__atomic_exchange_n(&scan_params_pending, false, __ATOMIC_ACQ_REL)) {
+            scan_params_apply();
+        }
+        scan_params_update();
+#endif
+
+        /* Wake the UI only for changes it shows */
+        if ((tag_list.version != version) || (tag_list.count != count)) {
+            version = tag_list.version;
+            count = tag_list.count;
+            events_post(EVENT_BLE);
+        }
+    }
+}
+
+static void tag_store_init(void) {
+    size_t size = MAX_AIRTAG_COUNT * sizeof(tag_name_t);
+
+#if TAG_NAMES_IN_PSRAM
+    tag_list.names = (tag_name_t *) heap_caps_calloc(1, size, MALLOC_CAP_SPIRAM);
+    tag_names_in_psram = (tag_list.names != NULL);
+#endif
+    if (tag_list.names == NULL) {
+        tag_list.names = (tag_name_t *) heap_caps_calloc(1, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (tag_list.names == NULL) {
+        LOG_PRINTLN("Tag store allocation failed");
+        while (true) {
+            DELAY_MS(10);
+        }
+    }
+
+    tag_index_reset();
+}
+
+void bluetooth_init(void) {
+    esp_err_t ret;
+    tag_store_init();
+#if SCAN_CONTINUOUS
+    scan_duty_start(&scan_idle_duty, CURRENT_TIME_MS(), 0, SCAN_WINDOW, SCAN_IDLE_WINDOW_MIN);
+#endif
+
+    /* Bluedroid starts delivering events during the registrations below */
+    ble_queue = xQueueCreate(BLE_TASK_QUEUE_SIZE, sizeof(ble_msg_t));
+    gattc_queue = xQueueCreate(BLE_GATTC_QUEUE_SIZE, sizeof(ble_gattc_msg_t));
+    xTaskCreatePinnedToCore(ble_task, "ble", BLE_TASK_STACK, NULL, BLE_TASK_PRIORITY, &ble_task_handle, BLE_TASK_CORE);
+
+    /* Controller and Bluedroid only, the Arduino BLE classes are not used */
+    btStart();
+    if ((esp_bluedroid_init() != ESP_OK) || (esp_bluedroid_enable() != ESP_OK)) {
+        LOG_PRINTLN("Bluedroid start failed");
+        return;
+    }
+    esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_DEFAULT, ESP_PWR_LVL_P9);
+
+    /* Register the callback function to the gap module */
+    ret = esp_ble_gap_register_callback(bluetooth_gap_event);
+    if (ret) {
+        LOG_PRINTLN("esp_ble_gap_register_callback failed");
+    }
+
+    ret = esp_ble_gattc_register_callback(bluetooth_gattc_event);
+    if(ret){
+        LOG_PRINTLN("esp_ble_gattc_register_callback failed");
+        return;
+    }
+
+    ret = esp_ble_gattc_app_register(PROFILE_A_APP_ID);
+    if (ret){
+        LOG_PRINTLN("esp_ble_gattc_app_register failed");
+    }
+
+    gatt_cache_init();
+
+    ret = esp_ble_gatt_set_local_mtu(BLE_LOCAL_MTU);
+    if (ret) {
+        LOG_PRINTLN("esp_ble_gatt_set_local_mtu failed");
+    }
+
+#if BLUETOOTH_SCAN_TARGETED
+    uint16_t whitelist_size = 0;
+    if ((esp_ble_gap_get_whitelist_size(&whitelist_size) == ESP_OK) && (whitelist_size < scan_whitelist_size)) {
+        scan_whitelist_size = whitelist_size;
+    }
+#endif
+    scan_mode_since_ms = CURRENT_TIME_MS();
+
+    /* Set scanning params */
+    ret = esp_ble_gap_set_scan_params(&ble_scan_params);
+    if (ret) {
+        LOG_PRINTLN("esp_ble_gap_set_scan_params failed");
+    }
 }
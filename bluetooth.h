@@ -1,10 +1,8 @@
 #pragma once
 
-#include <esp_bt.h>
-#include <esp_bt_main.h>
 #include <esp_gap_ble_api.h>
-#include <BLEDevice.h>
-#include <BLEUtils.h>
+#include <esp_gattc_api.h>
+#include "scan_sched.h"
 
 #define BLE_NAME_MAX_LEN 16
 
@@ -16,17 +14,45 @@ typedef struct {
     uint32_t last_seen;
 } tag_t;
 
+#define TAG_VIEW_ROWS 8
+
+/* Consistent copy of a window of the tag list, in display order */
 typedef struct {
-    tag_t tags[MAX_AIRTAG_COUNT];
-    uint8_t count;
-} tag_scan_t;
+    uint16_t count;      /* Whole list */
+    uint16_t version;    /* Bumped whenever tags are added, removed or reordered */
+    uint16_t first;      /* Rank of tags[0] */
+    uint8_t rows;        /* Filled entries of tags[] */
+    tag_t tags[TAG_VIEW_ROWS];
+} tag_view_t;
+
+/* Bluedroid callbacks, also the entry points for replaying recorded events.
+ * Scanning, links and tag_list are owned by the BLE task; the calls below
+ * only queue requests or read published state. */
+void bluetooth_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+void bluetooth_gattc_event(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param);
 
-tag_scan_t *bluetooth_get_tag_list(void);
-void bluetooth_release_tag_list(void);
+/* Tag list reads never block the BLE task, they copy and retry when a
+ * write overlapped */
+void bluetooth_read_tags(uint16_t first, uint8_t rows, tag_view_t *view);  /* Up to TAG_VIEW_ROWS from rank first */
+int bluetooth_find_tag(const uint8_t *bda);     /* Current rank, -1 if gone */
 void bluetooth_start_scanning(void);
+void bluetooth_get_scan_report(scan_sched_t *report);  /* Scan started by bluetooth_start_scanning */
+/* Several tags can be connected at once, up to BLE_MAX_LINKS */
+#define BLUETOOTH_LINK_NONE  -1
+int bluetooth_link_open(esp_bd_addr_t mac, esp_ble_addr_type_t addr_type);
+void bluetooth_link_close(int link);
+bool bluetooth_link_is_ready(int link);
+bool bluetooth_link_send(int link, const char *cmd);            /* Queued, completes asynchronously */
+bool bluetooth_link_take_error(int link);                       /* A queued command failed since last call */
+uint32_t bluetooth_link_get_latency(int link, uint32_t *max_ms); /* Last command round trip */
+
+/* Single-device API used by the UI, backed by one of the links */
 void bluetooth_airtag_connect(esp_bd_addr_t mac, esp_ble_addr_type_t addr_type);
 void bluetooth_disconnect(void);
 
 bool bluetooth_send_command(const char *cmd);
+bool bluetooth_take_command_error(void);
 bool bluetooth_is_connected(void);
-void bluetooth_init(void);
+void bluetooth_get_adv_stats(uint32_t *received, uint32_t *dropped);
+void bluetooth_dump(void);      /* Tag store size and lookup cost */
+void bluetooth_init(void);      /* Starts the BLE task */
@@ -4,10 +4,49 @@
 #include <Adafruit_SSD1306.h>
 #include "app_config.h"
 #include "display.h"
+#include "events.h"
+#include "framebuffer.h"
+#include "menu.h"
+
+#define DISPLAY_I2C_ADDR      0x3C
+#define DISPLAY_PAGES         FB_PAGES
+#define DISPLAY_BUFFER_SIZE   FB_SIZE
+#define DISPLAY_I2C_CHUNK     64      /* Data bytes per I2C transaction, below the Wire buffer size */
+
+static_assert(MAX_LINES - 1 <= TAG_VIEW_ROWS, "Device list rows must fit in one tag view");
 
 typedef void (*screen_draw_t)(system_status_t *status);
 
+typedef struct {
+    uint8_t screen_id;
+    uint8_t selected_index;
+    uint16_t selected_device;
+    uint16_t device_count;
+    int state;              /* Screen specific value: GPIO state, delay or error */
+    uint32_t seconds;       /* Time shown on screen, 0 if none */
+} display_view_t;
+
+/* Frames are drawn into the Adafruit buffer (back) by the loop, copied to the
+ * front buffer and pushed by the display task, which alone uses Wire after
+ * init. */
 Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
+static uint8_t front_buffer[DISPLAY_BUFFER_SIZE];
+static TaskHandle_t display_task_handle;
+static bool flush_busy = false;     /* Front buffer owned by the display task */
+static bool frame_pending = false;  /* Back buffer holds a frame not yet handed over */
+static bool frame_shown = false;    /* Set by the task, taken by the loop */
+
+/* Written by the display task only. display_dump() reads the counters from
+ * the loop task, each atomically so a 64-bit one is never half updated. */
+static uint8_t panel_shadow[DISPLAY_BUFFER_SIZE];   /* What the panel currently shows */
+static uint32_t bytes_sent = 0;
+static uint32_t bytes_per_second = 0;
+static uint32_t bytes_window_ms = 0;
+static uint32_t transfer_count = 0;
+static uint32_t transfer_last_us = 0;
+static uint32_t transfer_max_us = 0;
+static uint64_t transfer_total_us = 0;
+
 static const char *error_names[ERROR_COUNT] = {
     "ERROR_NONE",
     "ERROR_BLE_CONNECT",
@@ -15,6 +54,50 @@ static const char *error_names[ERROR_COUNT] = {
     "ERROR_BLE_READ",
 };
 
+/* Glyph cache: the built-in 5x7 font, one byte per column with the bit per
+ * row, which is the SSD1306 page layout. Built through drawChar at init. */
+#define GLYPH_FIRST     ' '
+#define GLYPH_LAST      '~'
+#define GLYPH_WIDTH     6       /* 5 columns plus spacing */
+#define GLYPH_COUNT     (GLYPH_LAST - GLYPH_FIRST + 1)
+#define TEXT_MAX_CHARS  (SCREEN_WIDTH / GLYPH_WIDTH)
+
+static uint8_t glyph_cache[GLYPH_COUNT][GLYPH_WIDTH];
+
+/* Static parts of every screen, drawn once by the template functions */
+static uint8_t screen_templates[SCREEN_COUNT][DISPLAY_BUFFER_SIZE];
+
+static void display_build_glyphs(void) {
+    uint8_t *buffer = display.getBuffer();
+
+    for (int c = GLYPH_FIRST; c <= GLYPH_LAST; c++) {
+        display.drawChar(0, 0, c, WHITE, BLACK, 1);
+        memcpy(glyph_cache[c - GLYPH_FIRST], buffer, GLYPH_WIDTH);
+    }
+}
+
+/* Opaque size 1 text from the glyph cache, clipped at the right edge */
+static void display_text(uint8_t x, uint8_t y, const char *text) {
+    uint8_t cols[TEXT_MAX_CHARS * GLYPH_WIDTH];
+    uint8_t width = 0;
+
+    for (; *text && (x + width + GLYPH_WIDTH <= SCREEN_WIDTH); text++) {
+        uint8_t c = *text;
+        if ((c < GLYPH_FIRST) || (c > GLYPH_LAST)) {
+            c = '?';
+        }
+        for (uint8_t col = 0; col < GLYPH_WIDTH; col++) {
+            cols[width++] = glyph_cache[c - GLYPH_FIRST][col];
+        }
+    }
+    fb_blit_strip(display.getBuffer(), x, y, cols, width);
+}
+
+/* Selection bar: the text row at y inverted across the whole width */
+static void display_highlight_row(int16_t y) {
+    fb_invert_rows(display.getBuffer(), y, 8);
+}
+
 static void display_draw_title(const char *text) {
     display.setTextSize(1);
     display.setTextColor(WHITE, BLACK);
@@ -22,256 +105,422 @@ static void display_draw_title(const char *text) {
     display.println(text);
 }
 
-static void display_draw_ping_screen(system_status_t *status) {
-    display_draw_title("Ping");
-    display.setTextSize(1);
-    display.setTextColor(WHITE, BLACK);
-    display.setCursor(0, 14);
-    display.println("Devices");
-    display.setTextColor(WHITE, BLACK);
-    display.setCursor(0, 26);
-    display.println("Select = Ping");
-    if (status->last_ping_ms > 0) {
-        display.setCursor(0, 38);
-        display.print(status->last_device_count);
-        display.print(" found ");
-        display.print((CURRENT_TIME_MS() - status->last_ping_ms) / 1000);
-        display.print("s ago");
+static uint32_t display_ping_age(const system_status_t *status) {
+    if (status->last_ping_ms == 0) {
+        return 0;
     }
+    return (CURRENT_TIME_MS() - status->last_ping_ms) / 1000;
 }
 
-static void display_draw_scanning_screen(system_status_t *status) {
+static int display_scan_timeout(const system_status_t *status) {
     int timeout = (CURRENT_TIME_MS() - status->start_scanning_ms) / 1000;
     timeout = GAP_SCAN_DURATION - timeout;
     if (timeout < 1) {
         timeout = 1;
     }
+    return timeout;
+}
 
-    display_draw_title("Scanning...");
-    display.setTextSize(1);
-    display.setTextColor(WHITE, BLACK);
-    display.setCursor(0, 14);
-    display.print("Timeout ");
-    display.print(timeout);
-    display.println(timeout > 1 ? " seconds" : " second");
-    display.setCursor(0, 26);
-    display.print("Found ");
-    display.print(status->device_count);
-    display.print(status->device_count > 1 ? " devices" : " device");
+/* Time until a shown second count changes, from the given start */
+static uint32_t display_next_second(uint32_t start_ms) {
+    return 1000 - (CURRENT_TIME_MS() - start_ms) % 1000;
+}
+
+/* Per frame content that the menu table cannot describe */
+static void display_draw_ping_screen(system_status_t *status) {
+    char line[TEXT_MAX_CHARS + 1];
+
+    if (status->last_ping_ms > 0) {
+        /* Clamped to fit the row, 19 characters at most */
+        uint16_t count = (status->last_device_count < 9999) ? status->last_device_count : 9999;
+        uint32_t age = display_ping_age(status);
+        snprintf(line, sizeof(line), "%u found %us ago", count, (age < 999) ? age : 999);
+        display_text(0, 38, line);
+    }
+}
+
+static void display_draw_scanning_screen(system_status_t *status) {
+    char line[TEXT_MAX_CHARS + 1];
+    int timeout = display_scan_timeout(status);
+
+    snprintf(line, sizeof(line), "Timeout %d %s", timeout, timeout > 1 ? "seconds" : "second");
+    display_text(0, 14, line);
+    snprintf(line, sizeof(line), "Found %d %s", status->device_count, status->device_count > 1 ? "devices" : "device");
+    display_text(0, 26, line);
+    snprintf(line, sizeof(line), "Radio %u%%", status->scan_duty);
+    display_text(0, 38, line);
 }
 
 static void display_draw_device_list_screen(system_status_t *status) {
-    char title[32];
-    sprintf(title, "Devices (%d)", status->device_count);
-    display_draw_title(title);
-    display.setTextSize(1);
-    display.setTextColor(WHITE, BLACK);
-    display.setCursor(0, 14);
-    display.println("Pick a device");
+    char line[TEXT_MAX_CHARS + 1];
+    if (status->device_count > status->list_rows) {
+        snprintf(line, sizeof(line), "Dev %u-%u/%u", status->list_start + 1,
+                 status->list_start + status->list_rows, status->device_count);
+    }
+    else {
+        snprintf(line, sizeof(line), "Devices (%d)", status->device_count);
+    }
+    display_text(0, 0, line);
 
+    /* One snapshot for all rows, the list may change while drawing */
+    tag_view_t view;
+    bluetooth_read_tags(status->list_start, status->list_rows, &view);
     int y = 24;
-    for (int i = 0; i < MAX_LINES; i++) {
-        if (i == status->selected_index) {
-            display.setTextColor(BLACK, WHITE);
-            display.setCursor(0, y);
-            display.println(status->names[i]);
-            display.setTextColor(WHITE, BLACK);
+    for (uint8_t i = 0; i <= status->list_rows; i++) {
+        if (i == status->list_rows) {
+            snprintf(line, sizeof(line), "  [ Back ]");
+        }
+        else if (i < view.rows) {
+            snprintf(line, sizeof(line), "  %d. %s", view.first + i + 1, view.tags[i].name);
         }
         else {
-            display.setCursor(0, y);
-            if (strlen(status->names[i]) > 1) {
-                display.println(status->names[i]);
-            }
-            else {
-                break;
-            }
+            continue;
         }
-        y += 8;
-    }
-}
-
-static void display_draw_actions_screen(system_status_t *status) {
-    display_draw_title("Actions");
-    display.setTextSize(1);
-    display.setTextColor(WHITE, BLACK);
-    display.setCursor(0, 14);
-    display.print("Device: ");
-    display.println(status->selected_tag.name);
 
-    const char *options[3] = {"  GPIO", "  BLE", "  [ Back ]"};
-    int y = 24;
-    for (uint8_t i = 0; i < 3; i++) {
+        display_text(0, y, line);
         if (i == status->selected_index) {
-            display.setTextColor(BLACK, WHITE);
-            display.setCursor(0, y);
-            display.println(options[i]);
-            display.setTextColor(WHITE, BLACK);
-        } else {
-            display.setCursor(0, y);
-            display.println(options[i]);
+            display_highlight_row(y);
         }
         y += 8;
     }
 }
 
 static void display_draw_control_gpio_screen(system_status_t *status) {
-    display_draw_title("GPIO");
-    display.setTextSize(1);
-    display.setTextColor(WHITE, BLACK);
-    display.setCursor(0, 14);
-    display.print("Device: ");
-    display.println(status->selected_tag.name);
-
-    display.setCursor(0, 22);
-    display.print("State: ");
-    display.println(status->gpio_state == 1 ? "ON" : "OFF");
-
-    const char *options[3] = {"  OFF", "  ON", "  [ Back ]"};
-    int y = 32;
-    for (int i = 0; i < 3; i++) {
-        if (i == status->selected_index) {
-            display.setTextColor(BLACK, WHITE);
-            display.setCursor(0, y);
-            display.println(options[i]);
-            display.setTextColor(WHITE, BLACK);
-        }
-        else {
-            display.setCursor(0, y);
-            display.println(options[i]);
-        }
-        y += 8;
-    }
+    display_text(0, 22, status->gpio_state == 1 ? "State: ON" : "State: OFF");
 }
 
 static void display_draw_control_ble_screen(system_status_t *status) {
-    display_draw_title("BLE");
-    display.setTextSize(1);
-    display.setTextColor(WHITE, BLACK);
-    display.setCursor(0, 14);
-    display.print("Device: ");
-    display.println(status->selected_tag.name);
+    char line[TEXT_MAX_CHARS + 1];
 
-    display.setCursor(0, 22);
     if (status->ble_delay < 0) {
-        display.print("State: OFF");
+        snprintf(line, sizeof(line), "State: OFF");
     }
     else if (status->ble_delay == 0) {
-        display.print("State: ON immediately");
+        snprintf(line, sizeof(line), "State: ON immediately");
     }
     else {
-        char state_buf[32];
-        sprintf(state_buf, "State: ON delay %dm", status->ble_delay);
-        display.println(state_buf);
-    }
-
-    const char *options[4] = {"  OFF", "  ON", "  ON w/Delay", "  [ Back ]"};
-    int y = 32;
-    for (int i = 0; i < 4; i++) {
-        if (i == status->selected_index) {
-            display.setTextColor(BLACK, WHITE);
-            display.setCursor(0, y);
-            display.println(options[i]);
-            display.setTextColor(WHITE, BLACK);
-        }
-        else {
-            display.setCursor(0, y);
-            display.println(options[i]);
-        }
-        y += 8;
+        /* Clamped to fit the row, up to 9999 minutes */
+        snprintf(line, sizeof(line), "State: ON delay %dm", (status->ble_delay < 9999) ? status->ble_delay : 9999);
     }
+    display_text(0, 22, line);
 }
 
 static void display_draw_set_delay_screen(system_status_t *status) {
-    display_draw_title("DELAY (minutes)");
-    display.setTextSize(1);
-    display.setTextColor(WHITE, BLACK);
-    display.setCursor(0, 12);
-    display.println("Pick digit, Up/Down +/-");
-
-    int tensH = (status->set_ble_delay / 60) / 10;
-    int onesH = (status->set_ble_delay / 60) % 10;
-    int tensM = (status->set_ble_delay % 60) / 10;
-    int onesM = (status->set_ble_delay % 60) % 10;
+    /* Double size digits are rare enough to go through Adafruit_GFX */
+    static const int16_t digit_x[4] = {8, 24, 50, 66};
+    int digits[4] = {
+        (status->set_ble_delay / 60) / 10,
+        (status->set_ble_delay / 60) % 10,
+        (status->set_ble_delay % 60) / 10,
+        (status->set_ble_delay % 60) % 10,
+    };
 
     display.setTextSize(2);
-    display.setCursor(8, 26);
-    display.setTextColor(status->selected_index == 0 ? BLACK : WHITE, status->selected_index == 0 ? WHITE : BLACK);
-    display.print(tensH);
-
-    display.setTextColor(status->selected_index == 1 ? BLACK : WHITE, status->selected_index == 1 ? WHITE : BLACK);
-    display.setCursor(24, 26);
-    display.print(onesH);
-
-    display.setTextColor(WHITE, BLACK);
-    display.setCursor(40, 26);
-    display.print(":");
-
-    display.setTextColor(status->selected_index == 2 ? BLACK : WHITE, status->selected_index == 2 ? WHITE : BLACK);
-    display.setCursor(50, 26);
-    display.print(tensM);
-
-    display.setTextColor(status->selected_index == 3 ? BLACK : WHITE, status->selected_index == 3 ? WHITE : BLACK);
-    display.setCursor(66, 26);
-    display.print(onesM);
-
+    for (uint8_t i = 0; i < 4; i++) {
+        bool selected = (status->selected_index == i);
+        display.setTextColor(selected ? BLACK : WHITE, selected ? WHITE : BLACK);
+        display.setCursor(digit_x[i], 26);
+        display.print(digits[i]);
+    }
     display.setTextSize(1);
-    display.setCursor(0, 44);
-    display.setTextColor(status->selected_index == 4 ? BLACK : WHITE, status->selected_index == 4 ? WHITE : BLACK);
-    display.println("   [ OK ]");
-    display.setCursor(0, 52);
-    display.setTextColor(status->selected_index == 5 ? BLACK : WHITE, status->selected_index == 5 ? WHITE : BLACK);
-    display.println("   [ Back ]");
+    display.setTextColor(WHITE, BLACK);
 }
 
 static void display_draw_error_screen(system_status_t *status) {
-    if (status->error < ERROR_COUNT) {
-        display_draw_title("ERROR");
-        display.setTextSize(1);
-        display.setTextColor(WHITE, BLACK);
-        display.setCursor(0, 14);
-        display.println("Error: ");
-        display.print("    ");
-        display.println(error_names[status->error]);
+    char line[TEXT_MAX_CHARS + 1];
 
-        display.setTextColor(BLACK, WHITE);
-        display.setCursor(0, 32);
-        display.println("  [ Back ]");
-        display.setTextColor(WHITE, BLACK);
+    if (status->error < ERROR_COUNT) {
+        snprintf(line, sizeof(line), "    %s", error_names[status->error]);
+        display_text(0, 22, line);
     }
 }
 
-screen_draw_t screen_draws[SCREEN_COUNT] = {
+static const screen_draw_t screen_draws[SCREEN_COUNT] = {
     display_draw_ping_screen,
     display_draw_scanning_screen,
     display_draw_device_list_screen,
-    display_draw_actions_screen,
+    NULL,
     display_draw_control_gpio_screen,
     display_draw_control_ble_screen,
     display_draw_set_delay_screen,
     display_draw_error_screen,
 };
 
-void display_loop(system_status_t *status) {
-    static uint32_t last_update_ms = 0;
+/* Everything static in a screen comes from its menu table entry, drawn
+ * once through Adafruit_GFX */
+static void display_build_template(const menu_screen_t *screen) {
+    if (screen->title != NULL) {
+        display_draw_title(screen->title);
+    }
+    for (uint8_t i = 0; i < screen->label_count; i++) {
+        const menu_label_t *label = &screen->labels[i];
+        display.setTextSize(label->size);
+        display.setCursor(label->x, label->y);
+        display.println(label->text);
+    }
+    display.setTextSize(1);
+    if (screen->flags & MENU_SHOWS_DEVICE) {
+        display.setCursor(0, 14);
+        display.println("Device: ");
+    }
+    for (uint8_t i = 0; i < screen->option_count; i++) {
+        display.setCursor(0, screen->option_y + i * 8);
+        display.println(screen->options[i].label);
+    }
+}
 
-    /* Update screen every 200ms */
-    if (status->force_update || (ELAPSED_TIME_MS(last_update_ms) > 100)) {
-        status->force_update = false;
-        last_update_ms = CURRENT_TIME_MS();
+static void display_build_templates(void) {
+    display.setTextSize(1);
+    display.setTextColor(WHITE, BLACK);
+    for (uint8_t id = 0; id < SCREEN_COUNT; id++) {
         display.clearDisplay();
+        display_build_template(&menu_screens[id]);
+        memcpy(screen_templates[id], display.getBuffer(), DISPLAY_BUFFER_SIZE);
+    }
+    display.clearDisplay();
+}
+
+/* One renderer for every screen: template, shared parts, screen specifics,
+ * then the selection bar over the options */
+static void display_render(system_status_t *status) {
+    const menu_screen_t *screen = &menu_screens[status->screen_id];
 
-        if (status->screen_id < SCREEN_COUNT) {
-            screen_draws[status->screen_id](status);
+    fb_copy_pages(display.getBuffer(), screen_templates[status->screen_id], 0, DISPLAY_PAGES);
+    if (screen->flags & MENU_SHOWS_DEVICE) {
+        display_text(8 * GLYPH_WIDTH, 14, status->selected_tag.name);
+    }
+    if (screen_draws[status->screen_id] != NULL) {
+        screen_draws[status->screen_id](status);
+    }
+
+    uint8_t option = status->selected_index - screen->option_first;
+    if ((status->selected_index >= screen->option_first) && (option < screen->option_count)) {
+        display_highlight_row(screen->option_y + option * 8);
+    }
+}
+
+static void display_send_commands(const uint8_t *cmds, uint8_t len) {
+    Wire.beginTransmission(DISPLAY_I2C_ADDR);
+    Wire.write((uint8_t) 0x00);  /* Co = 0, D/C = 0: command stream */
+    Wire.write(cmds, len);
+    Wire.endTransmission();
+}
+
+static void display_send_pages(const uint8_t *buffer, uint8_t first, uint8_t last) {
+    const uint8_t window[] = {
+        SSD1306_PAGEADDR, first, last,
+        SSD1306_COLUMNADDR, 0, SCREEN_WIDTH - 1,
+    };
+    display_send_commands(window, sizeof(window));
+
+    const uint8_t *data = &buffer[first * SCREEN_WIDTH];
+    uint16_t remaining = (last - first + 1) * SCREEN_WIDTH;
+    bytes_sent += remaining;
+
+    while (remaining > 0) {
+        uint16_t chunk = (remaining < DISPLAY_I2C_CHUNK) ? remaining : DISPLAY_I2C_CHUNK;
+        Wire.beginTransmission(DISPLAY_I2C_ADDR);
+        Wire.write((uint8_t) 0x40);  /* Co = 0, D/C = 1: data stream */
+        Wire.write(data, chunk);
+        Wire.endTransmission();
+        data += chunk;
+        remaining -= chunk;
+    }
+}
+
+/* Push only the pages that differ from the panel, coalescing adjacent ones */
+static void display_flush(const uint8_t *buffer) {
+    int first_dirty = -1;
+
+    for (uint8_t page = 0; page <= DISPLAY_PAGES; page++) {
+        bool dirty = (page < DISPLAY_PAGES) &&
+                     (memcmp(&buffer[page * SCREEN_WIDTH], &panel_shadow[page * SCREEN_WIDTH], SCREEN_WIDTH) != 0);
+
+        if (dirty) {
+            if (first_dirty < 0) {
+                first_dirty = page;
+            }
+        }
+        else if (first_dirty >= 0) {
+            display_send_pages(buffer, first_dirty, page - 1);
+            memcpy(&panel_shadow[first_dirty * SCREEN_WIDTH], &buffer[first_dirty * SCREEN_WIDTH],
+                   (page - first_dirty) * SCREEN_WIDTH);
+            first_dirty = -1;
         }
+    }
+}
 
-        display.display();
+static void display_update_stats(void) {
+    if (ELAPSED_TIME_MS(bytes_window_ms) >= 1000) {
+        __atomic_store_n(&bytes_per_second, bytes_sent, __ATOMIC_RELAXED);
+        bytes_sent = 0;
+        bytes_window_ms = CURRENT_TIME_MS();
     }
 }
 
+/* The stats tick: the rate window also closes without transfers, so an idle
+ * panel reads 0 bytes/s. Once it does the task sleeps until the next frame. */
+static TickType_t display_stats_ticks(void) {
+    if ((bytes_sent == 0) && (bytes_per_second == 0)) {
+        return portMAX_DELAY;
+    }
+    uint32_t elapsed = ELAPSED_TIME_MS(bytes_window_ms);
+    return pdMS_TO_TICKS((elapsed < 1000) ? 1000 - elapsed : 1);
+}
+
+uint32_t display_get_bytes_per_second(void) {
+    return __atomic_load_n(&bytes_per_second, __ATOMIC_RELAXED);
+}
+
+void display_dump(void) {
+    /* A frame may land between the loads, the average is one frame off at worst */
+    uint32_t count = __atomic_load_n(&transfer_count, __ATOMIC_RELAXED);
+    uint32_t last_us = __atomic_load_n(&transfer_last_us, __ATOMIC_RELAXED);
+    uint32_t max_us = __atomic_load_n(&transfer_max_us, __ATOMIC_RELAXED);
+    uint64_t total_us = __atomic_load_n(&transfer_total_us, __ATOMIC_RELAXED);
+
+    LOG_PRINTF("DISPLAY %u bytes/s at %u Hz\n", display_get_bytes_per_second(), DISPLAY_I2C_CLOCK_HZ);
+    if (count > 0) {
+        LOG_PRINTF("DISPLAY %u frames, transfer last %u us avg %u us max %u us\n",
+                   count, last_us, (uint32_t)(total_us / count), max_us);
+    }
+}
+
+static void display_task(void *arg) {
+    for (;;) {
+        if (ulTaskNotifyTake(pdTRUE, display_stats_ticks()) == 0) {
+            display_update_stats();
+            continue;
+        }
+
+        uint32_t start = CURRENT_TIME_US();
+        display_flush(front_buffer);
+        uint32_t us = CURRENT_TIME_US() - start;
+
+        __atomic_store_n(&transfer_last_us, us, __ATOMIC_RELAXED);
+        __atomic_store_n(&transfer_total_us, transfer_total_us + us, __ATOMIC_RELAXED);
+        if (us > transfer_max_us) {
+            __atomic_store_n(&transfer_max_us, us, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&transfer_count, transfer_count + 1, __ATOMIC_RELAXED);
+        display_update_stats();
+
+        __atomic_store_n(&frame_shown, true, __ATOMIC_RELAXED);
+        __atomic_store_n(&flush_busy, false, __ATOMIC_RELEASE);
+        events_post(EVENT_DISPLAY);
+    }
+}
+
+/* Hand the back buffer over unless a transfer is running; the task wakes
+ * the loop when it is done and the latest frame goes then. */
+static void display_submit(void) {
+    if (!frame_pending || __atomic_load_n(&flush_busy, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    memcpy(front_buffer, display.getBuffer(), DISPLAY_BUFFER_SIZE);
+    frame_pending = false;
+    __atomic_store_n(&flush_busy, true, __ATOMIC_RELEASE);
+    xTaskNotifyGive(display_task_handle);
+}
+
+/* Reduce the status to what the current screen shows, including the
+ * time-derived values, so unchanged frames can be skipped */
+static void display_build_view(const system_status_t *status, display_view_t *view) {
+    memset(view, 0, sizeof(*view));
+    view->screen_id = status->screen_id;
+    view->selected_index = status->selected_index;
+
+    switch (status->screen_id) {
+        case SCREEN_PING:
+            view->device_count = status->last_device_count;
+            view->seconds = display_ping_age(status);
+            break;
+
+        case SCREEN_SCANNING:
+            view->device_count = status->device_count;
+            view->seconds = display_scan_timeout(status);
+            view->state = status->scan_duty;
+            break;
+
+        case SCREEN_DEVICE_LIST:
+            view->device_count = status->device_count;
+            view->selected_device = status->selected_device;
+            view->state = status->list_version;
+            break;
+
+        case SCREEN_CONTROL_GPIO:
+            view->state = status->gpio_state;
+            break;
+
+        case SCREEN_CONTROL_BLE:
+            view->state = status->ble_delay;
+            break;
+
+        case SCREEN_SET_DELAY:
+            view->state = status->set_ble_delay;
+            break;
+
+        case SCREEN_BLE_ERROR:
+            view->state = status->error;
+            break;
+
+        default:
+            break;
+    }
+}
+
+uint32_t display_next_deadline_ms(const system_status_t *status) {
+    switch (status->screen_id) {
+        case SCREEN_PING:
+            if (status->last_ping_ms != 0) {
+                return display_next_second(status->last_ping_ms);
+            }
+            break;
+
+        case SCREEN_SCANNING:
+            return display_next_second(status->start_scanning_ms);
+
+        default:
+            break;
+    }
+    return EVENT_WAIT_FOREVER;
+}
+
+void display_loop(system_status_t *status) {
+    static display_view_t last_view;
+    static bool has_view = false;
+    display_view_t view;
+
+    if (__atomic_exchange_n(&frame_shown, false, __ATOMIC_RELAXED)) {
+        events_frame_shown();
+    }
+    display_submit();
+
+    display_build_view(status, &view);
+    if (!status->force_update && has_view && (memcmp(&view, &last_view, sizeof(view)) == 0)) {
+        return;
+    }
+
+    status->force_update = false;
+    memcpy(&last_view, &view, sizeof(view));
+    has_view = true;
+
+    /* Start from the pre-rendered static parts, then draw what changes */
+    if (status->screen_id < SCREEN_COUNT) {
+        display_render(status);
+    }
+    else {
+        display.clearDisplay();
+    }
+    frame_pending = true;
+    display_submit();
+}
+
 void display_init(void) {
     if (!display.begin(SSD1306_SWITCHCAPVCC, 0x3C)) {
         while (true) {
-            delay(10);
+            DELAY_MS(10);
         }
     }
 
@@ -284,5 +533,17 @@ void display_init(void) {
     display.setCursor(0, 36);
     display.println("Beacon Configuration");
     display.display();
-    delay(1200);
+    memcpy(panel_shadow, display.getBuffer(), DISPLAY_BUFFER_SIZE);
+
+    /* The splash stays on the panel, the buffer is free for building caches */
+    display_build_glyphs();
+    display_build_templates();
+
+    /* Frames are flushed directly over Wire from now on, keep the bus fast */
+    Wire.setClock(DISPLAY_I2C_CLOCK_HZ);
+    bytes_window_ms = CURRENT_TIME_MS();
+    DELAY_MS(1200);
+
+    xTaskCreatePinnedToCore(display_task, "display", DISPLAY_TASK_STACK, NULL, DISPLAY_TASK_PRIORITY,
+                            &display_task_handle, DISPLAY_TASK_CORE);
 }
@@ -12,28 +12,7 @@ enum {
     ERROR_COUNT,
 };
 
-enum {
-    ACTION_CONTROL_GPIO = 0,
-    ACTION_CONTROL_BLE,
-    ACTION_MENU_BACK,
-    ACTION_MENU_COUNT,
-};
-
-enum {
-    GPIO_CONTROL_OFF = 0,
-    GPIO_CONTROL_ON,
-    GPIO_MENU_BACK,
-    GPIO_MENU_COUNT,
-};
-
-enum {
-    BLE_CONTROL_OFF = 0,
-    BLE_CONTROL_ON,
-    BLE_CONTROL_DELAY,
-    BLE_MENU_BACK,
-    BLE_MENU_COUNT,
-};
-
+/* Set delay screen: four digits, then the options from the menu table */
 enum {
     DELAY_CONTROL_0 = 0,
     DELAY_CONTROL_1,
@@ -70,9 +49,9 @@ enum {
 typedef struct {
     bool force_update;
     uint8_t screen_id;
-    uint8_t device_count;
-    uint8_t last_device_count;
-    uint8_t selected_device;
+    uint16_t device_count;
+    uint16_t last_device_count;
+    uint16_t selected_device;
     uint8_t selected_index;
     uint8_t max_index;
     uint8_t error;
@@ -82,11 +61,21 @@ typedef struct {
     int set_ble_delay;       /* Set to remote device (in minutes) */
 
     uint32_t start_scanning_ms;
+    uint8_t scan_duty;       /* Radio duty cycle picked by the scan scheduler, percent */
     uint32_t last_ping_ms;
 
-    char names[MAX_LINES][BLE_NAME_MAX_LEN + 16];
+    /* Device list window, rendered from the tag list display order */
+    uint16_t list_start;
+    uint8_t list_rows;
+    uint16_t list_version;
+    bool cursor_on_tag;
+    esp_bd_addr_t cursor_bda;
+
     tag_t selected_tag;
 } system_status_t;
 
+uint32_t display_get_bytes_per_second(void);
+void display_dump(void);                 /* Bus rate and transfer time per frame */
+uint32_t display_next_deadline_ms(const system_status_t *status);
 void display_loop(system_status_t *status);
 void display_init(void);
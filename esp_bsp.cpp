@@ -1,17 +1,23 @@
 #include <Arduino.h>
+#include <soc/gpio_reg.h>
 #include "app_config.h"
 #include "esp_bsp.h"
+#include "events.h"
 
-#define DEBOUNCE_MS 60
-#define HOLDING_MS  900
+#define DEBOUNCE_TICK_MS    15      /* Four stable samples, ~60 ms, flip a debounced state */
+#define HOLDING_MS          900
+#define REPEAT_DELAY_MS     400     /* Up/Down held this long start repeating */
+#define REPEAT_START_MS     150
+#define REPEAT_MIN_MS       40      /* Each repeat shortens the interval down to this */
+
+#define REPEAT_BUTTONS      ((1 << UP_BUTTON_ID) | (1 << DOWN_BUTTON_ID))
 
 typedef struct {
-    bool pressed;
+    uint8_t pressed;        /* Presses not yet consumed, repeats included */
     bool holding;
-    int state;
-    int last_state;
-    uint32_t last_time;
-    uint32_t holding_ms;
+    uint32_t down_ms;
+    uint32_t next_repeat_ms;
+    uint32_t repeat_ms;
 } button_state_t;
 
 static const int button_pins[BUTTON_COUNT] = {
@@ -24,47 +30,152 @@ static const int button_pins[BUTTON_COUNT] = {
 
 static button_state_t button_state[BUTTON_COUNT];
 
-static void button_loop(void) {
-    int reading;
-    uint32_t vol;
-    uint32_t elapsed;
-    uint32_t now = millis();
+/* Bit i of each mask is button i. Two-bit vertical counters debounce all
+ * buttons at once: a bit flips after four consecutive differing samples. */
+static uint8_t debounced = 0;       /* 1 = pressed */
+static uint8_t count0 = 0;
+static uint8_t count1 = 0;
+static uint32_t last_sample_ms = 0;
+static volatile uint32_t edge_count = 0;
+static volatile uint32_t edge_us = 0;   /* First edge of the current activity */
+static uint32_t edges_seen = 0;
+static uint32_t input_us = 0;           /* Start of the last reported press */
+
+static void IRAM_ATTR button_isr(void) {
+    if (edge_us == 0) {
+        edge_us = CURRENT_TIME_US() | 1;
+    }
+    edge_count++;
+    events_post_from_isr(EVENT_BUTTON);
+}
+
+/* All button pins are below 32, one register read gets them all */
+static uint8_t button_sample(void) {
+    uint32_t port = GPIO_READ_PORT();
+    uint8_t sample = 0;
 
     for (int i = 0; i < BUTTON_COUNT; i++) {
-        /* Normal button */
-        reading = digitalRead(button_pins[i]);
+        /* Pulled up, pressed reads low */
+        sample |= (uint8_t)((~port >> button_pins[i]) & 1) << i;
+    }
+    return sample;
+}
+
+static void button_pressed(uint8_t id, uint32_t now) {
+    button_state_t *b = &button_state[id];
+    b->down_ms = now;
+
+    /* Up/Down act on press so they can repeat while held */
+    if (REPEAT_BUTTONS & (1 << id)) {
+        b->pressed++;
+        input_us = edge_us;
+        b->next_repeat_ms = now + REPEAT_DELAY_MS;
+        b->repeat_ms = REPEAT_START_MS;
+    }
+}
+
+static void button_released(uint8_t id, uint32_t now) {
+    button_state_t *b = &button_state[id];
+
+    if (REPEAT_BUTTONS & (1 << id)) {
+        return;
+    }
+
+    if (((now - b->down_ms) & 0xFFFFFFFF) > HOLDING_MS) {
+        b->holding = true;
+    }
+    else {
+        b->pressed++;
+    }
+    input_us = edge_us;
+}
+
+static void button_repeat(uint32_t now) {
+    uint8_t held = debounced & REPEAT_BUTTONS;
+
+    for (int i = 0; held; i++, held >>= 1) {
+        button_state_t *b = &button_state[i];
+        if ((held & 1) && ((int32_t)(now - b->next_repeat_ms) >= 0)) {
+            b->pressed++;
+            input_us = CURRENT_TIME_US() | 1;
+            b->repeat_ms = (b->repeat_ms * 3) / 4;
+            if (b->repeat_ms < REPEAT_MIN_MS) {
+                b->repeat_ms = REPEAT_MIN_MS;
+            }
+            b->next_repeat_ms = now + b->repeat_ms;
+        }
+    }
+}
+
+static bool button_is_idle(void) {
+    return (edge_count == edges_seen) && !(count0 | count1) && !debounced;
+}
 
-        /* Check if state is changed */
-        if (reading != button_state[i].last_state) {
-            button_state[i].last_time = now;
+static void button_loop(void) {
+    uint32_t now = CURRENT_TIME_MS();
+
+    /* Idle: no edges, nothing settling, nothing held */
+    if (button_is_idle()) {
+#if CONFIG_PM_ENABLE
+        /* Edges during light sleep are lost, look at the levels instead */
+        if (button_sample() == debounced)
+#endif
+        {
+            edge_us = 0;
+            return;
         }
+    }
 
-        /* Handle after noise */
-        if (((now - button_state[i].last_time) & 0xFFFFFFFF) > DEBOUNCE_MS) {
-            if (reading != button_state[i].state) {
-                button_state[i].state = reading;
-
-                if (button_state[i].state == HIGH) {
-                    if (((now - button_state[i].holding_ms) & 0xFFFFFFFF) > HOLDING_MS) {
-                        button_state[i].holding = true;
-                    }
-                    else {
-                        button_state[i].pressed = true;
-                    }
-                }
-                else {
-                    button_state[i].holding_ms = now;
-                }
+    /* Too early to sample: leave the edges unseen, so the loop keeps a
+     * deadline for the next sample instead of going idle on a press */
+    if (ELAPSED_TIME_MS(last_sample_ms) < DEBOUNCE_TICK_MS) {
+        return;
+    }
+    last_sample_ms = now;
+    edges_seen = edge_count;   /* Before sampling, a later edge is seen next time */
+
+    uint8_t delta = button_sample() ^ debounced;
+    count1 = (count1 ^ count0) & delta;
+    count0 = ~count0 & delta;
+    uint8_t toggle = delta & ~(count0 | count1);
+    debounced ^= toggle;
+    bool settled = (toggle != 0);
+
+    for (int i = 0; toggle; i++, toggle >>= 1) {
+        if (toggle & 1) {
+            if (debounced & (1 << i)) {
+                button_pressed(i, now);
             }
-        } 
+            else {
+                button_released(i, now);
+            }
+        }
+    }
+    if (settled) {
+        edge_us = 0;    /* Settled, the next edge starts a new input */
+    }
+
+    button_repeat(now);
+}
+
+uint32_t button_take_input_us(void) {
+    uint32_t us = input_us;
+    input_us = 0;
+    return us;
+}
 
-        button_state[i].last_state = reading;
+uint32_t esp_bsp_next_deadline_ms(void) {
+    if (button_is_idle()) {
+        return EVENT_WAIT_FOREVER;
     }
+
+    uint32_t elapsed = ELAPSED_TIME_MS(last_sample_ms);
+    return (elapsed < DEBOUNCE_TICK_MS) ? DEBOUNCE_TICK_MS - elapsed : 0;
 }
 
 bool button_is_pressed(uint8_t id) {
     if (button_state[id].pressed) {
-        button_state[id].pressed = false;
+        button_state[id].pressed--;
         return true;
     }
     return false;
@@ -85,17 +196,19 @@ void esp_bsp_loop(void) {
 void esp_bsp_init(void) {
     memset(&button_state, 0, sizeof(button_state));
     for (int i = 0; i < BUTTON_COUNT; i++) {
-        pinMode(button_pins[i], INPUT_PULLUP);
-        button_state[i].last_time = CURRENT_TIME_MS();
-        button_state[i].state = digitalRead(button_pins[i]);
-        button_state[i].last_state = button_state[i].state;
+        GPIO_MODE(button_pins[i], INPUT_PULLUP);
+    }
 
-        button_state[i].holding_ms = CURRENT_TIME_MS();
-        button_state[i].holding = false;
+    /* Buttons already down at boot are ignored until released */
+    debounced = button_sample();
+    last_sample_ms = CURRENT_TIME_MS();
+
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        attachInterrupt(digitalPinToInterrupt(button_pins[i]), button_isr, CHANGE);
     }
 
-    pinMode(VIBE, OUTPUT);
-    pinMode(RED_LED, OUTPUT);
-    digitalWrite(VIBE, LOW);
-    digitalWrite(RED_LED, LOW);
+    GPIO_MODE(VIBE, OUTPUT);
+    GPIO_MODE(RED_LED, OUTPUT);
+    GPIO_WRITE(VIBE, LOW);
+    GPIO_WRITE(RED_LED, LOW);
 }
@@ -11,5 +11,7 @@ enum {
 
 bool button_is_pressed(uint8_t id);
 bool button_is_holding(uint8_t id);
+uint32_t button_take_input_us(void);    /* First edge of the last reported press */
+uint32_t esp_bsp_next_deadline_ms(void);
 void esp_bsp_loop(void);
 void esp_bsp_init(void);
@@ -0,0 +1,120 @@
+#include <Arduino.h>
+#include "app_config.h"
+#include "events.h"
+
+#if CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
+
+static TaskHandle_t loop_task = NULL;
+
+static uint32_t wakeups = 0;
+static uint32_t wakeups_total = 0;
+static uint32_t wakeups_per_second = 0;
+static uint32_t wakeups_window_ms = 0;
+
+static uint32_t input_us = 0;
+static uint32_t latency_last_us = 0;
+static uint32_t latency_max_us = 0;
+static uint32_t latency_count = 0;
+
+void events_post(uint32_t bits) {
+    if (loop_task != NULL) {
+        xTaskNotify(loop_task, bits, eSetBits);
+    }
+}
+
+void IRAM_ATTR events_post_from_isr(uint32_t bits) {
+    BaseType_t woken = pdFALSE;
+
+    if (loop_task != NULL) {
+        xTaskNotifyFromISR(loop_task, bits, eSetBits, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+}
+
+uint32_t events_wait(uint32_t timeout_ms) {
+    uint32_t bits = 0;
+
+#if CONFIG_PM_ENABLE
+    if (timeout_ms > EVENT_PM_POLL_MS) {
+        timeout_ms = EVENT_PM_POLL_MS;
+    }
+#endif
+
+    if (timeout_ms > 0) {
+        TickType_t ticks = (timeout_ms == EVENT_WAIT_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+        if (ticks == 0) {
+            ticks = 1;
+        }
+        xTaskNotifyWait(0, UINT32_MAX, &bits, ticks);
+    }
+    else {
+        /* Collect whatever is pending without blocking */
+        xTaskNotifyWait(0, UINT32_MAX, &bits, 0);
+    }
+
+    wakeups++;
+    wakeups_total++;
+    if (ELAPSED_TIME_MS(wakeups_window_ms) >= 1000) {
+        wakeups_per_second = wakeups;
+        wakeups = 0;
+        wakeups_window_ms = CURRENT_TIME_MS();
+    }
+    return bits;
+}
+
+void events_input_handled(uint32_t us) {
+    if ((input_us == 0) && (us != 0)) {
+        input_us = us;
+    }
+}
+
+void events_frame_shown(void) {
+    if (input_us == 0) {
+        return;
+    }
+
+    latency_last_us = CURRENT_TIME_US() - input_us;
+    if (latency_last_us > latency_max_us) {
+        latency_max_us = latency_last_us;
+    }
+    latency_count++;
+    input_us = 0;
+}
+
+uint32_t events_get_wakeups(void) {
+    return wakeups_total;
+}
+
+uint32_t events_get_input_latency(uint32_t *max_us) {
+    if (max_us) {
+        *max_us = latency_max_us;
+    }
+    return latency_last_us;
+}
+
+void events_dump(void) {
+    LOG_PRINTF("EVENTS wakeups/s %u\n", wakeups_per_second);
+    LOG_PRINTF("EVENTS input to screen last %u us max %u us over %u inputs\n",
+               latency_last_us, latency_max_us, latency_count);
+    latency_max_us = 0;
+    latency_count = 0;
+}
+
+void events_init(void) {
+    loop_task = xTaskGetCurrentTaskHandle();
+    wakeups_window_ms = CURRENT_TIME_MS();
+
+#if CONFIG_PM_ENABLE
+    /* With tickless idle the blocked loop lets the chip light sleep */
+    esp_pm_config_esp32_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = 80,
+        .light_sleep_enable = CONFIG_FREERTOS_USE_TICKLESS_IDLE,
+    };
+    if (esp_pm_configure(&pm_config) != ESP_OK) {
+        LOG_PRINTLN("esp_pm_configure failed");
+    }
+#endif
+}
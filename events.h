@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include "app_config.h"
+
+/* Main loop wake-up sources. Posted from callbacks and ISRs, the loop blocks
+ * on them until the nearest deadline. */
+enum {
+    EVENT_BUTTON  = (1 << 0),
+    EVENT_BLE     = (1 << 1),
+    EVENT_SERIAL  = (1 << 2),
+    EVENT_DISPLAY = (1 << 3),   /* A frame transfer finished */
+};
+
+#define EVENT_WAIT_FOREVER  UINT32_MAX
+
+void events_init(void);                     /* Call from the loop task */
+void events_post(uint32_t bits);
+void events_post_from_isr(uint32_t bits);
+uint32_t events_wait(uint32_t timeout_ms);  /* Returns the bits posted */
+
+/* Input-to-screen latency: input_us is when the handled input started */
+void events_input_handled(uint32_t input_us);
+void events_frame_shown(void);
+uint32_t events_get_wakeups(void);                  /* events_wait() returns since boot */
+uint32_t events_get_input_latency(uint32_t *max_us); /* Last input to screen, max since the last dump */
+void events_dump(void);
@@ -0,0 +1,129 @@
+#include <Arduino.h>
+#include "app_config.h"
+#include "framebuffer.h"
+
+/* Replicate a byte into the four bytes of a word */
+#define BYTES_X4(b)     (0x01010101u * (uint8_t)(b))
+
+enum {
+    FB_OP_SET = 0,
+    FB_OP_CLEAR,
+    FB_OP_INVERT,
+};
+
+static inline uint32_t fb_op_word(uint32_t value, uint32_t mask, uint8_t op) {
+    switch (op) {
+        case FB_OP_SET:
+            return value | mask;
+        case FB_OP_CLEAR:
+            return value & ~mask;
+        default:
+            return value ^ mask;
+    }
+}
+
+/* Apply the op to the masked rows of width bytes of one page */
+static void fb_apply_span(uint8_t *p, uint8_t width, uint8_t mask, uint8_t op) {
+    uint32_t mask4 = BYTES_X4(mask);
+    uint8_t i = 0;
+
+    for (; (i < width) && ((uintptr_t) &p[i] & 3); i++) {
+        p[i] = fb_op_word(p[i], mask, op);
+    }
+    /* Aligned by now, memcpy keeps the word access defined */
+    for (; i + 4 <= width; i += 4) {
+        uint32_t word;
+        memcpy(&word, &p[i], 4);
+        word = fb_op_word(word, mask4, op);
+        memcpy(&p[i], &word, 4);
+    }
+    for (; i < width; i++) {
+        p[i] = fb_op_word(p[i], mask, op);
+    }
+}
+
+static void fb_apply_rect(uint8_t *fb, int16_t x, int16_t y, int16_t w, int16_t h, uint8_t op) {
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > SCREEN_WIDTH) w = SCREEN_WIDTH - x;
+    if (y + h > SCREEN_HEIGHT) h = SCREEN_HEIGHT - y;
+    if ((w <= 0) || (h <= 0)) {
+        return;
+    }
+
+    uint8_t first = y / 8;
+    uint8_t last = (y + h - 1) / 8;
+    for (uint8_t page = first; page <= last; page++) {
+        uint8_t top = (page == first) ? y % 8 : 0;
+        uint8_t bottom = (page == last) ? (y + h - 1) % 8 : 7;
+        uint8_t mask = (0xFF << top) & (0xFF >> (7 - bottom));
+        fb_apply_span(&fb[page * SCREEN_WIDTH + x], w, mask, op);
+    }
+}
+
+void fb_fill_rect(uint8_t *fb, int16_t x, int16_t y, int16_t w, int16_t h) {
+    fb_apply_rect(fb, x, y, w, h, FB_OP_SET);
+}
+
+void fb_clear_rect(uint8_t *fb, int16_t x, int16_t y, int16_t w, int16_t h) {
+    fb_apply_rect(fb, x, y, w, h, FB_OP_CLEAR);
+}
+
+void fb_invert_rect(uint8_t *fb, int16_t x, int16_t y, int16_t w, int16_t h) {
+    fb_apply_rect(fb, x, y, w, h, FB_OP_INVERT);
+}
+
+void fb_invert_rows(uint8_t *fb, int16_t y, int16_t h) {
+    fb_apply_rect(fb, 0, y, SCREEN_WIDTH, h, FB_OP_INVERT);
+}
+
+void fb_copy_pages(uint8_t *dst, const uint8_t *src, uint8_t first, uint8_t count) {
+    /* Whole pages are word aligned, memcpy moves them a word at a time */
+    memcpy(&dst[first * SCREEN_WIDTH], &src[first * SCREEN_WIDTH], count * SCREEN_WIDTH);
+}
+
+/* Rows that straddle two pages are split with per-byte shifts applied to
+ * four columns at a time. Strips starting off screen are dropped. */
+void fb_blit_strip(uint8_t *fb, uint8_t x, uint8_t y, const uint8_t *cols, uint8_t width) {
+    if ((x >= SCREEN_WIDTH) || (y >= SCREEN_HEIGHT)) {
+        return;
+    }
+
+    uint8_t page = y / 8;
+    uint8_t shift = y % 8;
+    uint8_t *top = &fb[page * SCREEN_WIDTH + x];
+    uint8_t *bottom = (page + 1 < FB_PAGES) ? &fb[(page + 1) * SCREEN_WIDTH + x] : NULL;
+    uint8_t top_mask = 0xFF << shift;
+    uint8_t bottom_mask = shift ? 0xFF >> (8 - shift) : 0;
+    uint8_t i = 0;
+
+    if (x + width > SCREEN_WIDTH) {
+        width = SCREEN_WIDTH - x;
+    }
+
+    if (shift == 0) {
+        memcpy(top, cols, width);
+        return;
+    }
+
+    for (; i + 4 <= width; i += 4) {
+        uint32_t src, dst;
+        memcpy(&src, &cols[i], 4);
+
+        memcpy(&dst, &top[i], 4);
+        dst = (dst & ~BYTES_X4(top_mask)) | ((src << shift) & BYTES_X4(top_mask));
+        memcpy(&top[i], &dst, 4);
+
+        if (bottom != NULL) {
+            memcpy(&dst, &bottom[i], 4);
+            dst = (dst & ~BYTES_X4(bottom_mask)) | ((src >> (8 - shift)) & BYTES_X4(bottom_mask));
+            memcpy(&bottom[i], &dst, 4);
+        }
+    }
+    for (; i < width; i++) {
+        top[i] = (top[i] & ~top_mask) | (uint8_t)(cols[i] << shift);
+        if (bottom != NULL) {
+            bottom[i] = (bottom[i] & ~bottom_mask) | (cols[i] >> (8 - shift));
+        }
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include "app_config.h"
+
+/* 1bpp framebuffer in SSD1306 page layout: byte = page * SCREEN_WIDTH + x,
+ * bit = y % 8. Spans are processed four columns per 32-bit word. */
+#define FB_PAGES        (SCREEN_HEIGHT / 8)
+#define FB_SIZE         (SCREEN_WIDTH * FB_PAGES)
+
+void fb_fill_rect(uint8_t *fb, int16_t x, int16_t y, int16_t w, int16_t h);
+void fb_clear_rect(uint8_t *fb, int16_t x, int16_t y, int16_t w, int16_t h);
+void fb_invert_rect(uint8_t *fb, int16_t x, int16_t y, int16_t w, int16_t h);
+void fb_invert_rows(uint8_t *fb, int16_t y, int16_t h);     /* Full width band */
+void fb_copy_pages(uint8_t *dst, const uint8_t *src, uint8_t first, uint8_t count);
+
+/* Place an 8 pixel high strip of columns at (x, y), replacing what is under it */
+void fb_blit_strip(uint8_t *fb, uint8_t x, uint8_t y, const uint8_t *cols, uint8_t width);
@@ -0,0 +1,150 @@
+#include <Arduino.h>
+#include <Preferences.h>
+#include "app_config.h"
+#include "gatt_cache.h"
+
+#define GATT_CACHE_NAMESPACE  "gatt_cache"
+#define GATT_CACHE_VERSION    2     /* Bump when the entry layout or the tag firmware layout changes */
+#define GATT_CACHE_KEY_LEN    5     /* "s", the slot number and NUL */
+
+static_assert(GATT_CACHE_SLOTS <= 256, "Slot numbers are 8 bits");
+
+/* A fixed set of slots, so a fleet of tags cannot fill the NVS partition
+ * Bluedroid keeps its own GATT cache in. The slots are mirrored in RAM:
+ * lookups never touch flash, and use is tracked there only, a reboot
+ * falls back to the order the slots were stored in. */
+typedef struct {
+    uint8_t bda[6];
+    uint32_t stamp;         /* Store order, survives reboots */
+    gatt_cache_entry_t entry;
+} gatt_cache_slot_t;
+
+static Preferences prefs;
+static bool cache_ready = false;
+static gatt_cache_slot_t slots[GATT_CACHE_SLOTS];
+static bool slot_used[GATT_CACHE_SLOTS];
+static uint32_t slot_last_use[GATT_CACHE_SLOTS];
+static uint32_t cache_clock = 0;
+
+static void gatt_cache_key(uint8_t slot, char *key) {
+    snprintf(key, GATT_CACHE_KEY_LEN, "s%02u", slot);
+}
+
+static int gatt_cache_find(const uint8_t *bda) {
+    for (int i = 0; i < GATT_CACHE_SLOTS; i++) {
+        if (slot_used[i] && (memcmp(slots[i].bda, bda, sizeof(slots[i].bda)) == 0)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* A free slot, else the least recently used one */
+static int gatt_cache_victim(void) {
+    int victim = 0;
+
+    for (int i = 0; i < GATT_CACHE_SLOTS; i++) {
+        if (!slot_used[i]) {
+            return i;
+        }
+        if ((int32_t)(slot_last_use[i] - slot_last_use[victim]) < 0) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+static void gatt_cache_drop(int slot) {
+    char key[GATT_CACHE_KEY_LEN];
+
+    slot_used[slot] = false;
+    gatt_cache_key(slot, key);
+    prefs.remove(key);
+}
+
+bool gatt_cache_lookup(const uint8_t *bda, gatt_cache_entry_t *entry) {
+    if (!cache_ready) {
+        return false;
+    }
+
+    int slot = gatt_cache_find(bda);
+    if (slot < 0) {
+        return false;
+    }
+    slot_last_use[slot] = ++cache_clock;
+    *entry = slots[slot].entry;
+    return true;
+}
+
+void gatt_cache_store(const uint8_t *bda, const gatt_cache_entry_t *entry) {
+    char key[GATT_CACHE_KEY_LEN];
+
+    if (!cache_ready) {
+        return;
+    }
+
+    gatt_cache_entry_t stored = *entry;
+    stored.version = GATT_CACHE_VERSION;
+
+    int slot = gatt_cache_find(bda);
+    if (slot >= 0) {
+        slot_last_use[slot] = ++cache_clock;
+        /* Avoid flash wear when nothing changed */
+        if (memcmp(&slots[slot].entry, &stored, sizeof(stored)) == 0) {
+            return;
+        }
+    }
+    else {
+        slot = gatt_cache_victim();
+    }
+
+    memcpy(slots[slot].bda, bda, sizeof(slots[slot].bda));
+    slots[slot].entry = stored;
+    slots[slot].stamp = ++cache_clock;
+    slot_used[slot] = true;
+    slot_last_use[slot] = cache_clock;
+    gatt_cache_key(slot, key);
+    prefs.putBytes(key, &slots[slot], sizeof(slots[slot]));
+}
+
+void gatt_cache_invalidate(const uint8_t *bda) {
+    if (!cache_ready) {
+        return;
+    }
+
+    int slot = gatt_cache_find(bda);
+    if (slot >= 0) {
+        gatt_cache_drop(slot);
+    }
+}
+
+/* Cheap sanity checks, anything odd is treated as a miss */
+static bool gatt_cache_valid(const gatt_cache_entry_t *entry) {
+    return (entry->version == GATT_CACHE_VERSION) && (entry->nus_handler != 0) &&
+           (entry->nus_handler >= entry->service_start_handle) && (entry->nus_handler <= entry->service_end_handle);
+}
+
+void gatt_cache_init(void) {
+    char key[GATT_CACHE_KEY_LEN];
+
+    cache_ready = prefs.begin(GATT_CACHE_NAMESPACE, false);
+    if (!cache_ready) {
+        LOG_PRINTLN("GATT cache unavailable");
+        return;
+    }
+
+    cache_clock = 0;
+    for (int i = 0; i < GATT_CACHE_SLOTS; i++) {
+        gatt_cache_key(i, key);
+        slot_used[i] = (prefs.getBytes(key, &slots[i], sizeof(slots[i])) == sizeof(slots[i]));
+        if (slot_used[i] && !gatt_cache_valid(&slots[i].entry)) {
+            gatt_cache_drop(i);
+        }
+        if (slot_used[i]) {
+            slot_last_use[i] = slots[i].stamp;
+            if ((int32_t)(slots[i].stamp - cache_clock) > 0) {
+                cache_clock = slots[i].stamp;
+            }
+        }
+    }
+}
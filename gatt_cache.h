@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* GATT layout of one tag, kept in NVS so reconnects can skip discovery */
+typedef struct {
+    uint8_t version;
+    uint8_t write_no_rsp;
+    uint16_t service_start_handle;
+    uint16_t service_end_handle;
+    uint16_t nus_handler;
+} gatt_cache_entry_t;
+
+bool gatt_cache_lookup(const uint8_t *bda, gatt_cache_entry_t *entry);
+void gatt_cache_store(const uint8_t *bda, const gatt_cache_entry_t *entry);
+void gatt_cache_invalidate(const uint8_t *bda);
+void gatt_cache_init(void);
@@ -0,0 +1,57 @@
+#pragma once
+
+/* Host stand-in for Adafruit_GFX: the classic 6x8 text path and the
+ * primitives the sketch uses. The font is a generated 5x7 one, not the
+ * Adafruit glyphs, so text stays recognisable to the tests (see
+ * sim_font_column()) while the drawing rules match the library. */
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+class Adafruit_GFX {
+public:
+    Adafruit_GFX(int16_t w, int16_t h) : _width(w), _height(h) {}
+    virtual ~Adafruit_GFX() {}
+
+    virtual void drawPixel(int16_t x, int16_t y, uint16_t color) = 0;
+    virtual void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+    void fillScreen(uint16_t color) { fillRect(0, 0, _width, _height, color); }
+
+    void drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg, uint8_t size);
+    void setCursor(int16_t x, int16_t y) { cursor_x = x; cursor_y = y; }
+    void setTextSize(uint8_t s) { textsize = (s > 0) ? s : 1; }
+    void setTextColor(uint16_t c) { textcolor = textbgcolor = c; }
+    void setTextColor(uint16_t c, uint16_t bg) { textcolor = c; textbgcolor = bg; }
+    void setTextWrap(bool w) { wrap = w; }
+    int16_t width(void) const { return _width; }
+    int16_t height(void) const { return _height; }
+
+    size_t write(uint8_t c);
+    size_t print(const char *text);
+    size_t print(char c) { return write((uint8_t) c); }
+    size_t print(int value) { return printNumber("%d", value); }
+    size_t print(unsigned int value) { return printNumber("%u", value); }
+    size_t print(long value) { return printNumber("%ld", value); }
+    size_t print(unsigned long value) { return printNumber("%lu", value); }
+    size_t println(void) { return write('\n'); }
+    template <typename T> size_t println(T value) { return print(value) + println(); }
+
+protected:
+    template <typename T> size_t printNumber(const char *format, T value) {
+        char text[24];
+        snprintf(text, sizeof(text), format, value);
+        return print(text);
+    }
+
+    int16_t _width;
+    int16_t _height;
+    int16_t cursor_x = 0;
+    int16_t cursor_y = 0;
+    uint16_t textcolor = 0xFFFF;
+    uint16_t textbgcolor = 0xFFFF;
+    uint8_t textsize = 1;
+    bool wrap = true;
+};
+
+/* Column col (0-4) of the glyph for c, bit n is row n */
+uint8_t sim_font_column(uint8_t c, uint8_t col);
@@ -0,0 +1,45 @@
+#pragma once
+
+/* Host stand-in for Adafruit_SSD1306: a 1bpp buffer in the panel page
+ * layout, pushed over Wire to the simulated panel by display() */
+#include "Adafruit_GFX.h"
+#include "Wire.h"
+
+#define BLACK                   0
+#define WHITE                   1
+#define INVERSE                 2
+#define SSD1306_BLACK           BLACK
+#define SSD1306_WHITE           WHITE
+#define SSD1306_INVERSE         INVERSE
+
+#define SSD1306_EXTERNALVCC     0x01
+#define SSD1306_SWITCHCAPVCC    0x02
+
+#define SSD1306_MEMORYMODE      0x20
+#define SSD1306_COLUMNADDR      0x21
+#define SSD1306_PAGEADDR        0x22
+#define SSD1306_DISPLAYOFF      0xAE
+#define SSD1306_DISPLAYON       0xAF
+
+class Adafruit_SSD1306 : public Adafruit_GFX {
+public:
+    Adafruit_SSD1306(uint8_t w, uint8_t h, TwoWire *twi = &Wire, int8_t rst_pin = -1,
+                     uint32_t clk_during = 400000UL, uint32_t clk_after = 100000UL);
+    ~Adafruit_SSD1306();
+
+    bool begin(uint8_t switchvcc = SSD1306_SWITCHCAPVCC, uint8_t i2caddr = 0, bool reset = true, bool periph_begin = true);
+    void display(void);
+    void clearDisplay(void);
+    void drawPixel(int16_t x, int16_t y, uint16_t color) override;
+    uint8_t *getBuffer(void) { return buffer; }
+    void ssd1306_command(uint8_t c);
+
+private:
+    void commands(const uint8_t *c, uint8_t n);
+
+    TwoWire *wire;
+    uint8_t *buffer = NULL;
+    uint8_t i2caddr = 0x3C;
+    uint32_t clk_during;
+    uint32_t clk_after;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+/* Host stand-in for the ESP32 Arduino core: the parts of Arduino.h, the
+ * HAL and FreeRTOS the sketch uses. Time, GPIO, Serial and the tasks run
+ * on the simulation in host/, see host/sim.h. */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "soc/soc.h"
+#include "esp_heap_caps.h"
+
+#define HIGH            0x1
+#define LOW             0x0
+
+#define INPUT           0x01
+#define OUTPUT          0x03
+#define PULLUP          0x04
+#define INPUT_PULLUP    0x05
+#define PULLDOWN        0x08
+#define INPUT_PULLDOWN  0x09
+
+#define RISING          0x01
+#define FALLING         0x02
+#define CHANGE          0x03
+
+#define DEC             10
+#define HEX             16
+
+#define IRAM_ATTR
+
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(uint32_t ms);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t pin);
+#define digitalPinToInterrupt(pin)  (pin)
+
+bool btStart(void);
+bool psramFound(void);
+void *xthal_memcpy(void *dst, const void *src, unsigned len);
+
+/* Output is captured by the simulation, see sim_serial_output() */
+class HardwareSerial {
+public:
+    void begin(unsigned long baud);
+    void onReceive(void (*callback)(void));
+    int available(void);
+    int read(void);
+
+    size_t write(const uint8_t *data, size_t len);
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    size_t print(const char *text) { return write((const uint8_t *) text, strlen(text)); }
+    size_t print(char c) { return write((const uint8_t *) &c, 1); }
+    size_t print(unsigned char value, int base = DEC) { return print((unsigned long) value, base); }
+    size_t print(int value, int base = DEC) { return print((long) value, base); }
+    size_t print(unsigned int value, int base = DEC) { return print((unsigned long) value, base); }
+    size_t print(long value, int base = DEC) {
+        return (base == DEC) ? printf("%ld", value) : printf("%lx", value);
+    }
+    size_t print(unsigned long value, int base = DEC) {
+        return (base == DEC) ? printf("%lu", value) : printf("%lx", value);
+    }
+    size_t print(double value, int digits = 2) { return printf("%.*f", digits, value); }
+
+    size_t println(void) { return print("\r\n"); }
+    template <typename T> size_t println(T value) { return print(value) + println(); }
+};
+
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+    uint32_t getCycleCount(void);   /* Host nanoseconds, so a 1000 MHz CPU */
+    uint32_t getCpuFreqMHz(void);
+};
+
+extern EspClass ESP;
@@ -0,0 +1,23 @@
+#pragma once
+
+/* Host stand-in for the Preferences (NVS) library, backed by a file so
+ * data survives a simulated reboot, see sim_nvs_set_path() */
+#include <stddef.h>
+#include <stdint.h>
+
+class Preferences {
+public:
+    bool begin(const char *name, bool read_only = false, const char *partition = NULL);
+    void end(void);
+    size_t putBytes(const char *key, const void *value, size_t len);
+    size_t getBytes(const char *key, void *buf, size_t len);
+    size_t getBytesLength(const char *key);
+    bool remove(const char *key);
+    bool clear(void);
+    bool isKey(const char *key);
+
+private:
+    char name[16] = "";
+    bool started = false;
+    bool read_only = false;
+};
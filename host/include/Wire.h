@@ -0,0 +1,27 @@
+#pragma once
+
+/* Host stand-in for the Arduino Wire library. Transfers reach the simulated
+ * I2C devices and take the bus time at the configured clock. */
+#include <stdint.h>
+#include <stddef.h>
+
+#define I2C_BUFFER_LENGTH   128
+
+class TwoWire {
+public:
+    bool begin(void);
+    void setClock(uint32_t frequency);
+    uint32_t getClock(void);
+    void beginTransmission(uint8_t address);
+    size_t write(uint8_t data);
+    size_t write(const uint8_t *data, size_t len);
+    uint8_t endTransmission(bool send_stop = true);
+
+private:
+    uint32_t clock = 100000;
+    uint8_t address = 0;
+    uint8_t buffer[I2C_BUFFER_LENGTH];
+    size_t length = 0;
+};
+
+extern TwoWire Wire;
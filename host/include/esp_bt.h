@@ -0,0 +1,25 @@
+#pragma once
+
+/* Host stand-in for ESP-IDF esp_bt.h, controller settings */
+#include "esp_err.h"
+#include "esp_bt_defs.h"
+
+typedef enum {
+    ESP_BLE_PWR_TYPE_CONN_HDL0 = 0,
+    ESP_BLE_PWR_TYPE_ADV = 9,
+    ESP_BLE_PWR_TYPE_SCAN = 10,
+    ESP_BLE_PWR_TYPE_DEFAULT = 11,
+} esp_ble_power_type_t;
+
+typedef enum {
+    ESP_PWR_LVL_N12 = 0,
+    ESP_PWR_LVL_N9,
+    ESP_PWR_LVL_N6,
+    ESP_PWR_LVL_N3,
+    ESP_PWR_LVL_N0,
+    ESP_PWR_LVL_P3,
+    ESP_PWR_LVL_P6,
+    ESP_PWR_LVL_P9,
+} esp_power_level_t;
+
+esp_err_t esp_ble_tx_power_set(esp_ble_power_type_t power_type, esp_power_level_t power_level);
@@ -0,0 +1,7 @@
+#pragma once
+
+/* Host stand-in for ESP-IDF esp_bt_main.h */
+#include "esp_err.h"
+
+esp_err_t esp_bluedroid_init(void);
+esp_err_t esp_bluedroid_enable(void);
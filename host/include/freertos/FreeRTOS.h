@@ -0,0 +1,45 @@
+#pragma once
+
+/* Host stand-in for FreeRTOS.h as shipped with ESP-IDF. Tasks, queues and
+ * notifications are implemented by the simulation kernel in
+ * host/sim_kernel.cpp, on a simulated clock with 1 ms ticks. */
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE                 ((BaseType_t) 0)
+#define pdTRUE                  ((BaseType_t) 1)
+#define pdPASS                  pdTRUE
+#define pdFAIL                  pdFALSE
+#define errQUEUE_FULL           ((BaseType_t) 0)
+#define errQUEUE_EMPTY          ((BaseType_t) 0)
+
+#define portMAX_DELAY           ((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS      ((TickType_t) 1000 / CONFIG_FREERTOS_HZ)
+#define pdMS_TO_TICKS(ms)       ((TickType_t) (((TickType_t) (ms) * (TickType_t) CONFIG_FREERTOS_HZ) / (TickType_t) 1000U))
+
+#define portNUM_PROCESSORS      2
+#define PRO_CPU_NUM             0
+#define APP_CPU_NUM             1
+#define tskNO_AFFINITY          0x7FFFFFFF
+
+/* Critical sections are spinlocks, as on the dual core ESP32. The simulated
+ * tasks never run in parallel, host threads outside the simulation do. */
+typedef struct {
+    uint32_t owner;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    {0}
+
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+
+#define portENTER_CRITICAL(mux)         vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux)          vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux)     vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux)      vPortExitCritical(mux)
+#define portYIELD_FROM_ISR(woken)       ((void) (woken))
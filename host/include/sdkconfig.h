@@ -0,0 +1,11 @@
+#pragma once
+
+/* Host stand-in for the Arduino core sdkconfig.h. Options the sketch tests
+ * for can be overridden from the build. */
+#define CONFIG_FREERTOS_HZ                  1000
+#define CONFIG_ARDUINO_RUNNING_CORE         1
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ   240
+
+#ifndef CONFIG_BT_GATTC_CACHE_NVS_FLASH
+#define CONFIG_BT_GATTC_CACHE_NVS_FLASH     1   /* Bluedroid keeps attribute tables in NVS */
+#endif
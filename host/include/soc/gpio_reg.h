@@ -0,0 +1,6 @@
+#pragma once
+
+/* Host stand-in for ESP-IDF soc/gpio_reg.h */
+#include "soc.h"
+
+#define GPIO_IN_REG     0x3FF4403C  /* Levels of GPIO 0-31 */
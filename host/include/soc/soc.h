@@ -0,0 +1,8 @@
+#pragma once
+
+/* Host stand-in for ESP-IDF soc/soc.h: register reads go to the simulation */
+#include <stdint.h>
+
+uint32_t sim_reg_read(uint32_t reg);
+
+#define REG_READ(reg)   sim_reg_read(reg)
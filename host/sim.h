@@ -0,0 +1,125 @@
+#pragma once
+
+/* Host simulation of the board the sketch runs on: FreeRTOS tasks on a
+ * simulated clock, GPIO, Serial, NVS, the SSD1306 panel on I2C and a BLE
+ * controller with advertisers and peripherals around it.
+ *
+ * Only one simulated task runs at a time, the highest priority one that is
+ * ready, until it blocks. The clock stands still while tasks run and jumps
+ * to the next wake-up when they are all blocked, so code costs no simulated
+ * time; waits, timeouts and bus transfers do. Tests drive everything from
+ * a timeline of actions run at given times on a high priority task, the
+ * same context Bluedroid callbacks and ISRs run in on the board. */
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gattc_api.h"
+
+/* Clock and timeline. The run calls are for the test thread only. */
+uint64_t sim_now_us(void);
+void sim_at_us(uint64_t t_us, std::function<void()> action);
+void sim_at_ms(uint64_t t_ms, std::function<void()> action);
+void sim_run_until_us(uint64_t t_us);
+void sim_run_for_ms(uint32_t ms);
+bool sim_run_until(std::function<bool()> done, uint32_t timeout_ms);   /* Checked every millisecond */
+
+/* Creates the Arduino loop task: setup() then loop() forever */
+void sim_start_sketch(void);
+
+/* GPIO levels as seen by the pins, buttons pull them low */
+void sim_gpio_set(uint8_t pin, uint8_t level);
+uint8_t sim_gpio_get(uint8_t pin);
+void sim_button_press(uint8_t pin, uint64_t at_ms, uint32_t hold_ms);
+
+/* Serial console */
+std::string sim_serial_output(void);
+void sim_serial_clear(void);
+void sim_serial_input(const char *text);
+
+/* Memory and NVS */
+void sim_set_psram(bool present);
+void sim_nvs_set_path(const char *path);   /* Loads it, then keeps it up to date */
+uint32_t sim_nvs_writes(void);
+size_t sim_nvs_keys(const char *space);    /* Keys stored in a namespace */
+
+/* SSD1306 panel: what the controller RAM holds, in its page layout */
+const uint8_t *sim_panel_gddram(void);
+bool sim_panel_pixel(uint8_t x, uint8_t y);
+bool sim_panel_has_text(const char *text, uint8_t size = 1);   /* Anywhere, either polarity */
+bool sim_panel_is_on(void);
+uint32_t sim_panel_data_bytes(void);        /* GDDRAM bytes written since boot */
+uint32_t sim_wire_clock(void);
+
+/* BLE: advertisers are heard while the controller scans and its window is
+ * open, peripherals accept connections and serve the NUS service */
+typedef struct {
+    esp_bd_addr_t bda;
+    esp_ble_addr_type_t addr_type;
+    const char *name;               /* NULL: no name at all */
+    bool name_in_rsp;               /* Name only in the scan response */
+    esp_ble_evt_type_t evt_type;
+    int rssi;
+    uint32_t interval_ms;
+    uint32_t start_ms;
+    uint32_t end_ms;                /* 0: forever */
+} sim_advertiser_t;
+
+typedef struct {
+    esp_bd_addr_t bda;
+    bool has_nus;
+    uint16_t rx_handle;             /* NUS service spans handles 40 to 60 */
+    uint8_t rx_properties;
+    uint16_t mtu;
+    uint32_t connect_ms;
+    uint32_t discovery_ms;          /* Full service discovery over the air */
+    uint32_t conn_interval_ms;
+} sim_peripheral_t;
+
+typedef struct {
+    uint32_t scan_starts;           /* Scanning enabled from stopped */
+    uint32_t scan_stops;
+    uint64_t scan_on_us;            /* Scanning enabled */
+    uint64_t listen_us;             /* Scanning enabled times the window duty */
+    uint64_t policy_us[2];          /* Scanning enabled, open and whitelist filter */
+    uint32_t results[2];            /* Scan results delivered, per filter policy */
+    uint32_t adverts;               /* Adverts on the air */
+    uint32_t param_sets;
+    uint32_t param_rejects;         /* Parameters sent while scanning */
+    uint32_t whitelist_adds;
+    uint32_t whitelist_rejects;     /* Invalid address type or full */
+    uint32_t connections;
+    uint32_t ota_discoveries;       /* Service discoveries over the air */
+    uint64_t discovery_air_ms;
+    uint32_t writes_rsp;
+    uint32_t writes_no_rsp;
+    uint32_t writes_lost;           /* Without response to a wrong handle, nobody notices */
+    uint32_t write_errors;          /* Error responses */
+} sim_ble_stats_t;
+
+void sim_advertiser_defaults(sim_advertiser_t *adv, const char *bda, const char *name);
+int sim_ble_add_advertiser(const sim_advertiser_t *adv);
+void sim_ble_set_rssi(int advertiser, int rssi);
+size_t sim_ble_load_trace(const char *path, uint32_t offset_ms);   /* "t_ms bda type evt rssi name" lines */
+
+void sim_peripheral_defaults(sim_peripheral_t *periph, const char *bda);
+void sim_ble_add_peripheral(const sim_peripheral_t *periph);
+void sim_ble_set_rx_handle(const uint8_t *bda, uint16_t handle);  /* Tag firmware moved the characteristic */
+void sim_ble_fail_writes(const uint8_t *bda, uint32_t count);     /* Next writes fail to be queued */
+void sim_ble_disconnect(const uint8_t *bda);                      /* Peripheral side */
+std::vector<std::string> sim_ble_received(const uint8_t *bda);
+bool sim_ble_is_connected(const uint8_t *bda);
+
+void sim_ble_set_stack_cache(bool enabled);  /* Bluedroid GATTC cache, CONFIG_BT_GATTC_CACHE_NVS_FLASH */
+void sim_ble_set_whitelist_size(uint16_t size);
+bool sim_ble_is_scanning(void);
+uint16_t sim_ble_scan_window(void);
+uint8_t sim_ble_filter_policy(void);
+size_t sim_ble_whitelist_count(void);
+sim_ble_stats_t sim_ble_stats(void);
+void sim_ble_reset_stats(void);
+
+void sim_parse_bda(const char *text, uint8_t *bda);
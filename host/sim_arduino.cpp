@@ -0,0 +1,229 @@
+/* Arduino core stand-in: time, GPIO, Serial, heap capabilities */
+#include <chrono>
+#include <mutex>
+#include "sim.h"
+#include "soc/gpio_reg.h"
+
+#define SIM_GPIO_COUNT  40
+
+void sim_sleep_us(uint64_t us);
+
+HardwareSerial Serial;
+EspClass ESP;
+
+/* Time ***********************************************************************/
+
+uint32_t millis(void) {
+    return (uint32_t)(sim_now_us() / 1000);
+}
+
+uint32_t micros(void) {
+    return (uint32_t) sim_now_us();
+}
+
+void delay(uint32_t ms) {
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+/* Host time, the simulated clock does not move while code runs */
+uint32_t EspClass::getCycleCount(void) {
+    return (uint32_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t EspClass::getCpuFreqMHz(void) {
+    return 1000;
+}
+
+/* GPIO ***********************************************************************/
+
+static uint8_t gpio_level[SIM_GPIO_COUNT];
+static uint8_t gpio_mode[SIM_GPIO_COUNT];
+static bool gpio_driven[SIM_GPIO_COUNT];        /* Level set from outside */
+static void (*gpio_isr[SIM_GPIO_COUNT])(void);
+static int gpio_isr_mode[SIM_GPIO_COUNT];
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin >= SIM_GPIO_COUNT) {
+        return;
+    }
+    gpio_mode[pin] = mode;
+    if (!gpio_driven[pin] && ((mode & PULLUP) == PULLUP)) {
+        gpio_level[pin] = HIGH;
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+    if (pin < SIM_GPIO_COUNT) {
+        gpio_level[pin] = level ? HIGH : LOW;
+    }
+}
+
+int digitalRead(uint8_t pin) {
+    return (pin < SIM_GPIO_COUNT) ? gpio_level[pin] : LOW;
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode) {
+    if (pin < SIM_GPIO_COUNT) {
+        gpio_isr[pin] = handler;
+        gpio_isr_mode[pin] = mode;
+    }
+}
+
+void detachInterrupt(uint8_t pin) {
+    if (pin < SIM_GPIO_COUNT) {
+        gpio_isr[pin] = NULL;
+    }
+}
+
+uint32_t sim_reg_read(uint32_t reg) {
+    uint32_t value = 0;
+
+    if (reg == GPIO_IN_REG) {
+        for (int pin = 0; pin < 32; pin++) {
+            value |= (uint32_t) gpio_level[pin] << pin;
+        }
+    }
+    return value;
+}
+
+/* Edges run the ISR in the caller's context, timeline actions are the ISR
+ * context of the simulation */
+void sim_gpio_set(uint8_t pin, uint8_t level) {
+    if (pin >= SIM_GPIO_COUNT) {
+        return;
+    }
+
+    uint8_t old = gpio_level[pin];
+    gpio_driven[pin] = true;
+    gpio_level[pin] = level ? HIGH : LOW;
+    if ((old == gpio_level[pin]) || (gpio_isr[pin] == NULL)) {
+        return;
+    }
+
+    int mode = gpio_isr_mode[pin];
+    if ((mode == CHANGE) || ((mode == RISING) && level) || ((mode == FALLING) && !level)) {
+        gpio_isr[pin]();
+    }
+}
+
+uint8_t sim_gpio_get(uint8_t pin) {
+    return digitalRead(pin);
+}
+
+void sim_button_press(uint8_t pin, uint64_t at_ms, uint32_t hold_ms) {
+    sim_at_ms(at_ms, [pin] { sim_gpio_set(pin, LOW); });
+    sim_at_ms(at_ms + hold_ms, [pin] { sim_gpio_set(pin, HIGH); });
+}
+
+/* Serial *********************************************************************/
+
+static std::mutex serial_lock;
+static std::string serial_output;
+static std::string serial_input;
+static void (*serial_receive)(void) = NULL;
+static bool serial_echo = getenv("SIM_LOG") != NULL;
+
+void HardwareSerial::begin(unsigned long baud) {
+}
+
+void HardwareSerial::onReceive(void (*callback)(void)) {
+    serial_receive = callback;
+}
+
+int HardwareSerial::available(void) {
+    std::lock_guard<std::mutex> guard(serial_lock);
+    return serial_input.size();
+}
+
+int HardwareSerial::read(void) {
+    std::lock_guard<std::mutex> guard(serial_lock);
+
+    if (serial_input.empty()) {
+        return -1;
+    }
+    int c = (uint8_t) serial_input[0];
+    serial_input.erase(0, 1);
+    return c;
+}
+
+size_t HardwareSerial::write(const uint8_t *data, size_t len) {
+    std::lock_guard<std::mutex> guard(serial_lock);
+
+    serial_output.append((const char *) data, len);
+    if (serial_echo) {
+        fwrite(data, 1, len, stdout);
+    }
+    return len;
+}
+
+size_t HardwareSerial::printf(const char *format, ...) {
+    char text[512];
+    va_list args;
+
+    va_start(args, format);
+    int len = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (len < 0) {
+        return 0;
+    }
+    return write((const uint8_t *) text, ((size_t) len < sizeof(text)) ? len : sizeof(text) - 1);
+}
+
+std::string sim_serial_output(void) {
+    std::lock_guard<std::mutex> guard(serial_lock);
+    return serial_output;
+}
+
+void sim_serial_clear(void) {
+    std::lock_guard<std::mutex> guard(serial_lock);
+    serial_output.clear();
+}
+
+void sim_serial_input(const char *text) {
+    {
+        std::lock_guard<std::mutex> guard(serial_lock);
+        serial_input.append(text);
+    }
+    if (serial_receive != NULL) {
+        serial_receive();
+    }
+}
+
+/* Memory *********************************************************************/
+
+static bool psram_present = false;
+
+void sim_set_psram(bool present) {
+    psram_present = present;
+}
+
+bool psramFound(void) {
+    return psram_present;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+    if ((caps & MALLOC_CAP_SPIRAM) && !psram_present) {
+        return NULL;
+    }
+    return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+    if ((caps & MALLOC_CAP_SPIRAM) && !psram_present) {
+        return NULL;
+    }
+    return calloc(n, size);
+}
+
+void heap_caps_free(void *ptr) {
+    free(ptr);
+}
+
+void *xthal_memcpy(void *dst, const void *src, unsigned len) {
+    return memcpy(dst, src, len);
+}
+
+bool btStart(void) {
+    return true;
+}
@@ -0,0 +1,906 @@
+/* Bluedroid stand-in: the GAP scanning and GATT client calls of the sketch,
+ * served by a simulated controller. Command completions and air events are
+ * timeline actions, so callbacks run on the high priority timeline task as
+ * they run on the Bluedroid BTC task on the board. Timings are typical for
+ * a 30 ms connection interval, not measurements. */
+#include <map>
+#include <string>
+#include <vector>
+#include "sim.h"
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_gatt_common_api.h"
+
+#define SIM_GATTC_IF            3
+#define SIM_HCI_US              700         /* Command to completion event */
+#define SIM_OPEN_TIMEOUT_MS     1000        /* Nobody answering a connection request */
+#define SIM_CACHED_DISCOVERY_MS 2           /* Service table loaded from the stack cache */
+#define SIM_ADV_JITTER_MS       10          /* advDelay, keeps advertisers out of phase with the scan */
+
+#define NUS_START_HANDLE        40
+#define NUS_END_HANDLE          60
+#define NUS_UUID_INDEX          12          /* Byte of the 128-bit UUID telling service, RX and TX apart */
+
+typedef struct {
+    bool has_nus;
+    uint16_t rx_handle;
+    uint8_t rx_properties;
+} sim_gatt_db_t;
+
+typedef struct {
+    sim_peripheral_t config;
+    sim_gatt_db_t db;                   /* What the tag firmware serves now */
+    uint32_t fail_writes;
+    std::vector<std::string> received;
+    int conn;                           /* Index in conns, -1 if not connected */
+} sim_peripheral_state_t;
+
+typedef struct {
+    uint16_t conn_id;
+    int periph;
+    bool up;
+    bool discovered;
+    bool search_pending;
+    bool search_all;
+    sim_gatt_db_t db;                   /* What the client believes */
+    uint32_t generation;                /* Bumped on disconnect, stale actions check it */
+} sim_conn_t;
+
+typedef struct {
+    sim_advertiser_t config;
+    std::string name;
+    uint32_t jitter;
+} sim_adv_state_t;
+
+static esp_gap_ble_cb_t gap_callback = NULL;
+static esp_gattc_cb_t gattc_callback = NULL;
+
+static esp_ble_scan_params_t scan_params = {BLE_SCAN_TYPE_ACTIVE, BLE_ADDR_TYPE_PUBLIC, BLE_SCAN_FILTER_ALLOW_ALL,
+                                            0x50, 0x30, BLE_SCAN_DUPLICATE_DISABLE};
+static esp_ble_scan_params_t scan_active;   /* Parameters of the running scan */
+static bool scanning = false;
+static uint64_t scan_start_us = 0;
+static uint32_t scan_generation = 0;
+static std::vector<std::pair<std::vector<uint8_t>, uint8_t>> whitelist;
+static uint16_t whitelist_size = 12;
+static uint16_t local_mtu = 23;
+
+static std::vector<sim_adv_state_t> advertisers;
+static std::vector<sim_peripheral_state_t> peripherals;
+static std::vector<sim_conn_t> conns;
+static bool stack_cache = CONFIG_BT_GATTC_CACHE_NVS_FLASH;
+static std::map<std::vector<uint8_t>, sim_gatt_db_t> stack_cache_db;
+static std::map<std::vector<uint8_t>, std::vector<uint8_t>> stack_cache_assoc;
+
+static sim_ble_stats_t stats;
+
+static std::vector<uint8_t> bda_key(const uint8_t *bda) {
+    return std::vector<uint8_t>(bda, bda + ESP_BD_ADDR_LEN);
+}
+
+void sim_parse_bda(const char *text, uint8_t *bda) {
+    unsigned b[ESP_BD_ADDR_LEN] = {0};
+
+    sscanf(text, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]);
+    for (int i = 0; i < ESP_BD_ADDR_LEN; i++) {
+        bda[i] = b[i];
+    }
+}
+
+static void sim_after_us(uint64_t delay_us, std::function<void()> action) {
+    sim_at_us(sim_now_us() + delay_us, std::move(action));
+}
+
+static void sim_after_ms(uint32_t delay_ms, std::function<void()> action) {
+    sim_after_us((uint64_t) delay_ms * 1000, std::move(action));
+}
+
+static void gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+    if (gap_callback != NULL) {
+        gap_callback(event, param);
+    }
+}
+
+static void gap_status_event(esp_gap_ble_cb_event_t event, esp_bt_status_t status) {
+    esp_ble_gap_cb_param_t param;
+
+    memset(&param, 0, sizeof(param));
+    param.scan_start_cmpl.status = status;  /* Same layout for every completion */
+    gap_event(event, &param);
+}
+
+static void gattc_event(esp_gattc_cb_event_t event, esp_ble_gattc_cb_param_t *param) {
+    if (gattc_callback != NULL) {
+        gattc_callback(event, SIM_GATTC_IF, param);
+    }
+}
+
+/* Scanning *******************************************************************/
+
+static uint8_t scan_policy_index(void) {
+    return (scan_active.scan_filter_policy == BLE_SCAN_FILTER_ALLOW_ONLY_WLST) ? 1 : 0;
+}
+
+static void scan_account(uint64_t until_us) {
+    uint64_t on = until_us - scan_start_us;
+
+    stats.scan_on_us += on;
+    stats.listen_us += on * scan_active.scan_window / scan_active.scan_interval;
+    stats.policy_us[scan_policy_index()] += on;
+}
+
+static void scan_stop_now(void) {
+    scan_account(sim_now_us());
+    scanning = false;
+    scan_generation++;
+    stats.scan_stops++;
+}
+
+static bool scan_window_open(uint64_t t_us) {
+    uint64_t interval_us = (uint64_t) scan_active.scan_interval * 625;
+    uint64_t window_us = (uint64_t) scan_active.scan_window * 625;
+
+    return ((t_us - scan_start_us) % interval_us) < window_us;
+}
+
+static bool whitelist_has(const uint8_t *bda, uint8_t addr_type) {
+    for (auto &entry : whitelist) {
+        if ((entry.second == addr_type) && (memcmp(entry.first.data(), bda, ESP_BD_ADDR_LEN) == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint8_t ad_append(uint8_t *data, uint8_t len, uint8_t type, const void *value, uint8_t value_len) {
+    if (len + 2 + value_len > ESP_BLE_ADV_DATA_LEN_MAX) {
+        value_len = ESP_BLE_ADV_DATA_LEN_MAX - len - 2;
+    }
+    data[len] = value_len + 1;
+    data[len + 1] = type;
+    memcpy(&data[len + 2], value, value_len);
+    return len + 2 + value_len;
+}
+
+/* One advert on the air, heard if the controller listens and lets it through */
+static void sim_advert(const uint8_t *bda, esp_ble_addr_type_t addr_type, esp_ble_evt_type_t evt_type,
+                       int rssi, const char *name, bool name_in_rsp) {
+    static const uint8_t flags = 0x06;
+    esp_ble_gap_cb_param_t param;
+
+    stats.adverts++;
+    if (!scanning || !scan_window_open(sim_now_us())) {
+        return;
+    }
+    if ((scan_active.scan_filter_policy == BLE_SCAN_FILTER_ALLOW_ONLY_WLST) && !whitelist_has(bda, addr_type)) {
+        return;
+    }
+
+    memset(&param, 0, sizeof(param));
+    param.scan_rst.search_evt = ESP_GAP_SEARCH_INQ_RES_EVT;
+    memcpy(param.scan_rst.bda, bda, ESP_BD_ADDR_LEN);
+    param.scan_rst.dev_type = ESP_BT_DEVICE_TYPE_BLE;
+    param.scan_rst.ble_addr_type = addr_type;
+    param.scan_rst.ble_evt_type = evt_type;
+    param.scan_rst.rssi = rssi;
+
+    bool scannable = (scan_active.scan_type == BLE_SCAN_TYPE_ACTIVE) &&
+                     ((evt_type == ESP_BLE_EVT_CONN_ADV) || (evt_type == ESP_BLE_EVT_DISC_ADV));
+    uint8_t adv_len = ad_append(param.scan_rst.ble_adv, 0, 0x01, &flags, 1);
+    uint8_t rsp_len = 0;
+    if ((name != NULL) && !name_in_rsp) {
+        adv_len = ad_append(param.scan_rst.ble_adv, adv_len, 0x09, name, strlen(name));
+    }
+    else if ((name != NULL) && scannable) {
+        rsp_len = ad_append(&param.scan_rst.ble_adv[adv_len], 0, 0x09, name, strlen(name));
+    }
+    param.scan_rst.adv_data_len = adv_len;
+    param.scan_rst.scan_rsp_len = rsp_len;
+
+    stats.results[scan_policy_index()]++;
+    gap_event(ESP_GAP_BLE_SCAN_RESULT_EVT, &param);
+}
+
+static void sim_advertiser_next(int id, uint64_t t_us) {
+    sim_adv_state_t *adv = &advertisers[id];
+    uint32_t end_ms = adv->config.end_ms;
+
+    if ((end_ms != 0) && (t_us >= (uint64_t) end_ms * 1000)) {
+        return;
+    }
+    sim_at_us(t_us, [id] {
+        sim_adv_state_t *adv = &advertisers[id];
+        sim_advert(adv->config.bda, adv->config.addr_type, adv->config.evt_type, adv->config.rssi,
+                   adv->config.name ? adv->name.c_str() : NULL, adv->config.name_in_rsp);
+
+        /* Deterministic advDelay */
+        adv->jitter = adv->jitter * 1103515245 + 12345;
+        uint32_t delay_ms = (adv->jitter >> 16) % (SIM_ADV_JITTER_MS + 1);
+        sim_advertiser_next(id, sim_now_us() + (uint64_t)(adv->config.interval_ms + delay_ms) * 1000);
+    });
+}
+
+void sim_advertiser_defaults(sim_advertiser_t *adv, const char *bda, const char *name) {
+    memset(adv, 0, sizeof(*adv));
+    sim_parse_bda(bda, adv->bda);
+    adv->addr_type = BLE_ADDR_TYPE_RANDOM;
+    adv->name = name;
+    adv->evt_type = ESP_BLE_EVT_CONN_ADV;
+    adv->rssi = -60;
+    adv->interval_ms = 100;
+}
+
+int sim_ble_add_advertiser(const sim_advertiser_t *config) {
+    sim_adv_state_t adv;
+    int id = advertisers.size();
+
+    adv.config = *config;
+    adv.name = config->name ? config->name : "";
+    adv.jitter = id * 7919 + 1;
+    advertisers.push_back(adv);
+    sim_advertiser_next(id, (uint64_t) config->start_ms * 1000);
+    return id;
+}
+
+void sim_ble_set_rssi(int advertiser, int rssi) {
+    advertisers[advertiser].config.rssi = rssi;
+}
+
+size_t sim_ble_load_trace(const char *path, uint32_t offset_ms) {
+    char line[160];
+    size_t count = 0;
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        fprintf(stderr, "sim: cannot open trace %s\n", path);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        unsigned long t_ms;
+        char bda_text[24];
+        unsigned addr_type, evt_type;
+        int rssi;
+        char name[40];
+
+        if ((line[0] == '#') || (sscanf(line, "%lu %23s %u %u %d %39s", &t_ms, bda_text, &addr_type, &evt_type, &rssi, name) != 6)) {
+            continue;
+        }
+
+        std::vector<uint8_t> bda(ESP_BD_ADDR_LEN);
+        sim_parse_bda(bda_text, bda.data());
+        std::string adv_name = name;
+        bool has_name = (adv_name != "-");
+        sim_at_ms(t_ms + offset_ms, [bda, addr_type, evt_type, rssi, adv_name, has_name] {
+            sim_advert(bda.data(), (esp_ble_addr_type_t) addr_type, (esp_ble_evt_type_t) evt_type, rssi,
+                       has_name ? adv_name.c_str() : NULL, false);
+        });
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback) {
+    gap_callback = callback;
+    return ESP_OK;
+}
+
+/* The controller refuses new parameters while it scans */
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *params) {
+    esp_ble_scan_params_t requested = *params;
+
+    sim_after_us(SIM_HCI_US, [requested] {
+        esp_bt_status_t status = ESP_BT_STATUS_SUCCESS;
+        if (scanning) {
+            stats.param_rejects++;
+            status = ESP_BT_STATUS_FAIL;
+        }
+        else {
+            scan_params = requested;
+            stats.param_sets++;
+        }
+        gap_status_event(ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT, status);
+    });
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_start_scanning(uint32_t duration) {
+    sim_after_us(SIM_HCI_US, [duration] {
+        if (!scanning) {
+            scanning = true;
+            scan_active = scan_params;
+            scan_start_us = sim_now_us();
+            stats.scan_starts++;
+
+            uint32_t generation = ++scan_generation;
+            if (duration > 0) {
+                sim_after_ms(duration * 1000, [generation] {
+                    if (!scanning || (generation != scan_generation)) {
+                        return;
+                    }
+                    scan_stop_now();
+                    esp_ble_gap_cb_param_t param;
+                    memset(&param, 0, sizeof(param));
+                    param.scan_rst.search_evt = ESP_GAP_SEARCH_INQ_CMPL_EVT;
+                    gap_event(ESP_GAP_BLE_SCAN_RESULT_EVT, &param);
+                });
+            }
+        }
+        gap_status_event(ESP_GAP_BLE_SCAN_START_COMPLETE_EVT, ESP_BT_STATUS_SUCCESS);
+    });
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_stop_scanning(void) {
+    sim_after_us(SIM_HCI_US, [] {
+        if (!scanning) {
+            gap_status_event(ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT, ESP_BT_STATUS_FAIL);
+            return;
+        }
+        scan_stop_now();
+        gap_status_event(ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT, ESP_BT_STATUS_SUCCESS);
+    });
+    return ESP_OK;
+}
+
+/* Only public and static random addresses go in the whitelist, resolvable
+ * ones need the resolving list */
+esp_err_t esp_ble_gap_update_whitelist(bool add_remove, esp_bd_addr_t remote_bda, esp_ble_wl_addr_type_t wl_addr_type) {
+    std::vector<uint8_t> bda = bda_key(remote_bda);
+    uint8_t type = wl_addr_type;
+
+    sim_after_us(SIM_HCI_US, [add_remove, bda, type] {
+        esp_bt_status_t status = ESP_BT_STATUS_SUCCESS;
+        bool busy = scanning && (scan_active.scan_filter_policy == BLE_SCAN_FILTER_ALLOW_ONLY_WLST);
+
+        if (busy || (type > BLE_WL_ADDR_TYPE_RANDOM) || (add_remove && (whitelist.size() >= whitelist_size))) {
+            stats.whitelist_rejects++;
+            status = ESP_BT_STATUS_FAIL;
+        }
+        else if (add_remove) {
+            if (!whitelist_has(bda.data(), type)) {
+                whitelist.emplace_back(bda, type);
+            }
+            stats.whitelist_adds++;
+        }
+        else {
+            for (size_t i = 0; i < whitelist.size(); i++) {
+                if ((whitelist[i].first == bda) && (whitelist[i].second == type)) {
+                    whitelist.erase(whitelist.begin() + i);
+                    break;
+                }
+            }
+        }
+        gap_status_event(ESP_GAP_BLE_UPDATE_WHITELIST_COMPLETE_EVT, status);
+    });
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_clear_whitelist(void) {
+    sim_after_us(SIM_HCI_US, [] {
+        if (!(scanning && (scan_active.scan_filter_policy == BLE_SCAN_FILTER_ALLOW_ONLY_WLST))) {
+            whitelist.clear();
+        }
+    });
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_get_whitelist_size(uint16_t *length) {
+    *length = whitelist_size;
+    return ESP_OK;
+}
+
+/* GATT client ****************************************************************/
+
+static sim_peripheral_state_t *sim_find_peripheral(const uint8_t *bda) {
+    for (auto &periph : peripherals) {
+        if (memcmp(periph.config.bda, bda, ESP_BD_ADDR_LEN) == 0) {
+            return &periph;
+        }
+    }
+    return NULL;
+}
+
+static sim_conn_t *sim_find_conn(uint16_t conn_id) {
+    for (auto &conn : conns) {
+        if (conn.up && (conn.conn_id == conn_id)) {
+            return &conn;
+        }
+    }
+    return NULL;
+}
+
+void sim_peripheral_defaults(sim_peripheral_t *periph, const char *bda) {
+    memset(periph, 0, sizeof(*periph));
+    sim_parse_bda(bda, periph->bda);
+    periph->has_nus = true;
+    periph->rx_handle = 42;
+    periph->rx_properties = ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
+    periph->mtu = 247;
+    periph->connect_ms = 60;
+    periph->discovery_ms = 300;
+    periph->conn_interval_ms = 30;
+}
+
+void sim_ble_add_peripheral(const sim_peripheral_t *config) {
+    sim_peripheral_state_t periph;
+
+    periph.config = *config;
+    periph.db.has_nus = config->has_nus;
+    periph.db.rx_handle = config->rx_handle;
+    periph.db.rx_properties = config->rx_properties;
+    periph.fail_writes = 0;
+    periph.conn = -1;
+    peripherals.push_back(periph);
+}
+
+void sim_ble_set_rx_handle(const uint8_t *bda, uint16_t handle) {
+    sim_peripheral_state_t *periph = sim_find_peripheral(bda);
+    if (periph != NULL) {
+        periph->db.rx_handle = handle;
+    }
+}
+
+void sim_ble_fail_writes(const uint8_t *bda, uint32_t count) {
+    sim_peripheral_state_t *periph = sim_find_peripheral(bda);
+    if (periph != NULL) {
+        periph->fail_writes = count;
+    }
+}
+
+std::vector<std::string> sim_ble_received(const uint8_t *bda) {
+    sim_peripheral_state_t *periph = sim_find_peripheral(bda);
+    return (periph != NULL) ? periph->received : std::vector<std::string>();
+}
+
+bool sim_ble_is_connected(const uint8_t *bda) {
+    sim_peripheral_state_t *periph = sim_find_peripheral(bda);
+    return (periph != NULL) && (periph->conn >= 0);
+}
+
+void sim_ble_set_stack_cache(bool enabled) {
+    stack_cache = enabled;
+}
+
+static uint32_t conn_interval_ms(const sim_conn_t *conn) {
+    return peripherals[conn->periph].config.conn_interval_ms;
+}
+
+static void sim_search_complete(int index);
+
+/* Service discovery after connecting: from the stack cache when it has the
+ * tag or an associated one, else over the air */
+static void sim_discover(int index, bool use_cache) {
+    sim_conn_t *conn = &conns[index];
+    sim_peripheral_state_t *periph = &peripherals[conn->periph];
+    std::vector<uint8_t> key = bda_key(periph->config.bda);
+    uint32_t generation = conn->generation;
+    uint32_t delay_ms;
+
+    conn->discovered = false;
+    if (stack_cache && use_cache && !stack_cache_db.count(key) && stack_cache_assoc.count(key) &&
+        stack_cache_db.count(stack_cache_assoc[key])) {
+        stack_cache_db[key] = stack_cache_db[stack_cache_assoc[key]];
+    }
+    if (stack_cache && use_cache && stack_cache_db.count(key)) {
+        conn->db = stack_cache_db[key];
+        delay_ms = SIM_CACHED_DISCOVERY_MS;
+    }
+    else {
+        conn->db = periph->db;
+        delay_ms = periph->config.discovery_ms;
+        stats.ota_discoveries++;
+        stats.discovery_air_ms += delay_ms;
+        if (stack_cache) {
+            stack_cache_db[key] = periph->db;
+        }
+    }
+
+    sim_after_ms(delay_ms, [index, generation] {
+        sim_conn_t *conn = &conns[index];
+        if (!conn->up || (conn->generation != generation)) {
+            return;
+        }
+        conn->discovered = true;
+
+        esp_ble_gattc_cb_param_t param;
+        memset(&param, 0, sizeof(param));
+        param.dis_srvc_cmpl.status = ESP_GATT_OK;
+        param.dis_srvc_cmpl.conn_id = conn->conn_id;
+        gattc_event(ESP_GATTC_DIS_SRVC_CMPL_EVT, &param);
+
+        if (conn->search_pending) {
+            sim_search_complete(index);
+        }
+    });
+}
+
+static void sim_disconnected(int index, int reason) {
+    sim_conn_t *conn = &conns[index];
+    sim_peripheral_state_t *periph = &peripherals[conn->periph];
+    esp_ble_gattc_cb_param_t param;
+
+    if (!conn->up) {
+        return;
+    }
+    conn->up = false;
+    conn->generation++;
+    periph->conn = -1;
+
+    memset(&param, 0, sizeof(param));
+    param.disconnect.reason = reason;
+    param.disconnect.conn_id = conn->conn_id;
+    memcpy(param.disconnect.remote_bda, periph->config.bda, ESP_BD_ADDR_LEN);
+    gattc_event(ESP_GATTC_DISCONNECT_EVT, &param);
+
+    memset(&param, 0, sizeof(param));
+    param.close.status = ESP_GATT_OK;
+    param.close.conn_id = conn->conn_id;
+    param.close.reason = reason;
+    memcpy(param.close.remote_bda, periph->config.bda, ESP_BD_ADDR_LEN);
+    gattc_event(ESP_GATTC_CLOSE_EVT, &param);
+}
+
+void sim_ble_disconnect(const uint8_t *bda) {
+    sim_peripheral_state_t *periph = sim_find_peripheral(bda);
+    if ((periph != NULL) && (periph->conn >= 0)) {
+        int index = periph->conn;
+        sim_at_us(sim_now_us(), [index] { sim_disconnected(index, 0x13); });
+    }
+}
+
+esp_err_t esp_ble_gattc_register_callback(esp_gattc_cb_t callback) {
+    gattc_callback = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_app_register(uint16_t app_id) {
+    sim_after_us(SIM_HCI_US, [app_id] {
+        esp_ble_gattc_cb_param_t param;
+        memset(&param, 0, sizeof(param));
+        param.reg.status = ESP_GATT_OK;
+        param.reg.app_id = app_id;
+        gattc_event(ESP_GATTC_REG_EVT, &param);
+    });
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_open(esp_gatt_if_t gattc_if, esp_bd_addr_t remote_bda, esp_ble_addr_type_t remote_addr_type, bool is_direct) {
+    std::vector<uint8_t> bda = bda_key(remote_bda);
+    sim_peripheral_state_t *periph = sim_find_peripheral(remote_bda);
+
+    if ((periph != NULL) && (periph->conn >= 0)) {
+        return ESP_FAIL;
+    }
+    if (periph == NULL) {
+        sim_after_ms(SIM_OPEN_TIMEOUT_MS, [bda] {
+            esp_ble_gattc_cb_param_t param;
+            memset(&param, 0, sizeof(param));
+            param.open.status = ESP_GATT_ERROR;
+            memcpy(param.open.remote_bda, bda.data(), ESP_BD_ADDR_LEN);
+            gattc_event(ESP_GATTC_OPEN_EVT, &param);
+        });
+        return ESP_OK;
+    }
+
+    sim_after_ms(periph->config.connect_ms, [bda] {
+        sim_peripheral_state_t *periph = sim_find_peripheral(bda.data());
+        sim_conn_t conn = {};
+        int index = conns.size();
+
+        conn.conn_id = index;
+        conn.periph = periph - peripherals.data();
+        conn.up = true;
+        conns.push_back(conn);
+        periph->conn = index;
+        stats.connections++;
+
+        esp_ble_gattc_cb_param_t param;
+        memset(&param, 0, sizeof(param));
+        param.connect.conn_id = index;
+        memcpy(param.connect.remote_bda, bda.data(), ESP_BD_ADDR_LEN);
+        gattc_event(ESP_GATTC_CONNECT_EVT, &param);
+
+        memset(&param, 0, sizeof(param));
+        param.open.status = ESP_GATT_OK;
+        param.open.conn_id = index;
+        param.open.mtu = 23;
+        memcpy(param.open.remote_bda, bda.data(), ESP_BD_ADDR_LEN);
+        gattc_event(ESP_GATTC_OPEN_EVT, &param);
+
+        sim_discover(index, true);
+    });
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_close(esp_gatt_if_t gattc_if, uint16_t conn_id) {
+    sim_conn_t *conn = sim_find_conn(conn_id);
+
+    if (conn == NULL) {
+        return ESP_FAIL;
+    }
+    int index = conn - conns.data();
+    sim_after_ms(conn_interval_ms(conn), [index] { sim_disconnected(index, 0x16); });
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_send_mtu_req(esp_gatt_if_t gattc_if, uint16_t conn_id) {
+    sim_conn_t *conn = sim_find_conn(conn_id);
+
+    if (conn == NULL) {
+        return ESP_FAIL;
+    }
+    uint16_t mtu = peripherals[conn->periph].config.mtu;
+    mtu = (mtu < local_mtu) ? mtu : local_mtu;
+    sim_after_ms(conn_interval_ms(conn), [conn_id, mtu] {
+        if (sim_find_conn(conn_id) == NULL) {
+            return;
+        }
+        esp_ble_gattc_cb_param_t param;
+        memset(&param, 0, sizeof(param));
+        param.cfg_mtu.status = ESP_GATT_OK;
+        param.cfg_mtu.conn_id = conn_id;
+        param.cfg_mtu.mtu = mtu;
+        gattc_event(ESP_GATTC_CFG_MTU_EVT, &param);
+    });
+    return ESP_OK;
+}
+
+static void nus_uuid(esp_bt_uuid_t *uuid, uint8_t kind) {
+    static const uint8_t base[ESP_UUID_LEN_128] = {0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0,
+                                                   0x93, 0xF3, 0xA3, 0xB5, 0x01, 0x00, 0x40, 0x6E};
+    uuid->len = ESP_UUID_LEN_128;
+    memcpy(uuid->uuid.uuid128, base, ESP_UUID_LEN_128);
+    uuid->uuid.uuid128[NUS_UUID_INDEX] = kind;
+}
+
+/* Searches run on the table discovery produced, they take no airtime */
+static void sim_search_complete(int index) {
+    sim_conn_t *conn = &conns[index];
+    esp_ble_gattc_cb_param_t param;
+
+    conn->search_pending = false;
+    if (conn->db.has_nus) {
+        memset(&param, 0, sizeof(param));
+        param.search_res.conn_id = conn->conn_id;
+        param.search_res.start_handle = NUS_START_HANDLE;
+        param.search_res.end_handle = NUS_END_HANDLE;
+        nus_uuid(&param.search_res.srvc_id.uuid, 0x01);
+        param.search_res.is_primary = true;
+        gattc_event(ESP_GATTC_SEARCH_RES_EVT, &param);
+    }
+
+    memset(&param, 0, sizeof(param));
+    param.search_cmpl.status = ESP_GATT_OK;
+    param.search_cmpl.conn_id = conn->conn_id;
+    gattc_event(ESP_GATTC_SEARCH_CMPL_EVT, &param);
+}
+
+esp_err_t esp_ble_gattc_search_service(esp_gatt_if_t gattc_if, uint16_t conn_id, esp_bt_uuid_t *filter_uuid) {
+    sim_conn_t *conn = sim_find_conn(conn_id);
+
+    if (conn == NULL) {
+        return ESP_FAIL;
+    }
+    int index = conn - conns.data();
+    uint32_t generation = conn->generation;
+    conn->search_pending = true;
+    if (conn->discovered) {
+        sim_after_us(SIM_HCI_US, [index, generation] {
+            if (conns[index].up && (conns[index].generation == generation) && conns[index].search_pending) {
+                sim_search_complete(index);
+            }
+        });
+    }
+    return ESP_OK;
+}
+
+/* The NUS service holds RX and TX, TX three handles above RX */
+static uint16_t sim_chars(const sim_conn_t *conn, uint16_t start, uint16_t end, esp_gattc_char_elem_t *out, uint16_t max) {
+    uint16_t count = 0;
+
+    if (!conn->discovered || !conn->db.has_nus || (start > NUS_START_HANDLE) || (end < NUS_END_HANDLE)) {
+        return 0;
+    }
+    if (conn->db.rx_handle != 0) {
+        if ((out != NULL) && (count < max)) {
+            out[count].char_handle = conn->db.rx_handle;
+            out[count].properties = conn->db.rx_properties;
+            nus_uuid(&out[count].uuid, 0x02);
+        }
+        count++;
+    }
+    if ((out != NULL) && (count < max)) {
+        out[count].char_handle = conn->db.rx_handle + 3;
+        out[count].properties = ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+        nus_uuid(&out[count].uuid, 0x03);
+    }
+    count++;
+    return count;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_attr_count(esp_gatt_if_t gattc_if, uint16_t conn_id, esp_gatt_db_attr_type_t type,
+                                               uint16_t start_handle, uint16_t end_handle, uint16_t char_handle, uint16_t *count) {
+    sim_conn_t *conn = sim_find_conn(conn_id);
+
+    *count = 0;
+    if ((conn == NULL) || (type != ESP_GATT_DB_CHARACTERISTIC)) {
+        return ESP_GATT_INVALID_HANDLE;
+    }
+    *count = sim_chars(conn, start_handle, end_handle, NULL, 0);
+    return (*count > 0) ? ESP_GATT_OK : ESP_GATT_NOT_FOUND;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_all_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t start_handle, uint16_t end_handle,
+                                             esp_gattc_char_elem_t *result, uint16_t *count, uint16_t offset) {
+    sim_conn_t *conn = sim_find_conn(conn_id);
+
+    if (conn == NULL) {
+        *count = 0;
+        return ESP_GATT_INVALID_HANDLE;
+    }
+    uint16_t found = sim_chars(conn, start_handle, end_handle, result, *count);
+    if (found < *count) {
+        *count = found;
+    }
+    return (*count > 0) ? ESP_GATT_OK : ESP_GATT_NOT_FOUND;
+}
+
+/* Writes without response to a wrong handle vanish: the peripheral drops
+ * them and the stack still reports success */
+esp_err_t esp_ble_gattc_write_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle, uint16_t value_len, uint8_t *value,
+                                   esp_gatt_write_type_t write_type, esp_gatt_auth_req_t auth_req) {
+    sim_conn_t *conn = sim_find_conn(conn_id);
+
+    if (conn == NULL) {
+        return ESP_FAIL;
+    }
+    sim_peripheral_state_t *periph = &peripherals[conn->periph];
+    if (periph->fail_writes > 0) {
+        periph->fail_writes--;
+        return ESP_FAIL;
+    }
+
+    bool rsp = (write_type == ESP_GATT_WRITE_TYPE_RSP);
+    std::string data((const char *) value, value_len);
+    int periph_index = conn->periph;
+    uint32_t generation = conn->generation;
+    int index = conn - conns.data();
+    uint32_t delay_ms = conn_interval_ms(conn) * (rsp ? 2 : 1);
+
+    if (rsp) {
+        stats.writes_rsp++;
+    }
+    else {
+        stats.writes_no_rsp++;
+    }
+
+    sim_after_ms(delay_ms, [index, generation, periph_index, handle, rsp, data] {
+        sim_conn_t *conn = &conns[index];
+        sim_peripheral_state_t *periph = &peripherals[periph_index];
+        if (!conn->up || (conn->generation != generation)) {
+            return;
+        }
+
+        uint8_t needed = rsp ? ESP_GATT_CHAR_PROP_BIT_WRITE : ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
+        bool accepted = periph->db.has_nus && (handle == periph->db.rx_handle) && (periph->db.rx_properties & needed);
+        esp_gatt_status_t status = ESP_GATT_OK;
+        if (accepted) {
+            periph->received.push_back(data);
+        }
+        else if (rsp) {
+            stats.write_errors++;
+            status = ESP_GATT_INVALID_HANDLE;
+        }
+        else {
+            stats.writes_lost++;
+        }
+
+        esp_ble_gattc_cb_param_t param;
+        memset(&param, 0, sizeof(param));
+        param.write.status = status;
+        param.write.conn_id = conn->conn_id;
+        param.write.handle = handle;
+        gattc_event(ESP_GATTC_WRITE_CHAR_EVT, &param);
+    });
+    return ESP_OK;
+}
+
+/* Forget the cached table; a connected tag is discovered again */
+esp_err_t esp_ble_gattc_cache_refresh(esp_bd_addr_t remote_bda) {
+    std::vector<uint8_t> key = bda_key(remote_bda);
+    sim_peripheral_state_t *periph = sim_find_peripheral(remote_bda);
+
+    stack_cache_db.erase(key);
+    stack_cache_assoc.erase(key);
+    if ((periph != NULL) && (periph->conn >= 0)) {
+        int index = periph->conn;
+        sim_at_us(sim_now_us() + SIM_HCI_US, [index] {
+            if (conns[index].up) {
+                sim_discover(index, false);
+            }
+        });
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_cache_assoc(esp_gatt_if_t gattc_if, esp_bd_addr_t src_addr, esp_bd_addr_t assoc_addr, bool is_assoc) {
+    std::vector<uint8_t> src = bda_key(src_addr);
+    std::vector<uint8_t> assoc = bda_key(assoc_addr);
+
+    if (!stack_cache) {
+        return ESP_FAIL;
+    }
+    if (is_assoc) {
+        stack_cache_assoc[src] = assoc;
+    }
+    else {
+        stack_cache_assoc.erase(src);
+    }
+    sim_after_us(SIM_HCI_US, [] {
+        esp_ble_gattc_cb_param_t param;
+        memset(&param, 0, sizeof(param));
+        param.set_assoc_cmp.status = ESP_GATT_OK;
+        gattc_event(ESP_GATTC_SET_ASSOC_EVT, &param);
+    });
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t mtu) {
+    local_mtu = mtu;
+    return ESP_OK;
+}
+
+/* Controller and stack *******************************************************/
+
+esp_err_t esp_ble_tx_power_set(esp_ble_power_type_t power_type, esp_power_level_t power_level) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_enable(void) {
+    return ESP_OK;
+}
+
+void sim_ble_set_whitelist_size(uint16_t size) {
+    whitelist_size = size;
+}
+
+bool sim_ble_is_scanning(void) {
+    return scanning;
+}
+
+uint16_t sim_ble_scan_window(void) {
+    return scanning ? scan_active.scan_window : scan_params.scan_window;
+}
+
+uint8_t sim_ble_filter_policy(void) {
+    return scanning ? scan_active.scan_filter_policy : scan_params.scan_filter_policy;
+}
+
+size_t sim_ble_whitelist_count(void) {
+    return whitelist.size();
+}
+
+/* Includes the scan running now */
+sim_ble_stats_t sim_ble_stats(void) {
+    sim_ble_stats_t current = stats;
+
+    if (scanning) {
+        uint64_t on = sim_now_us() - scan_start_us;
+        current.scan_on_us += on;
+        current.listen_us += on * scan_active.scan_window / scan_active.scan_interval;
+        current.policy_us[scan_policy_index()] += on;
+    }
+    return current;
+}
+
+void sim_ble_reset_stats(void) {
+    memset(&stats, 0, sizeof(stats));
+    if (scanning) {
+        scan_start_us = sim_now_us();
+    }
+}
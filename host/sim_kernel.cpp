@@ -0,0 +1,488 @@
+/* Simulation kernel: FreeRTOS tasks, queues and notifications on a
+ * simulated clock, plus the timeline tests drive the world with.
+ *
+ * Every task is a host thread, but only the one holding the CPU runs; the
+ * others wait on their condition variable. A task gives the CPU back when
+ * it blocks or a higher priority task became ready, and the scheduler on
+ * the test thread hands it to the next one. Kernel state is only touched
+ * with kernel_lock held, which also orders the task threads for the race
+ * detector. Threads outside the simulation may use the API but never
+ * block: waits time out at once and delays just yield. */
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include "sim.h"
+
+#define SIM_WORLD_PRIORITY      20          /* Above every sketch task, like the Bluedroid tasks */
+#define SIM_LIVELOCK_PICKS      2000000     /* Task switches without the clock moving */
+#define SIM_FOREVER             UINT64_MAX
+
+struct sim_task {
+    std::string name;
+    UBaseType_t priority;
+    TaskFunction_t code;
+    void *arg;
+    std::condition_variable cv;
+    bool blocked = false;
+    bool done = false;
+    std::function<bool()> until;        /* Blocked: ready once this holds */
+    uint64_t wake_us = SIM_FOREVER;     /* Blocked: ready at this time */
+    uint64_t seq = 0;                   /* Round robin among equal priorities */
+    uint32_t notify_value = 0;
+    bool notify_pending = false;
+    uint64_t poll_us = SIM_FOREVER;     /* Failed zero timeout waits at this time */
+    uint32_t polls = 0;
+};
+
+struct sim_queue {
+    UBaseType_t length;
+    UBaseType_t item_size;
+    std::deque<std::vector<uint8_t>> items;
+};
+
+struct sim_kernel {
+    std::mutex lock;
+    std::condition_variable scheduler_cv;
+    std::vector<sim_task *> tasks;
+    sim_task *running = NULL;
+    sim_task *world = NULL;
+    uint64_t seq = 0;
+    std::multimap<uint64_t, std::function<void()>> timeline;
+};
+
+/* Never destroyed: task threads outlive main() */
+static sim_kernel &kernel = *new sim_kernel;
+static std::atomic<uint64_t> now_us{0};
+static thread_local sim_task *self = NULL;
+
+typedef std::unique_lock<std::mutex> kernel_lock_t;
+
+static bool sim_task_ready(sim_task *task) {
+    if (task->done) {
+        return false;
+    }
+    if (!task->blocked) {
+        return true;
+    }
+    return (task->until && task->until()) || (task->wake_us <= now_us.load());
+}
+
+static sim_task *sim_pick(void) {
+    sim_task *best = NULL;
+
+    for (sim_task *task : kernel.tasks) {
+        if (!sim_task_ready(task)) {
+            continue;
+        }
+        if ((best == NULL) || (task->priority > best->priority) ||
+            ((task->priority == best->priority) && (task->seq < best->seq))) {
+            best = task;
+        }
+    }
+    return best;
+}
+
+static uint64_t sim_next_wake_us(void) {
+    uint64_t next = SIM_FOREVER;
+
+    for (sim_task *task : kernel.tasks) {
+        if (task->blocked && !task->done && (task->wake_us < next)) {
+            next = task->wake_us;
+        }
+    }
+    if (!kernel.timeline.empty() && (kernel.timeline.begin()->first < next)) {
+        next = kernel.timeline.begin()->first;
+    }
+    return next;
+}
+
+/* Give the CPU back to the scheduler and wait to be picked again */
+static void sim_switch_out(kernel_lock_t &lock, sim_task *task) {
+    kernel.running = NULL;
+    kernel.scheduler_cv.notify_one();
+    task->cv.wait(lock, [task] { return kernel.running == task; });
+}
+
+static bool sim_in_task(void) {
+    return (self != NULL) && (kernel.running == self);
+}
+
+/* A task made a higher priority one ready: it runs first, as on one core */
+static void sim_preempt(kernel_lock_t &lock) {
+    if (!sim_in_task()) {
+        return;
+    }
+    for (sim_task *task : kernel.tasks) {
+        if ((task != self) && (task->priority > self->priority) && sim_task_ready(task)) {
+            self->seq = ++kernel.seq;
+            sim_switch_out(lock, self);
+            return;
+        }
+    }
+}
+
+/* Wait until the condition holds, at most ticks. True if it holds. */
+static bool sim_block_until(kernel_lock_t &lock, std::function<bool()> until, uint64_t wake_us) {
+    if (until && until()) {
+        return true;
+    }
+    if (!sim_in_task() || (wake_us <= now_us.load())) {
+        return false;
+    }
+
+    sim_task *task = self;
+    task->blocked = true;
+    task->until = until;
+    task->wake_us = wake_us;
+    task->seq = ++kernel.seq;
+    sim_switch_out(lock, task);
+    task->blocked = false;
+    task->until = nullptr;
+    task->wake_us = SIM_FOREVER;
+    return until && until();
+}
+
+static uint64_t sim_ticks_to_wake_us(TickType_t ticks) {
+    if (ticks == portMAX_DELAY) {
+        return SIM_FOREVER;
+    }
+    return now_us.load() + (uint64_t) ticks * 1000 * portTICK_PERIOD_MS;
+}
+
+/* A task polling with zero timeouts never gives the CPU back, on the board
+ * it starves everything below it on its core. Catch it like a livelock. */
+static void sim_poll_failed(void) {
+    if (!sim_in_task()) {
+        return;
+    }
+    if (self->poll_us != now_us.load()) {
+        self->poll_us = now_us.load();
+        self->polls = 0;
+    }
+    if (++self->polls > SIM_LIVELOCK_PICKS) {
+        fprintf(stderr, "sim: %s spins at %llu us, polling with zero timeouts\n",
+                self->name.c_str(), (unsigned long long) now_us.load());
+        abort();
+    }
+}
+
+static bool sim_block(kernel_lock_t &lock, std::function<bool()> until, TickType_t ticks) {
+    if (ticks == 0) {
+        if (until()) {
+            return true;
+        }
+        sim_poll_failed();
+        return false;
+    }
+    return sim_block_until(lock, until, sim_ticks_to_wake_us(ticks));
+}
+
+static void sim_task_main(sim_task *task) {
+    self = task;
+    {
+        kernel_lock_t lock(kernel.lock);
+        task->cv.wait(lock, [task] { return kernel.running == task; });
+    }
+
+    task->code(task->arg);
+
+    /* FreeRTOS tasks never return, treat it as vTaskDelete(NULL) */
+    kernel_lock_t lock(kernel.lock);
+    task->done = true;
+    kernel.running = NULL;
+    kernel.scheduler_cv.notify_one();
+}
+
+static sim_task *sim_task_create(TaskFunction_t code, const char *name, void *arg, UBaseType_t priority) {
+    sim_task *task = new sim_task;
+    task->name = name;
+    task->priority = priority;
+    task->code = code;
+    task->arg = arg;
+    task->seq = ++kernel.seq;
+    kernel.tasks.push_back(task);
+    std::thread(sim_task_main, task).detach();
+    return task;
+}
+
+/* Runs timeline actions, also the context of controller callbacks and ISRs */
+static void sim_world_task(void *arg) {
+    for (;;) {
+        std::function<void()> action;
+        {
+            kernel_lock_t lock(kernel.lock);
+            sim_block_until(lock, [] {
+                return !kernel.timeline.empty() && (kernel.timeline.begin()->first <= now_us.load());
+            }, SIM_FOREVER);
+            auto next = kernel.timeline.begin();
+            action = std::move(next->second);
+            kernel.timeline.erase(next);
+        }
+        action();
+    }
+}
+
+/* Simulation control *********************************************************/
+
+uint64_t sim_now_us(void) {
+    return now_us.load();
+}
+
+void sim_at_us(uint64_t t_us, std::function<void()> action) {
+    kernel_lock_t lock(kernel.lock);
+
+    if (kernel.world == NULL) {
+        kernel.world = sim_task_create(sim_world_task, "world", NULL, SIM_WORLD_PRIORITY);
+    }
+    kernel.timeline.emplace(t_us, std::move(action));
+    sim_preempt(lock);
+}
+
+void sim_at_ms(uint64_t t_ms, std::function<void()> action) {
+    sim_at_us(t_ms * 1000, std::move(action));
+}
+
+void sim_run_until_us(uint64_t t_us) {
+    kernel_lock_t lock(kernel.lock);
+    uint32_t picks = 0;
+
+    for (;;) {
+        sim_task *task = sim_pick();
+        if (task != NULL) {
+            if (++picks > SIM_LIVELOCK_PICKS) {
+                fprintf(stderr, "sim: livelock at %llu us, tasks keep running without time passing:\n",
+                        (unsigned long long) now_us.load());
+                for (sim_task *t : kernel.tasks) {
+                    fprintf(stderr, "  %s priority %u %s\n", t->name.c_str(), t->priority,
+                            t->done ? "done" : (t->blocked ? "blocked" : "ready"));
+                }
+                abort();
+            }
+            kernel.running = task;
+            task->cv.notify_one();
+            kernel.scheduler_cv.wait(lock, [] { return kernel.running == NULL; });
+            continue;
+        }
+
+        uint64_t next = sim_next_wake_us();
+        if (next > t_us) {
+            if (t_us > now_us.load()) {
+                now_us.store(t_us);
+            }
+            return;
+        }
+        if (next > now_us.load()) {
+            now_us.store(next);
+            picks = 0;
+        }
+    }
+}
+
+void sim_run_for_ms(uint32_t ms) {
+    sim_run_until_us(now_us.load() + (uint64_t) ms * 1000);
+}
+
+bool sim_run_until(std::function<bool()> done, uint32_t timeout_ms) {
+    for (uint32_t ms = 0; ms <= timeout_ms; ms++) {
+        if (done()) {
+            return true;
+        }
+        sim_run_for_ms(1);
+    }
+    return done();
+}
+
+/* Blocks the calling task for a bus transfer or similar */
+void sim_sleep_us(uint64_t us) {
+    kernel_lock_t lock(kernel.lock);
+    sim_block_until(lock, nullptr, now_us.load() + us);
+}
+
+/* FreeRTOS ********************************************************************/
+
+void vPortEnterCritical(portMUX_TYPE *mux) {
+    while (__atomic_exchange_n(&mux->owner, 1, __ATOMIC_ACQUIRE)) {
+        std::this_thread::yield();
+    }
+}
+
+void vPortExitCritical(portMUX_TYPE *mux) {
+    __atomic_store_n(&mux->owner, 0, __ATOMIC_RELEASE);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id) {
+    kernel_lock_t lock(kernel.lock);
+    sim_task *task = sim_task_create(code, name, arg, priority);
+
+    if (created_task != NULL) {
+        *created_task = task;
+    }
+    sim_preempt(lock);
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return self;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    kernel_lock_t lock(kernel.lock);
+
+    if (!sim_in_task()) {
+        lock.unlock();
+        std::this_thread::yield();
+        return;
+    }
+    if (ticks == 0) {
+        /* Yield to tasks of the same priority */
+        self->seq = ++kernel.seq;
+        sim_switch_out(lock, self);
+        return;
+    }
+    sim_block(lock, nullptr, ticks);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(now_us.load() / (1000 * portTICK_PERIOD_MS));
+}
+
+static void sim_notify(sim_task *task, uint32_t value, eNotifyAction action) {
+    switch (action) {
+        case eSetBits:
+            task->notify_value |= value;
+            break;
+        case eIncrement:
+            task->notify_value++;
+            break;
+        case eSetValueWithOverwrite:
+            task->notify_value = value;
+            break;
+        case eSetValueWithoutOverwrite:
+            if (!task->notify_pending) {
+                task->notify_value = value;
+            }
+            break;
+        default:
+            break;
+    }
+    task->notify_pending = true;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+    kernel_lock_t lock(kernel.lock);
+    sim_notify(task, value, action);
+    sim_preempt(lock);
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t *woken) {
+    kernel_lock_t lock(kernel.lock);
+    sim_notify(task, value, action);
+    if (woken != NULL) {
+        *woken = pdTRUE;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks) {
+    kernel_lock_t lock(kernel.lock);
+    sim_task *task = self;
+
+    if (task == NULL) {
+        return pdFALSE;
+    }
+    if (!task->notify_pending) {
+        task->notify_value &= ~clear_on_entry;
+    }
+    bool notified = sim_block(lock, [task] { return task->notify_pending; }, ticks);
+    if (value != NULL) {
+        *value = task->notify_value;
+    }
+    if (notified) {
+        task->notify_value &= ~clear_on_exit;
+        task->notify_pending = false;
+    }
+    return notified ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    return xTaskNotify(task, 0, eIncrement);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+    xTaskNotifyFromISR(task, 0, eIncrement, woken);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+    kernel_lock_t lock(kernel.lock);
+    sim_task *task = self;
+
+    if (task == NULL) {
+        return 0;
+    }
+    sim_block(lock, [task] { return task->notify_value != 0; }, ticks);
+
+    uint32_t value = task->notify_value;
+    if (value != 0) {
+        task->notify_value = clear_on_exit ? 0 : value - 1;
+    }
+    task->notify_pending = false;
+    return value;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    sim_queue *queue = new sim_queue;
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+static void sim_queue_push(sim_queue *queue, const void *item) {
+    const uint8_t *bytes = (const uint8_t *) item;
+    queue->items.emplace_back(bytes, bytes + queue->item_size);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    kernel_lock_t lock(kernel.lock);
+
+    if (!sim_block(lock, [queue] { return queue->items.size() < queue->length; }, ticks)) {
+        return errQUEUE_FULL;
+    }
+    sim_queue_push(queue, item);
+    sim_preempt(lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken) {
+    kernel_lock_t lock(kernel.lock);
+
+    if (queue->items.size() >= queue->length) {
+        return errQUEUE_FULL;
+    }
+    sim_queue_push(queue, item);
+    if (woken != NULL) {
+        *woken = pdTRUE;
+    }
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks) {
+    kernel_lock_t lock(kernel.lock);
+
+    if (!sim_block(lock, [queue] { return !queue->items.empty(); }, ticks)) {
+        return errQUEUE_EMPTY;
+    }
+    memcpy(buffer, queue->items.front().data(), queue->item_size);
+    queue->items.pop_front();
+    sim_preempt(lock);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    kernel_lock_t lock(kernel.lock);
+    return queue->items.size();
+}
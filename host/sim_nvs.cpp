@@ -0,0 +1,145 @@
+/* Preferences stand-in: NVS namespaces in memory, written through to a file
+ * when one is set so a later run sees what an earlier boot stored */
+#include <map>
+#include <string>
+#include <vector>
+#include "sim.h"
+#include "Preferences.h"
+
+#define NVS_NAME_MAX_LEN    15
+
+typedef std::map<std::string, std::vector<uint8_t>> nvs_namespace_t;
+
+static std::map<std::string, nvs_namespace_t> nvs;
+static std::string nvs_path;
+static uint32_t nvs_writes = 0;
+
+/* One "namespace key hexbytes" line per entry */
+static void sim_nvs_save(void) {
+    if (nvs_path.empty()) {
+        return;
+    }
+
+    FILE *file = fopen(nvs_path.c_str(), "w");
+    if (file == NULL) {
+        return;
+    }
+    for (auto &space : nvs) {
+        for (auto &entry : space.second) {
+            fprintf(file, "%s %s ", space.first.c_str(), entry.first.c_str());
+            for (uint8_t b : entry.second) {
+                fprintf(file, "%02x", b);
+            }
+            fprintf(file, "\n");
+        }
+    }
+    fclose(file);
+}
+
+void sim_nvs_set_path(const char *path) {
+    char space[NVS_NAME_MAX_LEN + 1];
+    char key[NVS_NAME_MAX_LEN + 1];
+    char hex[1024];
+
+    nvs.clear();
+    nvs_path = (path != NULL) ? path : "";
+    if (nvs_path.empty()) {
+        return;
+    }
+
+    FILE *file = fopen(nvs_path.c_str(), "r");
+    if (file == NULL) {
+        return;
+    }
+    while (fscanf(file, "%15s %15s %1023s", space, key, hex) == 3) {
+        std::vector<uint8_t> value;
+        for (size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+            unsigned b;
+            sscanf(&hex[i], "%2x", &b);
+            value.push_back(b);
+        }
+        nvs[space][key] = value;
+    }
+    fclose(file);
+}
+
+uint32_t sim_nvs_writes(void) {
+    return nvs_writes;
+}
+
+size_t sim_nvs_keys(const char *space) {
+    auto found = nvs.find(space);
+    return (found == nvs.end()) ? 0 : found->second.size();
+}
+
+bool Preferences::begin(const char *space, bool ro, const char *partition) {
+    if ((space == NULL) || (strlen(space) > NVS_NAME_MAX_LEN)) {
+        return false;
+    }
+    strcpy(name, space);
+    read_only = ro;
+    started = true;
+    return true;
+}
+
+void Preferences::end(void) {
+    started = false;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len) {
+    if (!started || read_only || (strlen(key) > NVS_NAME_MAX_LEN)) {
+        return 0;
+    }
+    const uint8_t *bytes = (const uint8_t *) value;
+    nvs[name][key] = std::vector<uint8_t>(bytes, bytes + len);
+    nvs_writes++;
+    sim_nvs_save();
+    return len;
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t len) {
+    if (!started) {
+        return 0;
+    }
+    auto space = nvs.find(name);
+    if (space == nvs.end()) {
+        return 0;
+    }
+    auto entry = space->second.find(key);
+    if ((entry == space->second.end()) || (entry->second.size() > len)) {
+        return 0;
+    }
+    memcpy(buf, entry->second.data(), entry->second.size());
+    return entry->second.size();
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+    auto space = nvs.find(name);
+    if (!started || (space == nvs.end()) || (space->second.count(key) == 0)) {
+        return 0;
+    }
+    return space->second[key].size();
+}
+
+bool Preferences::remove(const char *key) {
+    if (!started || read_only || (nvs[name].erase(key) == 0)) {
+        return false;
+    }
+    nvs_writes++;
+    sim_nvs_save();
+    return true;
+}
+
+bool Preferences::clear(void) {
+    if (!started || read_only) {
+        return false;
+    }
+    nvs[name].clear();
+    nvs_writes++;
+    sim_nvs_save();
+    return true;
+}
+
+bool Preferences::isKey(const char *key) {
+    return getBytesLength(key) > 0;
+}
@@ -0,0 +1,377 @@
+/* I2C bus with an SSD1306 on it, and the Adafruit drivers talking to it.
+ * The panel decodes the command and data streams into its display RAM the
+ * way the controller does in horizontal addressing mode, so tests see what
+ * a real panel would show. */
+#include "sim.h"
+#include "Wire.h"
+#include "Adafruit_SSD1306.h"
+
+#define PANEL_I2C_ADDR      0x3C
+#define PANEL_WIDTH         128
+#define PANEL_PAGES         8
+#define PANEL_CTRL_DATA     0x40    /* D/C bit of the control byte */
+#define I2C_BITS_PER_BYTE   9       /* Eight data bits and the acknowledge */
+
+void sim_sleep_us(uint64_t us);
+
+TwoWire Wire;
+
+typedef struct {
+    uint8_t gddram[PANEL_WIDTH * PANEL_PAGES];
+    uint8_t col_start, col_end, col;
+    uint8_t page_start, page_end, page;
+    bool on;
+    uint8_t cmd[3];         /* Command being assembled, with its parameters */
+    uint8_t cmd_len;
+    uint32_t data_bytes;
+} panel_t;
+
+static panel_t panel = {{0}, 0, PANEL_WIDTH - 1, 0, 0, PANEL_PAGES - 1, 0, false, {0}, 0, 0};
+
+/* Parameter bytes following each command the drivers send */
+static uint8_t panel_cmd_params(uint8_t cmd) {
+    switch (cmd) {
+        case 0x21: case 0x22:
+            return 2;
+        case 0x20: case 0x81: case 0x8D: case 0xA8: case 0xD3:
+        case 0xD5: case 0xD9: case 0xDA: case 0xDB:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void panel_command(const uint8_t *cmd) {
+    switch (cmd[0]) {
+        case 0x21:
+            panel.col_start = cmd[1] & (PANEL_WIDTH - 1);
+            panel.col_end = cmd[2] & (PANEL_WIDTH - 1);
+            panel.col = panel.col_start;
+            break;
+        case 0x22:
+            panel.page_start = cmd[1] & (PANEL_PAGES - 1);
+            panel.page_end = cmd[2] & (PANEL_PAGES - 1);
+            panel.page = panel.page_start;
+            break;
+        case 0xAE:
+            panel.on = false;
+            break;
+        case 0xAF:
+            panel.on = true;
+            break;
+        default:
+            break;
+    }
+}
+
+static void panel_data(uint8_t b) {
+    panel.gddram[panel.page * PANEL_WIDTH + panel.col] = b;
+    panel.data_bytes++;
+    if (panel.col < panel.col_end) {
+        panel.col++;
+        return;
+    }
+    panel.col = panel.col_start;
+    panel.page = (panel.page < panel.page_end) ? panel.page + 1 : panel.page_start;
+}
+
+static void panel_receive(const uint8_t *bytes, size_t len) {
+    if (len == 0) {
+        return;
+    }
+
+    bool data = bytes[0] & PANEL_CTRL_DATA;
+    panel.cmd_len = 0;
+    for (size_t i = 1; i < len; i++) {
+        if (data) {
+            panel_data(bytes[i]);
+            continue;
+        }
+        panel.cmd[panel.cmd_len++] = bytes[i];
+        if (panel.cmd_len > panel_cmd_params(panel.cmd[0])) {
+            panel_command(panel.cmd);
+            panel.cmd_len = 0;
+        }
+    }
+}
+
+const uint8_t *sim_panel_gddram(void) {
+    return panel.gddram;
+}
+
+bool sim_panel_pixel(uint8_t x, uint8_t y) {
+    return (panel.gddram[(y / 8) * PANEL_WIDTH + x] >> (y % 8)) & 1;
+}
+
+bool sim_panel_is_on(void) {
+    return panel.on;
+}
+
+uint32_t sim_panel_data_bytes(void) {
+    return panel.data_bytes;
+}
+
+/* Eight rows of column x starting at row y */
+static uint8_t panel_column(uint8_t x, uint8_t y) {
+    uint8_t column = 0;
+
+    for (uint8_t row = 0; row < 8; row++) {
+        column |= sim_panel_pixel(x, y + row) << row;
+    }
+    return column;
+}
+
+/* Column of a text cell as drawn opaque at the given size */
+static uint8_t text_column(const char *text, uint8_t size, int x, uint8_t row_band) {
+    int cell = x / (6 * size);
+    int col = (x % (6 * size)) / size;
+    uint8_t glyph = (col < 5) ? sim_font_column(text[cell], col) : 0;
+    uint8_t column = 0;
+
+    for (uint8_t row = 0; row < 8; row++) {
+        uint8_t glyph_row = (row_band * 8 + row) / size;
+        column |= ((glyph >> glyph_row) & 1) << row;
+    }
+    return column;
+}
+
+bool sim_panel_has_text(const char *text, uint8_t size) {
+    int width = strlen(text) * 6 * size;
+    int height = 8 * size;
+
+    for (int y = 0; y + height <= PANEL_PAGES * 8; y++) {
+        for (int x = 0; x + width <= PANEL_WIDTH; x++) {
+            for (uint8_t inverted = 0; inverted <= 1; inverted++) {
+                bool match = true;
+                for (int band = 0; match && (band < size); band++) {
+                    for (int i = 0; match && (i < width); i++) {
+                        uint8_t want = text_column(text, size, i, band);
+                        match = (panel_column(x + i, y + band * 8) == (inverted ? (uint8_t) ~want : want));
+                    }
+                }
+                if (match) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+/* Wire ***********************************************************************/
+
+bool TwoWire::begin(void) {
+    return true;
+}
+
+void TwoWire::setClock(uint32_t frequency) {
+    clock = frequency;
+}
+
+uint32_t TwoWire::getClock(void) {
+    return clock;
+}
+
+uint32_t sim_wire_clock(void) {
+    return Wire.getClock();
+}
+
+void TwoWire::beginTransmission(uint8_t addr) {
+    address = addr;
+    length = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if (length >= I2C_BUFFER_LENGTH) {
+        return 0;
+    }
+    buffer[length++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t len) {
+    size_t written = 0;
+
+    while ((written < len) && write(data[written])) {
+        written++;
+    }
+    return written;
+}
+
+/* The calling task waits for the bytes to go out, address byte included */
+uint8_t TwoWire::endTransmission(bool send_stop) {
+    sim_sleep_us((uint64_t)(length + 1) * I2C_BITS_PER_BYTE * 1000000 / clock);
+    if (address != PANEL_I2C_ADDR) {
+        return 2;   /* Address not acknowledged */
+    }
+    panel_receive(buffer, length);
+    return 0;
+}
+
+/* Adafruit_GFX ***************************************************************/
+
+/* A generated font: a fixed pattern per character, blank space, row 7 free
+ * like the classic font */
+uint8_t sim_font_column(uint8_t c, uint8_t col) {
+    if (c == ' ') {
+        return 0;
+    }
+    uint32_t h = (c * 2654435761u) ^ ((col + 1) * 40503u);
+    h ^= h >> 15;
+    h *= 2246822519u;
+    h ^= h >> 13;
+    return (h & 0x7F) | ((col == 2) ? 0x01 : 0);
+}
+
+void Adafruit_GFX::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+    for (int16_t i = x; i < x + w; i++) {
+        for (int16_t j = y; j < y + h; j++) {
+            drawPixel(i, j, color);
+        }
+    }
+}
+
+void Adafruit_GFX::drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg, uint8_t size) {
+    if ((x >= _width) || (y >= _height) || ((x + 6 * size - 1) < 0) || ((y + 8 * size - 1) < 0)) {
+        return;
+    }
+
+    for (int8_t i = 0; i < 5; i++) {
+        uint8_t line = sim_font_column(c, i);
+        for (int8_t j = 0; j < 8; j++, line >>= 1) {
+            if (line & 1) {
+                fillRect(x + i * size, y + j * size, size, size, color);
+            }
+            else if (bg != color) {
+                fillRect(x + i * size, y + j * size, size, size, bg);
+            }
+        }
+    }
+    if (bg != color) {
+        /* Opaque text also draws the spacing column */
+        fillRect(x + 5 * size, y, size, 8 * size, bg);
+    }
+}
+
+size_t Adafruit_GFX::write(uint8_t c) {
+    if (c == '\n') {
+        cursor_x = 0;
+        cursor_y += textsize * 8;
+    }
+    else if (c != '\r') {
+        if (wrap && ((cursor_x + textsize * 6) > _width)) {
+            cursor_x = 0;
+            cursor_y += textsize * 8;
+        }
+        drawChar(cursor_x, cursor_y, c, textcolor, textbgcolor, textsize);
+        cursor_x += textsize * 6;
+    }
+    return 1;
+}
+
+size_t Adafruit_GFX::print(const char *text) {
+    size_t n = 0;
+
+    while (*text) {
+        n += write((uint8_t) *text++);
+    }
+    return n;
+}
+
+/* Adafruit_SSD1306 ***********************************************************/
+
+Adafruit_SSD1306::Adafruit_SSD1306(uint8_t w, uint8_t h, TwoWire *twi, int8_t rst_pin,
+                                   uint32_t clk_during, uint32_t clk_after)
+    : Adafruit_GFX(w, h), wire(twi), clk_during(clk_during), clk_after(clk_after) {
+}
+
+Adafruit_SSD1306::~Adafruit_SSD1306() {
+    free(buffer);
+}
+
+void Adafruit_SSD1306::commands(const uint8_t *c, uint8_t n) {
+    wire->beginTransmission(i2caddr);
+    wire->write((uint8_t) 0x00);
+    for (uint8_t i = 0; i < n; i++) {
+        wire->write(c[i]);
+    }
+    wire->endTransmission();
+}
+
+void Adafruit_SSD1306::ssd1306_command(uint8_t c) {
+    commands(&c, 1);
+}
+
+bool Adafruit_SSD1306::begin(uint8_t switchvcc, uint8_t addr, bool reset, bool periph_begin) {
+    static const uint8_t init[] = {
+        SSD1306_DISPLAYOFF, 0xD5, 0x80, 0xA8, (uint8_t)(_height - 1), 0xD3, 0x00, 0x40,
+        0x8D, 0x14, SSD1306_MEMORYMODE, 0x00, 0xA1, 0xC8, 0xDA, 0x12, 0x81, 0xCF,
+        0xD9, 0xF1, 0xDB, 0x40, 0xA4, 0xA6, 0x2E, SSD1306_DISPLAYON,
+    };
+
+    if ((buffer == NULL) && ((buffer = (uint8_t *) malloc(_width * ((_height + 7) / 8))) == NULL)) {
+        return false;
+    }
+    clearDisplay();
+    if (addr != 0) {
+        i2caddr = addr;
+    }
+    if (periph_begin) {
+        wire->begin();
+    }
+
+    wire->setClock(clk_during);
+    commands(init, sizeof(init));
+    wire->setClock(clk_after);
+    return true;
+}
+
+void Adafruit_SSD1306::clearDisplay(void) {
+    memset(buffer, 0, _width * ((_height + 7) / 8));
+}
+
+void Adafruit_SSD1306::drawPixel(int16_t x, int16_t y, uint16_t color) {
+    if ((x < 0) || (x >= _width) || (y < 0) || (y >= _height)) {
+        return;
+    }
+
+    uint8_t *b = &buffer[x + (y / 8) * _width];
+    uint8_t bit = 1 << (y & 7);
+    switch (color) {
+        case WHITE:
+            *b |= bit;
+            break;
+        case BLACK:
+            *b &= ~bit;
+            break;
+        case INVERSE:
+            *b ^= bit;
+            break;
+    }
+}
+
+/* Whole buffer, in transactions as long as the Wire buffer allows */
+void Adafruit_SSD1306::display(void) {
+    const uint8_t window[] = {SSD1306_PAGEADDR, 0, 0xFF, SSD1306_COLUMNADDR, 0, (uint8_t)(_width - 1)};
+    uint16_t count = _width * ((_height + 7) / 8);
+    const uint8_t *p = buffer;
+
+    wire->setClock(clk_during);
+    commands(window, sizeof(window));
+
+    wire->beginTransmission(i2caddr);
+    wire->write((uint8_t) 0x40);
+    uint16_t bytes_out = 1;
+    while (count--) {
+        if (bytes_out >= I2C_BUFFER_LENGTH) {
+            wire->endTransmission();
+            wire->beginTransmission(i2caddr);
+            wire->write((uint8_t) 0x40);
+            bytes_out = 1;
+        }
+        wire->write(*p++);
+        bytes_out++;
+    }
+    wire->endTransmission();
+    wire->setClock(clk_after);
+}
@@ -0,0 +1,18 @@
+/* The sketch itself, run by the Arduino loop task as the core does */
+#include "../AirSticker_Controller.ino"
+#include "sim.h"
+
+#define SIM_LOOP_TASK_STACK     8192
+#define SIM_LOOP_TASK_PRIORITY  1
+
+static void sim_loop_task(void *arg) {
+    setup();
+    while (true) {
+        loop();
+    }
+}
+
+void sim_start_sketch(void) {
+    xTaskCreatePinnedToCore(sim_loop_task, "loopTask", SIM_LOOP_TASK_STACK, NULL, SIM_LOOP_TASK_PRIORITY, NULL,
+                            CONFIG_ARDUINO_RUNNING_CORE);
+}
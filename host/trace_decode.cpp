@@ -0,0 +1,308 @@
+#include <string.h>
+#include <stdlib.h>
+#include "trace_decode.h"
+
+typedef struct {
+    uint16_t value;
+    const char *name;
+} trace_name_t;
+
+/* Names as trace_dump() prints them, in enum order */
+static const char *event_names[TRACE_EVENT_COUNT] = {
+    "GAP",
+    "GATTC",
+    "SCREEN",
+    "SELECT",
+    "LINK_REQUEST",
+    "LINK_CONNECTED",
+    "LINK_READY",
+    "CMD_DONE",
+    "LINK_CLOSED",
+};
+
+static const char *phase_names[TRACE_PHASE_COUNT] = {
+    "connect",
+    "discovery",
+    "first_write",
+    "total",
+};
+
+/* esp_gap_ble_cb_event_t and esp_gattc_cb_event_t as numbered by ESP-IDF
+ * 4.4, the stand-in headers only declare what the sketch uses */
+static const trace_name_t gap_names[] = {
+    {0, "ADV_DATA_SET_COMPLETE"},
+    {1, "SCAN_RSP_DATA_SET_COMPLETE"},
+    {2, "SCAN_PARAM_SET_COMPLETE"},
+    {3, "SCAN_RESULT"},
+    {4, "ADV_DATA_RAW_SET_COMPLETE"},
+    {5, "SCAN_RSP_DATA_RAW_SET_COMPLETE"},
+    {6, "ADV_START_COMPLETE"},
+    {7, "SCAN_START_COMPLETE"},
+    {8, "AUTH_CMPL"},
+    {9, "KEY"},
+    {10, "SEC_REQ"},
+    {11, "PASSKEY_NOTIF"},
+    {12, "PASSKEY_REQ"},
+    {13, "OOB_REQ"},
+    {14, "LOCAL_IR"},
+    {15, "LOCAL_ER"},
+    {16, "NC_REQ"},
+    {17, "ADV_STOP_COMPLETE"},
+    {18, "SCAN_STOP_COMPLETE"},
+    {19, "SET_STATIC_RAND_ADDR"},
+    {20, "UPDATE_CONN_PARAMS"},
+    {21, "SET_PKT_LENGTH_COMPLETE"},
+    {22, "SET_LOCAL_PRIVACY_COMPLETE"},
+    {23, "REMOVE_BOND_DEV_COMPLETE"},
+    {24, "CLEAR_BOND_DEV_COMPLETE"},
+    {25, "GET_BOND_DEV_COMPLETE"},
+    {26, "READ_RSSI_COMPLETE"},
+    {27, "UPDATE_WHITELIST_COMPLETE"},
+};
+
+static const trace_name_t gattc_names[] = {
+    {0, "REG"},
+    {1, "UNREG"},
+    {2, "OPEN"},
+    {3, "READ_CHAR"},
+    {4, "WRITE_CHAR"},
+    {5, "CLOSE"},
+    {6, "SEARCH_CMPL"},
+    {7, "SEARCH_RES"},
+    {8, "READ_DESCR"},
+    {9, "WRITE_DESCR"},
+    {10, "NOTIFY"},
+    {11, "PREP_WRITE"},
+    {12, "EXEC"},
+    {13, "ACL"},
+    {14, "CANCEL_OPEN"},
+    {15, "SRVC_CHG"},
+    {17, "ENC_CMPL_CB"},
+    {18, "CFG_MTU"},
+    {24, "CONGEST"},
+    {38, "REG_FOR_NOTIFY"},
+    {39, "UNREG_FOR_NOTIFY"},
+    {40, "CONNECT"},
+    {41, "DISCONNECT"},
+    {42, "READ_MULTIPLE"},
+    {43, "QUEUE_FULL"},
+    {44, "SET_ASSOC"},
+    {45, "GET_ADDR_LIST"},
+    {46, "DIS_SRVC_CMPL"},
+};
+
+static const char *trace_lookup(const trace_name_t *names, size_t count, uint16_t value) {
+    for (size_t i = 0; i < count; i++) {
+        if (names[i].value == value) {
+            return names[i].name;
+        }
+    }
+    return NULL;
+}
+
+const char *trace_decode_event_name(uint8_t id) {
+    return (id < TRACE_EVENT_COUNT) ? event_names[id] : "?";
+}
+
+const char *trace_decode_phase_name(uint8_t phase) {
+    return (phase < TRACE_PHASE_COUNT) ? phase_names[phase] : "?";
+}
+
+const char *trace_decode_gap_name(uint16_t event) {
+    return trace_lookup(gap_names, sizeof(gap_names) / sizeof(gap_names[0]), event);
+}
+
+const char *trace_decode_gattc_name(uint16_t event) {
+    return trace_lookup(gattc_names, sizeof(gattc_names) / sizeof(gattc_names[0]), event);
+}
+
+void trace_decode_init(trace_decode_t *dec) {
+    dec->records.clear();
+    memset(dec->hist, 0, sizeof(dec->hist));
+    memset(dec->device_hist, 0, sizeof(dec->device_hist));
+    dec->has_device_hist = false;
+    dec->skipped = 0;
+}
+
+/* Event by name, or by number for dumps from before the names */
+static int trace_parse_event(const char *text) {
+    for (int id = 0; id < TRACE_EVENT_COUNT; id++) {
+        if (strcmp(text, event_names[id]) == 0) {
+            return id;
+        }
+    }
+    char *end;
+    long id = strtol(text, &end, 10);
+    return ((*end == '\0') && (end != text) && (id >= 0) && (id < TRACE_EVENT_COUNT)) ? id : -1;
+}
+
+static bool trace_parse_hist(trace_decode_t *dec, const char *line) {
+    char phase_text[24];
+    int used;
+
+    if (sscanf(line, "H %23s%n", phase_text, &used) != 1) {
+        return false;
+    }
+    for (int phase = 0; phase < TRACE_PHASE_COUNT; phase++) {
+        if (strcmp(phase_text, phase_names[phase]) != 0) {
+            continue;
+        }
+        const char *p = line + used;
+        for (int bucket = 0; bucket < TRACE_HIST_BUCKETS; bucket++) {
+            unsigned count;
+            if (sscanf(p, " %u%n", &count, &used) != 1) {
+                return false;
+            }
+            dec->device_hist[phase][bucket] = count;
+            p += used;
+        }
+        dec->has_device_hist = true;
+        return true;
+    }
+    return false;
+}
+
+/* Serial carries log lines between and around dumps, they are counted and
+ * left out */
+void trace_decode_line(trace_decode_t *dec, const char *line) {
+    unsigned us;
+    unsigned arg;
+    char event[24];
+
+    if (sscanf(line, "T %u %23s %u", &us, event, &arg) == 3) {
+        int id = trace_parse_event(event);
+        if (id >= 0) {
+            trace_decoded_t rec = { (uint32_t) us, (uint8_t) id, (uint16_t) arg };
+            dec->records.push_back(rec);
+            return;
+        }
+    }
+    else if (trace_parse_hist(dec, line)) {
+        return;
+    }
+    else if ((line[0] == '#') || (line[0] == '\n') || (line[0] == '\0') || (strncmp(line, "TRACE ", 6) == 0)) {
+        return;
+    }
+    dec->skipped++;
+}
+
+void trace_decode_file(trace_decode_t *dec, FILE *file) {
+    char line[256];
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        trace_decode_line(dec, line);
+    }
+    trace_decode_finish(dec);
+}
+
+/* Same as trace_hist_add() and trace_milestone() in trace.cpp */
+static void trace_hist_add(trace_decode_t *dec, uint8_t phase, uint32_t from_us, uint32_t to_us) {
+    uint32_t ms = (to_us - from_us) / 1000;
+    uint8_t bucket = 0;
+
+    while ((bucket < TRACE_HIST_BUCKETS - 1) && ((ms + 1) >> (bucket + 1))) {
+        bucket++;
+    }
+    dec->hist[phase][bucket]++;
+}
+
+void trace_decode_finish(trace_decode_t *dec) {
+    typedef struct {
+        uint32_t request_us;
+        uint32_t connected_us;
+        uint32_t ready_us;
+        bool wrote;
+    } link_t;
+    link_t links[BLE_MAX_LINKS] = {};
+
+    memset(dec->hist, 0, sizeof(dec->hist));
+    for (const trace_decoded_t &rec : dec->records) {
+        if ((rec.id < TRACE_LINK_REQUEST) || (rec.arg >= BLE_MAX_LINKS)) {
+            continue;
+        }
+        link_t *t = &links[rec.arg];
+        switch (rec.id) {
+            case TRACE_LINK_REQUEST:
+                *t = {};
+                t->request_us = rec.us;
+                break;
+            case TRACE_LINK_CONNECTED:
+                if (t->request_us && !t->connected_us) {
+                    t->connected_us = rec.us;
+                    trace_hist_add(dec, TRACE_PHASE_CONNECT, t->request_us, rec.us);
+                }
+                break;
+            case TRACE_LINK_READY:
+                if (t->connected_us && !t->ready_us) {
+                    t->ready_us = rec.us;
+                    trace_hist_add(dec, TRACE_PHASE_DISCOVERY, t->connected_us, rec.us);
+                    trace_hist_add(dec, TRACE_PHASE_TOTAL, t->request_us, rec.us);
+                }
+                break;
+            case TRACE_CMD_DONE:
+                if (t->ready_us && !t->wrote) {
+                    t->wrote = true;
+                    trace_hist_add(dec, TRACE_PHASE_FIRST_WRITE, t->ready_us, rec.us);
+                }
+                break;
+            case TRACE_LINK_CLOSED:
+                *t = {};
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void trace_print_hist(const uint32_t hist[TRACE_PHASE_COUNT][TRACE_HIST_BUCKETS], FILE *out) {
+    for (int phase = 0; phase < TRACE_PHASE_COUNT; phase++) {
+        fprintf(out, "  %s\n", phase_names[phase]);
+        for (int bucket = 0; bucket < TRACE_HIST_BUCKETS; bucket++) {
+            if (hist[phase][bucket] == 0) {
+                continue;
+            }
+            uint32_t low = (1u << bucket) - 1;
+            if (bucket == TRACE_HIST_BUCKETS - 1) {
+                fprintf(out, "    %6u ms and up   %u\n", low, hist[phase][bucket]);
+            }
+            else {
+                fprintf(out, "    %6u-%-6u ms  %u\n", low, (2u << bucket) - 2, hist[phase][bucket]);
+            }
+        }
+    }
+}
+
+void trace_decode_print(const trace_decode_t *dec, FILE *out) {
+    uint32_t first_us = dec->records.empty() ? 0 : dec->records[0].us;
+
+    for (const trace_decoded_t &rec : dec->records) {
+        const char *detail = NULL;
+        if (rec.id == TRACE_GAP_EVT) {
+            detail = trace_decode_gap_name(rec.arg);
+        }
+        else if (rec.id == TRACE_GATTC_EVT) {
+            detail = trace_decode_gattc_name(rec.arg);
+        }
+
+        fprintf(out, "%10.3f ms  %-14s ", (rec.us - first_us) / 1000.0, event_names[rec.id]);
+        if (detail != NULL) {
+            fprintf(out, "%s\n", detail);
+        }
+        else if (rec.id >= TRACE_LINK_REQUEST) {
+            fprintf(out, "link %u\n", rec.arg);
+        }
+        else {
+            fprintf(out, "%u\n", rec.arg);
+        }
+    }
+
+    fprintf(out, "Phases in this dump:\n");
+    trace_print_hist(dec->hist, out);
+    if (dec->has_device_hist) {
+        fprintf(out, "Phases since boot:\n");
+        trace_print_hist(dec->device_hist, out);
+    }
+    if (dec->skipped > 0) {
+        fprintf(out, "%u other lines skipped\n", dec->skipped);
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+/* Host side of trace.cpp: reads what trace_dump() printed on Serial back
+ * into records, names the GAP and GATTC events, and rebuilds the per-phase
+ * latency histograms from the records the same way the firmware does. */
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "trace.h"
+
+typedef struct {
+    uint32_t us;
+    uint8_t id;
+    uint16_t arg;
+} trace_decoded_t;
+
+typedef struct {
+    std::vector<trace_decoded_t> records;
+    uint32_t hist[TRACE_PHASE_COUNT][TRACE_HIST_BUCKETS];          /* Rebuilt from the records */
+    uint32_t device_hist[TRACE_PHASE_COUNT][TRACE_HIST_BUCKETS];   /* "H" lines, since boot */
+    bool has_device_hist;
+    uint32_t skipped;       /* Lines that were not part of a dump */
+} trace_decode_t;
+
+void trace_decode_init(trace_decode_t *dec);
+void trace_decode_line(trace_decode_t *dec, const char *line);
+void trace_decode_file(trace_decode_t *dec, FILE *file);
+void trace_decode_finish(trace_decode_t *dec);     /* Rebuilds hist[] */
+
+const char *trace_decode_event_name(uint8_t id);
+const char *trace_decode_phase_name(uint8_t phase);
+const char *trace_decode_gap_name(uint16_t event);     /* NULL when unknown */
+const char *trace_decode_gattc_name(uint16_t event);
+void trace_decode_print(const trace_decode_t *dec, FILE *out);
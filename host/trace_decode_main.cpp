@@ -0,0 +1,17 @@
+/* trace_decode [dump]: prints a trace_dump() capture from the file or
+ * stdin with event names and the phase histograms */
+#include "trace_decode.h"
+
+int main(int argc, char **argv) {
+    FILE *file = stdin;
+    trace_decode_t dec;
+
+    if ((argc > 1) && ((file = fopen(argv[1], "r")) == NULL)) {
+        perror(argv[1]);
+        return 1;
+    }
+    trace_decode_init(&dec);
+    trace_decode_file(&dec, file);
+    trace_decode_print(&dec, stdout);
+    return 0;
+}
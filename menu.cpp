@@ -0,0 +1,63 @@
+#include <Arduino.h>
+#include "app_config.h"
+#include "menu.h"
+
+static const menu_option_t menu_action_options[] = {
+    {"  GPIO",      MENU_ACT_GOTO, SCREEN_CONTROL_GPIO, NULL, MENU_FIELD_NONE, 0},
+    {"  BLE",       MENU_ACT_GOTO, SCREEN_CONTROL_BLE,  NULL, MENU_FIELD_NONE, 0},
+    {"  [ Back ]",  MENU_ACT_GOTO, SCREEN_DEVICE_LIST,  NULL, MENU_FIELD_NONE, 0},
+};
+
+static const menu_option_t menu_gpio_options[] = {
+    {"  OFF",       MENU_ACT_SEND, 0,              "OUTPUTS:0", MENU_FIELD_GPIO_STATE, 0},
+    {"  ON",        MENU_ACT_SEND, 0,              "OUTPUTS:1", MENU_FIELD_GPIO_STATE, 1},
+    {"  [ Back ]",  MENU_ACT_GOTO, SCREEN_ACTIONS, NULL,        MENU_FIELD_NONE,       0},
+};
+
+static const menu_option_t menu_ble_options[] = {
+    {"  OFF",         MENU_ACT_SEND, 0,                "BLE_DELAY:-1", MENU_FIELD_BLE_DELAY, -1},
+    {"  ON",          MENU_ACT_SEND, 0,                "BLE_DELAY:0",  MENU_FIELD_BLE_DELAY, 0},
+    {"  ON w/Delay",  MENU_ACT_GOTO, SCREEN_SET_DELAY, NULL,           MENU_FIELD_NONE,      0},
+    {"  [ Back ]",    MENU_ACT_GOTO, SCREEN_ACTIONS,   NULL,           MENU_FIELD_NONE,      0},
+};
+
+static const menu_option_t menu_delay_options[] = {
+    {"   [ OK ]",   MENU_ACT_SEND_DELAY, SCREEN_CONTROL_BLE, NULL, MENU_FIELD_NONE, 0},
+    {"   [ Back ]", MENU_ACT_GOTO,       SCREEN_CONTROL_BLE, NULL, MENU_FIELD_NONE, 0},
+};
+
+static const menu_option_t menu_error_options[] = {
+    {"  [ Back ]",  MENU_ACT_GOTO, SCREEN_PING, NULL, MENU_FIELD_NONE, 0},
+};
+
+#define MENU_OPTIONS(options)   options, sizeof(options) / sizeof(options[0])
+
+const menu_screen_t menu_screens[SCREEN_COUNT] = {
+    /* SCREEN_PING */
+    {"Ping", {{0, 14, 1, "Devices"}, {0, 26, 1, "Select = Ping"}}, 2,
+     NULL, 0, 0, 0, SCREEN_PING, 0},
+    /* SCREEN_SCANNING */
+    {"Scanning...", {}, 0,
+     NULL, 0, 0, 0, SCREEN_PING, 0},
+    /* SCREEN_DEVICE_LIST, rows come from the tag list */
+    {NULL, {{0, 14, 1, "Pick a device"}}, 1,
+     NULL, 0, 0, 0, SCREEN_PING, 0},
+    /* SCREEN_ACTIONS */
+    {"Actions", {}, 0,
+     MENU_OPTIONS(menu_action_options), 0, 24, SCREEN_DEVICE_LIST, MENU_NEEDS_LINK | MENU_SHOWS_DEVICE},
+    /* SCREEN_CONTROL_GPIO */
+    {"GPIO", {}, 0,
+     MENU_OPTIONS(menu_gpio_options), 0, 32, SCREEN_ACTIONS, MENU_SHOWS_DEVICE},
+    /* SCREEN_CONTROL_BLE */
+    {"BLE", {}, 0,
+     MENU_OPTIONS(menu_ble_options), 0, 32, SCREEN_ACTIONS, MENU_SHOWS_DEVICE},
+    /* SCREEN_SET_DELAY, the four digits come before the options */
+    {"DELAY (minutes)", {{0, 12, 1, "Pick digit, Up/Down +/-"}, {40, 26, 2, ":"}}, 2,
+     MENU_OPTIONS(menu_delay_options), DELAY_CONTROL_OK, 44, SCREEN_CONTROL_BLE, 0},
+    /* SCREEN_BLE_ERROR */
+    {"ERROR", {{0, 14, 1, "Error: "}}, 1,
+     MENU_OPTIONS(menu_error_options), 0, 32, SCREEN_PING, 0},
+};
+
+static_assert(sizeof(menu_delay_options) / sizeof(menu_delay_options[0]) == DELAY_MENU_COUNT - DELAY_CONTROL_OK,
+              "Delay options out of sync with DELAY_CONTROL_OK");
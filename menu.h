@@ -0,0 +1,56 @@
+#pragma once
+
+#include "display.h"
+
+/* Screen flow as data: the static content of every screen, its options and
+ * where they lead. Input handling and the renderer both walk this table. */
+enum {
+    MENU_ACT_GOTO = 0,      /* Enter target */
+    MENU_ACT_SEND,          /* Send command, on success field = value */
+    MENU_ACT_SEND_DELAY,    /* Send the delay being edited, then enter target */
+};
+
+enum {
+    MENU_FIELD_NONE = 0,
+    MENU_FIELD_GPIO_STATE,
+    MENU_FIELD_BLE_DELAY,
+};
+
+#define MENU_NEEDS_LINK     (1 << 0)    /* Options need the tag connected */
+#define MENU_SHOWS_DEVICE   (1 << 1)    /* "Device: <name>" on the line below the title */
+#define MENU_MAX_LABELS     2
+
+typedef struct {
+    const char *label;
+    uint8_t action;
+    uint8_t target;
+    const char *command;
+    uint8_t field;
+    int8_t value;
+} menu_option_t;
+
+typedef struct {
+    int16_t x;
+    int16_t y;
+    uint8_t size;
+    const char *text;
+} menu_label_t;
+
+typedef struct {
+    const char *title;          /* NULL when the title changes per frame */
+    menu_label_t labels[MENU_MAX_LABELS];
+    uint8_t label_count;
+    const menu_option_t *options;
+    uint8_t option_count;
+    uint8_t option_first;       /* selected_index of the first option, lower ones are screen specific */
+    int16_t option_y;
+    uint8_t back;               /* Where holding Select leads */
+    uint8_t flags;
+} menu_screen_t;
+
+/* Defined once in menu.cpp, read-only so it stays in flash */
+extern const menu_screen_t menu_screens[SCREEN_COUNT];
+
+static inline uint8_t menu_index_count(uint8_t screen_id) {
+    return menu_screens[screen_id].option_first + menu_screens[screen_id].option_count;
+}
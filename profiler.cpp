@@ -0,0 +1,148 @@
+#include <Arduino.h>
+#include "app_config.h"
+#include "profiler.h"
+
+#if PROFILE_ENABLED
+
+/* Loop period histogram: 4 buckets per power of two of microseconds */
+#define PROFILE_HIST_SUB      4
+#define PROFILE_HIST_BUCKETS  (32 * PROFILE_HIST_SUB)
+
+typedef struct {
+    uint64_t total;
+    uint32_t max;
+} profile_stage_stat_t;
+
+static const char *stage_names[PROFILE_STAGE_COUNT] = {
+    "bsp",
+    "ui",
+    "state",
+    "display",
+};
+
+static profile_stage_stat_t stages[PROFILE_STAGE_COUNT];
+static uint32_t stage_cycles[PROFILE_STAGE_COUNT];   /* Current loop */
+static uint32_t hist[PROFILE_HIST_BUCKETS];
+static uint32_t loops = 0;
+static uint64_t period_total_us = 0;
+static uint32_t period_min_us = UINT32_MAX;
+static uint32_t period_max_us = 0;
+static uint32_t stalls = 0;
+static uint8_t last_stall_stage = PROFILE_STAGE_COUNT;
+static uint32_t last_stall_us = 0;
+
+static uint32_t loop_start = 0;
+static uint32_t stage_start = 0;
+static bool running = false;
+
+static uint8_t profile_bucket(uint32_t us) {
+    if (us < PROFILE_HIST_SUB) {
+        return us;
+    }
+
+    uint8_t msb = 31 - __builtin_clz(us);
+    uint8_t sub = (us >> (msb - 2)) & (PROFILE_HIST_SUB - 1);
+    return msb * PROFILE_HIST_SUB + sub;
+}
+
+/* Lower bound of a bucket, in microseconds */
+static uint32_t profile_bucket_us(uint8_t bucket) {
+    if (bucket < PROFILE_HIST_SUB) {
+        return bucket;
+    }
+
+    uint8_t msb = bucket / PROFILE_HIST_SUB;
+    uint8_t sub = bucket % PROFILE_HIST_SUB;
+    return (1u << msb) | ((uint32_t) sub << (msb - 2));
+}
+
+static void profile_account_loop(uint32_t now) {
+    uint32_t us = (now - loop_start) / ESP.getCpuFreqMHz();
+
+    loops++;
+    period_total_us += us;
+    if (us < period_min_us) period_min_us = us;
+    if (us > period_max_us) period_max_us = us;
+    hist[profile_bucket(us)]++;
+
+    uint8_t worst = 0;
+    for (uint8_t i = 0; i < PROFILE_STAGE_COUNT; i++) {
+        stages[i].total += stage_cycles[i];
+        if (stage_cycles[i] > stages[i].max) stages[i].max = stage_cycles[i];
+        if (stage_cycles[i] > stage_cycles[worst]) worst = i;
+    }
+
+    if (us > PROFILE_STALL_US) {
+        stalls++;
+        last_stall_us = us;
+        last_stall_stage = worst;
+    }
+}
+
+void profile_loop_begin(void) {
+    uint32_t now = CURRENT_CYCLES();
+
+    if (running) {
+        profile_account_loop(now);
+    }
+    memset(stage_cycles, 0, sizeof(stage_cycles));
+    loop_start = now;
+    stage_start = now;
+    running = true;
+}
+
+void profile_loop_end(void) {
+    if (running) {
+        profile_account_loop(CURRENT_CYCLES());
+        running = false;
+    }
+}
+
+void profile_stage(uint8_t stage) {
+    uint32_t now = CURRENT_CYCLES();
+    stage_cycles[stage] += now - stage_start;
+    stage_start = now;
+}
+
+void profile_dump(void) {
+    uint32_t mhz = ESP.getCpuFreqMHz();
+
+    if (loops == 0) {
+        LOG_PRINTLN("PROFILE no loops");
+        return;
+    }
+
+    /* p99 from the histogram */
+    uint32_t target = loops - loops / 100;
+    uint32_t seen = 0;
+    uint32_t p99_us = 0;
+    for (uint8_t i = 0; i < PROFILE_HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen >= target) {
+            p99_us = profile_bucket_us(i);
+            break;
+        }
+    }
+
+    LOG_PRINTF("PROFILE loops %u period us min %u avg %u max %u p99 >= %u\n",
+               loops, period_min_us, (uint32_t)(period_total_us / loops), period_max_us, p99_us);
+    for (uint8_t i = 0; i < PROFILE_STAGE_COUNT; i++) {
+        LOG_PRINTF("PROFILE %-8s avg %u us max %u us\n", stage_names[i],
+                   (uint32_t)(stages[i].total / loops / mhz), stages[i].max / mhz);
+    }
+    if (stalls > 0) {
+        LOG_PRINTF("PROFILE stalls %u over %u us, last %u us in %s\n",
+                   stalls, PROFILE_STALL_US, last_stall_us, stage_names[last_stall_stage]);
+    }
+
+    memset(stages, 0, sizeof(stages));
+    memset(hist, 0, sizeof(hist));
+    loops = 0;
+    period_total_us = 0;
+    period_min_us = UINT32_MAX;
+    period_max_us = 0;
+    stalls = 0;
+    running = false;
+}
+
+#endif
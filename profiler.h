@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include "app_config.h"
+
+/* Main loop profiler: cycles per stage, loop period statistics and stalls */
+enum {
+    PROFILE_STAGE_BSP = 0,
+    PROFILE_STAGE_UI,
+    PROFILE_STAGE_STATE,
+    PROFILE_STAGE_DISPLAY,
+    PROFILE_STAGE_COUNT,
+};
+
+#if PROFILE_ENABLED
+void profile_loop_begin(void);
+void profile_stage(uint8_t stage);  /* Closes a stage, the next starts here */
+void profile_loop_end(void);        /* Before blocking, keeps idle time out */
+void profile_dump(void);            /* Prints and resets the statistics */
+#else
+#define profile_loop_begin()
+#define profile_stage(stage)
+#define profile_loop_end()
+#define profile_dump()
+#endif
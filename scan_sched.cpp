@@ -0,0 +1,129 @@
+#include "app_config.h"
+#include "scan_sched.h"
+
+#define SCAN_SCHED_DURATION_MS  (GAP_SCAN_DURATION * 1000)
+
+static_assert((SCAN_WINDOW_MIN >= 4) && (SCAN_WINDOW_MIN <= SCAN_WINDOW) && (SCAN_WINDOW <= SCAN_INTERVAL),
+              "Scan windows must fit in the interval, a duty step takes at least one unit off");
+static_assert((SCAN_IDLE_WINDOW_MIN >= SCAN_WINDOW_MIN) && (SCAN_IDLE_WINDOW_MIN <= SCAN_WINDOW),
+              "The idle window floor must be within the scan windows");
+
+/* Time left until a period that began at since_ms is over */
+static uint32_t scan_sched_remaining(uint32_t since_ms, uint32_t period_ms, uint32_t now_ms) {
+    uint32_t elapsed = now_ms - since_ms;
+    return (elapsed < period_ms) ? period_ms - elapsed : 0;
+}
+
+void scan_duty_start(scan_duty_t *duty, uint32_t now_ms, uint16_t count, uint16_t max, uint16_t min) {
+    duty->window = max;
+    duty->max = max;
+    duty->min = min;
+    duty->count = count;
+    duty->step_ms = now_ms;
+}
+
+bool scan_duty_update(scan_duty_t *duty, uint32_t now_ms, uint16_t count) {
+    uint16_t window = duty->window;
+
+    if (count > duty->count) {
+        duty->window = duty->max;
+        duty->step_ms = now_ms;
+    }
+    else if ((duty->window > duty->min) && ((now_ms - duty->step_ms) >= SCAN_DUTY_STEP_MS)) {
+        /* Nothing new lately, spend less time listening */
+        duty->window -= duty->window / 4;
+        if (duty->window < duty->min) {
+            duty->window = duty->min;
+        }
+        duty->step_ms = now_ms;
+    }
+    duty->count = count;
+
+    return duty->window != window;
+}
+
+uint32_t scan_duty_next_deadline_ms(const scan_duty_t *duty, uint32_t now_ms) {
+    if (duty->window <= duty->min) {
+        return UINT32_MAX;
+    }
+    return scan_sched_remaining(duty->step_ms, SCAN_DUTY_STEP_MS, now_ms);
+}
+
+void scan_sched_start(scan_sched_t *sched, uint32_t now_ms, uint16_t count, bool adaptive) {
+    memset(sched, 0, sizeof(*sched));
+    sched->state = SCAN_SCHED_RUNNING;
+    sched->count = count;
+    /* Listen all the time until tags stop showing up */
+    if (adaptive) {
+        scan_duty_start(&sched->duty, now_ms, count, SCAN_INTERVAL, SCAN_WINDOW_MIN);
+    }
+    else {
+        scan_duty_start(&sched->duty, now_ms, count, SCAN_WINDOW, SCAN_WINDOW);
+    }
+    sched->start_ms = now_ms;
+    sched->growth_ms = now_ms;
+    sched->update_ms = now_ms;
+}
+
+bool scan_sched_update(scan_sched_t *sched, uint32_t now_ms, uint16_t count, uint16_t listening) {
+    if (sched->state != SCAN_SCHED_RUNNING) {
+        return false;
+    }
+
+    /* Only time the radio actually scanned counts, not a stop to switch
+     * parameters or a one-shot scan that already ended */
+    sched->radio_on_acc += (uint64_t)(now_ms - sched->update_ms) * listening;
+    sched->update_ms = now_ms;
+
+    /* Tags expiring do not count, only new ones */
+    if (count > sched->count) {
+        sched->count = count;
+        sched->growth_ms = now_ms;
+    }
+
+    if ((SCAN_TARGET_COUNT > 0) && (sched->count >= SCAN_TARGET_COUNT)) {
+        sched->state = SCAN_SCHED_DONE_TARGET;
+    }
+    else if ((sched->count > 0) && ((now_ms - sched->growth_ms) >= SCAN_QUIET_MS)) {
+        sched->state = SCAN_SCHED_DONE_QUIET;
+    }
+    else if ((now_ms - sched->start_ms) >= SCAN_SCHED_DURATION_MS) {
+        sched->state = SCAN_SCHED_DONE_TIMEOUT;
+    }
+
+    if (sched->state != SCAN_SCHED_RUNNING) {
+        sched->complete_ms = now_ms - sched->start_ms;
+        return false;
+    }
+    return scan_duty_update(&sched->duty, now_ms, sched->count);
+}
+
+bool scan_sched_is_running(const scan_sched_t *sched) {
+    return sched->state == SCAN_SCHED_RUNNING;
+}
+
+uint32_t scan_sched_next_deadline_ms(const scan_sched_t *sched, uint32_t now_ms) {
+    uint32_t timeout;
+    uint32_t deadline;
+
+    if (sched->state != SCAN_SCHED_RUNNING) {
+        return UINT32_MAX;
+    }
+
+    timeout = scan_sched_remaining(sched->start_ms, SCAN_SCHED_DURATION_MS, now_ms);
+    if (sched->count > 0) {
+        deadline = scan_sched_remaining(sched->growth_ms, SCAN_QUIET_MS, now_ms);
+        if (deadline < timeout) timeout = deadline;
+    }
+    deadline = scan_duty_next_deadline_ms(&sched->duty, now_ms);
+    if (deadline < timeout) timeout = deadline;
+    return timeout;
+}
+
+uint32_t scan_sched_radio_on_ms(const scan_sched_t *sched) {
+    return (uint32_t)(sched->radio_on_acc / SCAN_INTERVAL);
+}
+
+uint8_t scan_sched_duty_percent(const scan_sched_t *sched) {
+    return (uint8_t)((uint32_t) sched->duty.window * 100 / SCAN_INTERVAL);
+}
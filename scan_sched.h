@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Scan scheduler: decides from the tag count over time how hard to scan and
+ * when the list is complete. Pure logic, the caller passes the time in and
+ * applies the window, so it runs the same on recorded advert traces. */
+
+enum {
+    SCAN_SCHED_IDLE = 0,
+    SCAN_SCHED_RUNNING,
+    SCAN_SCHED_DONE_QUIET,     /* No new tag for SCAN_QUIET_MS */
+    SCAN_SCHED_DONE_TARGET,    /* SCAN_TARGET_COUNT tags known */
+    SCAN_SCHED_DONE_TIMEOUT,   /* Ran for GAP_SCAN_DURATION */
+};
+
+/* Listening duty: max right after a new tag, a quarter less every
+ * SCAN_DUTY_STEP_MS without one, down to min. Every change restarts the
+ * scan, so steps are coarse. */
+typedef struct {
+    uint16_t window;           /* In 0.625 ms units, out of SCAN_INTERVAL */
+    uint16_t max;
+    uint16_t min;
+    uint16_t count;            /* Tags at the last update */
+    uint32_t step_ms;          /* Last window change or new tag */
+} scan_duty_t;
+
+typedef struct {
+    uint8_t state;
+    uint16_t count;            /* Most tags known at once during this scan */
+    scan_duty_t duty;
+    uint32_t start_ms;
+    uint32_t growth_ms;        /* Last time the count grew */
+    uint32_t update_ms;
+    uint32_t complete_ms;      /* Time to complete list, once done */
+    uint64_t radio_on_acc;     /* Milliseconds scanning times the window */
+} scan_sched_t;
+
+void scan_duty_start(scan_duty_t *duty, uint32_t now_ms, uint16_t count, uint16_t max, uint16_t min);
+bool scan_duty_update(scan_duty_t *duty, uint32_t now_ms, uint16_t count);  /* True when the window changed */
+uint32_t scan_duty_next_deadline_ms(const scan_duty_t *duty, uint32_t now_ms);
+
+void scan_sched_start(scan_sched_t *sched, uint32_t now_ms, uint16_t count, bool adaptive);
+/* listening is the window the radio used since the last update, 0 while
+ * stopped. True when the wanted window changed. */
+bool scan_sched_update(scan_sched_t *sched, uint32_t now_ms, uint16_t count, uint16_t listening);
+bool scan_sched_is_running(const scan_sched_t *sched);
+uint32_t scan_sched_next_deadline_ms(const scan_sched_t *sched, uint32_t now_ms);
+uint32_t scan_sched_radio_on_ms(const scan_sched_t *sched);
+uint8_t scan_sched_duty_percent(const scan_sched_t *sched);
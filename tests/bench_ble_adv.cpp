@@ -0,0 +1,94 @@
+/* Cost of the "ATS" filter per advert: parse a scan result and test the
+ * name, for the kinds of adverts a busy site delivers */
+#include <string.h>
+#include <vector>
+#include "esp_gap_ble_api.h"
+#include "ble_adv.h"
+#include "test.h"
+
+#define BENCH_RUNS  2000000
+
+typedef struct {
+    const char *label;
+    uint8_t data[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+    uint8_t adv_len;
+    uint8_t rsp_len;
+    bool is_tag;
+} bench_adv_t;
+
+static uint8_t ad_put(uint8_t *data, uint8_t pos, uint8_t type, const void *value, uint8_t len) {
+    data[pos] = len + 1;
+    data[pos + 1] = type;
+    memcpy(&data[pos + 2], value, len);
+    return pos + 2 + len;
+}
+
+static std::vector<bench_adv_t> bench_adverts(void) {
+    static const uint8_t flags = 0x06;
+    static const uint8_t apple[] = {0x4C, 0x00, 0x10, 0x07, 0x3B, 0x1F, 0x1C, 0x2A, 0x4E, 0x51, 0x38};
+    static const uint8_t ibeacon[] = {0x4C, 0x00, 0x02, 0x15, 0xE2, 0xC5, 0x6D, 0xB5, 0xDF, 0xFB, 0x48, 0xD2, 0xB0,
+                                      0x60, 0xD0, 0xF5, 0xA7, 0x10, 0x96, 0xE0, 0x00, 0x01, 0x00, 0x02, 0xC5};
+    static const uint8_t uuid16[] = {0x6F, 0xFD};
+    std::vector<bench_adv_t> adverts;
+    bench_adv_t adv;
+
+    memset(&adv, 0, sizeof(adv));
+    adv.label = "tag, name in advert";
+    adv.adv_len = ad_put(adv.data, 0, BLE_AD_TYPE_FLAGS, &flags, 1);
+    adv.adv_len = ad_put(adv.data, adv.adv_len, BLE_AD_TYPE_NAME_CMPL, "ATS-0A1B", 8);
+    adv.is_tag = true;
+    adverts.push_back(adv);
+
+    memset(&adv, 0, sizeof(adv));
+    adv.label = "tag, name in response";
+    adv.adv_len = ad_put(adv.data, 0, BLE_AD_TYPE_FLAGS, &flags, 1);
+    adv.adv_len = ad_put(adv.data, adv.adv_len, BLE_AD_TYPE_UUID16_CMPL, uuid16, 2);
+    adv.rsp_len = ad_put(&adv.data[adv.adv_len], 0, BLE_AD_TYPE_NAME_CMPL, "ATS-0A1C", 8);
+    adv.is_tag = true;
+    adverts.push_back(adv);
+
+    memset(&adv, 0, sizeof(adv));
+    adv.label = "phone, manufacturer data";
+    adv.adv_len = ad_put(adv.data, 0, BLE_AD_TYPE_FLAGS, &flags, 1);
+    adv.adv_len = ad_put(adv.data, adv.adv_len, BLE_AD_TYPE_MANUFACTURER, apple, sizeof(apple));
+    adverts.push_back(adv);
+
+    memset(&adv, 0, sizeof(adv));
+    adv.label = "iBeacon";
+    adv.adv_len = ad_put(adv.data, 0, BLE_AD_TYPE_FLAGS, &flags, 1);
+    adv.adv_len = ad_put(adv.data, adv.adv_len, BLE_AD_TYPE_MANUFACTURER, ibeacon, sizeof(ibeacon));
+    adverts.push_back(adv);
+
+    memset(&adv, 0, sizeof(adv));
+    adv.label = "other named device";
+    adv.adv_len = ad_put(adv.data, 0, BLE_AD_TYPE_FLAGS, &flags, 1);
+    adv.adv_len = ad_put(adv.data, adv.adv_len, BLE_AD_TYPE_UUID16_CMPL, uuid16, 2);
+    adv.rsp_len = ad_put(&adv.data[adv.adv_len], 0, BLE_AD_TYPE_NAME_CMPL, "Galaxy Buds2 Pro", 16);
+    adverts.push_back(adv);
+
+    return adverts;
+}
+
+static bool is_tag(const bench_adv_t *adv) {
+    ble_adv_info_t info;
+
+    ble_adv_parse(adv->data, adv->adv_len, adv->rsp_len, sizeof(adv->data), &info);
+    return ble_ad_field_has_prefix(&info.name, "ATS");
+}
+
+int main(void) {
+    std::vector<bench_adv_t> adverts = bench_adverts();
+    volatile uint32_t tags = 0;
+
+    for (auto &adv : adverts) {
+        CHECK(is_tag(&adv) == adv.is_tag);
+
+        uint64_t start = test_now_ns();
+        for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+            tags = tags + is_tag(&adv);
+        }
+        printf("%-26s %6.1f ns per advert\n", adv.label, (double)(test_now_ns() - start) / BENCH_RUNS);
+    }
+
+    return test_report("bench_ble_adv");
+}
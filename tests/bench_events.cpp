@@ -0,0 +1,75 @@
+/* Main loop wake-ups per second while idle, with nothing in range and with
+ * tags advertising, and button to redraw latency on the device list. The
+ * host build has no CONFIG_PM_ENABLE, like the stock Arduino core: waits
+ * are not cut to EVENT_PM_POLL_MS. */
+#include <algorithm>
+#include <vector>
+#include "sim.h"
+#include "app_config.h"
+#include "events.h"
+#include "test.h"
+
+#define BENCH_IDLE_MS       10000
+#define BENCH_TAGS          8
+#define BENCH_TAGS_FROM_MS  20000
+#define BENCH_PRESSES       20
+#define PRESS_MS            80
+
+static double idle_wakeups_per_second(void) {
+    uint32_t wakeups = events_get_wakeups();
+
+    sim_run_for_ms(BENCH_IDLE_MS);
+    return (events_get_wakeups() - wakeups) * 1000.0 / BENCH_IDLE_MS;
+}
+
+int main(void) {
+    for (int i = 0; i < BENCH_TAGS; i++) {
+        sim_advertiser_t adv;
+        char bda[24];
+        char name[16];
+
+        snprintf(bda, sizeof(bda), "c0:00:00:00:00:%02x", i);
+        snprintf(name, sizeof(name), "ATS-%d", i);
+        sim_advertiser_defaults(&adv, bda, name);
+        adv.rssi = -50 - 3 * i;
+        adv.start_ms = BENCH_TAGS_FROM_MS;
+        sim_ble_add_advertiser(&adv);
+    }
+
+    sim_start_sketch();
+    sim_run_until_us(3000 * 1000);
+    CHECK(sim_panel_has_text("Ping"));
+
+    double empty = idle_wakeups_per_second();
+    sim_run_until_us((BENCH_TAGS_FROM_MS + 2000) * 1000ull);
+    double tags = idle_wakeups_per_second();
+    /* Nothing to do on the ping screen but deadlines and BLE events */
+    CHECK(empty < 1.0);
+    CHECK(tags < 20.0);
+
+    sim_button_press(BUTTON_SELECT_PIN, sim_now_us() / 1000 + 1, PRESS_MS);
+    CHECK(sim_run_until([] { return sim_panel_has_text("1. ATS-0"); }, 1000));
+    sim_run_for_ms(500);
+
+    std::vector<uint32_t> latencies;
+    for (int i = 0; i < BENCH_PRESSES; i++) {
+        uint8_t pin = (i % 8 < 4) ? BUTTON_DOWN_PIN : BUTTON_UP_PIN;
+
+        sim_button_press(pin, sim_now_us() / 1000 + 1 + i % 7, PRESS_MS);
+        sim_run_for_ms(PRESS_MS + 200);
+        uint32_t latency = events_get_input_latency(NULL);
+        CHECK(latency > 0);
+        latencies.push_back(latency);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    uint32_t median = latencies[latencies.size() / 2];
+    uint32_t worst = latencies.back();
+    CHECK(worst < 100000);
+
+    printf("idle, nothing in range: %.2f wakeups/s\n", empty);
+    printf("idle, %d tags advertising: %.2f wakeups/s\n", BENCH_TAGS, tags);
+    printf("button to redraw over %d presses: median %.1f ms, max %.1f ms\n",
+           BENCH_PRESSES, median / 1000.0, worst / 1000.0);
+
+    return test_report("bench_events");
+}
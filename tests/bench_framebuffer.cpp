@@ -0,0 +1,121 @@
+/* Framebuffer word ops against Adafruit_GFX on the same buffer layout: the
+ * menu highlight bar, a filled rectangle and starting a frame. The per-glyph
+ * column is how the sketch used to draw a selected row, text included. */
+#include <string.h>
+#include "Adafruit_SSD1306.h"
+#include "framebuffer.h"
+#include "test.h"
+
+#define BENCH_ROUNDS    20000
+#define BENCH_ROW       "  ON w/Delay         "   /* A full 21 character menu row */
+
+static Adafruit_SSD1306 panel(SCREEN_WIDTH, SCREEN_HEIGHT);
+static uint8_t template_fb[FB_SIZE];
+
+static double bench_ns(uint64_t start) {
+    return (double)(test_now_ns() - start) / BENCH_ROUNDS;
+}
+
+/* Selected row at y: the band inverted in place, the band inverted pixel by
+ * pixel, and the row printed black on white */
+static void bench_highlight(int16_t y) {
+    uint8_t *fb = panel.getBuffer();
+    uint64_t start;
+
+    start = test_now_ns();
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        fb_invert_rows(fb, y, 8);
+    }
+    double words_ns = bench_ns(start);
+
+    start = test_now_ns();
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        panel.fillRect(0, y, SCREEN_WIDTH, 8, INVERSE);
+    }
+    double pixels_ns = bench_ns(start);
+
+    panel.setTextSize(1);
+    panel.setTextWrap(false);
+    start = test_now_ns();
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        panel.setTextColor(BLACK, WHITE);
+        panel.setCursor(0, y);
+        panel.print(BENCH_ROW);
+        panel.setTextColor(WHITE, BLACK);
+    }
+    double glyphs_ns = bench_ns(start);
+
+    printf("highlight y=%-2d   %8.1f ns %10.1f ns %10.1f ns %7.1fx\n",
+           y, words_ns, pixels_ns, glyphs_ns, glyphs_ns / words_ns);
+}
+
+static void bench_fill(int16_t x, int16_t y, int16_t w, int16_t h) {
+    uint8_t *fb = panel.getBuffer();
+    uint64_t start;
+
+    start = test_now_ns();
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        fb_fill_rect(fb, x, y, w, h);
+        fb_clear_rect(fb, x, y, w, h);
+    }
+    double words_ns = bench_ns(start) / 2;
+
+    start = test_now_ns();
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        panel.fillRect(x, y, w, h, WHITE);
+        panel.fillRect(x, y, w, h, BLACK);
+    }
+    double pixels_ns = bench_ns(start) / 2;
+
+    printf("fill %3dx%-2d      %8.1f ns %10.1f ns %13s %7.1fx\n", w, h, words_ns, pixels_ns, "-", pixels_ns / words_ns);
+}
+
+/* A frame starts from its template instead of a cleared buffer */
+static void bench_frame_start(void) {
+    uint8_t *fb = panel.getBuffer();
+    uint64_t start;
+
+    start = test_now_ns();
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        fb_copy_pages(fb, template_fb, 0, FB_PAGES);
+    }
+    double copy_ns = bench_ns(start);
+
+    start = test_now_ns();
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        panel.clearDisplay();
+    }
+    double clear_ns = bench_ns(start);
+
+    start = test_now_ns();
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        panel.fillScreen(BLACK);
+    }
+    double pixels_ns = bench_ns(start);
+
+    printf("frame start      %8.1f ns %10.1f ns %10.1f ns (copy, clearDisplay, fillScreen)\n",
+           copy_ns, clear_ns, pixels_ns);
+}
+
+int main(void) {
+    CHECK(panel.begin(SSD1306_SWITCHCAPVCC, 0x3C));
+    for (uint16_t i = 0; i < FB_SIZE; i++) {
+        template_fb[i] = i * 37;
+    }
+
+    printf("%-16s %11s %13s %13s %8s\n", "", "words", "per pixel", "per glyph", "speedup");
+    bench_highlight(24);
+    bench_highlight(22);
+    bench_fill(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    bench_fill(13, 21, 40, 12);
+    bench_frame_start();
+
+    /* Same pixels both ways */
+    uint8_t expected[FB_SIZE];
+    memcpy(expected, panel.getBuffer(), FB_SIZE);
+    panel.fillRect(3, 5, 70, 30, INVERSE);
+    fb_invert_rect(expected, 3, 5, 70, 30);
+    CHECK(memcmp(expected, panel.getBuffer(), FB_SIZE) == 0);
+
+    return test_report("bench_framebuffer");
+}
@@ -0,0 +1,108 @@
+/* Tags configured per minute of simulated time: each tag is connected,
+ * sent one command and closed, with one link at a time and with up to
+ * BLE_MAX_LINKS at once. Every run uses tags nothing has discovered yet,
+ * so both pay for discovery over the air. */
+#include "app_config.h"
+#include "bluetooth.h"
+#include "sim.h"
+#include "test.h"
+
+#define BENCH_TAGS  12
+
+typedef struct {
+    int tag;            /* -1: free */
+    int link;
+    bool sent;
+    bool closed;
+} bench_slot_t;
+
+static void bench_bda(int run, int tag, uint8_t *bda) {
+    char text[24];
+
+    snprintf(text, sizeof(text), "c0:00:00:00:%02x:%02x", run, tag);
+    sim_parse_bda(text, bda);
+}
+
+static void bench_add_tags(int run) {
+    for (int i = 0; i < BENCH_TAGS; i++) {
+        sim_peripheral_t periph;
+        char text[24];
+
+        snprintf(text, sizeof(text), "c0:00:00:00:%02x:%02x", run, i);
+        sim_peripheral_defaults(&periph, text);
+        sim_ble_add_peripheral(&periph);
+    }
+}
+
+/* Returns the simulated ms it took to configure every tag */
+static uint32_t bench_configure(int run, int width) {
+    bench_slot_t slots[BLE_MAX_LINKS];
+    int next = 0;
+    int done = 0;
+    uint64_t start = sim_now_us();
+
+    for (bench_slot_t &slot : slots) {
+        slot.tag = -1;
+    }
+
+    bool finished = sim_run_until([&] {
+        for (int i = 0; i < width; i++) {
+            bench_slot_t *slot = &slots[i];
+            uint8_t bda[ESP_BD_ADDR_LEN];
+
+            if (slot->tag < 0) {
+                if (next == BENCH_TAGS) {
+                    continue;
+                }
+                bench_bda(run, next, bda);
+                slot->link = bluetooth_link_open(bda, BLE_ADDR_TYPE_RANDOM);
+                if (slot->link == BLUETOOTH_LINK_NONE) {
+                    continue;   /* A closed link is not free yet */
+                }
+                slot->tag = next++;
+                slot->sent = false;
+                slot->closed = false;
+            }
+
+            bench_bda(run, slot->tag, bda);
+            if (!slot->sent) {
+                slot->sent = bluetooth_link_send(slot->link, "CFG");
+            }
+            else if (!slot->closed && !sim_ble_received(bda).empty()) {
+                bluetooth_link_close(slot->link);
+                slot->closed = true;
+            }
+            else if (slot->closed && !sim_ble_is_connected(bda)) {
+                CHECK(!bluetooth_link_take_error(slot->link));
+                slot->tag = -1;
+                done++;
+            }
+        }
+        return done == BENCH_TAGS;
+    }, 60000);
+
+    CHECK(finished);
+    return (sim_now_us() - start) / 1000;
+}
+
+int main(void) {
+    /* Tags share one firmware, the stack cache would serve every tag after
+     * the first from its table; it is left out to compare the links alone */
+    sim_ble_set_stack_cache(false);
+    bench_add_tags(1);
+    bench_add_tags(2);
+
+    bluetooth_init();
+    sim_run_for_ms(1000);
+
+    uint32_t single_ms = bench_configure(1, 1);
+    sim_run_for_ms(1000);
+    uint32_t multi_ms = bench_configure(2, BLE_MAX_LINKS);
+
+    CHECK(multi_ms < single_ms);
+    printf("%d tags, 1 link: %u ms, %.1f tags/min\n", BENCH_TAGS, single_ms, BENCH_TAGS * 60000.0 / single_ms);
+    printf("%d tags, %d links: %u ms, %.1f tags/min, %.2fx\n", BENCH_TAGS, BLE_MAX_LINKS, multi_ms,
+           BENCH_TAGS * 60000.0 / multi_ms, (double) single_ms / multi_ms);
+
+    return test_report("bench_links");
+}
@@ -0,0 +1,143 @@
+/* Scan results from a crowd replayed through the GAP callback, with the
+ * reject cache and with every foreign advert parsed as before it. Host
+ * cycles are nanoseconds, so the callback's own counters give the time.
+ * A crowd that fits the cache and one that thrashes it. */
+#include <vector>
+#include "../bluetooth.cpp"
+#include "test.h"
+
+#define BENCH_CALLBACKS     1000000
+#define BENCH_TAGS          8
+
+typedef struct {
+    esp_bd_addr_t bda;
+    uint8_t data[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+    uint8_t adv_len;
+    uint8_t rsp_len;
+    esp_ble_evt_type_t evt_type;
+    bool is_tag;
+} bench_advertiser_t;
+
+static uint32_t bench_rand = 1;
+
+static uint32_t bench_next(void) {
+    bench_rand = bench_rand * 1103515245 + 12345;
+    return bench_rand >> 8;
+}
+
+static uint8_t ad_put(uint8_t *data, uint8_t pos, uint8_t type, const void *value, uint8_t len) {
+    data[pos] = len + 1;
+    data[pos + 1] = type;
+    memcpy(&data[pos + 2], value, len);
+    return pos + 2 + len;
+}
+
+/* Tags, phones with manufacturer data and a scan response name, beacons
+ * without a name that never connect */
+static std::vector<bench_advertiser_t> bench_crowd(uint32_t foreign) {
+    static const uint8_t flags = 0x06;
+    static const uint8_t apple[] = {0x4C, 0x00, 0x10, 0x07, 0x3B, 0x1F, 0x1C, 0x2A, 0x4E, 0x51, 0x38};
+    std::vector<bench_advertiser_t> crowd(BENCH_TAGS + foreign);
+    char name[24];
+
+    for (uint32_t i = 0; i < crowd.size(); i++) {
+        bench_advertiser_t *adv = &crowd[i];
+        memset(adv, 0, sizeof(*adv));
+        adv->bda[0] = 0xC0;
+        adv->bda[1] = i >> 8;
+        adv->bda[2] = i;
+        adv->bda[5] = i * 37;
+        adv->adv_len = ad_put(adv->data, 0, BLE_AD_TYPE_FLAGS, &flags, 1);
+        adv->evt_type = ESP_BLE_EVT_CONN_ADV;
+        adv->is_tag = (i < BENCH_TAGS);
+
+        if (adv->is_tag) {
+            snprintf(name, sizeof(name), "ATS-%04u", i);
+            adv->adv_len = ad_put(adv->data, adv->adv_len, BLE_AD_TYPE_NAME_CMPL, name, strlen(name));
+        }
+        else if (i % 2) {
+            snprintf(name, sizeof(name), "Phone %u", i);
+            adv->adv_len = ad_put(adv->data, adv->adv_len, BLE_AD_TYPE_MANUFACTURER, apple, sizeof(apple));
+            adv->rsp_len = ad_put(&adv->data[adv->adv_len], 0, BLE_AD_TYPE_NAME_CMPL, name, strlen(name));
+        }
+        else {
+            adv->adv_len = ad_put(adv->data, adv->adv_len, BLE_AD_TYPE_MANUFACTURER, apple, sizeof(apple));
+            adv->evt_type = ESP_BLE_EVT_NON_CONN_ADV;
+        }
+    }
+    return crowd;
+}
+
+static void bench_callback(const bench_advertiser_t *adv) {
+    esp_ble_gap_cb_param_t param;
+
+    memset(&param.scan_rst, 0, sizeof(param.scan_rst));
+    param.scan_rst.search_evt = ESP_GAP_SEARCH_INQ_RES_EVT;
+    memcpy(param.scan_rst.bda, adv->bda, sizeof(esp_bd_addr_t));
+    param.scan_rst.ble_addr_type = BLE_ADDR_TYPE_RANDOM;
+    param.scan_rst.ble_evt_type = adv->evt_type;
+    param.scan_rst.rssi = -60;
+    param.scan_rst.adv_data_len = adv->adv_len;
+    param.scan_rst.scan_rsp_len = adv->rsp_len;
+    memcpy(param.scan_rst.ble_adv, adv->data, adv->adv_len + adv->rsp_len);
+    bluetooth_gap_handle(ESP_GAP_BLE_SCAN_RESULT_EVT, &param);
+
+    /* Nobody drains the advert ring here */
+    if (adv->is_tag) {
+        adv_queue_release(adv_queue_peek(ADV_QUEUE_SIZE));
+    }
+}
+
+/* Returns the ns spent on foreign adverts */
+static uint64_t bench_replay(const std::vector<bench_advertiser_t> &crowd, const std::vector<uint32_t> &order,
+                             bool cached, adv_reject_stats_t *stats) {
+    memset(adv_reject_cache, 0, sizeof(adv_reject_cache));
+    memset(&adv_reject_stats, 0, sizeof(adv_reject_stats));
+
+    for (uint32_t i : order) {
+        if (!cached) {
+            adv_reject_cache[bda_hash(crowd[i].bda, ADV_REJECT_CACHE_BITS)].used = false;
+        }
+        bench_callback(&crowd[i]);
+    }
+    adv_reject_stats_read(stats);
+    return stats->hit_cycles + stats->reject_cycles;
+}
+
+static void bench_crowd_size(uint32_t foreign) {
+    std::vector<bench_advertiser_t> crowd = bench_crowd(foreign);
+    std::vector<uint32_t> order(BENCH_CALLBACKS);
+    uint32_t foreign_callbacks = 0;
+
+    for (uint32_t &i : order) {
+        i = bench_next() % crowd.size();
+        foreign_callbacks += !crowd[i].is_tag;
+    }
+
+    adv_reject_stats_t parsed;
+    adv_reject_stats_t cached;
+    uint64_t parsed_ns = bench_replay(crowd, order, false, &parsed);
+    uint64_t cached_ns = bench_replay(crowd, order, true, &cached);
+
+    CHECK(parsed.hits == 0);
+    CHECK(parsed.rejects == foreign_callbacks);
+    CHECK(cached.hits + cached.rejects == foreign_callbacks);
+    if (foreign <= ADV_REJECT_CACHE_SIZE / 2) {
+        CHECK(cached.hits * 10 > foreign_callbacks * 9);
+    }
+
+    printf("%4u foreign advertisers: %5.1f%% hits, %u evictions, %6.1f ns per foreign advert, %6.1f parsed, %5.1f ms saved per 100k\n",
+           foreign, cached.hits * 100.0 / foreign_callbacks, cached.evictions,
+           (double) cached_ns / foreign_callbacks, (double) parsed_ns / foreign_callbacks,
+           ((double) parsed_ns - cached_ns) / foreign_callbacks * 100000 / 1e6);
+}
+
+int main(void) {
+    ble_queue = xQueueCreate(BLE_TASK_QUEUE_SIZE, sizeof(ble_msg_t));
+
+    bench_crowd_size(24);
+    bench_crowd_size(ADV_REJECT_CACHE_SIZE);
+    bench_crowd_size(512);
+
+    return test_report("bench_reject_cache");
+}
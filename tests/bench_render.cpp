@@ -0,0 +1,50 @@
+/* Frame composition per screen, in frames per second of host time: the
+ * templates and glyph cache against drawing everything through Adafruit_GFX
+ * as the reference does. The bus is not part of it, see test_display_flush. */
+#include "../display.cpp"
+#include "sim.h"
+#include "render_ref.h"
+
+#define BENCH_STATUSES  64      /* Made up front, cycled through */
+#define BENCH_FRAMES    20000   /* Per screen and renderer */
+
+system_status_t system_status;
+static const char *screen_names[] = SCREEN_NAMES;
+
+static system_status_t statuses[BENCH_STATUSES];
+
+static double bench_fps(void (*render)(system_status_t *)) {
+    uint64_t start = test_now_ns();
+
+    for (uint32_t frame = 0; frame < BENCH_FRAMES; frame++) {
+        render(&statuses[frame % BENCH_STATUSES]);
+    }
+    return BENCH_FRAMES * 1e9 / (test_now_ns() - start);
+}
+
+static void bench_reference(system_status_t *status) {
+    ref_render(status);
+}
+
+int main(void) {
+    display_init();
+    sim_run_for_ms(100 * 1000);
+
+    printf("%-20s %12s %12s %8s\n", "screen", "frames/s", "reference", "speedup");
+    for (uint8_t id = 0; id < SCREEN_COUNT; id++) {
+        for (uint32_t i = 0; i < BENCH_STATUSES; i++) {
+            ref_random_status(&statuses[i], id);
+        }
+        double fps = bench_fps(display_render);
+        double ref_fps = bench_fps(bench_reference);
+        printf("%-20s %12.0f %12.0f %7.1fx\n", screen_names[id], fps, ref_fps, fps / ref_fps);
+
+        /* The last frames of both runs must agree */
+        uint8_t frame[DISPLAY_BUFFER_SIZE];
+        memcpy(frame, display.getBuffer(), DISPLAY_BUFFER_SIZE);
+        display_render(&statuses[(BENCH_FRAMES - 1) % BENCH_STATUSES]);
+        CHECK(memcmp(frame, display.getBuffer(), DISPLAY_BUFFER_SIZE) == 0);
+    }
+
+    return test_report("bench_render");
+}
@@ -0,0 +1,140 @@
+/* Tag store cost per advert at 8, 64 and 1024 tags: first sighting,
+ * repeated sightings, and new tags evicting the oldest in a full store.
+ * Also checks the index, the LRU order and the display order afterwards. */
+#include "../bluetooth.cpp"
+#include <vector>
+#include "test.h"
+
+#define BENCH_UPDATE_ROUNDS     200
+#define BENCH_EVICT_INSERTS     20000
+
+static uint32_t bench_rand = 1;
+
+static uint32_t bench_next(void) {
+    bench_rand = bench_rand * 1103515245 + 12345;
+    return bench_rand >> 8;
+}
+
+static void bench_record(adv_record_t *adv, uint32_t id) {
+    memset(adv, 0, sizeof(*adv));
+    adv->bda[0] = 0xC0;
+    adv->bda[1] = id >> 24;
+    adv->bda[2] = id >> 16;
+    adv->bda[3] = id >> 8;
+    adv->bda[4] = id;
+    adv->bda[5] = id * 37;
+    adv->addr_type = BLE_ADDR_TYPE_RANDOM;
+    adv->rssi = -40 - (int8_t)(bench_next() % 50);
+    snprintf(adv->name, sizeof(adv->name), "ATS-%u", id);
+}
+
+static void bench_reset(void) {
+    tag_list.count = 0;
+    tag_list.version = 0;
+    tag_index_reset();
+}
+
+static void check_store(uint16_t expected) {
+    CHECK(tag_list.count == expected);
+
+    uint16_t lru = 0;
+    for (tag_index_t index = tag_lru_head; index != TAG_INDEX_NONE; index = tag_lru_next[index]) {
+        if (tag_lru_next[index] != TAG_INDEX_NONE) {
+            CHECK(tag_hot[index].last_seen >= tag_hot[tag_lru_next[index]].last_seen);
+        }
+        lru++;
+    }
+    CHECK(lru == expected);
+
+    for (tag_index_t rank = 0; rank < tag_list.count; rank++) {
+        tag_index_t index = tag_order[rank];
+        CHECK(tag_rank[index] == rank);
+        CHECK(tag_hash[tag_index_find_slot(tag_hot[index].bda, NULL)] == index);
+        if (rank > 0) {
+            CHECK(!tag_order_before(index, tag_order[rank - 1]));
+        }
+    }
+}
+
+static double bench_ns(uint64_t start, uint32_t ops) {
+    return (double)(test_now_ns() - start) / ops;
+}
+
+/* Records are made up front so only the store is timed */
+static std::vector<adv_record_t> bench_records(uint32_t first, uint32_t count) {
+    std::vector<adv_record_t> records(count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        bench_record(&records[i], first + i);
+    }
+    return records;
+}
+
+static void bench_size(uint16_t tags) {
+    std::vector<adv_record_t> records = bench_records(0, tags);
+    uint64_t start;
+
+    bench_reset();
+    start = test_now_ns();
+    for (auto &adv : records) {
+        bluetooth_add_device(&adv);
+    }
+    double insert_ns = bench_ns(start, tags);
+    check_store(tags);
+
+    /* Sightings arrive in no particular order */
+    uint32_t updates = tags * BENCH_UPDATE_ROUNDS;
+    std::vector<adv_record_t> sightings(updates);
+    for (auto &adv : sightings) {
+        adv = records[bench_next() % tags];
+        adv.rssi = -40 - (int8_t)(bench_next() % 50);
+    }
+    uint32_t probes = tag_probes;
+    uint32_t lookups = tag_lookups;
+    start = test_now_ns();
+    for (auto &adv : sightings) {
+        bluetooth_add_device(&adv);
+    }
+    double update_ns = bench_ns(start, updates);
+    double probes_per_lookup = (double)(tag_probes - probes) / (tag_lookups - lookups);
+    check_store(tags);
+
+    printf("%5u tags: insert %7.1f ns, update %7.1f ns, %.2f probes per lookup\n",
+           tags, insert_ns, update_ns, probes_per_lookup);
+}
+
+static void bench_evict(void) {
+    std::vector<adv_record_t> records = bench_records(0, MAX_AIRTAG_COUNT + BENCH_EVICT_INSERTS);
+    adv_record_t adv;
+
+    bench_reset();
+    for (uint32_t id = 0; id < MAX_AIRTAG_COUNT; id++) {
+        bluetooth_add_device(&records[id]);
+    }
+
+    uint64_t start = test_now_ns();
+    for (uint32_t id = MAX_AIRTAG_COUNT; id < MAX_AIRTAG_COUNT + BENCH_EVICT_INSERTS; id++) {
+        bluetooth_add_device(&records[id]);
+    }
+    double evict_ns = bench_ns(start, BENCH_EVICT_INSERTS);
+    check_store(MAX_AIRTAG_COUNT);
+
+    /* The survivors are the last MAX_AIRTAG_COUNT tags inserted */
+    bench_record(&adv, MAX_AIRTAG_COUNT + BENCH_EVICT_INSERTS - 1);
+    CHECK(tag_index_find_slot(adv.bda, NULL) >= 0);
+    bench_record(&adv, BENCH_EVICT_INSERTS - 1);
+    CHECK(tag_index_find_slot(adv.bda, NULL) < 0);
+
+    printf("%5u tags: evict and insert %7.1f ns\n", MAX_AIRTAG_COUNT, evict_ns);
+}
+
+int main(void) {
+    tag_store_init();
+
+    bench_size(8);
+    bench_size(64);
+    bench_size(MAX_AIRTAG_COUNT);
+    bench_evict();
+
+    return test_report("bench_tag_store");
+}
@@ -0,0 +1,63 @@
+/* Fuzz target for the AD structure parser. Input: advertising data length,
+ * scan response length, then the scan result buffer, which may be shorter
+ * or longer than the lengths claim. Built with -fsanitize=fuzzer under
+ * clang; otherwise tests/fuzz_main.cpp replays a corpus and random inputs
+ * through it with AddressSanitizer. */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ble_adv.h"
+
+#define FUZZ_ASSERT(cond) do { if (!(cond)) abort(); } while (0)
+
+/* Every view points into the part of the buffer the lengths allow, and a
+ * field never straddles the advertising data and the scan response */
+static void check_field(const ble_ad_field_t *field, const uint8_t *data, uint16_t adv_end, uint16_t total) {
+    if (field->data == NULL) {
+        return;
+    }
+    uint16_t start = field->data - data;
+    uint16_t end = start + field->len;
+
+    FUZZ_ASSERT((start >= 2) && (end <= total));
+    FUZZ_ASSERT((end <= adv_end) || (start - 2 >= adv_end));
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *input, size_t size) {
+    if (size < 2) {
+        return 0;
+    }
+
+    uint8_t adv_len = input[0];
+    uint8_t rsp_len = input[1];
+    uint16_t buf_len = (size - 2 > 0xFFFF) ? 0xFFFF : size - 2;
+
+    /* Own allocation, exactly buf_len long, so an overread is caught */
+    uint8_t *data = (uint8_t *) malloc(buf_len ? buf_len : 1);
+    memcpy(data, input + 2, buf_len);
+
+    uint16_t adv_end = (adv_len < buf_len) ? adv_len : buf_len;
+    uint16_t total = (adv_len + rsp_len < buf_len) ? adv_len + rsp_len : buf_len;
+
+    ble_ad_iter_t it;
+    ble_ad_field_t field;
+    uint32_t fields = 0;
+    ble_ad_iter_init(&it, data, adv_len, rsp_len, buf_len);
+    while (ble_ad_next(&it, &field)) {
+        check_field(&field, data, adv_end, total);
+        FUZZ_ASSERT(++fields <= total / 2);
+    }
+
+    ble_adv_info_t info;
+    ble_adv_parse(data, adv_len, rsp_len, buf_len, &info);
+    check_field(&info.name, data, adv_end, total);
+    check_field(&info.manufacturer, data, adv_end, total);
+    check_field(&info.uuid16, data, adv_end, total);
+    check_field(&info.uuid128, data, adv_end, total);
+    FUZZ_ASSERT((info.name.data == NULL) || (info.name.type == BLE_AD_TYPE_NAME_CMPL) ||
+                (info.name.type == BLE_AD_TYPE_NAME_SHORT));
+    ble_ad_field_has_prefix(&info.name, "ATS");
+
+    free(data);
+    return 0;
+}
@@ -0,0 +1,89 @@
+/* Stand-alone driver for LLVMFuzzerTestOneInput where libFuzzer is not
+ * available: runs every file of the corpus directories given, then mutated
+ * copies of them and random inputs. Deterministic, so failures reproduce. */
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#define FUZZ_RANDOM_RUNS    200000
+#define FUZZ_MAX_LEN        80
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static uint32_t fuzz_seed = 12345;
+
+static uint32_t fuzz_rand(void) {
+    fuzz_seed ^= fuzz_seed << 13;
+    fuzz_seed ^= fuzz_seed >> 17;
+    fuzz_seed ^= fuzz_seed << 5;
+    return fuzz_seed;
+}
+
+static void load_corpus(const char *path, std::vector<std::vector<uint8_t>> *corpus) {
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+
+    if (dir == NULL) {
+        fprintf(stderr, "cannot open corpus %s\n", path);
+        exit(2);
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        std::string file = std::string(path) + "/" + entry->d_name;
+        FILE *f = fopen(file.c_str(), "rb");
+        if (f == NULL) {
+            continue;
+        }
+        std::vector<uint8_t> input;
+        int c;
+        while ((c = fgetc(f)) != EOF) {
+            input.push_back(c);
+        }
+        fclose(f);
+        corpus->push_back(input);
+    }
+    closedir(dir);
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::vector<uint8_t>> corpus;
+
+    for (int i = 1; i < argc; i++) {
+        load_corpus(argv[i], &corpus);
+    }
+    for (auto &input : corpus) {
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+
+    for (uint32_t run = 0; run < FUZZ_RANDOM_RUNS; run++) {
+        std::vector<uint8_t> input;
+
+        if (!corpus.empty() && (run & 1)) {
+            /* Flip, overwrite or cut a few bytes of a seed */
+            input = corpus[fuzz_rand() % corpus.size()];
+            for (uint32_t edits = 1 + fuzz_rand() % 4; edits > 0 && !input.empty(); edits--) {
+                size_t pos = fuzz_rand() % input.size();
+                switch (fuzz_rand() % 3) {
+                    case 0: input[pos] ^= 1 << (fuzz_rand() % 8); break;
+                    case 1: input[pos] = fuzz_rand(); break;
+                    default: input.resize(pos); break;
+                }
+            }
+        }
+        else {
+            input.resize(fuzz_rand() % FUZZ_MAX_LEN);
+            for (auto &b : input) {
+                b = fuzz_rand();
+            }
+        }
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+
+    printf("fuzz_ble_adv: %zu corpus inputs and %u generated ones passed\n", corpus.size(), FUZZ_RANDOM_RUNS);
+    return 0;
+}
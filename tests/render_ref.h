@@ -0,0 +1,195 @@
+#pragma once
+
+/* Reference renderer for the display tests: every screen drawn the slow
+ * way, pixel by pixel through Adafruit_GFX, the way the sketch did before
+ * templates and the glyph cache. Include after display.cpp. */
+#include "test.h"
+
+/* Opaque size 1 text, without the characters that would not fit whole */
+static void ref_text(int16_t x, int16_t y, const char *text) {
+    display.setTextSize(1);
+    display.setTextColor(WHITE, BLACK);
+    display.setTextWrap(false);
+    display.setCursor(x, y);
+    for (; *text && (x + GLYPH_WIDTH <= SCREEN_WIDTH); text++, x += GLYPH_WIDTH) {
+        bool printable = (*text >= GLYPH_FIRST) && (*text <= GLYPH_LAST);
+        display.print(printable ? *text : '?');
+    }
+    display.setTextWrap(true);
+}
+
+static void ref_highlight(int16_t y) {
+    display.fillRect(0, y, SCREEN_WIDTH, 8, INVERSE);
+}
+
+static void ref_static(const menu_screen_t *screen) {
+    display.setTextColor(WHITE, BLACK);
+    if (screen->title != NULL) {
+        display.setTextSize(1);
+        display.setCursor(0, 0);
+        display.println(screen->title);
+    }
+    for (uint8_t i = 0; i < screen->label_count; i++) {
+        display.setTextSize(screen->labels[i].size);
+        display.setCursor(screen->labels[i].x, screen->labels[i].y);
+        display.println(screen->labels[i].text);
+    }
+    display.setTextSize(1);
+    if (screen->flags & MENU_SHOWS_DEVICE) {
+        display.setCursor(0, 14);
+        display.print("Device: ");
+    }
+    for (uint8_t i = 0; i < screen->option_count; i++) {
+        display.setCursor(0, screen->option_y + i * 8);
+        display.println(screen->options[i].label);
+    }
+}
+
+static void ref_dynamic(const system_status_t *status) {
+    char line[64];
+
+    switch (status->screen_id) {
+        case SCREEN_PING:
+            if (status->last_ping_ms > 0) {
+                snprintf(line, sizeof(line), "%d found %us ago", status->last_device_count, display_ping_age(status));
+                ref_text(0, 38, line);
+            }
+            break;
+
+        case SCREEN_SCANNING: {
+            int timeout = display_scan_timeout(status);
+            snprintf(line, sizeof(line), "Timeout %d %s", timeout, timeout > 1 ? "seconds" : "second");
+            ref_text(0, 14, line);
+            snprintf(line, sizeof(line), "Found %d %s", status->device_count, status->device_count > 1 ? "devices" : "device");
+            ref_text(0, 26, line);
+            snprintf(line, sizeof(line), "Radio %u%%", status->scan_duty);
+            ref_text(0, 38, line);
+            break;
+        }
+
+        case SCREEN_DEVICE_LIST: {
+            if (status->device_count > status->list_rows) {
+                snprintf(line, sizeof(line), "Dev %u-%u/%u", status->list_start + 1,
+                         status->list_start + status->list_rows, status->device_count);
+            }
+            else {
+                snprintf(line, sizeof(line), "Devices (%d)", status->device_count);
+            }
+            ref_text(0, 0, line);
+
+            tag_view_t view;
+            bluetooth_read_tags(status->list_start, status->list_rows, &view);
+            int16_t y = 24;
+            for (uint8_t i = 0; i < view.rows; i++, y += 8) {
+                snprintf(line, sizeof(line), "  %d. %s", view.first + i + 1, view.tags[i].name);
+                ref_text(0, y, line);
+                if (i == status->selected_index) {
+                    ref_highlight(y);
+                }
+            }
+            ref_text(0, y, "  [ Back ]");
+            if (status->selected_index == status->list_rows) {
+                ref_highlight(y);
+            }
+            break;
+        }
+
+        case SCREEN_CONTROL_GPIO:
+            ref_text(0, 22, status->gpio_state == 1 ? "State: ON" : "State: OFF");
+            break;
+
+        case SCREEN_CONTROL_BLE:
+            if (status->ble_delay < 0) {
+                snprintf(line, sizeof(line), "State: OFF");
+            }
+            else if (status->ble_delay == 0) {
+                snprintf(line, sizeof(line), "State: ON immediately");
+            }
+            else {
+                snprintf(line, sizeof(line), "State: ON delay %dm", status->ble_delay);
+            }
+            ref_text(0, 22, line);
+            break;
+
+        case SCREEN_SET_DELAY: {
+            static const int16_t digit_x[4] = {8, 24, 50, 66};
+            int minutes[4] = {
+                (status->set_ble_delay / 60) / 10,
+                (status->set_ble_delay / 60) % 10,
+                (status->set_ble_delay % 60) / 10,
+                (status->set_ble_delay % 60) % 10,
+            };
+            display.setTextSize(2);
+            for (uint8_t i = 0; i < 4; i++) {
+                bool selected = (status->selected_index == i);
+                display.setTextColor(selected ? BLACK : WHITE, selected ? WHITE : BLACK);
+                display.setCursor(digit_x[i], 26);
+                display.print(minutes[i]);
+            }
+            display.setTextSize(1);
+            display.setTextColor(WHITE, BLACK);
+            break;
+        }
+
+        case SCREEN_BLE_ERROR:
+            if (status->error < ERROR_COUNT) {
+                snprintf(line, sizeof(line), "    %s", error_names[status->error]);
+                ref_text(0, 22, line);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* The whole frame into the display buffer */
+static void ref_render(const system_status_t *status) {
+    const menu_screen_t *screen = &menu_screens[status->screen_id];
+
+    display.clearDisplay();
+    ref_static(screen);
+    if (screen->flags & MENU_SHOWS_DEVICE) {
+        ref_text(8 * GLYPH_WIDTH, 14, status->selected_tag.name);
+    }
+    ref_dynamic(status);
+
+    uint8_t option = status->selected_index - screen->option_first;
+    if ((status->selected_index >= screen->option_first) && (option < screen->option_count)) {
+        ref_highlight(screen->option_y + option * 8);
+    }
+}
+
+static uint32_t ref_seed = 1;
+
+static uint32_t ref_rand(void) {
+    ref_seed = ref_seed * 1103515245 + 12345;
+    return ref_seed >> 8;
+}
+
+/* A plausible status for the screen, every field the screen shows varied */
+static void ref_random_status(system_status_t *status, uint8_t screen_id) {
+    memset(status, 0, sizeof(*status));
+    status->screen_id = screen_id;
+    status->selected_index = ref_rand() % (menu_index_count(screen_id) + 1);
+    status->device_count = ref_rand() % 200;
+    status->last_device_count = ref_rand() % 200;
+    status->last_ping_ms = (ref_rand() % 4) ? 1 + ref_rand() % CURRENT_TIME_MS() : 0;
+    status->start_scanning_ms = ref_rand() % CURRENT_TIME_MS();
+    status->scan_duty = ref_rand() % 101;
+    status->list_rows = 1 + ref_rand() % (MAX_LINES - 1);
+    status->list_start = ref_rand() % 100;
+    status->gpio_state = ref_rand() % 2;
+    status->ble_delay = (int)(ref_rand() % 1000) - 100;
+    status->set_ble_delay = ref_rand() % (100 * 60);
+    status->error = ref_rand() % (ERROR_COUNT + 1);
+    if (screen_id == SCREEN_DEVICE_LIST) {
+        status->selected_index = ref_rand() % (status->list_rows + 1);
+    }
+
+    /* Names long enough to be clipped at the right edge at times */
+    uint8_t len = ref_rand() % (sizeof(status->selected_tag.name) - 1);
+    for (uint8_t i = 0; i < len; i++) {
+        status->selected_tag.name[i] = ' ' + ref_rand() % 96;
+    }
+}
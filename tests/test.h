@@ -0,0 +1,30 @@
+#pragma once
+
+/* Minimal checks for the host tests. Failures are counted, not fatal, so
+ * one run reports everything that broke. */
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <chrono>
+
+static int test_failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+/* Simulated tasks never return, leave without waiting for them */
+static inline int test_report(const char *name) {
+    printf("%s: %s\n", name, test_failures ? "FAILED" : "passed");
+    fflush(stdout);
+    _exit(test_failures ? 1 : 0);
+}
+
+/* Host wall clock for the benchmarks, the simulated one stands still */
+static inline uint64_t test_now_ns(void) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,114 @@
+/* The advert ring between the GAP callback and the BLE task, hammered from
+ * two host threads. Every record carries its sequence number in each field,
+ * so the consumer can tell lost, reordered and torn records apart from the
+ * drops the producer was told about. */
+#include <atomic>
+#include <thread>
+#include "../bluetooth.cpp"
+#include "test.h"
+
+#define STRESS_RECORDS      2000000
+#define STRESS_BURST_MAX    48      /* Adverts between producer yields, above the ring size at times */
+
+static std::atomic<bool> producer_done{false};
+static uint32_t producer_dropped = 0;
+
+static void make_record(uint32_t seq, uint8_t *bda, int8_t *rssi, char *name, uint8_t *name_len) {
+    bda[0] = 0xC0;
+    bda[1] = seq >> 24;
+    bda[2] = seq >> 16;
+    bda[3] = seq >> 8;
+    bda[4] = seq;
+    bda[5] = seq * 131;
+    *rssi = (int8_t)(seq * 7);
+    *name_len = snprintf(name, BLE_NAME_MAX_LEN, "ATS%08x", seq);
+}
+
+/* Bursts of varying length, so the ring runs empty, half full and over */
+static void producer(void) {
+    uint32_t burst = 0;
+
+    for (uint32_t seq = 0; seq < STRESS_RECORDS; seq++) {
+        esp_bd_addr_t bda;
+        int8_t rssi;
+        char name[BLE_NAME_MAX_LEN];
+        ble_ad_field_t field = {BLE_AD_TYPE_NAME_CMPL, 0, (const uint8_t *) name};
+
+        make_record(seq, bda, &rssi, name, &field.len);
+        if (!adv_queue_push(&field, bda, rssi, (esp_ble_addr_type_t)(seq & 1))) {
+            producer_dropped++;
+        }
+        if (burst-- == 0) {
+            burst = (seq * 2654435761u >> 16) % STRESS_BURST_MAX;
+            std::this_thread::yield();
+        }
+    }
+    producer_done = true;
+}
+
+int main(void) {
+    uint32_t consumed = 0;
+    uint32_t torn = 0;
+    uint32_t reordered = 0;
+    uint32_t batches = 0;
+    int64_t last_seq = -1;
+
+    /* Wake messages have nobody to read them here, they just stop fitting */
+    ble_queue = xQueueCreate(BLE_TASK_QUEUE_SIZE, sizeof(ble_msg_t));
+
+    uint64_t start = test_now_ns();
+    std::thread producer_thread(producer);
+
+    while (true) {
+        bool done = producer_done.load();
+        uint32_t tail = adv_queue_tail;
+        uint32_t head = adv_queue_peek(ADV_DRAIN_BATCH);
+
+        if (head == tail) {
+            if (done) {
+                break;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+
+        for (; tail != head; tail++) {
+            const adv_record_t *adv = adv_queue_at(tail);
+            uint32_t seq = ((uint32_t) adv->bda[1] << 24) | ((uint32_t) adv->bda[2] << 16) |
+                           ((uint32_t) adv->bda[3] << 8) | adv->bda[4];
+            esp_bd_addr_t bda;
+            int8_t rssi;
+            char name[BLE_NAME_MAX_LEN];
+            uint8_t name_len;
+
+            make_record(seq, bda, &rssi, name, &name_len);
+            if ((memcmp(adv->bda, bda, sizeof(bda)) != 0) || (adv->rssi != rssi) ||
+                (strcmp(adv->name, name) != 0) || (adv->addr_type != (esp_ble_addr_type_t)(seq & 1))) {
+                torn++;
+            }
+            if ((int64_t) seq <= last_seq) {
+                reordered++;
+            }
+            last_seq = seq;
+            consumed++;
+        }
+        adv_queue_release(tail);
+        batches++;
+    }
+    producer_thread.join();
+    double seconds = (test_now_ns() - start) / 1e9;
+
+    uint32_t received, dropped;
+    bluetooth_get_adv_stats(&received, &dropped);
+    printf("%u records in %.2f s (%.1f M/s), %u consumed in %u batches, %u dropped\n",
+           received, seconds, received / seconds / 1e6, consumed, batches, dropped);
+
+    CHECK(torn == 0);
+    CHECK(reordered == 0);
+    CHECK(received == STRESS_RECORDS);
+    CHECK(dropped == producer_dropped);
+    CHECK(consumed + dropped == received);
+    CHECK(consumed > 0);
+
+    return test_report("test_adv_queue");
+}
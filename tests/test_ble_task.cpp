@@ -0,0 +1,149 @@
+/* The Bluedroid callbacks and the UI against the BLE task, from three host
+ * threads under ThreadSanitizer. GATTC events never wait for a busy BLE
+ * task: bursts of advisory events overflow and are counted, while the write
+ * completions in between always find room. The scan state the task polls is
+ * written by the GAP events, and the link slots the UI claims and closes are
+ * set up and freed by the task, without a race. */
+#include <atomic>
+#include <thread>
+#include "../bluetooth.cpp"
+#include "test.h"
+
+#define STRESS_EVENTS       20000
+#define STRESS_BURST_MAX    (2 * BLE_GATTC_QUEUE_SIZE)  /* Events between yields, over the queue size at times */
+#define STRESS_CONN_ID      0x7F                        /* No link has it, the handler just looks */
+#define STRESS_OPENS        5000
+
+static std::atomic<bool> bluedroid_done{false};
+static std::atomic<bool> ui_done{false};
+static std::atomic<uint32_t> links_opened{0};
+static std::atomic<uint32_t> writes_sent{0};
+static std::atomic<uint32_t> writes_in_flight{0};
+
+/* MTU updates in bursts with write completions in between, as many of
+ * those outstanding as the links could have, and scan start and stop */
+static void bluedroid(void) {
+    uint32_t burst = 0;
+
+    for (uint32_t i = 0; i < STRESS_EVENTS; i++) {
+        esp_ble_gattc_cb_param_t param = {};
+        if (((i % 3) == 0) && (writes_in_flight.load() < BLE_GATTC_RESERVED)) {
+            writes_in_flight++;
+            writes_sent++;
+            param.write.conn_id = STRESS_CONN_ID;
+            param.write.status = ESP_GATT_OK;
+            bluetooth_gattc_event(ESP_GATTC_WRITE_CHAR_EVT, ESP_GATT_IF_NONE, &param);
+        }
+        else {
+            param.cfg_mtu.conn_id = STRESS_CONN_ID;
+            param.cfg_mtu.status = ESP_GATT_OK;
+            param.cfg_mtu.mtu = 247;
+            bluetooth_gattc_event(ESP_GATTC_CFG_MTU_EVT, ESP_GATT_IF_NONE, &param);
+        }
+
+        if ((i % 64) == 0) {
+            esp_ble_gap_cb_param_t gap = {};
+            esp_gap_ble_cb_event_t event = (i % 128) ? ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT : ESP_GAP_BLE_SCAN_START_COMPLETE_EVT;
+            bluetooth_gap_event(event, &gap);
+        }
+        if (burst-- == 0) {
+            burst = (i * 2654435761u >> 16) % STRESS_BURST_MAX;
+            std::this_thread::yield();
+        }
+    }
+    bluedroid_done = true;
+}
+
+/* Opens and closes links to ever new tags, reading them as the screens do */
+static void ui(void) {
+    esp_bd_addr_t mac = {0xC0, 0, 0, 0, 0, 0};
+
+    for (uint32_t i = 0; i < STRESS_OPENS; i++) {
+        mac[4] = i >> 8;
+        mac[5] = i;
+        int link = bluetooth_link_open(mac, BLE_ADDR_TYPE_RANDOM);
+        if (link == BLUETOOTH_LINK_NONE) {
+            std::this_thread::yield();
+            continue;
+        }
+        links_opened++;
+        CHECK(!bluetooth_link_is_ready(link));
+        bluetooth_link_take_error(link);
+        bluetooth_link_get_latency(link, NULL);
+        bluetooth_link_close(link);
+    }
+    ui_done = true;
+}
+
+/* No tag answers: the task fails every connection it opens, as the stack
+ * would after its timeout */
+static void fail_opening_links(void) {
+    for (int i = 0; i < BLE_MAX_LINKS; i++) {
+        if (link_state(&links[i]) == LINK_OPENING) {
+            esp_ble_gattc_cb_param_t param = {};
+            param.open.status = ESP_GATT_ERROR;
+            memcpy(param.open.remote_bda, links[i].bda, sizeof(esp_bd_addr_t));
+            bluetooth_gattc_handle(ESP_GATTC_OPEN_EVT, ESP_GATT_IF_NONE, &param);
+        }
+    }
+}
+
+int main(void) {
+    uint32_t handled = 0;
+    uint32_t writes_done = 0;
+    uint32_t rounds = 0;
+    uint32_t scanning = 0;
+    ble_msg_t msg;
+    ble_gattc_msg_t event;
+
+    ble_queue = xQueueCreate(BLE_TASK_QUEUE_SIZE, sizeof(ble_msg_t));
+    gattc_queue = xQueueCreate(BLE_GATTC_QUEUE_SIZE, sizeof(ble_gattc_msg_t));
+    std::thread bluedroid_thread(bluedroid);
+    std::thread ui_thread(ui);
+
+    /* The BLE task loop, slow now and then so the queues run full */
+    while (true) {
+        bool done = bluedroid_done.load() && ui_done.load();
+        while (xQueueReceive(ble_queue, &msg, 0) == pdTRUE) {
+            ble_handle_msg(&msg);
+        }
+        while (xQueueReceive(gattc_queue, &event, 0) == pdTRUE) {
+            CHECK(event.param.write.conn_id == STRESS_CONN_ID);
+            bluetooth_gattc_handle(event.event, event.gattc_if, &event.param);
+            if (event.event == ESP_GATTC_WRITE_CHAR_EVT) {
+                writes_in_flight--;
+                writes_done++;
+            }
+            handled++;
+        }
+        fail_opening_links();
+        bluetooth_next_deadline_ms();
+        scanning += __atomic_load_n(&is_scanning, __ATOMIC_ACQUIRE);
+        if (done) {
+            break;
+        }
+        if ((++rounds % 8) == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        std::this_thread::yield();
+    }
+    bluedroid_thread.join();
+    ui_thread.join();
+    while (xQueueReceive(ble_queue, &msg, 0) == pdTRUE) {
+        ble_handle_msg(&msg);
+    }
+    fail_opening_links();
+
+    uint32_t dropped = __atomic_load_n(&gattc_dropped, __ATOMIC_RELAXED);
+    uint32_t lost = __atomic_load_n(&gattc_lost, __ATOMIC_RELAXED);
+    printf("test_ble_task: %u GATTC events, %u handled, %u dropped, %u writes done, %u links opened, scanning in %u of %u rounds\n",
+           STRESS_EVENTS, handled, dropped, writes_done, links_opened.load(), scanning, rounds);
+    CHECK(handled + dropped == STRESS_EVENTS);
+    CHECK(dropped > 0);     /* The bursts did overflow the queue */
+    CHECK(lost == 0);
+    CHECK(writes_done == writes_sent.load());
+    CHECK(links_opened > 0);
+    CHECK(!link_any_active());  /* Every link closed or failed, none leaked */
+
+    return test_report("test_ble_task");
+}
@@ -0,0 +1,104 @@
+/* Button debouncing fed from recorded edges: every press in a bouncy trace
+ * is reported exactly once, and so is a clean press landing at any point
+ * of the sample period right after the previous release settled */
+#include <map>
+#include "sim.h"
+#include "esp_bsp.h"
+#include "events.h"
+#include "test.h"
+
+#define TRACE_BOUNCY        "traces/buttons_bouncy.txt"
+#define SWEEP_FIRST_MS      60      /* Release to next press, around the settle sample */
+#define SWEEP_LAST_MS       100
+
+static std::map<uint8_t, uint8_t> pin_ids = {
+    {BUTTON_SELECT_PIN, SELECT_BUTTON_ID},
+    {BUTTON_UP_PIN, UP_BUTTON_ID},
+    {BUTTON_DOWN_PIN, DOWN_BUTTON_ID},
+    {BUTTON_LEFT_PIN, LEFT_BUTTON_ID},
+    {BUTTON_RIGHT_PIN, RIGHT_BUTTON_ID},
+};
+static uint32_t presses[BUTTON_COUNT];
+static uint32_t holds[BUTTON_COUNT];
+
+/* The part of the sketch loop that handles buttons */
+static void loop_task(void *arg) {
+    events_init();
+    esp_bsp_init();
+
+    for (;;) {
+        events_wait(esp_bsp_next_deadline_ms());
+        esp_bsp_loop();
+        for (uint8_t id = 0; id < BUTTON_COUNT; id++) {
+            while (button_is_pressed(id)) {
+                presses[id]++;
+            }
+            holds[id] += button_is_holding(id);
+        }
+    }
+}
+
+/* "t_us pin level" lines, "# expect pin presses" for the result */
+static void test_trace(const char *path) {
+    std::map<uint8_t, uint32_t> expected;
+    uint64_t offset_us = sim_now_us();
+    uint64_t end_us = offset_us;
+    char line[80];
+    FILE *file = fopen(path, "r");
+
+    CHECK(file != NULL);
+    if (file == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long long t_us;
+        unsigned pin, level;
+        if (sscanf(line, "# expect %u %u", &pin, &level) == 2) {
+            expected[pin] = level;
+        }
+        else if (sscanf(line, "%llu %u %u", &t_us, &pin, &level) == 3) {
+            sim_at_us(offset_us + t_us, [pin, level] { sim_gpio_set(pin, level); });
+            end_us = offset_us + t_us;
+        }
+    }
+    fclose(file);
+    CHECK(!expected.empty());
+
+    memset(presses, 0, sizeof(presses));
+    sim_run_until_us(end_us + 500 * 1000);
+    for (auto &pin : pin_ids) {
+        uint32_t want = expected.count(pin.first) ? expected[pin.first] : 0;
+        if (presses[pin.second] != want) {
+            printf("%s: pin %u pressed %u times, expected %u\n", path, pin.first, presses[pin.second], want);
+        }
+        CHECK(presses[pin.second] == want);
+    }
+    CHECK(holds[SELECT_BUTTON_ID] == 0);
+}
+
+/* Clean single-edge presses at every millisecond around the sample that
+ * settles the previous release */
+static void test_sweep(void) {
+    uint32_t expected = 0;
+    uint64_t at_ms = sim_now_us() / 1000 + 100;
+
+    memset(presses, 0, sizeof(presses));
+    for (uint32_t gap_ms = SWEEP_FIRST_MS; gap_ms <= SWEEP_LAST_MS; gap_ms++) {
+        sim_button_press(BUTTON_SELECT_PIN, at_ms, 100);
+        sim_button_press(BUTTON_SELECT_PIN, at_ms + 100 + gap_ms, 100);
+        expected += 2;
+        at_ms += 100 + gap_ms + 100 + 300;
+    }
+    sim_run_until_us(at_ms * 1000);
+    CHECK(presses[SELECT_BUTTON_ID] == expected);
+}
+
+int main(void) {
+    xTaskCreatePinnedToCore(loop_task, "loop", 4096, NULL, 1, NULL, CONFIG_ARDUINO_RUNNING_CORE);
+    sim_run_for_ms(100);
+
+    test_trace(TRACE_BOUNCY);
+    test_sweep();
+
+    return test_report("test_buttons");
+}
@@ -0,0 +1,116 @@
+/* Dirty-page flush: the panel must end up showing exactly the frame, with
+ * only the changed pages on the bus */
+#include "../display.cpp"
+#include "sim.h"
+#include "test.h"
+
+#define RANDOM_FRAMES   500
+
+system_status_t system_status;
+
+static uint32_t test_seed = 7;
+
+static uint32_t test_rand(void) {
+    test_seed = test_seed * 1103515245 + 12345;
+    return test_seed >> 8;
+}
+
+static bool panel_matches(const uint8_t *buffer) {
+    return memcmp(sim_panel_gddram(), buffer, DISPLAY_BUFFER_SIZE) == 0;
+}
+
+static uint8_t dirty_pages(const uint8_t *buffer) {
+    uint8_t dirty = 0;
+
+    for (uint8_t page = 0; page < DISPLAY_PAGES; page++) {
+        dirty += memcmp(&buffer[page * SCREEN_WIDTH], &panel_shadow[page * SCREEN_WIDTH], SCREEN_WIDTH) != 0;
+    }
+    return dirty;
+}
+
+/* Random edits of a few rectangles, often leaving most pages alone */
+static void test_random_frame(uint8_t *buffer) {
+    for (uint32_t edits = test_rand() % 4; edits > 0; edits--) {
+        int16_t x = test_rand() % SCREEN_WIDTH;
+        int16_t y = test_rand() % SCREEN_HEIGHT;
+        int16_t w = 1 + test_rand() % 40;
+        int16_t h = 1 + test_rand() % 12;
+        switch (test_rand() % 3) {
+            case 0: fb_fill_rect(buffer, x, y, w, h); break;
+            case 1: fb_clear_rect(buffer, x, y, w, h); break;
+            default: fb_invert_rect(buffer, x, y, w, h); break;
+        }
+    }
+}
+
+static void test_flush_random(void) {
+    uint8_t buffer[DISPLAY_BUFFER_SIZE];
+
+    memcpy(buffer, panel_shadow, sizeof(buffer));
+    for (uint32_t frame = 0; frame < RANDOM_FRAMES; frame++) {
+        test_random_frame(buffer);
+
+        uint32_t expected = dirty_pages(buffer) * SCREEN_WIDTH;
+        uint32_t before = sim_panel_data_bytes();
+        display_flush(buffer);
+        CHECK(sim_panel_data_bytes() - before == expected);
+        CHECK(panel_matches(buffer));
+        CHECK(memcmp(panel_shadow, buffer, sizeof(buffer)) == 0);
+    }
+}
+
+/* Through display_loop and the display task */
+static void test_flush_frames(void) {
+    memset(&system_status, 0, sizeof(system_status));
+    system_status.screen_id = SCREEN_ACTIONS;
+    system_status.max_index = 3;
+    strcpy(system_status.selected_tag.name, "ATS-1");
+
+    uint32_t start = sim_panel_data_bytes();
+    display_loop(&system_status);
+    sim_run_for_ms(100);
+    CHECK(panel_matches(display.getBuffer()));
+    CHECK(sim_panel_has_text("Actions"));
+    uint32_t first = sim_panel_data_bytes() - start;
+    CHECK((first > 0) && (first <= DISPLAY_BUFFER_SIZE));
+
+    /* Nothing changed: nothing drawn, nothing sent */
+    uint32_t before = sim_panel_data_bytes();
+    display_loop(&system_status);
+    sim_run_for_ms(100);
+    CHECK(sim_panel_data_bytes() == before);
+
+    /* Moving the selection bar one row touches at most two pages */
+    system_status.selected_index = 1;
+    display_loop(&system_status);
+    sim_run_for_ms(100);
+    CHECK(panel_matches(display.getBuffer()));
+    CHECK(sim_panel_data_bytes() - before <= 2 * SCREEN_WIDTH);
+    CHECK(sim_panel_data_bytes() > before);
+
+    /* The rate counter covers the window that just closed, with or without
+     * a transfer closing it, and falls to zero once the panel is idle */
+    uint32_t window = sim_panel_data_bytes() - start;
+    sim_run_for_ms(1000);
+    CHECK(display_get_bytes_per_second() == window);
+    before = sim_panel_data_bytes();
+    system_status.selected_index = 2;
+    display_loop(&system_status);
+    sim_run_for_ms(1000);
+    CHECK(display_get_bytes_per_second() == sim_panel_data_bytes() - before);
+    sim_run_for_ms(1000);
+    CHECK(display_get_bytes_per_second() == 0);
+    sim_run_for_ms(5000);
+    CHECK(display_get_bytes_per_second() == 0);
+}
+
+int main(void) {
+    display_init();
+    sim_run_for_ms(100);
+    CHECK(panel_matches(panel_shadow));
+
+    test_flush_frames();
+    test_flush_random();
+
+    return test_report("test_display_flush");
+}
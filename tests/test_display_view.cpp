@@ -0,0 +1,105 @@
+/* Redraw skipping: display_loop draws and flushes only when what the
+ * screen shows has changed, on force_update, or when a shown time ticks */
+#include "../display.cpp"
+#include "sim.h"
+#include "test.h"
+
+system_status_t system_status;
+
+/* Runs display_loop over a scribbled back buffer: a redraw starts from the
+ * screen template and wipes the scribble, a skipped frame leaves it */
+static bool loop_redraws(bool *flushed) {
+    uint8_t *buffer = display.getBuffer();
+    uint8_t frame[DISPLAY_BUFFER_SIZE];
+
+    sim_run_for_ms(100);
+    memcpy(frame, buffer, sizeof(frame));
+    memset(buffer, 0xA5, DISPLAY_BUFFER_SIZE);
+    uint32_t before = sim_panel_data_bytes();
+    display_loop(&system_status);
+    bool redrawn = (buffer[0] != 0xA5) || (memcmp(buffer, buffer + 1, DISPLAY_BUFFER_SIZE - 1) != 0);
+    sim_run_for_ms(100);
+    *flushed = sim_panel_data_bytes() != before;
+    if (!redrawn) {
+        memcpy(buffer, frame, sizeof(frame));
+    }
+    return redrawn;
+}
+
+static void test_same_view(void) {
+    bool flushed;
+
+    memset(&system_status, 0, sizeof(system_status));
+    system_status.screen_id = SCREEN_ACTIONS;
+    system_status.max_index = 3;
+    strcpy(system_status.selected_tag.name, "ATS-1");
+    CHECK(loop_redraws(&flushed));
+    CHECK(flushed);
+
+    /* Same view: nothing drawn, nothing sent */
+    CHECK(!loop_redraws(&flushed));
+    CHECK(!flushed);
+
+    /* Fields this screen does not show are not part of its view */
+    system_status.gpio_state = 1;
+    system_status.device_count = 42;
+    system_status.ble_delay = 15;
+    CHECK(!loop_redraws(&flushed));
+    CHECK(!flushed);
+
+    /* A shown field changes */
+    system_status.selected_index = 2;
+    CHECK(loop_redraws(&flushed));
+    CHECK(flushed);
+    CHECK(!loop_redraws(&flushed));
+
+    /* force_update redraws the same view once and is consumed */
+    system_status.force_update = true;
+    CHECK(loop_redraws(&flushed));
+    CHECK(!system_status.force_update);
+    CHECK(!loop_redraws(&flushed));
+
+    /* Same fields on another screen are another view */
+    system_status.screen_id = SCREEN_CONTROL_GPIO;
+    CHECK(loop_redraws(&flushed));
+    CHECK(flushed);
+    system_status.gpio_state = 0;
+    CHECK(loop_redraws(&flushed));
+    CHECK(flushed);
+    CHECK(!loop_redraws(&flushed));
+}
+
+/* The scan countdown is part of the view: one redraw per second */
+static void test_time_view(void) {
+    bool flushed;
+
+    memset(&system_status, 0, sizeof(system_status));
+    system_status.screen_id = SCREEN_SCANNING;
+    system_status.start_scanning_ms = CURRENT_TIME_MS();
+    system_status.device_count = 1;
+    system_status.scan_duty = 50;
+    CHECK(loop_redraws(&flushed));
+    CHECK(sim_panel_has_text("Timeout"));
+
+    /* Frames 200 ms apart: the next four stay inside the first second */
+    for (int i = 0; i < 4; i++) {
+        CHECK(!loop_redraws(&flushed));
+        CHECK(!flushed);
+    }
+    CHECK(loop_redraws(&flushed));
+    CHECK(flushed);
+    CHECK(!loop_redraws(&flushed));
+
+    system_status.scan_duty = 25;
+    CHECK(loop_redraws(&flushed));
+}
+
+int main(void) {
+    display_init();
+    sim_run_for_ms(100);
+
+    test_same_view();
+    test_time_view();
+
+    return test_report("test_display_view");
+}
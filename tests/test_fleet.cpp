@@ -0,0 +1,142 @@
+/* A warehouse full of tags: hundreds are all kept and paged through on the
+ * device list, and past the store capacity the tags that fell silent are
+ * the ones evicted, never the ones still around */
+#include <string>
+#include "sim.h"
+#include "app_config.h"
+#include "display.h"
+#include "esp_bsp.h"
+#include "test.h"
+
+#define FLEET_FIRST         300
+#define FLEET_SECOND        900     /* Together past MAX_AIRTAG_COUNT */
+#define FLEET_INTERVAL_MS   1000
+#define FLEET_SWITCH_MS     20000   /* The first tags go quiet, the second start */
+
+static_assert(FLEET_FIRST + FLEET_SECOND > MAX_AIRTAG_COUNT, "The second fleet must overflow the store");
+static_assert(FLEET_SECOND < MAX_AIRTAG_COUNT, "The second fleet must fit on its own");
+
+static std::string names[FLEET_FIRST + FLEET_SECOND];
+static std::string bdas[FLEET_FIRST + FLEET_SECOND];
+
+static void add_tags(uint32_t first, uint32_t count, uint32_t start_ms, uint32_t end_ms) {
+    sim_advertiser_t adv;
+    char text[24];
+
+    for (uint32_t i = first; i < first + count; i++) {
+        snprintf(text, sizeof(text), "c0:00:00:00:%02x:%02x", i >> 8, i & 0xFF);
+        bdas[i] = text;
+        snprintf(text, sizeof(text), "ATS-%04u", i);
+        names[i] = text;
+
+        sim_advertiser_defaults(&adv, bdas[i].c_str(), names[i].c_str());
+        adv.rssi = -45 - (int)(i % 50);
+        adv.interval_ms = FLEET_INTERVAL_MS + i % 11;  /* Drifting across the scan window */
+        adv.start_ms = start_ms + (i * FLEET_INTERVAL_MS) / count % FLEET_INTERVAL_MS;
+        adv.end_ms = end_ms;
+        sim_ble_add_advertiser(&adv);
+    }
+}
+
+static uint16_t tag_count(void) {
+    tag_view_t view;
+
+    bluetooth_read_tags(0, 0, &view);
+    return view.count;
+}
+
+static bool tag_known(uint32_t i) {
+    uint8_t bda[ESP_BD_ADDR_LEN];
+
+    sim_parse_bda(bdas[i].c_str(), bda);
+    return bluetooth_find_tag(bda) >= 0;
+}
+
+/* The first row shown is the tag at that rank */
+static bool row_shown(uint16_t rank) {
+    tag_view_t view;
+    char line[32];
+
+    bluetooth_read_tags(rank, 1, &view);
+    if (view.rows == 0) {
+        return false;
+    }
+    snprintf(line, sizeof(line), "%u. %s", rank + 1, view.tags[0].name);
+    return sim_panel_has_text(line);
+}
+
+static void press(uint8_t pin) {
+    sim_button_press(pin, sim_now_us() / 1000 + 1, 80);
+    sim_run_for_ms(300);
+}
+
+static void test_paging(void) {
+    char title[24];
+
+    sim_run_until_us(10000 * 1000);
+    CHECK(tag_count() == FLEET_FIRST);
+    for (uint32_t i = 0; i < FLEET_FIRST; i++) {
+        CHECK(tag_known(i));
+    }
+
+    /* Ping shows the list at once, a page of MAX_LINES - 1 tags */
+    press(BUTTON_SELECT_PIN);
+    snprintf(title, sizeof(title), "Dev 1-%u/%u", MAX_LINES - 1, FLEET_FIRST);
+    CHECK(sim_panel_has_text(title));
+    CHECK(row_shown(0));
+
+    /* A page moves the cursor by a page, the window follows it */
+    press(BUTTON_RIGHT_PIN);
+    press(BUTTON_RIGHT_PIN);
+    snprintf(title, sizeof(title), "Dev %u-%u/%u", MAX_LINES + 1, 2 * MAX_LINES - 1, FLEET_FIRST);
+    CHECK(sim_panel_has_text(title));
+    CHECK(row_shown(2 * (MAX_LINES - 1)));
+
+    press(BUTTON_LEFT_PIN);
+    snprintf(title, sizeof(title), "Dev %u-%u/%u", MAX_LINES, 2 * (MAX_LINES - 1), FLEET_FIRST);
+    CHECK(sim_panel_has_text(title));
+    CHECK(row_shown(MAX_LINES - 1));
+
+    /* The store reports its size and what a lookup costs */
+    sim_serial_clear();
+    sim_serial_input("b");
+    sim_run_for_ms(100);
+    std::string dump = sim_serial_output();
+    snprintf(title, sizeof(title), "TAGS %u of %u", FLEET_FIRST, MAX_AIRTAG_COUNT);
+    CHECK(dump.find(title) != std::string::npos);
+    CHECK(dump.find("probes and") != std::string::npos);
+}
+
+/* New tags past capacity take the places of the silent ones */
+static void test_overflow(void) {
+    sim_run_until_us((FLEET_SWITCH_MS + 10000) * 1000);
+    CHECK(tag_count() == MAX_AIRTAG_COUNT);
+
+    uint32_t second = 0;
+    uint32_t first = 0;
+    for (uint32_t i = 0; i < FLEET_FIRST + FLEET_SECOND; i++) {
+        if (tag_known(i)) {
+            (i < FLEET_FIRST) ? first++ : second++;
+        }
+    }
+    CHECK(second == FLEET_SECOND);
+    CHECK(first == MAX_AIRTAG_COUNT - FLEET_SECOND);
+
+    /* And they keep their places while being heard */
+    sim_run_for_ms(10000);
+    CHECK(tag_count() == MAX_AIRTAG_COUNT);
+    for (uint32_t i = FLEET_FIRST; i < FLEET_FIRST + FLEET_SECOND; i++) {
+        CHECK(tag_known(i));
+    }
+}
+
+int main(void) {
+    add_tags(0, FLEET_FIRST, 0, FLEET_SWITCH_MS);
+    add_tags(FLEET_FIRST, FLEET_SECOND, FLEET_SWITCH_MS, 0);
+
+    sim_start_sketch();
+    test_paging();
+    test_overflow();
+
+    return test_report("test_fleet");
+}
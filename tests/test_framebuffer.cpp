@@ -0,0 +1,202 @@
+/* Framebuffer word ops against a pixel at a time reference: random
+ * rectangles hanging over every edge, empty and negative sizes, strips
+ * starting on or past the right and bottom edges, buffers at every
+ * alignment, and nothing written outside the buffer */
+#include <string.h>
+#include "framebuffer.h"
+#include "test.h"
+
+#define RANDOM_OPS      100000
+#define GUARD           8           /* Bytes checked on each side of the buffer */
+#define GUARD_BYTE      0xA5
+
+static uint32_t test_seed = 3;
+
+static uint32_t test_rand(void) {
+    test_seed = test_seed * 1103515245 + 12345;
+    return test_seed >> 8;
+}
+
+enum {
+    REF_SET = 0,
+    REF_CLEAR,
+    REF_INVERT,
+    REF_INVERT_ROWS,
+    REF_BLIT,
+    REF_COPY,
+    REF_COUNT,
+};
+
+static void ref_pixel(uint8_t *fb, int16_t x, int16_t y, uint8_t op) {
+    if ((x < 0) || (x >= SCREEN_WIDTH) || (y < 0) || (y >= SCREEN_HEIGHT)) {
+        return;
+    }
+    uint8_t *b = &fb[(y / 8) * SCREEN_WIDTH + x];
+    uint8_t bit = 1 << (y % 8);
+    switch (op) {
+        case REF_SET: *b |= bit; break;
+        case REF_CLEAR: *b &= ~bit; break;
+        default: *b ^= bit; break;
+    }
+}
+
+static void ref_rect(uint8_t *fb, int16_t x, int16_t y, int16_t w, int16_t h, uint8_t op) {
+    for (int16_t i = x; i < x + w; i++) {
+        for (int16_t j = y; j < y + h; j++) {
+            ref_pixel(fb, i, j, op);
+        }
+    }
+}
+
+static void ref_blit(uint8_t *fb, uint8_t x, uint8_t y, const uint8_t *cols, uint8_t width) {
+    for (uint8_t i = 0; i < width; i++) {
+        for (uint8_t j = 0; j < 8; j++) {
+            ref_pixel(fb, x + i, y + j, ((cols[i] >> j) & 1) ? REF_SET : REF_CLEAR);
+        }
+    }
+}
+
+/* Coordinates mostly on screen, some a little off it */
+static int16_t random_coord(int16_t size) {
+    return (int16_t)(test_rand() % (size + 40)) - 20;
+}
+
+static const char *op_names[REF_COUNT] = { "fill", "clear", "invert", "invert rows", "blit", "copy" };
+
+static void test_random_ops(uint8_t align) {
+    uint8_t storage[FB_SIZE + 2 * GUARD + 4];
+    uint8_t expected[FB_SIZE];
+    uint8_t source[FB_SIZE];
+    uint8_t *fb = &storage[GUARD + align];
+
+    memset(storage, GUARD_BYTE, sizeof(storage));
+    for (uint16_t i = 0; i < FB_SIZE; i++) {
+        fb[i] = expected[i] = test_rand();
+    }
+
+    for (uint32_t run = 0; run < RANDOM_OPS; run++) {
+        uint8_t op = test_rand() % REF_COUNT;
+        int16_t x = random_coord(SCREEN_WIDTH);
+        int16_t y = random_coord(SCREEN_HEIGHT);
+        int16_t w = random_coord(SCREEN_WIDTH);
+        int16_t h = random_coord(SCREEN_HEIGHT);
+
+        switch (op) {
+            case REF_SET:
+                fb_fill_rect(fb, x, y, w, h);
+                ref_rect(expected, x, y, w, h, op);
+                break;
+            case REF_CLEAR:
+                fb_clear_rect(fb, x, y, w, h);
+                ref_rect(expected, x, y, w, h, op);
+                break;
+            case REF_INVERT:
+                fb_invert_rect(fb, x, y, w, h);
+                ref_rect(expected, x, y, w, h, op);
+                break;
+            case REF_INVERT_ROWS:
+                fb_invert_rows(fb, y, h);
+                ref_rect(expected, 0, y, SCREEN_WIDTH, h, REF_INVERT);
+                break;
+            case REF_BLIT: {
+                /* Text rows: on screen, clipped at the right edge */
+                uint8_t cols[SCREEN_WIDTH];
+                uint8_t bx = test_rand() % SCREEN_WIDTH;
+                uint8_t by = test_rand() % (SCREEN_HEIGHT - 7);
+                uint8_t width = test_rand() % (SCREEN_WIDTH - bx + 1);
+                for (uint8_t i = 0; i < width; i++) {
+                    cols[i] = test_rand();
+                }
+                fb_blit_strip(fb, bx, by, cols, width);
+                ref_blit(expected, bx, by, cols, width);
+                break;
+            }
+            default: {
+                uint8_t first = test_rand() % FB_PAGES;
+                uint8_t count = test_rand() % (FB_PAGES - first + 1);
+                for (uint16_t i = 0; i < FB_SIZE; i++) {
+                    source[i] = test_rand();
+                }
+                fb_copy_pages(fb, source, first, count);
+                memcpy(&expected[first * SCREEN_WIDTH], &source[first * SCREEN_WIDTH], count * SCREEN_WIDTH);
+                break;
+            }
+        }
+
+        if (memcmp(fb, expected, FB_SIZE) != 0) {
+            printf("align %u run %u: %s %d,%d %dx%d differs from the reference\n",
+                   align, run, op_names[op], x, y, w, h);
+            CHECK(!"framebuffer op differs");
+            return;
+        }
+    }
+
+    for (uint8_t i = 0; i < GUARD + align; i++) {
+        CHECK(storage[i] == GUARD_BYTE);
+    }
+    for (uint16_t i = GUARD + align + FB_SIZE; i < sizeof(storage); i++) {
+        CHECK(storage[i] == GUARD_BYTE);
+    }
+}
+
+/* The edges of the masks one at a time: every row range of one column */
+static void test_row_ranges(void) {
+    uint8_t fb[FB_SIZE];
+    uint8_t expected[FB_SIZE];
+
+    for (int16_t y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int16_t h = 1; y + h <= SCREEN_HEIGHT; h++) {
+            memset(fb, 0, sizeof(fb));
+            memset(expected, 0, sizeof(expected));
+            fb_fill_rect(fb, 5, y, 3, h);
+            ref_rect(expected, 5, y, 3, h, REF_SET);
+            CHECK(memcmp(fb, expected, FB_SIZE) == 0);
+        }
+    }
+}
+
+/* Strips from the last columns and rows on, any width: clipped or dropped */
+static void test_blit_edges(void) {
+    static const uint8_t xs[] = {SCREEN_WIDTH - 5, SCREEN_WIDTH - 1, SCREEN_WIDTH, SCREEN_WIDTH + 1, 200, 255};
+    static const uint8_t ys[] = {0, 3, SCREEN_HEIGHT - 8, SCREEN_HEIGHT - 3, SCREEN_HEIGHT - 1,
+                                 SCREEN_HEIGHT, SCREEN_HEIGHT + 5, 255};
+    static const uint8_t widths[] = {1, 4, 9, 255};
+    uint8_t storage[GUARD + FB_SIZE + GUARD];
+    uint8_t *fb = &storage[GUARD];
+    uint8_t expected[FB_SIZE];
+    uint8_t cols[255];
+
+    for (uint8_t i = 0; i < sizeof(cols); i++) {
+        cols[i] = test_rand();
+    }
+    for (uint8_t x : xs) {
+        for (uint8_t y : ys) {
+            for (uint8_t width : widths) {
+                memset(storage, GUARD_BYTE, sizeof(storage));
+                memset(fb, 0x3C, FB_SIZE);
+                memcpy(expected, fb, FB_SIZE);
+
+                fb_blit_strip(fb, x, y, cols, width);
+                ref_blit(expected, x, y, cols, width);
+                if (memcmp(fb, expected, FB_SIZE) != 0) {
+                    printf("blit %u,%u width %u differs from the reference\n", x, y, width);
+                    CHECK(!"edge blit differs");
+                }
+                for (uint8_t i = 0; i < GUARD; i++) {
+                    CHECK(storage[i] == GUARD_BYTE);
+                    CHECK(storage[GUARD + FB_SIZE + i] == GUARD_BYTE);
+                }
+            }
+        }
+    }
+}
+
+int main(void) {
+    test_row_ranges();
+    test_blit_edges();
+    for (uint8_t align = 0; align < 4; align++) {
+        test_random_ops(align);
+    }
+
+    return test_report("test_framebuffer");
+}
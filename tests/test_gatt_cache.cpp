@@ -0,0 +1,170 @@
+/* GATT caching across a reboot, with NVS kept in a file. The first boot
+ * learns one tag over the air and takes the others from its table, the
+ * second finds the handles in NVS, and stale handles from either cache
+ * are caught by the first write instead of being written into the void.
+ * More tags than slots evict the least recently used ones. */
+#include <stdlib.h>
+#include <unistd.h>
+#include "app_config.h"
+#include "bluetooth.h"
+#include "gatt_cache.h"
+#include "sim.h"
+#include "test.h"
+
+/* Opens a link, sends the commands one after the other and closes it.
+ * Returns the ms from opening to the first command arriving. */
+static uint32_t send_commands(const char *text, std::vector<std::string> commands) {
+    uint8_t bda[ESP_BD_ADDR_LEN];
+    uint32_t first_ms = 0;
+
+    sim_parse_bda(text, bda);
+    std::vector<std::string> expected = sim_ble_received(bda);
+    uint64_t start = sim_now_us();
+    int link = bluetooth_link_open(bda, BLE_ADDR_TYPE_RANDOM);
+    CHECK(link != BLUETOOTH_LINK_NONE);
+
+    for (const std::string &cmd : commands) {
+        CHECK(sim_run_until([&] { return bluetooth_link_send(link, cmd.c_str()); }, 1000));
+        expected.push_back(cmd);
+        CHECK(sim_run_until([&] { return sim_ble_received(bda).size() == expected.size(); }, 2000));
+        if (first_ms == 0) {
+            first_ms = (sim_now_us() - start) / 1000;
+        }
+    }
+    sim_run_for_ms(200);
+    CHECK(sim_ble_received(bda) == expected);
+    CHECK(!bluetooth_link_take_error(link));
+
+    bluetooth_link_close(link);
+    CHECK(sim_run_until([&] { return !sim_ble_is_connected(bda); }, 1000));
+    return first_ms;
+}
+
+static void add_tag(const char *text, uint16_t rx_handle) {
+    sim_peripheral_t periph;
+
+    sim_peripheral_defaults(&periph, text);
+    periph.rx_handle = rx_handle;
+    sim_ble_add_peripheral(&periph);
+}
+
+static void first_boot(void) {
+    add_tag("c0:00:00:00:00:01", 42);
+    add_tag("c0:00:00:00:00:02", 42);
+    add_tag("c0:00:00:00:00:03", 45);   /* Other tag firmware */
+    bluetooth_init();
+    sim_run_for_ms(1000);
+
+    /* Nothing known yet: discovered over the air */
+    send_commands("c0:00:00:00:00:01", {"A1"});
+    sim_ble_stats_t stats = sim_ble_stats();
+    CHECK(stats.ota_discoveries == 1);
+
+    /* Same layout: the stack takes the first tag's table, the first write
+     * proves the handle with a response and the next one goes without */
+    send_commands("c0:00:00:00:00:02", {"B1", "B2"});
+    sim_ble_stats_t after = sim_ble_stats();
+    CHECK(after.ota_discoveries == stats.ota_discoveries);
+    CHECK(after.writes_rsp == stats.writes_rsp + 1);
+    CHECK(after.writes_no_rsp == stats.writes_no_rsp + 1);
+
+    /* The borrowed table is wrong for this one: the probe write fails and
+     * the tag is discovered over the air after all, the command still
+     * arrives once */
+    stats = after;
+    send_commands("c0:00:00:00:00:03", {"C1"});
+    after = sim_ble_stats();
+    CHECK(after.write_errors == stats.write_errors + 1);
+    CHECK(after.ota_discoveries == stats.ota_discoveries + 1);
+    CHECK(after.writes_lost == 0);
+}
+
+static void second_boot(void) {
+    add_tag("c0:00:00:00:00:01", 50);   /* Tag firmware update moved RX */
+    add_tag("c0:00:00:00:00:02", 42);
+    bluetooth_init();
+    sim_run_for_ms(1000);
+
+    /* Known tag: writing starts before the stack is done discovering */
+    sim_peripheral_t periph;
+    sim_peripheral_defaults(&periph, "c0:00:00:00:00:02");
+    sim_ble_stats_t stats = sim_ble_stats();
+    uint32_t writes = sim_nvs_writes();
+    uint32_t ms = send_commands("c0:00:00:00:00:02", {"B3"});
+    CHECK(ms < periph.connect_ms + periph.discovery_ms);
+    CHECK(sim_ble_stats().write_errors == stats.write_errors);
+    CHECK(sim_nvs_writes() == writes);
+
+    /* Stale handle in NVS: caught by the first write, never lost */
+    send_commands("c0:00:00:00:00:01", {"A2", "A3"});
+    CHECK(sim_ble_stats().write_errors == stats.write_errors + 1);
+    CHECK(sim_ble_stats().writes_lost == 0);
+    CHECK(sim_nvs_writes() > writes);
+
+    /* And the corrected entry is used from now on */
+    stats = sim_ble_stats();
+    send_commands("c0:00:00:00:00:01", {"A4"});
+    CHECK(sim_ble_stats().write_errors == stats.write_errors);
+}
+
+/* A fleet of tags keeps NVS within GATT_CACHE_SLOTS entries. Tag 0 is
+ * looked up after every store, so it stays while older ones go. */
+static void fleet(void) {
+    const int tags = GATT_CACHE_SLOTS + 8;
+    uint8_t bda[ESP_BD_ADDR_LEN];
+    uint8_t known[ESP_BD_ADDR_LEN];
+    gatt_cache_entry_t entry = {};
+    char text[24];
+
+    entry.service_start_handle = 40;
+    entry.service_end_handle = 60;
+    for (int i = 0; i < tags; i++) {
+        snprintf(text, sizeof(text), "c0:00:00:00:02:%02x", i);
+        sim_parse_bda(text, bda);
+        entry.nus_handler = 41 + i % 10;
+        gatt_cache_store(bda, &entry);
+        sim_parse_bda("c0:00:00:00:02:00", bda);
+        CHECK(gatt_cache_lookup(bda, &entry));
+    }
+    CHECK(sim_nvs_keys("gatt_cache") <= GATT_CACHE_SLOTS);
+
+    /* The tags from the boots above and the first new ones were evicted */
+    sim_parse_bda("c0:00:00:00:00:01", known);
+    CHECK(!gatt_cache_lookup(known, &entry));
+    for (int i = 1; i < tags; i++) {
+        snprintf(text, sizeof(text), "c0:00:00:00:02:%02x", i);
+        sim_parse_bda(text, bda);
+        bool found = gatt_cache_lookup(bda, &entry);
+        CHECK(found == (i >= tags - GATT_CACHE_SLOTS + 1));
+        if (found) {
+            CHECK(entry.nus_handler == 41 + i % 10);
+        }
+    }
+    sim_parse_bda("c0:00:00:00:02:00", bda);
+    CHECK(gatt_cache_lookup(bda, &entry));
+}
+
+int main(int argc, char **argv) {
+    std::string nvs_path = std::string(argv[0]) + ".nvs";
+
+    if (argc < 3) {
+        remove(nvs_path.c_str());
+        sim_nvs_set_path(nvs_path.c_str());
+        first_boot();
+
+        /* Reboot: a fresh process with only the NVS file left */
+        char failures[16];
+        snprintf(failures, sizeof(failures), "%d", test_failures);
+        fflush(stdout);
+        execl(argv[0], argv[0], "reboot", failures, (char *) NULL);
+        CHECK(!"exec failed");
+    }
+    else {
+        test_failures = atoi(argv[2]);
+        sim_nvs_set_path(nvs_path.c_str());
+        second_boot();
+        fleet();
+    }
+
+    return test_report("test_gatt_cache");
+}
@@ -0,0 +1,278 @@
+/* Links against simulated tags: commands reach a good tag, every way
+ * discovery can come up empty ends the connection and reports it instead
+ * of leaving the link discovering, refused writes do not hold up the
+ * commands behind them, BLE_MAX_LINKS tags are served at once, a link
+ * closed while still opening is dropped once it connects, a late close
+ * leaves alone the link that took over its slot, a burst of GATTC events
+ * loses none a link waits on and scan parameters set late do not restart
+ * the scan under a link */
+#include "app_config.h"
+#include "bluetooth.h"
+#include "sim.h"
+#include "test.h"
+
+static void add_tag(const char *text, bool has_nus, uint16_t rx_handle) {
+    sim_peripheral_t periph;
+
+    sim_peripheral_defaults(&periph, text);
+    periph.has_nus = has_nus;
+    periph.rx_handle = rx_handle;
+    sim_ble_add_peripheral(&periph);
+}
+
+static int open_link(const char *text, uint8_t *bda) {
+    sim_parse_bda(text, bda);
+    return bluetooth_link_open(bda, BLE_ADDR_TYPE_RANDOM);
+}
+
+static void test_good_tag(void) {
+    uint8_t bda[ESP_BD_ADDR_LEN];
+    int link = open_link("c0:00:00:00:00:01", bda);
+    size_t received = sim_ble_received(bda).size();
+
+    CHECK(link != BLUETOOTH_LINK_NONE);
+    /* Commands are taken once connected, ahead of discovery */
+    CHECK(sim_run_until([&] { return bluetooth_link_send(link, "PING"); }, 1000));
+    CHECK(sim_run_until([&] { return bluetooth_link_is_ready(link); }, 2000));
+    CHECK(sim_run_until([&] { return sim_ble_received(bda).size() == received + 1; }, 1000) &&
+          (sim_ble_received(bda).back() == "PING"));
+    CHECK(!bluetooth_link_take_error(link));
+
+    bluetooth_link_close(link);
+    CHECK(sim_run_until([&] { return !sim_ble_is_connected(bda); }, 1000));
+}
+
+static void test_discovery_fails(const char *text) {
+    uint8_t bda[ESP_BD_ADDR_LEN];
+    uint32_t connections = sim_ble_stats().connections;
+    int link = open_link(text, bda);
+
+    CHECK(link != BLUETOOTH_LINK_NONE);
+    CHECK(sim_run_until([&] { return sim_ble_is_connected(bda); }, 1000));
+    CHECK(sim_run_until([&] { return !sim_ble_is_connected(bda); }, 2000));
+    CHECK(!bluetooth_link_is_ready(link));
+    CHECK(bluetooth_link_take_error(link));
+    CHECK(sim_ble_received(bda).empty());
+
+    /* The radio went back to scanning and the link is free again */
+    CHECK(sim_run_until([] { return sim_ble_is_scanning(); }, 1000));
+    CHECK(open_link(text, bda) != BLUETOOTH_LINK_NONE);
+    CHECK(sim_run_until([&] { return sim_ble_stats().connections == connections + 2; }, 1000));
+    CHECK(sim_run_until([&] { return !sim_ble_is_connected(bda); }, 2000));
+    sim_run_for_ms(500);
+}
+
+/* Commands queued during discovery all go out once the link is ready, even
+ * when the stack refuses the first ones */
+static void test_refused_writes(void) {
+    uint8_t bda[ESP_BD_ADDR_LEN];
+    int link = open_link("c0:00:00:00:00:04", bda);
+
+    CHECK(sim_run_until([&] { return bluetooth_link_send(link, "A"); }, 1000));
+    CHECK(bluetooth_link_send(link, "B"));
+    CHECK(bluetooth_link_send(link, "C"));
+    CHECK(!bluetooth_link_is_ready(link));
+    sim_ble_fail_writes(bda, 2);
+
+    CHECK(sim_run_until([&] { return !sim_ble_received(bda).empty(); }, 2000));
+    CHECK(sim_ble_received(bda) == std::vector<std::string>{"C"});
+    CHECK(bluetooth_link_take_error(link));
+
+    /* And the queue keeps moving afterwards */
+    CHECK(bluetooth_link_send(link, "D"));
+    CHECK(sim_run_until([&] { return sim_ble_received(bda).size() == 2; }, 1000));
+    CHECK(!bluetooth_link_take_error(link));
+
+    bluetooth_link_close(link);
+    CHECK(sim_run_until([&] { return !sim_ble_is_connected(bda); }, 1000));
+}
+
+/* Every link in use at once: connections are made one after the other but
+ * discovery and writes overlap */
+static void test_concurrent_links(void) {
+    uint8_t bda[BLE_MAX_LINKS][ESP_BD_ADDR_LEN];
+    int link[BLE_MAX_LINKS];
+    char text[24];
+
+    for (int i = 0; i < BLE_MAX_LINKS; i++) {
+        snprintf(text, sizeof(text), "c0:00:00:00:01:%02x", i);
+        link[i] = open_link(text, bda[i]);
+        CHECK(link[i] != BLUETOOTH_LINK_NONE);
+    }
+    uint8_t spare[ESP_BD_ADDR_LEN];
+    CHECK(open_link("c0:00:00:00:00:01", spare) == BLUETOOTH_LINK_NONE);
+
+    /* All connected before the first discovery completes */
+    auto all = [&](std::function<bool(int)> pred) {
+        for (int i = 0; i < BLE_MAX_LINKS; i++) {
+            if (!pred(i)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    CHECK(sim_run_until([&] { return all([&](int i) { return sim_ble_is_connected(bda[i]); }); }, 2000));
+    CHECK(!bluetooth_link_is_ready(link[0]));
+
+    for (int i = 0; i < BLE_MAX_LINKS; i++) {
+        CHECK(bluetooth_link_send(link[i], "ONE"));
+        CHECK(bluetooth_link_send(link[i], "TWO"));
+    }
+    CHECK(sim_run_until([&] { return all([&](int i) { return bluetooth_link_is_ready(link[i]); }); }, 2000));
+    CHECK(sim_run_until([&] { return all([&](int i) { return sim_ble_received(bda[i]).size() == 2; }); }, 2000));
+    for (int i = 0; i < BLE_MAX_LINKS; i++) {
+        CHECK(sim_ble_received(bda[i]) == (std::vector<std::string>{"ONE", "TWO"}));
+        CHECK(!bluetooth_link_take_error(link[i]));
+    }
+
+    /* Closing one leaves the others up */
+    bluetooth_link_close(link[0]);
+    CHECK(sim_run_until([&] { return !sim_ble_is_connected(bda[0]); }, 1000));
+    CHECK(bluetooth_link_send(link[1], "THREE"));
+    CHECK(sim_run_until([&] { return sim_ble_received(bda[1]).size() == 3; }, 1000));
+    CHECK(!sim_ble_is_scanning());
+
+    for (int i = 1; i < BLE_MAX_LINKS; i++) {
+        bluetooth_link_close(link[i]);
+    }
+    CHECK(sim_run_until([&] { return all([&](int i) { return !sim_ble_is_connected(bda[i]); }); }, 1000));
+    CHECK(sim_run_until([] { return sim_ble_is_scanning(); }, 1000));
+}
+
+/* The UI switches tags before the first one connected: that connection
+ * is closed when it comes up instead of being left without an owner */
+static void test_switch_while_opening(void) {
+    uint8_t first[ESP_BD_ADDR_LEN];
+    uint8_t second[ESP_BD_ADDR_LEN];
+    uint32_t connections = sim_ble_stats().connections;
+
+    sim_parse_bda("c0:00:00:00:00:01", first);
+    sim_parse_bda("c0:00:00:00:00:04", second);
+    bluetooth_airtag_connect(first, BLE_ADDR_TYPE_RANDOM);
+    sim_run_for_ms(10);
+    CHECK(!sim_ble_is_connected(first));
+    bluetooth_airtag_connect(second, BLE_ADDR_TYPE_RANDOM);
+
+    CHECK(sim_run_until([] { return bluetooth_is_connected(); }, 2000));
+    CHECK(sim_run_until([&] { return !sim_ble_is_connected(first); }, 1000));
+    CHECK(sim_ble_stats().connections == connections + 2);
+    CHECK(sim_ble_is_connected(second));
+
+    /* Only the second link is left, closing it brings scanning back */
+    bluetooth_disconnect();
+    CHECK(sim_run_until([&] { return !sim_ble_is_connected(second); }, 1000));
+    CHECK(sim_run_until([] { return sim_ble_is_scanning(); }, 1000));
+    for (int i = 0; i < BLE_MAX_LINKS; i++) {
+        CHECK(!bluetooth_link_is_ready(i));
+    }
+}
+
+/* The tag dropped the connection itself, its slot is free again and the
+ * next tag takes it: the close for the old link must not cancel the new
+ * one, queued behind it */
+static void test_switch_after_drop(void) {
+    uint8_t first[ESP_BD_ADDR_LEN];
+    uint8_t second[ESP_BD_ADDR_LEN];
+
+    sim_parse_bda("c0:00:00:00:00:01", first);
+    sim_parse_bda("c0:00:00:00:00:04", second);
+    bluetooth_airtag_connect(first, BLE_ADDR_TYPE_RANDOM);
+    CHECK(sim_run_until([] { return bluetooth_is_connected(); }, 2000));
+    sim_ble_disconnect(first);
+    CHECK(sim_run_until([] { return !bluetooth_is_connected(); }, 1000));
+    sim_run_for_ms(100);
+
+    bluetooth_airtag_connect(second, BLE_ADDR_TYPE_RANDOM);
+    CHECK(sim_run_until([] { return bluetooth_is_connected(); }, 3000));
+    CHECK(sim_ble_is_connected(second));
+    CHECK(bluetooth_send_command("PING"));
+    CHECK(sim_run_until([&] { return !sim_ble_received(second).empty(); }, 1000));
+
+    bluetooth_disconnect();
+    CHECK(sim_run_until([&] { return !sim_ble_is_connected(second); }, 1000));
+    CHECK(sim_run_until([] { return sim_ble_is_scanning(); }, 1000));
+}
+
+/* A burst of events the links do not need fills the GATTC queue just as
+ * the tag drops the connection: the disconnect still gets through, the link
+ * goes idle, scanning resumes and the tag can be connected again */
+static void test_event_burst(void) {
+    uint8_t bda[ESP_BD_ADDR_LEN];
+    int link = open_link("c0:00:00:00:00:01", bda);
+
+    CHECK(sim_run_until([&] { return bluetooth_link_is_ready(link); }, 2000));
+    sim_at_us(sim_now_us(), [] {
+        for (int i = 0; i < 4 * BLE_GATTC_QUEUE_SIZE; i++) {
+            esp_ble_gattc_cb_param_t param = {};
+            param.cfg_mtu.conn_id = 0x7F;
+            param.cfg_mtu.status = ESP_GATT_OK;
+            param.cfg_mtu.mtu = 247;
+            bluetooth_gattc_event(ESP_GATTC_CFG_MTU_EVT, ESP_GATT_IF_NONE, &param);
+        }
+    });
+    sim_ble_disconnect(bda);
+
+    CHECK(sim_run_until([&] { return !bluetooth_link_is_ready(link); }, 1000));
+    CHECK(sim_run_until([] { return sim_ble_is_scanning(); }, 1000));
+
+    link = open_link("c0:00:00:00:00:01", bda);
+    CHECK(sim_run_until([&] { return bluetooth_link_send(link, "AFTER"); }, 2000));
+    CHECK(sim_run_until([&] { return !sim_ble_received(bda).empty() && (sim_ble_received(bda).back() == "AFTER"); }, 2000));
+    CHECK(!bluetooth_link_take_error(link));
+    bluetooth_link_close(link);
+    CHECK(sim_run_until([&] { return !sim_ble_is_connected(bda); }, 1000));
+    CHECK(sim_run_until([] { return sim_ble_is_scanning(); }, 1000));
+}
+
+/* New scan parameters confirmed after a link took the radio */
+static void test_late_scan_params(void) {
+    uint8_t bda[ESP_BD_ADDR_LEN];
+    int link = open_link("c0:00:00:00:00:01", bda);
+
+    CHECK(sim_run_until([&] { return bluetooth_link_is_ready(link); }, 2000));
+    CHECK(!sim_ble_is_scanning());
+    sim_at_us(sim_now_us(), [] {
+        esp_ble_gap_cb_param_t param = {};
+        param.scan_param_cmpl.status = ESP_BT_STATUS_SUCCESS;
+        bluetooth_gap_event(ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT, &param);
+    });
+    sim_run_for_ms(500);
+    CHECK(!sim_ble_is_scanning());
+    CHECK(bluetooth_link_is_ready(link));
+
+    bluetooth_link_close(link);
+    CHECK(sim_run_until([&] { return !sim_ble_is_connected(bda); }, 1000));
+    CHECK(sim_run_until([] { return sim_ble_is_scanning(); }, 1000));
+}
+
+int main(void) {
+    /* Discovery over the air every time: a table borrowed from the good tag
+     * would hide the broken ones until the first write, test_gatt_cache
+     * covers that */
+    sim_ble_set_stack_cache(false);
+    add_tag("c0:00:00:00:00:01", true, 42);
+    add_tag("c0:00:00:00:00:02", false, 42);    /* No NUS service */
+    add_tag("c0:00:00:00:00:03", true, 0);      /* NUS without the RX characteristic */
+    add_tag("c0:00:00:00:00:04", true, 42);
+    for (int i = 0; i < BLE_MAX_LINKS; i++) {
+        char text[24];
+        snprintf(text, sizeof(text), "c0:00:00:00:01:%02x", i);
+        add_tag(text, true, 42);
+    }
+
+    bluetooth_init();
+    sim_run_for_ms(1000);
+
+    test_good_tag();
+    test_discovery_fails("c0:00:00:00:00:02");
+    test_discovery_fails("c0:00:00:00:00:03");
+    test_good_tag();
+    test_refused_writes();
+    test_concurrent_links();
+    test_switch_while_opening();
+    test_switch_after_drop();
+    test_event_burst();
+    test_late_scan_params();
+
+    return test_report("test_links");
+}
@@ -0,0 +1,87 @@
+/* Templates and the glyph cache against the reference renderer, pixel for
+ * pixel: text at every row offset and clipped at the right edge over
+ * whatever was there, and whole frames of every screen */
+#include "../display.cpp"
+#include "sim.h"
+#include "render_ref.h"
+
+#define TEXT_RUNS       2000
+#define FRAMES          300     /* Per screen */
+
+system_status_t system_status;
+static const char *screen_names[] = SCREEN_NAMES;
+
+static uint8_t expected[DISPLAY_BUFFER_SIZE];
+
+/* Prints the first differing pixel, the buffer holds the frame under test */
+static bool buffer_matches(const char *what, uint32_t run) {
+    const uint8_t *buffer = display.getBuffer();
+
+    for (uint16_t i = 0; i < DISPLAY_BUFFER_SIZE; i++) {
+        uint8_t diff = buffer[i] ^ expected[i];
+        if (diff) {
+            uint8_t row = __builtin_ctz(diff);
+            printf("%s %u: pixel %u,%u is %u, reference %u\n", what, run, i % SCREEN_WIDTH,
+                   (i / SCREEN_WIDTH) * 8 + row, (buffer[i] >> row) & 1, (expected[i] >> row) & 1);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void random_fill(uint8_t *buffer) {
+    for (uint16_t i = 0; i < DISPLAY_BUFFER_SIZE; i++) {
+        buffer[i] = ref_rand();
+    }
+}
+
+/* Any position over a noisy background: only the text cells change */
+static void test_text(void) {
+    uint8_t background[DISPLAY_BUFFER_SIZE];
+    char text[TEXT_MAX_CHARS + 8];
+
+    for (uint32_t run = 0; run < TEXT_RUNS; run++) {
+        uint8_t x = ref_rand() % SCREEN_WIDTH;
+        uint8_t y = run % (SCREEN_HEIGHT - 7);
+        uint8_t len = ref_rand() % sizeof(text);
+        for (uint8_t i = 0; i < len; i++) {
+            text[i] = 1 + ref_rand() % 255;
+        }
+        text[len] = '\0';
+
+        random_fill(background);
+        memcpy(display.getBuffer(), background, DISPLAY_BUFFER_SIZE);
+        ref_text(x, y, text);
+        memcpy(expected, display.getBuffer(), DISPLAY_BUFFER_SIZE);
+
+        memcpy(display.getBuffer(), background, DISPLAY_BUFFER_SIZE);
+        display_text(x, y, text);
+        CHECK(buffer_matches("text", run));
+    }
+}
+
+static void test_screens(void) {
+    system_status_t status;
+
+    for (uint8_t id = 0; id < SCREEN_COUNT; id++) {
+        for (uint32_t frame = 0; frame < FRAMES; frame++) {
+            ref_random_status(&status, id);
+            ref_render(&status);
+            memcpy(expected, display.getBuffer(), DISPLAY_BUFFER_SIZE);
+
+            random_fill(display.getBuffer());
+            display_render(&status);
+            CHECK(buffer_matches(screen_names[id], frame));
+        }
+    }
+}
+
+int main(void) {
+    display_init();
+    sim_run_for_ms(100 * 1000);
+
+    test_text();
+    test_screens();
+
+    return test_report("test_render");
+}
@@ -0,0 +1,103 @@
+/* Open and targeted scanning in a crowd of foreign advertisers: scan
+ * results per second in each mode, the same tags kept in both, and a tag
+ * seen with a resolvable private address keeping the scan open instead of
+ * being filtered out by a whitelist it cannot be in */
+#include "sim.h"
+#include "app_config.h"
+#include "bluetooth.h"
+#include "test.h"
+
+#define CROWD_TAGS          6
+#define CROWD_OTHERS        60      /* Phones, watches, beacons */
+#define CROWD_RUN_MS        60000
+#define RPA_RUN_MS          60000
+
+static_assert(CROWD_TAGS <= SCAN_WHITELIST_MAX, "The tags must fit the whitelist");
+
+static bool tag_known(const char *text) {
+    uint8_t bda[ESP_BD_ADDR_LEN];
+
+    sim_parse_bda(text, bda);
+    return bluetooth_find_tag(bda) >= 0;
+}
+
+static double per_second(uint32_t results, uint64_t us) {
+    return us ? results * 1e6 / us : 0;
+}
+
+static void add_crowd(void) {
+    static char bdas[CROWD_TAGS + CROWD_OTHERS][24];
+    static char names[CROWD_TAGS + CROWD_OTHERS][16];
+    sim_advertiser_t adv;
+
+    for (uint32_t i = 0; i < CROWD_TAGS + CROWD_OTHERS; i++) {
+        bool tag = (i < CROWD_TAGS);
+        snprintf(bdas[i], sizeof(bdas[i]), "%s:00:00:00:00:%02x", tag ? "c0" : "5a", i);
+        snprintf(names[i], sizeof(names[i]), tag ? "ATS-%u" : "Phone-%u", i);
+        sim_advertiser_defaults(&adv, bdas[i], names[i]);
+        adv.addr_type = tag ? BLE_ADDR_TYPE_RANDOM : BLE_ADDR_TYPE_RPA_RANDOM;
+        adv.rssi = -50 - (int)(i % 40);
+        adv.interval_ms = tag ? 1000 + i * 13 : 100 + (i % 7) * 50;
+        sim_ble_add_advertiser(&adv);
+    }
+}
+
+/* Both modes take turns, targeted hears the tags only */
+static void test_crowd(void) {
+    sim_ble_reset_stats();
+    sim_run_for_ms(CROWD_RUN_MS);
+
+    sim_ble_stats_t stats = sim_ble_stats();
+    double open = per_second(stats.results[BLE_SCAN_FILTER_ALLOW_ALL], stats.policy_us[BLE_SCAN_FILTER_ALLOW_ALL]);
+    double targeted = per_second(stats.results[BLE_SCAN_FILTER_ALLOW_ONLY_WLST], stats.policy_us[BLE_SCAN_FILTER_ALLOW_ONLY_WLST]);
+    printf("crowd of %u tags and %u others: open %.1f callbacks/s for %llu ms, targeted %.1f callbacks/s for %llu ms\n",
+           CROWD_TAGS, CROWD_OTHERS, open, (unsigned long long) stats.policy_us[BLE_SCAN_FILTER_ALLOW_ALL] / 1000,
+           targeted, (unsigned long long) stats.policy_us[BLE_SCAN_FILTER_ALLOW_ONLY_WLST] / 1000);
+
+    CHECK(stats.policy_us[BLE_SCAN_FILTER_ALLOW_ONLY_WLST] > stats.policy_us[BLE_SCAN_FILTER_ALLOW_ALL]);
+    CHECK(targeted > 0);
+    CHECK(targeted * 10 < open);
+    CHECK(stats.whitelist_adds > 0);
+    CHECK(stats.whitelist_rejects == 0);
+
+    tag_view_t view;
+    bluetooth_read_tags(0, 0, &view);
+    CHECK(view.count == CROWD_TAGS);
+    sim_serial_clear();
+    bluetooth_dump();
+    printf("%s", sim_serial_output().c_str());
+}
+
+/* A tag behind a resolvable private address cannot go in the whitelist,
+ * so the scan stays open from the moment it is known */
+static void test_rpa_tag(void) {
+    sim_advertiser_t adv;
+
+    sim_advertiser_defaults(&adv, "4c:00:00:00:00:01", "ATS-RPA");
+    adv.addr_type = BLE_ADDR_TYPE_RPA_RANDOM;
+    adv.interval_ms = 1013;
+    adv.start_ms = sim_now_us() / 1000;
+    sim_ble_add_advertiser(&adv);
+
+    /* Heard once the current targeted period ends */
+    CHECK(sim_run_until([] { return tag_known("4c:00:00:00:00:01"); }, SCAN_TARGETED_MS + 2000));
+    sim_ble_reset_stats();
+    sim_run_for_ms(RPA_RUN_MS);
+
+    sim_ble_stats_t stats = sim_ble_stats();
+    CHECK(stats.policy_us[BLE_SCAN_FILTER_ALLOW_ONLY_WLST] == 0);
+    CHECK(stats.whitelist_rejects == 0);
+    CHECK(sim_ble_filter_policy() == BLE_SCAN_FILTER_ALLOW_ALL);
+    CHECK(tag_known("4c:00:00:00:00:01"));
+    CHECK(tag_known("c0:00:00:00:00:00"));
+}
+
+int main(void) {
+    add_crowd();
+    bluetooth_init();
+
+    test_crowd();
+    test_rpa_tag();
+
+    return test_report("test_scan_modes");
+}
@@ -0,0 +1,111 @@
+/* Scan scheduling on a recorded advert trace: a UI scan ends once the tags
+ * stop showing up and reports the radio time the controller really spent
+ * listening, the window between UI scans shrinks and comes back for a new
+ * tag, and window changes restart the scan only at coarse steps */
+#include "sim.h"
+#include "app_config.h"
+#include "bluetooth.h"
+#include "test.h"
+
+#define TRACE_OFFICE        "traces/scan_office.txt"
+#define OFFICE_TAGS         8
+#define OFFICE_SCAN_MS      1000    /* UI scan asked for, before the first tag */
+#define OFFICE_LATE_MS      30000   /* The ninth tag shows up */
+#define OFFICE_END_MS       60000
+
+static bool tag_known(const char *text) {
+    uint8_t bda[ESP_BD_ADDR_LEN];
+
+    sim_parse_bda(text, bda);
+    return bluetooth_find_tag(bda) >= 0;
+}
+
+static uint16_t tag_count(void) {
+    tag_view_t view;
+
+    bluetooth_read_tags(0, 0, &view);
+    return view.count;
+}
+
+static scan_sched_t scan_report(void) {
+    scan_sched_t report;
+
+    bluetooth_get_scan_report(&report);
+    return report;
+}
+
+/* Radio time is counted for the window in use, and not at all while stopped */
+static void test_radio_on(void) {
+    scan_sched_t sched;
+
+    scan_sched_start(&sched, 0, 0, true);
+    CHECK(sched.duty.window == SCAN_INTERVAL);
+    scan_sched_update(&sched, 600, 0, SCAN_INTERVAL);
+    scan_sched_update(&sched, 1000, 0, 0);
+    scan_sched_update(&sched, 1800, 0, SCAN_INTERVAL / 2);
+    CHECK(scan_sched_radio_on_ms(&sched) == 1000);
+
+    /* Coarse steps: the window holds for SCAN_DUTY_STEP_MS without a new tag */
+    CHECK(scan_sched_next_deadline_ms(&sched, 1800) == SCAN_DUTY_STEP_MS - 1800);
+    CHECK(!scan_sched_update(&sched, SCAN_DUTY_STEP_MS - 1, 0, SCAN_INTERVAL));
+    CHECK(scan_sched_update(&sched, SCAN_DUTY_STEP_MS, 0, SCAN_INTERVAL));
+    CHECK(sched.duty.window == SCAN_INTERVAL - SCAN_INTERVAL / 4);
+}
+
+static void test_ui_scan(void) {
+    sim_run_until_us(OFFICE_SCAN_MS * 1000);
+    sim_ble_reset_stats();
+    bluetooth_start_scanning();
+
+    CHECK(sim_run_until([] { return scan_report().state > SCAN_SCHED_RUNNING; }, GAP_SCAN_DURATION * 1000 + 100));
+    sim_ble_stats_t stats = sim_ble_stats();
+    scan_sched_t report = scan_report();
+    uint32_t listen_ms = stats.listen_us / 1000;
+    printf("UI scan: %u tags in %u ms, radio on %u ms, controller listened %u ms, %u scan starts\n",
+           report.count, report.complete_ms, scan_sched_radio_on_ms(&report), listen_ms, stats.scan_starts);
+
+    CHECK(report.state == SCAN_SCHED_DONE_QUIET);
+    CHECK(report.count == OFFICE_TAGS);
+    CHECK(report.complete_ms < GAP_SCAN_DURATION * 1000);
+    CHECK(tag_count() == OFFICE_TAGS);
+    /* One restart for the full window, none for steps during the scan */
+    CHECK(stats.scan_starts <= 1);
+    /* Within a couple of BLE task passes of what the controller did */
+    CHECK(scan_sched_radio_on_ms(&report) <= listen_ms + 10);
+    CHECK(scan_sched_radio_on_ms(&report) + 10 >= listen_ms);
+}
+
+static void test_idle_duty(void) {
+    /* Down to the floor after the steps, each one a single restart */
+    sim_ble_reset_stats();
+    sim_run_for_ms(4 * SCAN_DUTY_STEP_MS);
+    sim_ble_stats_t stats = sim_ble_stats();
+    CHECK(sim_ble_scan_window() == SCAN_IDLE_WINDOW_MIN);
+    CHECK(stats.listen_us * SCAN_INTERVAL < stats.scan_on_us * SCAN_WINDOW);
+    CHECK(stats.scan_starts <= 4);
+
+    /* The late tag is heard in open discovery and opens the window again */
+    CHECK(sim_run_until([] { return tag_known("c0:00:00:00:01:40"); }, OFFICE_LATE_MS + SCAN_TARGETED_MS));
+    CHECK(sim_run_until([] { return sim_ble_scan_window() == SCAN_WINDOW; }, 100));
+    printf("late tag at %llu ms\n", (unsigned long long) sim_now_us() / 1000);
+
+    /* Every tag is still heard often enough on the idle floor */
+    sim_ble_reset_stats();
+    sim_run_until_us(OFFICE_END_MS * 1000ULL);
+    stats = sim_ble_stats();
+    printf("idle: %u scan starts, listened %llu of %llu ms\n", stats.scan_starts,
+           (unsigned long long) stats.listen_us / 1000, (unsigned long long) stats.scan_on_us / 1000);
+    CHECK(tag_count() == OFFICE_TAGS + 1);
+    CHECK(stats.listen_us * SCAN_INTERVAL < stats.scan_on_us * SCAN_WINDOW);
+}
+
+int main(void) {
+    test_radio_on();
+
+    CHECK(sim_ble_load_trace(TRACE_OFFICE, 0) > 0);
+    bluetooth_init();
+    test_ui_scan();
+    test_idle_duty();
+
+    return test_report("test_scan_sched");
+}
@@ -0,0 +1,199 @@
+/* Display order and its rank array: RSSI changes moving tags, tags
+ * removed from the middle of the order by expiry, and a full store
+ * evicting a tag that held a rank */
+#include "../bluetooth.cpp"
+#include "sim.h"
+#include "test.h"
+
+static_assert(!TAG_SORT_BY_NAME, "The order under test is by RSSI");
+
+static void order_record(adv_record_t *adv, uint32_t id, int8_t rssi) {
+    memset(adv, 0, sizeof(*adv));
+    adv->bda[0] = 0xC0;
+    adv->bda[4] = id >> 8;
+    adv->bda[5] = id;
+    adv->addr_type = BLE_ADDR_TYPE_RANDOM;
+    adv->rssi = rssi;
+    snprintf(adv->name, sizeof(adv->name), "ATS-%u", id);
+}
+
+static void order_add(uint32_t id, int8_t rssi) {
+    adv_record_t adv;
+
+    order_record(&adv, id, rssi);
+    tag_write_begin();
+    bluetooth_add_device(&adv);
+    tag_write_end();
+}
+
+static int order_find(uint32_t id) {
+    adv_record_t adv;
+
+    order_record(&adv, id, 0);
+    return bluetooth_find_tag(adv.bda);
+}
+
+static void order_reset(void) {
+    tag_write_begin();
+    tag_list.count = 0;
+    tag_list.version = 0;
+    tag_index_reset();
+    tag_write_end();
+}
+
+/* tag_order and tag_rank are inverses, sorted, and agree with lookups */
+static bool order_consistent(void) {
+    bool ok = true;
+
+    for (tag_index_t rank = 0; rank < tag_list.count; rank++) {
+        tag_index_t index = tag_order[rank];
+        ok &= (index < tag_list.count) && (tag_rank[index] == rank);
+        ok &= bluetooth_find_tag(tag_hot[index].bda) == rank;
+        if (rank > 0) {
+            ok &= !tag_order_before(index, tag_order[rank - 1]);
+        }
+    }
+    return ok;
+}
+
+/* The names in display order, as the device list reads them */
+static bool order_is(const uint32_t *ids, uint16_t count) {
+    tag_view_t view;
+    char name[BLE_NAME_MAX_LEN];
+
+    bluetooth_read_tags(0, count, &view);
+    if ((view.count != count) || (view.rows != count)) {
+        return false;
+    }
+    for (uint16_t rank = 0; rank < count; rank++) {
+        snprintf(name, sizeof(name), "ATS-%u", ids[rank]);
+        if ((strcmp(view.tags[rank].name, name) != 0) || (order_find(ids[rank]) != rank)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_rssi_resort(void) {
+    order_reset();
+    order_add(1, -50);
+    order_add(2, -60);
+    order_add(3, -70);
+    order_add(4, -80);
+    static const uint32_t added[] = {1, 2, 3, 4};
+    CHECK(order_is(added, 4));
+    CHECK(order_consistent());
+
+    /* Tag 3 gets closer: the smoothed RSSI climbs past 2, then past 1 */
+    uint16_t version = tag_list.version;
+    order_add(3, -30);
+    order_add(3, -30);
+    static const uint32_t past_two[] = {1, 3, 2, 4};
+    CHECK(order_is(past_two, 4));
+    CHECK(order_consistent());
+    CHECK(tag_list.version != version);
+
+    for (int i = 0; i < 20; i++) {
+        order_add(3, -30);
+        CHECK(order_consistent());
+    }
+    static const uint32_t closest[] = {3, 1, 2, 4};
+    CHECK(order_is(closest, 4));
+
+    /* Samples that move no tag leave the version alone */
+    version = tag_list.version;
+    order_add(3, -30);
+    order_add(1, -50);
+    CHECK(tag_list.version == version);
+
+    /* The first tag falls to the end */
+    for (int i = 0; i < 20; i++) {
+        order_add(3, -90);
+        CHECK(order_consistent());
+    }
+    static const uint32_t farthest[] = {1, 2, 4, 3};
+    CHECK(order_is(farthest, 4));
+
+    /* Equal RSSI keeps the address order */
+    order_add(5, -60);
+    static const uint32_t tie[] = {1, 2, 5, 4, 3};
+    CHECK(order_is(tie, 5));
+    CHECK(order_consistent());
+}
+
+/* Expiry swap-removes: the last stored tag moves into the freed index and
+ * keeps its rank, every tag after the removed one moves up a rank */
+static void test_expire_ranked(void) {
+    order_reset();
+    order_add(1, -70);      /* Index 0, rank 3 */
+    sim_run_for_ms(TAG_EXPIRE_MS / 2);
+    order_add(2, -50);
+    order_add(3, -80);
+    order_add(4, -60);
+    order_add(5, -40);      /* Last index, rank 0 */
+    CHECK(order_consistent());
+    CHECK(order_find(1) == 3);
+
+    /* Removal is not a lookup, the probe statistics stay put */
+    uint32_t lookups = tag_lookups;
+    uint32_t probes = tag_probes;
+    sim_run_for_ms(TAG_EXPIRE_MS / 2);
+    tag_write_begin();
+    int removed = tag_list_expire(CURRENT_TIME_MS());
+    tag_write_end();
+    CHECK(removed == 1);
+    CHECK((tag_lookups == lookups) && (tag_probes == probes));
+    CHECK(order_find(1) == -1);
+    static const uint32_t left[] = {5, 2, 4, 3};
+    CHECK(order_is(left, 4));
+    CHECK(order_consistent());
+
+    /* The moved tag still reorders from its new index */
+    for (int i = 0; i < 20; i++) {
+        order_add(5, -90);
+    }
+    static const uint32_t moved[] = {2, 4, 3, 5};
+    CHECK(order_is(moved, 4));
+    CHECK(order_consistent());
+}
+
+/* A full store reuses the least recently seen tag wherever it ranks */
+static void test_evict_ranked(void) {
+    order_reset();
+    for (uint32_t id = 0; id < MAX_AIRTAG_COUNT; id++) {
+        order_add(id, -40 - (int8_t)(id % 50));
+    }
+    CHECK(tag_list.count == MAX_AIRTAG_COUNT);
+    CHECK(order_consistent());
+
+    /* Tag 0 is the oldest and ranks first, tag 1 takes the LRU tail */
+    int first = order_find(0);
+    CHECK(first == 0);
+    order_add(0, -40);
+    int evicted_rank = order_find(1);
+    CHECK(evicted_rank > 0);
+
+    /* The newcomer lands at the bottom, the evicted tag is gone */
+    order_add(MAX_AIRTAG_COUNT, -99);
+    CHECK(tag_list.count == MAX_AIRTAG_COUNT);
+    CHECK(order_find(1) == -1);
+    CHECK(order_find(MAX_AIRTAG_COUNT) == MAX_AIRTAG_COUNT - 1);
+    CHECK(order_consistent());
+
+    /* And one strong enough to go to the top */
+    order_add(MAX_AIRTAG_COUNT + 1, -20);
+    CHECK(order_find(2) == -1);
+    CHECK(order_find(MAX_AIRTAG_COUNT + 1) == 0);
+    CHECK(order_find(0) == 1);
+    CHECK(order_consistent());
+}
+
+int main(void) {
+    tag_store_init();
+
+    test_rssi_resort();
+    test_expire_ranked();
+    test_evict_ranked();
+
+    return test_report("test_tag_order");
+}
@@ -0,0 +1,118 @@
+/* The tag store seqlock under ThreadSanitizer: the BLE task side adds,
+ * reorders and removes tags and publishes scan reports while two UI side
+ * threads copy rows, look tags up and read reports. No access may race and
+ * no copy that passed its retry check may mix two writes. */
+#include <atomic>
+#include <thread>
+#include "../bluetooth.cpp"
+#include "test.h"
+
+#define STRESS_TAGS         64
+#define STRESS_SECTIONS     100000
+#define STRESS_READERS      2
+
+static std::atomic<bool> writer_done{false};
+static std::atomic<uint32_t> views_read{0};
+static std::atomic<uint32_t> torn_views{0};
+static std::atomic<uint32_t> torn_reports{0};
+static std::atomic<uint32_t> lost_tags{0};
+
+/* Names follow from the address, a row mixing two tags shows */
+static void stress_tag(uint32_t i, adv_record_t *adv) {
+    memset(adv, 0, sizeof(*adv));
+    adv->bda[0] = 0xC0;
+    adv->bda[4] = i >> 8;
+    adv->bda[5] = i;
+    adv->addr_type = BLE_ADDR_TYPE_RANDOM;
+    snprintf(adv->name, sizeof(adv->name), "ATS-%02x%02x", adv->bda[4], adv->bda[5]);
+}
+
+static bool stress_row_ok(const tag_t *tag) {
+    char name[BLE_NAME_MAX_LEN];
+
+    snprintf(name, sizeof(name), "ATS-%02x%02x", tag->bda[4], tag->bda[5]);
+    return (tag->bda[0] == 0xC0) && (strcmp(tag->name, name) == 0);
+}
+
+static void ble_side(void) {
+    uint32_t seed = 7;
+    adv_record_t adv;
+
+    for (uint32_t section = 0; section < STRESS_SECTIONS; section++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t i = (seed >> 8) % STRESS_TAGS;
+
+        tag_write_begin();
+        stress_tag(i, &adv);
+        adv.rssi = -40 - (int8_t)((seed >> 20) % 50);
+        bluetooth_add_device(&adv);
+        /* Now and then one goes and comes back at the next add */
+        if ((section % 97) == 0) {
+            tag_list_remove(tag_hash[tag_index_find_slot(adv.bda, NULL)]);
+        }
+        tag_write_end();
+
+        /* A report is consistent when count and start match */
+        if ((section % 16) == 0) {
+            scan_sched_start(&scan_sched, section, section & 0xFFFF, true);
+            tag_write_begin();
+            tag_copy_in(&scan_report, &scan_sched, sizeof(scan_report));
+            tag_write_end();
+        }
+        if ((section % 64) == 0) {
+            std::this_thread::yield();
+        }
+    }
+    writer_done = true;
+}
+
+static void ui_side(uint32_t id) {
+    tag_view_t view;
+    adv_record_t adv;
+    scan_sched_t report;
+    uint32_t round = id;
+
+    while (!writer_done.load()) {
+        uint16_t first = round % STRESS_TAGS;
+        bluetooth_read_tags(first, TAG_VIEW_ROWS, &view);
+        bool ok = view.count <= STRESS_TAGS;
+        for (uint8_t row = 0; ok && (row < view.rows); row++) {
+            ok = stress_row_ok(&view.tags[row]) &&
+                 ((row == 0) || (view.tags[row - 1].rssi >= view.tags[row].rssi));
+        }
+        torn_views += !ok;
+        views_read++;
+
+        /* Any tag that is there is found at a rank within the list */
+        stress_tag(round % STRESS_TAGS, &adv);
+        int rank = bluetooth_find_tag(adv.bda);
+        lost_tags += (rank >= STRESS_TAGS);
+
+        bluetooth_get_scan_report(&report);
+        torn_reports += (report.count != (report.start_ms & 0xFFFF));
+        round++;
+    }
+}
+
+int main(void) {
+    tag_store_init();
+
+    std::thread readers[STRESS_READERS];
+    for (uint32_t id = 0; id < STRESS_READERS; id++) {
+        readers[id] = std::thread(ui_side, id);
+    }
+    ble_side();
+    for (std::thread &reader : readers) {
+        reader.join();
+    }
+
+    printf("%u sections, %u views read, %u torn, %u torn reports\n",
+           STRESS_SECTIONS, views_read.load(), torn_views.load(), torn_reports.load());
+    CHECK(views_read > 0);
+    CHECK(torn_views == 0);
+    CHECK(torn_reports == 0);
+    CHECK(lost_tags == 0);
+    CHECK(tag_list.count <= STRESS_TAGS);
+
+    return test_report("test_tag_seqlock");
+}
@@ -0,0 +1,114 @@
+/* Continuous scanning keeps the tag list: RSSI smoothing, the list being
+ * ready on Ping, tags aging out once they fall silent, and Back still
+ * working once the open list has emptied */
+#include "../bluetooth.cpp"
+#include "sim.h"
+#include "test.h"
+
+/* Steady samples pull the average all the way, from above and below */
+static void test_rssi_smoothing(void) {
+    int16_t average = -60 * (1 << TAG_RSSI_FRAC_BITS);
+
+    for (int i = 0; i < 40; i++) {
+        average = tag_rssi_smooth(average, -80);
+    }
+    CHECK(tag_rssi_dbm(average) == -80);
+
+    for (int i = 0; i < 40; i++) {
+        average = tag_rssi_smooth(average, -60);
+    }
+    CHECK(tag_rssi_dbm(average) == -60);
+
+    /* One sample 3 dB weaker moves the average by 3/4 dB, whole dB kept it */
+    average = tag_rssi_smooth(-60 * (1 << TAG_RSSI_FRAC_BITS), -63);
+    CHECK(tag_rssi_dbm(average) == -61);
+    CHECK(tag_rssi_dbm(-70 * (1 << TAG_RSSI_FRAC_BITS)) == -70);
+    CHECK(tag_rssi_dbm(-70 * (1 << TAG_RSSI_FRAC_BITS) - 7) == -70);
+    CHECK(tag_rssi_dbm(-70 * (1 << TAG_RSSI_FRAC_BITS) - 9) == -71);
+}
+
+static int8_t tag_rssi(const char *bda_text) {
+    uint8_t bda[ESP_BD_ADDR_LEN];
+    tag_view_t view;
+
+    sim_parse_bda(bda_text, bda);
+    int rank = bluetooth_find_tag(bda);
+    if (rank < 0) {
+        return 0;
+    }
+    bluetooth_read_tags(rank, 1, &view);
+    return view.tags[0].rssi;
+}
+
+static uint16_t tag_count(void) {
+    tag_view_t view;
+
+    bluetooth_read_tags(0, 0, &view);
+    return view.count;
+}
+
+#define LAST_HEARD_MS   (9000 + 3 * TAG_EXPIRE_MS)     /* The last two fall silent */
+
+static void test_background_list(void) {
+    sim_advertiser_t adv;
+
+    sim_advertiser_defaults(&adv, "c0:00:00:00:00:01", "ATS-A");
+    adv.rssi = -55;
+    adv.end_ms = LAST_HEARD_MS;
+    int tag_a = sim_ble_add_advertiser(&adv);
+    sim_advertiser_defaults(&adv, "c0:00:00:00:00:02", "ATS-B");
+    adv.rssi = -65;
+    adv.end_ms = 8000;
+    sim_ble_add_advertiser(&adv);
+    sim_advertiser_defaults(&adv, "c0:00:00:00:00:03", "ATS-C");
+    adv.rssi = -75;
+    adv.end_ms = LAST_HEARD_MS;
+    sim_ble_add_advertiser(&adv);
+
+    sim_start_sketch();
+    sim_run_until_us(6000 * 1000);
+    CHECK(tag_count() == 3);
+    CHECK(tag_rssi("c0:00:00:00:00:01") == -55);
+
+    /* Ping shows the list at once, no scan to wait for */
+    sim_button_press(BUTTON_SELECT_PIN, 6001, 80);
+    CHECK(sim_run_until([] { return sim_panel_has_text("Devices (3)"); }, 300));
+    sim_run_for_ms(200);
+    CHECK(sim_panel_has_text("1. ATS-A"));
+    CHECK(sim_panel_has_text("2. ATS-B"));
+
+    /* A weaker signal takes over the average and the order follows */
+    sim_ble_set_rssi(tag_a, -90);
+    sim_run_until_us(10000 * 1000);
+    CHECK(tag_rssi("c0:00:00:00:00:01") == -90);
+    CHECK(sim_panel_has_text("3. ATS-A"));
+
+    /* ATS-B fell silent at 8 s and goes once it is TAG_EXPIRE_MS old */
+    sim_run_until_us((8000 + TAG_EXPIRE_MS - 500) * 1000);
+    CHECK(tag_count() == 3);
+    sim_run_until_us((8000 + TAG_EXPIRE_MS + 500) * 1000);
+    CHECK(tag_count() == 2);
+    CHECK(tag_rssi("c0:00:00:00:00:02") == 0);
+    CHECK(sim_panel_has_text("Devices (2)"));
+
+    /* The others keep being heard and stay */
+    sim_run_for_ms(2 * TAG_EXPIRE_MS);
+    CHECK(tag_count() == 2);
+
+    /* Until they go too: the open list empties down to Back, which still
+     * leads back to Ping */
+    sim_run_until_us((LAST_HEARD_MS + TAG_EXPIRE_MS + 500) * 1000);
+    CHECK(tag_count() == 0);
+    CHECK(sim_panel_has_text("Devices (0)"));
+    CHECK(sim_panel_has_text("[ Back ]"));
+    sim_button_press(BUTTON_SELECT_PIN, sim_now_us() / 1000 + 1, 80);
+    CHECK(sim_run_until([] { return sim_panel_has_text("Select = Ping"); }, 500));
+    CHECK(!sim_panel_has_text("[ Back ]"));
+}
+
+int main(void) {
+    test_rssi_smoothing();
+    test_background_list();
+
+    return test_report("test_tag_store");
+}
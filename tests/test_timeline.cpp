@@ -0,0 +1,79 @@
+/* Boot to a command on a tag, driven through the buttons and checked on the
+ * panel and at the peripheral */
+#include "sim.h"
+#include "app_config.h"
+#include "test.h"
+
+#define PRESS_MS    80
+
+static void press(uint8_t pin) {
+    sim_button_press(pin, sim_now_us() / 1000 + 1, PRESS_MS);
+    sim_run_for_ms(PRESS_MS + 200);
+}
+
+int main(void) {
+    sim_advertiser_t adv;
+    sim_peripheral_t periph;
+
+    sim_advertiser_defaults(&adv, "c0:00:00:00:00:01", "ATS-A");
+    adv.rssi = -50;
+    sim_ble_add_advertiser(&adv);
+    sim_advertiser_defaults(&adv, "c0:00:00:00:00:02", "ATS-B");
+    adv.rssi = -75;
+    sim_ble_add_advertiser(&adv);
+    sim_advertiser_defaults(&adv, "c0:00:00:00:00:03", "ATS-C");
+    adv.rssi = -62;
+    adv.name_in_rsp = true;
+    sim_ble_add_advertiser(&adv);
+    sim_advertiser_defaults(&adv, "d0:00:00:00:00:09", "Phone");
+    adv.rssi = -40;
+    sim_ble_add_advertiser(&adv);
+    sim_peripheral_defaults(&periph, "c0:00:00:00:00:03");
+    sim_ble_add_peripheral(&periph);
+
+    sim_start_sketch();
+
+    /* Splash while the panel settles */
+    sim_run_until_us(500 * 1000);
+    CHECK(sim_panel_is_on());
+    CHECK(sim_panel_has_text("AirSentry", 2));
+    CHECK(sim_wire_clock() == DISPLAY_I2C_CLOCK_HZ);
+
+    sim_run_until_us(3000 * 1000);
+    CHECK(sim_panel_has_text("Ping"));
+    CHECK(sim_ble_is_scanning());
+
+    /* Background scanning already knows the tags, strongest first */
+    press(BUTTON_SELECT_PIN);
+    CHECK(sim_run_until([] { return sim_panel_has_text("Devices (3)"); }, 1000));
+    CHECK(sim_panel_has_text("1. ATS-A"));
+    CHECK(sim_panel_has_text("2. ATS-C"));
+    CHECK(sim_panel_has_text("3. ATS-B"));
+    CHECK(!sim_panel_has_text("Phone"));
+
+    /* Second tag, then its actions */
+    uint8_t tag[ESP_BD_ADDR_LEN];
+    sim_parse_bda("c0:00:00:00:00:03", tag);
+    press(BUTTON_DOWN_PIN);
+    press(BUTTON_SELECT_PIN);
+    CHECK(sim_panel_has_text("Actions"));
+    CHECK(sim_run_until([&] { return sim_ble_is_connected(tag); }, 2000));
+    sim_run_for_ms(1000);   /* Discovery and MTU exchange */
+
+    press(BUTTON_SELECT_PIN);
+    CHECK(sim_panel_has_text("GPIO"));
+    CHECK(sim_panel_has_text("State: OFF"));
+    press(BUTTON_DOWN_PIN);
+    press(BUTTON_SELECT_PIN);
+    CHECK(sim_run_until([&] { return !sim_ble_received(tag).empty(); }, 1000));
+    std::vector<std::string> received = sim_ble_received(tag);
+    CHECK((received.size() == 1) && (received[0] == "OUTPUTS:1"));
+    CHECK(sim_run_until([] { return sim_panel_has_text("State: ON"); }, 500));
+
+    /* Holding Select walks back out */
+    sim_button_press(BUTTON_SELECT_PIN, sim_now_us() / 1000 + 1, 1200);
+    sim_run_for_ms(1500);
+    CHECK(sim_panel_has_text("Actions"));
+
+    return test_report("test_timeline");
+}
@@ -0,0 +1,105 @@
+/* The trace decoder on a recorded dump: GAP and GATTC events get their
+ * names, and the phase histograms it rebuilds from the records match the
+ * latencies in the dump and the histograms the firmware kept */
+#include <string.h>
+#include "trace_decode.h"
+#include "test.h"
+
+#define TRACE_LINKS  "traces/links_trace.txt"
+
+/* Bucket of a latency, see TRACE_HIST_BUCKETS */
+static int bucket_of(uint32_t ms) {
+    int bucket = 0;
+    while ((bucket < TRACE_HIST_BUCKETS - 1) && (ms + 1 >= (2u << bucket))) {
+        bucket++;
+    }
+    return bucket;
+}
+
+static uint32_t count_phase(const trace_decode_t *dec, int phase) {
+    uint32_t total = 0;
+    for (int bucket = 0; bucket < TRACE_HIST_BUCKETS; bucket++) {
+        total += dec->hist[phase][bucket];
+    }
+    return total;
+}
+
+static void test_names(void) {
+    CHECK(strcmp(trace_decode_gattc_name(40), "CONNECT") == 0);
+    CHECK(strcmp(trace_decode_gattc_name(46), "DIS_SRVC_CMPL") == 0);
+    CHECK(strcmp(trace_decode_gap_name(18), "SCAN_STOP_COMPLETE") == 0);
+    CHECK(trace_decode_gattc_name(16) == NULL);
+    CHECK(strcmp(trace_decode_event_name(TRACE_LINK_READY), "LINK_READY") == 0);
+
+    /* Numeric ids are taken too, log lines in between are skipped */
+    trace_decode_t dec;
+    trace_decode_init(&dec);
+    trace_decode_line(&dec, "T 100 4 1\n");
+    trace_decode_line(&dec, "Connecting to device\n");
+    trace_decode_line(&dec, "T 2100 LINK_CONNECTED 1\n");
+    trace_decode_finish(&dec);
+    CHECK(dec.records.size() == 2);
+    CHECK(dec.records[0].id == TRACE_LINK_REQUEST);
+    CHECK(dec.skipped == 1);
+    CHECK(dec.hist[TRACE_PHASE_CONNECT][bucket_of(2)] == 1);
+}
+
+static void test_recorded(void) {
+    trace_decode_t dec;
+    FILE *file = fopen(TRACE_LINKS, "r");
+
+    CHECK(file != NULL);
+    if (file == NULL) {
+        return;
+    }
+    trace_decode_init(&dec);
+    trace_decode_file(&dec, file);
+    fclose(file);
+
+    CHECK(dec.records.size() == 68);
+    CHECK(dec.skipped == 0);
+    CHECK(dec.has_device_hist);
+
+    /* Three tags together: connected 60 ms apart, 300 ms of discovery each,
+     * then a slow one alone */
+    uint32_t connect[] = {60, 120, 180, 900};
+    uint32_t discovery[] = {300, 300, 300, 1500};
+    uint32_t total[] = {360, 420, 480, 3411};
+    uint32_t expected[TRACE_PHASE_COUNT][TRACE_HIST_BUCKETS] = {};
+    for (int i = 0; i < 4; i++) {
+        expected[TRACE_PHASE_CONNECT][bucket_of(connect[i])]++;
+        expected[TRACE_PHASE_DISCOVERY][bucket_of(discovery[i])]++;
+        expected[TRACE_PHASE_FIRST_WRITE][bucket_of(30)]++;
+        expected[TRACE_PHASE_TOTAL][bucket_of(total[i])]++;
+    }
+    CHECK(memcmp(dec.hist, expected, sizeof(expected)) == 0);
+    CHECK(dec.hist[TRACE_PHASE_DISCOVERY][8] == 3);
+    CHECK(dec.hist[TRACE_PHASE_DISCOVERY][10] == 1);
+    for (int phase = 0; phase < TRACE_PHASE_COUNT; phase++) {
+        CHECK(count_phase(&dec, phase) == 4);
+    }
+
+    /* The whole session fit the ring, so the firmware saw the same */
+    CHECK(memcmp(dec.hist, dec.device_hist, sizeof(dec.hist)) == 0);
+
+    /* GATTC events of the first connection, by name */
+    std::vector<const char *> gattc;
+    for (const trace_decoded_t &rec : dec.records) {
+        if ((rec.id == TRACE_GATTC_EVT) && (gattc.size() < 3) && (rec.us > 1000000)) {
+            gattc.push_back(trace_decode_gattc_name(rec.arg));
+        }
+    }
+    CHECK((gattc.size() == 3) && !strcmp(gattc[0], "CONNECT") && !strcmp(gattc[1], "OPEN") &&
+          !strcmp(gattc[2], "CFG_MTU"));
+
+    FILE *out = fopen("/dev/null", "w");
+    trace_decode_print(&dec, out);
+    fclose(out);
+}
+
+int main(void) {
+    test_names();
+    test_recorded();
+
+    return test_report("test_trace_decode");
+}
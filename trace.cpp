@@ -0,0 +1,150 @@
+#include <Arduino.h>
+#include "app_config.h"
+#include "trace.h"
+
+#if TRACE_ENABLED
+
+#define TRACE_RING_SIZE       256   /* Power of two */
+#define TRACE_MAX_LINKS       BLE_MAX_LINKS
+
+typedef struct {
+    uint32_t us;
+    uint8_t id;
+    uint16_t arg;
+} trace_record_t;
+
+typedef struct {
+    uint32_t request_us;
+    uint32_t connected_us;
+    uint32_t ready_us;
+    bool wrote;
+} trace_link_t;
+
+static const char *trace_names[TRACE_EVENT_COUNT] = {
+    "GAP",
+    "GATTC",
+    "SCREEN",
+    "SELECT",
+    "LINK_REQUEST",
+    "LINK_CONNECTED",
+    "LINK_READY",
+    "CMD_DONE",
+    "LINK_CLOSED",
+};
+
+static const char *phase_names[TRACE_PHASE_COUNT] = {
+    "connect",
+    "discovery",
+    "first_write",
+    "total",
+};
+
+static trace_record_t trace_ring[TRACE_RING_SIZE];
+static uint32_t trace_head = 0;
+static trace_link_t trace_links[TRACE_MAX_LINKS];
+static uint32_t trace_hist[TRACE_PHASE_COUNT][TRACE_HIST_BUCKETS];
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void trace_hist_add(uint8_t phase, uint32_t from_us, uint32_t to_us) {
+    uint32_t ms = (to_us - from_us) / 1000;
+    uint8_t bucket = 0;
+
+    while ((bucket < TRACE_HIST_BUCKETS - 1) && ((ms + 1) >> (bucket + 1))) {
+        bucket++;
+    }
+    trace_hist[phase][bucket]++;
+}
+
+/* Must be called with trace_lock held */
+static void trace_milestone(uint8_t id, uint16_t link, uint32_t now) {
+    if (link >= TRACE_MAX_LINKS) {
+        return;
+    }
+
+    trace_link_t *t = &trace_links[link];
+    switch (id) {
+        case TRACE_LINK_REQUEST:
+            t->request_us = now;
+            t->connected_us = 0;
+            t->ready_us = 0;
+            t->wrote = false;
+            break;
+
+        case TRACE_LINK_CONNECTED:
+            if (t->request_us && !t->connected_us) {
+                t->connected_us = now;
+                trace_hist_add(TRACE_PHASE_CONNECT, t->request_us, now);
+            }
+            break;
+
+        case TRACE_LINK_READY:
+            if (t->connected_us && !t->ready_us) {
+                t->ready_us = now;
+                trace_hist_add(TRACE_PHASE_DISCOVERY, t->connected_us, now);
+                trace_hist_add(TRACE_PHASE_TOTAL, t->request_us, now);
+            }
+            break;
+
+        case TRACE_CMD_DONE:
+            if (t->ready_us && !t->wrote) {
+                t->wrote = true;
+                trace_hist_add(TRACE_PHASE_FIRST_WRITE, t->ready_us, now);
+            }
+            break;
+
+        case TRACE_LINK_CLOSED:
+            memset(t, 0, sizeof(*t));
+            break;
+
+        default:
+            break;
+    }
+}
+
+void trace_event(uint8_t id, uint16_t arg) {
+    uint32_t now = CURRENT_TIME_US();
+
+    portENTER_CRITICAL(&trace_lock);
+    trace_record_t *rec = &trace_ring[trace_head & (TRACE_RING_SIZE - 1)];
+    rec->us = now;
+    rec->id = id;
+    rec->arg = arg;
+    trace_head++;
+
+    if (id >= TRACE_LINK_REQUEST) {
+        trace_milestone(id, arg, now);
+    }
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+/* One record per line: "T <us> <event> <arg>", then one line per phase:
+ * "H <phase> <count bucket 0> ... <count bucket 15>" */
+void trace_dump(void) {
+    static trace_record_t snapshot[TRACE_RING_SIZE];
+    static uint32_t hist[TRACE_PHASE_COUNT][TRACE_HIST_BUCKETS];
+    uint32_t head;
+
+    /* Copy first, printing over Serial is far too slow for a critical section */
+    portENTER_CRITICAL(&trace_lock);
+    head = trace_head;
+    memcpy(snapshot, trace_ring, sizeof(snapshot));
+    memcpy(hist, trace_hist, sizeof(hist));
+    portEXIT_CRITICAL(&trace_lock);
+
+    uint32_t count = (head < TRACE_RING_SIZE) ? head : TRACE_RING_SIZE;
+    LOG_PRINTF("TRACE %u events\n", count);
+    for (uint32_t i = head - count; i != head; i++) {
+        trace_record_t *rec = &snapshot[i & (TRACE_RING_SIZE - 1)];
+        LOG_PRINTF("T %u %s %u\n", rec->us, trace_names[rec->id], rec->arg);
+    }
+
+    for (int phase = 0; phase < TRACE_PHASE_COUNT; phase++) {
+        LOG_PRINTF("H %s", phase_names[phase]);
+        for (int bucket = 0; bucket < TRACE_HIST_BUCKETS; bucket++) {
+            LOG_PRINTF(" %u", hist[phase][bucket]);
+        }
+        LOG_PRINTLN("");
+    }
+}
+
+#endif
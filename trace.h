@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include "app_config.h"
+
+/* Timestamped connection lifecycle trace. Events go into a fixed ring, the
+ * link milestones also feed per-phase latency histograms. */
+enum {
+    TRACE_GAP_EVT = 0,      /* arg: esp_gap_ble_cb_event_t */
+    TRACE_GATTC_EVT,        /* arg: esp_gattc_cb_event_t */
+    TRACE_UI_SCREEN,        /* arg: new screen id */
+    TRACE_UI_SELECT,        /* arg: selected device */
+    TRACE_LINK_REQUEST,     /* arg: link id, from here on the milestones */
+    TRACE_LINK_CONNECTED,
+    TRACE_LINK_READY,
+    TRACE_CMD_DONE,
+    TRACE_LINK_CLOSED,
+    TRACE_EVENT_COUNT,
+};
+
+enum {
+    TRACE_PHASE_CONNECT = 0,    /* Request to connection up */
+    TRACE_PHASE_DISCOVERY,      /* Connection up to RX handle known */
+    TRACE_PHASE_FIRST_WRITE,    /* Ready to first command confirmed */
+    TRACE_PHASE_TOTAL,          /* Request to ready */
+    TRACE_PHASE_COUNT,
+};
+
+#define TRACE_HIST_BUCKETS    16    /* Bucket n holds latencies in [2^n - 1, 2^(n+1) - 1) ms */
+
+#if TRACE_ENABLED
+void trace_event(uint8_t id, uint16_t arg);
+void trace_dump(void);
+#else
+#define trace_event(id, arg)
+#define trace_dump()
+#endif